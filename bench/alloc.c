@@ -0,0 +1,225 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "../syntax/utf8_to_ast.h"
+#include "../syntax/ast_to_core.h"
+
+#include "../core/check.h"
+#include "../core/eval.h"
+
+#include "../support/arena.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Compares the malloc and arena backends of the rc functions
+ * by running the pipeline of duality.c (parse, convert, check, eval)
+ * on the same file over and over.
+ *
+ * Usage: alloc <file> [iterations]
+ *
+ * Programs that print will do so on every iteration, so redirect stdout if needed.
+ */
+
+static void run_pipeline(const char *text, size_t size, bool release_everything);
+
+static double time_malloc(const char *text, size_t size, size_t iterations);
+
+static double time_arena(const char *text, size_t size, size_t iterations);
+
+static void null_stream(dy_array_t *buffer, void *env);
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file> [iterations]\n", argv[0]);
+        return -1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror("Error reading file");
+        return -1;
+    }
+
+    size_t iterations = 100;
+    if (argc > 2) {
+        iterations = (size_t)strtoul(argv[2], NULL, 10);
+    }
+
+    size_t size = 0;
+    char *text = NULL;
+    for (;;) {
+        text = realloc(text, size + 4096);
+        assert(text);
+
+        size_t n = fread(text + size, 1, 4096, file);
+        size += n;
+
+        if (n < 4096) {
+            break;
+        }
+    }
+
+    fclose(file);
+
+    // Warm up both backends once.
+    time_malloc(text, size, 1);
+    time_arena(text, size, 1);
+
+    double malloc_secs = time_malloc(text, size, iterations);
+    double arena_secs = time_arena(text, size, iterations);
+
+    fprintf(stderr, "iterations: %zu\n", iterations);
+    fprintf(stderr, "malloc:     %.3f s (%.3f ms/run)\n", malloc_secs, malloc_secs * 1000 / (double)iterations);
+    fprintf(stderr, "arena:      %.3f s (%.3f ms/run)\n", arena_secs, arena_secs * 1000 / (double)iterations);
+    fprintf(stderr, "speedup:    %.2fx\n", malloc_secs / arena_secs);
+
+    free(text);
+
+    return 0;
+}
+
+double time_malloc(const char *text, size_t size, size_t iterations)
+{
+    clock_t start = clock();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        run_pipeline(text, size, true);
+    }
+
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+double time_arena(const char *text, size_t size, size_t iterations)
+{
+    struct dy_arena arena = dy_arena_create();
+
+    clock_t start = clock();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        struct dy_rc_allocator old = dy_rc_set_allocator(dy_arena_allocator(&arena));
+
+        run_pipeline(text, size, false);
+
+        dy_rc_set_allocator(old);
+
+        dy_arena_destroy(&arena);
+    }
+
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void run_pipeline(const char *text, size_t size, bool release_everything)
+{
+    dy_array_t buffer = dy_array_create(sizeof(char), DY_ALIGNOF(char), size);
+    memcpy(buffer.buffer, text, size);
+    buffer.num_elems = size;
+
+    struct dy_utf8_to_ast_ctx utf8_to_ast_ctx = {
+        .stream = {
+            .get_chars = null_stream,
+            .buffer = buffer,
+            .env = NULL,
+            .current_index = 0 }
+    };
+
+    struct dy_ast_do_block ast;
+    if (!dy_utf8_to_ast_file(&utf8_to_ast_ctx, &ast)) {
+        dy_bail("Failed to parse program.");
+    }
+
+    dy_interner_release(&utf8_to_ast_ctx.symbols);
+
+    dy_array_t custom_shared = dy_array_create(sizeof(struct dy_core_custom_shared), DY_ALIGNOF(struct dy_core_custom_shared), 5);
+
+    dy_uv_register(&custom_shared);
+    dy_def_register(&custom_shared);
+    dy_string_register(&custom_shared);
+    dy_string_type_register(&custom_shared);
+    dy_int_register(&custom_shared);
+    dy_int_type_register(&custom_shared);
+    dy_int_op_register(&custom_shared);
+    dy_string_op_register(&custom_shared);
+    dy_print_register(&custom_shared);
+
+    struct dy_ast_to_core_ctx ast_to_core_ctx = {
+        .running_id = 0,
+        .variable_replacements = dy_array_create(sizeof(struct dy_variable_replacement), DY_ALIGNOF(struct dy_variable_replacement), 128),
+        .innermost_replacements = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 128),
+        .num_lookups_per_level = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 16)
+    };
+
+    struct dy_core_expr core = dy_ast_do_block_to_core(&ast_to_core_ctx, ast);
+
+    struct dy_core_ctx core_ctx = {
+        .running_id = ast_to_core_ctx.running_id,
+        .free_variables = dy_array_create(sizeof(struct dy_free_var), DY_ALIGNOF(struct dy_free_var), 64),
+        .captured_inference_vars = dy_array_create(sizeof(struct dy_captured_inference_var), DY_ALIGNOF(struct dy_captured_inference_var), 64),
+        .recovered_negative_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
+        .recovered_positive_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
+        .past_subtype_checks = dy_array_create(sizeof(struct dy_core_past_subtype_check), DY_ALIGNOF(struct dy_core_past_subtype_check), 64),
+        .past_checks = dy_array_create(sizeof(struct dy_core_past_check), DY_ALIGNOF(struct dy_core_past_check), 0),
+        .equal_variables = dy_array_create(sizeof(struct dy_equal_variables), DY_ALIGNOF(struct dy_equal_variables), 64),
+        .equal_variable_levels = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 256),
+        .free_ids_arrays = dy_array_create(sizeof(dy_array_t), DY_ALIGNOF(dy_array_t), 8),
+        .constraints = dy_array_create(sizeof(struct dy_constraint), DY_ALIGNOF(struct dy_constraint), 64),
+        .constraint_index = dy_array_create(sizeof(struct dy_constraint_index_entry), DY_ALIGNOF(struct dy_constraint_index_entry), 0),
+        // Frees right away, so that the two backends see the same sequence of calls.
+        .dead_nodes = dy_array_create(sizeof(struct dy_core_expr *), DY_ALIGNOF(struct dy_core_expr *), 0),
+        .hash_consed_exprs = dy_array_create(sizeof(struct dy_hash_consed_expr), DY_ALIGNOF(struct dy_hash_consed_expr), 1024),
+        .custom_shared = custom_shared
+    };
+
+    core = dy_hash_cons(&core_ctx, core);
+
+    struct dy_core_expr new_core;
+    if (dy_check_expr(&core_ctx, core, &new_core)) {
+        dy_core_expr_release(&core_ctx, core);
+        core = dy_hash_cons(&core_ctx, new_core);
+    }
+
+    bool is_value = false;
+    if (dy_eval_expr(&core_ctx, core, &is_value, &new_core)) {
+        dy_core_expr_release(&core_ctx, core);
+        core = new_core;
+    }
+
+    if (!release_everything) {
+        // The arena gets torn down as a whole.
+        return;
+    }
+
+    dy_core_expr_release(&core_ctx, core);
+    dy_subtype_memo_clear(&core_ctx);
+    dy_hash_cons_clear(&core_ctx);
+
+    dy_ast_do_block_release(ast);
+    dy_array_release(&utf8_to_ast_ctx.stream.buffer);
+    dy_array_release(&ast_to_core_ctx.variable_replacements);
+    dy_array_release(&ast_to_core_ctx.innermost_replacements);
+    dy_array_release(&ast_to_core_ctx.num_lookups_per_level);
+
+    dy_array_release(&core_ctx.free_variables);
+    dy_array_release(&core_ctx.captured_inference_vars);
+    dy_array_release(&core_ctx.recovered_negative_inference_ids);
+    dy_array_release(&core_ctx.recovered_positive_inference_ids);
+    dy_array_release(&core_ctx.past_subtype_checks);
+    dy_array_release(&core_ctx.past_checks);
+    dy_array_release(&core_ctx.equal_variables);
+    dy_array_release(&core_ctx.equal_variable_levels);
+    dy_array_release(&core_ctx.free_ids_arrays);
+    dy_array_release(&core_ctx.constraints);
+    dy_array_release(&core_ctx.constraint_index);
+    dy_array_release(&core_ctx.dead_nodes);
+    dy_array_release(&core_ctx.hash_consed_exprs);
+    dy_array_release(&core_ctx.custom_shared);
+}
+
+void null_stream(dy_array_t *buffer, void *env)
+{
+}
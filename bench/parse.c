@@ -0,0 +1,120 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "../syntax/utf8_to_ast.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Compares parsing with and without the packrat memo (see dy_utf8_to_ast_ctx.memo)
+ * by parsing the same file over and over, and reports how many re-parses the memo avoided.
+ *
+ * Usage: parse <file> [iterations]
+ */
+
+static double time_parse(const char *text, size_t size, size_t iterations, size_t memo_capacity, size_t *num_memo_hits, size_t *num_memo_misses);
+
+static void null_stream(dy_array_t *buffer, void *env);
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file> [iterations]\n", argv[0]);
+        return -1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror("Error reading file");
+        return -1;
+    }
+
+    size_t iterations = 100;
+    if (argc > 2) {
+        iterations = (size_t)strtoul(argv[2], NULL, 10);
+    }
+
+    size_t size = 0;
+    char *text = NULL;
+    for (;;) {
+        text = realloc(text, size + 4096);
+        assert(text);
+
+        size_t n = fread(text + size, 1, 4096, file);
+        size += n;
+
+        if (n < 4096) {
+            break;
+        }
+    }
+
+    fclose(file);
+
+    size_t hits, misses;
+
+    // Warm up both once.
+    time_parse(text, size, 1, 0, &hits, &misses);
+    time_parse(text, size, 1, 64, &hits, &misses);
+
+    double plain_secs = time_parse(text, size, iterations, 0, &hits, &misses);
+    double memo_secs = time_parse(text, size, iterations, 64, &hits, &misses);
+
+    fprintf(stderr, "iterations:  %zu\n", iterations);
+    fprintf(stderr, "no memo:     %.3f s (%.3f ms/run)\n", plain_secs, plain_secs * 1000 / (double)iterations);
+    fprintf(stderr, "memo:        %.3f s (%.3f ms/run)\n", memo_secs, memo_secs * 1000 / (double)iterations);
+    fprintf(stderr, "speedup:     %.2fx\n", plain_secs / memo_secs);
+    fprintf(stderr, "memo hits:   %zu per run (re-parses avoided)\n", hits / iterations);
+    fprintf(stderr, "memo misses: %zu per run\n", misses / iterations);
+
+    free(text);
+
+    return 0;
+}
+
+double time_parse(const char *text, size_t size, size_t iterations, size_t memo_capacity, size_t *num_memo_hits, size_t *num_memo_misses)
+{
+    *num_memo_hits = 0;
+    *num_memo_misses = 0;
+
+    clock_t start = clock();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        dy_array_t buffer = dy_array_create(sizeof(char), DY_ALIGNOF(char), size);
+        memcpy(buffer.buffer, text, size);
+        buffer.num_elems = size;
+
+        struct dy_utf8_to_ast_ctx ctx = {
+            .stream = {
+                .get_chars = null_stream,
+                .buffer = buffer,
+                .env = NULL,
+                .current_index = 0 },
+            .memo = dy_array_create(sizeof(struct dy_utf8_memo_entry), DY_ALIGNOF(struct dy_utf8_memo_entry), memo_capacity)
+        };
+
+        struct dy_ast_do_block ast;
+        if (!dy_utf8_to_ast_file(&ctx, &ast)) {
+            dy_bail("Failed to parse program.");
+        }
+
+        *num_memo_hits += ctx.num_memo_hits;
+        *num_memo_misses += ctx.num_memo_misses;
+
+        dy_ast_do_block_release(ast);
+        dy_array_release(&ctx.memo);
+        dy_interner_release(&ctx.symbols);
+        dy_array_release(&ctx.stream.buffer);
+    }
+
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void null_stream(dy_array_t *buffer, void *env)
+{
+    (void)buffer;
+    (void)env;
+}
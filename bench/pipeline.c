@@ -0,0 +1,468 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "../syntax/utf8_to_ast.h"
+#include "../syntax/ast_to_core.h"
+
+#include "../core/check.h"
+#include "../core/eval.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#    include <sys/resource.h>
+#elif defined(_WIN32)
+#    include <windows.h>
+#    include <psapi.h>
+#endif
+
+/**
+ * Times the phases of the pipeline of duality.c (parse, convert to Core, check, eval)
+ * separately on synthetic programs, each of which stresses one dimension:
+ *
+ *   nesting   - Lists nested 'size' levels deep and a chain of applications to take them apart.
+ *   list      - A list with 'size' entries.
+ *   either    - An either with 'size' entries.
+ *   defs      - 'size' definitions, each referring to the previous one.
+ *   implicit  - 'size' applications of a function with an implicit type argument to be inferred.
+ *   recursive - 'size' recursive (inf and fin) types, and functions projecting out of them.
+ *
+ * The programs only depend on the shape and size, so runs are comparable across builds.
+ *
+ * Usage: pipeline [iterations]                       - Every shape at its default size.
+ *        pipeline <shape> <size> [iterations]
+ *        pipeline --emit <shape> <size>              - Prints the program instead.
+ *
+ * Prints one JSON object per shape and line, with the median time of each phase in
+ * milliseconds (CPU time, see clock()) and the peak resident set size of the process
+ * so far in kilobytes (-1 where unknown). Since the peak only ever grows, run one
+ * shape per process to attribute it to a single shape.
+ */
+
+struct shape {
+    const char *name;
+    void (*generate)(struct dy_writer *writer, size_t size);
+    size_t default_size;
+};
+
+struct phase_times {
+    double parse;
+    double lower;
+    double check;
+    double eval;
+};
+
+static void generate_nesting(struct dy_writer *writer, size_t size);
+
+static void generate_list(struct dy_writer *writer, size_t size);
+
+static void generate_either(struct dy_writer *writer, size_t size);
+
+static void generate_defs(struct dy_writer *writer, size_t size);
+
+static void generate_implicit(struct dy_writer *writer, size_t size);
+
+static void generate_recursive(struct dy_writer *writer, size_t size);
+
+static const struct shape shapes[] = {
+    { "nesting", generate_nesting, 200 },
+    { "list", generate_list, 2000 },
+    { "either", generate_either, 2000 },
+    { "defs", generate_defs, 2000 },
+    { "implicit", generate_implicit, 500 },
+    { "recursive", generate_recursive, 500 }
+};
+
+static const size_t num_shapes = sizeof shapes / sizeof shapes[0];
+
+static void bench_shape(const struct shape *shape, size_t size, size_t iterations);
+
+static struct phase_times run_pipeline(dy_string_t text);
+
+static double median(double *values, size_t num_values);
+
+static int compare_doubles(const void *a, const void *b);
+
+static double seconds_since(clock_t start);
+
+static long peak_rss_kb(void);
+
+static void write_name(struct dy_writer *writer, const char *prefix, size_t i);
+
+static void null_stream(dy_array_t *buffer, void *env);
+
+int main(int argc, const char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--emit") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: %s --emit <shape> <size>\n", argv[0]);
+            return -1;
+        }
+
+        for (size_t i = 0; i < num_shapes; ++i) {
+            if (strcmp(argv[2], shapes[i].name) == 0) {
+                struct dy_writer writer = dy_writer_to_file(stdout);
+                shapes[i].generate(&writer, (size_t)strtoul(argv[3], NULL, 10));
+                dy_writer_release(&writer);
+                return 0;
+            }
+        }
+
+        fprintf(stderr, "Unknown shape '%s'.\n", argv[2]);
+        return -1;
+    }
+
+    if (argc > 2) {
+        size_t iterations = 10;
+        if (argc > 3) {
+            iterations = (size_t)strtoul(argv[3], NULL, 10);
+        }
+
+        for (size_t i = 0; i < num_shapes; ++i) {
+            if (strcmp(argv[1], shapes[i].name) == 0) {
+                bench_shape(&shapes[i], (size_t)strtoul(argv[2], NULL, 10), iterations);
+                return 0;
+            }
+        }
+
+        fprintf(stderr, "Unknown shape '%s'.\n", argv[1]);
+        return -1;
+    }
+
+    size_t iterations = 10;
+    if (argc > 1) {
+        iterations = (size_t)strtoul(argv[1], NULL, 10);
+    }
+
+    for (size_t i = 0; i < num_shapes; ++i) {
+        bench_shape(&shapes[i], shapes[i].default_size, iterations);
+    }
+
+    return 0;
+}
+
+void bench_shape(const struct shape *shape, size_t size, size_t iterations)
+{
+    if (iterations == 0) {
+        iterations = 1;
+    }
+
+    struct dy_writer writer = dy_writer_to_buffer(4096);
+    shape->generate(&writer, size);
+    dy_string_t text = dy_array_view(&writer.buffer);
+
+    // Warm up once.
+    run_pipeline(text);
+
+    double *times = malloc(4 * iterations * sizeof(double));
+    assert(times);
+
+    double *parse = times;
+    double *lower = times + iterations;
+    double *check = times + 2 * iterations;
+    double *eval = times + 3 * iterations;
+
+    for (size_t i = 0; i < iterations; ++i) {
+        struct phase_times t = run_pipeline(text);
+        parse[i] = t.parse;
+        lower[i] = t.lower;
+        check[i] = t.check;
+        eval[i] = t.eval;
+    }
+
+    printf("{\"shape\":\"%s\",\"size\":%zu,\"bytes\":%zu,\"iterations\":%zu,"
+           "\"parse_ms\":%.3f,\"lower_ms\":%.3f,\"check_ms\":%.3f,\"eval_ms\":%.3f,\"peak_rss_kb\":%ld}\n",
+        shape->name, size, text.size, iterations,
+        median(parse, iterations) * 1000, median(lower, iterations) * 1000,
+        median(check, iterations) * 1000, median(eval, iterations) * 1000,
+        peak_rss_kb());
+
+    fflush(stdout);
+
+    free(times);
+    dy_writer_release(&writer);
+}
+
+struct phase_times run_pipeline(dy_string_t text)
+{
+    struct phase_times times;
+
+    dy_array_t buffer = dy_array_create(sizeof(char), DY_ALIGNOF(char), text.size);
+    memcpy(buffer.buffer, text.ptr, text.size);
+    buffer.num_elems = text.size;
+
+    struct dy_utf8_to_ast_ctx utf8_to_ast_ctx = {
+        .stream = {
+            .get_chars = null_stream,
+            .buffer = buffer,
+            .env = NULL,
+            .current_index = 0 }
+    };
+
+    clock_t start = clock();
+
+    struct dy_ast_do_block ast;
+    if (!dy_utf8_to_ast_file(&utf8_to_ast_ctx, &ast)) {
+        dy_bail("Failed to parse program.");
+    }
+
+    times.parse = seconds_since(start);
+
+    dy_interner_release(&utf8_to_ast_ctx.symbols);
+
+    dy_array_t custom_shared = dy_array_create(sizeof(struct dy_core_custom_shared), DY_ALIGNOF(struct dy_core_custom_shared), 5);
+
+    dy_uv_register(&custom_shared);
+    dy_def_register(&custom_shared);
+    dy_string_register(&custom_shared);
+    dy_string_type_register(&custom_shared);
+    dy_int_register(&custom_shared);
+    dy_int_type_register(&custom_shared);
+    dy_int_op_register(&custom_shared);
+    dy_string_op_register(&custom_shared);
+    dy_print_register(&custom_shared);
+
+    struct dy_ast_to_core_ctx ast_to_core_ctx = {
+        .running_id = 0,
+        .variable_replacements = dy_array_create(sizeof(struct dy_variable_replacement), DY_ALIGNOF(struct dy_variable_replacement), 128),
+        .innermost_replacements = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 128),
+        .num_lookups_per_level = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 16)
+    };
+
+    start = clock();
+
+    struct dy_core_expr core = dy_ast_do_block_to_core(&ast_to_core_ctx, ast);
+
+    times.lower = seconds_since(start);
+
+    struct dy_core_ctx core_ctx = {
+        .running_id = ast_to_core_ctx.running_id,
+        .free_variables = dy_array_create(sizeof(struct dy_free_var), DY_ALIGNOF(struct dy_free_var), 64),
+        .captured_inference_vars = dy_array_create(sizeof(struct dy_captured_inference_var), DY_ALIGNOF(struct dy_captured_inference_var), 64),
+        .recovered_negative_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
+        .recovered_positive_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
+        .past_subtype_checks = dy_array_create(sizeof(struct dy_core_past_subtype_check), DY_ALIGNOF(struct dy_core_past_subtype_check), 64),
+        .past_checks = dy_array_create(sizeof(struct dy_core_past_check), DY_ALIGNOF(struct dy_core_past_check), 0),
+        .equal_variables = dy_array_create(sizeof(struct dy_equal_variables), DY_ALIGNOF(struct dy_equal_variables), 64),
+        .equal_variable_levels = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 256),
+        .free_ids_arrays = dy_array_create(sizeof(dy_array_t), DY_ALIGNOF(dy_array_t), 8),
+        .constraints = dy_array_create(sizeof(struct dy_constraint), DY_ALIGNOF(struct dy_constraint), 64),
+        .constraint_index = dy_array_create(sizeof(struct dy_constraint_index_entry), DY_ALIGNOF(struct dy_constraint_index_entry), 0),
+        .dead_nodes = dy_array_create(sizeof(struct dy_core_expr *), DY_ALIGNOF(struct dy_core_expr *), 4096),
+        .hash_consed_exprs = dy_array_create(sizeof(struct dy_hash_consed_expr), DY_ALIGNOF(struct dy_hash_consed_expr), 1024),
+        .custom_shared = custom_shared
+    };
+
+    start = clock();
+
+    core = dy_hash_cons(&core_ctx, core);
+
+    struct dy_core_expr new_core;
+    if (dy_check_expr(&core_ctx, core, &new_core)) {
+        dy_core_expr_release(&core_ctx, core);
+        core = dy_hash_cons(&core_ctx, new_core);
+    }
+
+    times.check = seconds_since(start);
+
+    start = clock();
+
+    bool is_value = false;
+    if (dy_eval_expr(&core_ctx, core, &is_value, &new_core)) {
+        dy_core_expr_release(&core_ctx, core);
+        core = new_core;
+    }
+
+    times.eval = seconds_since(start);
+
+    dy_core_expr_release(&core_ctx, core);
+    dy_subtype_memo_clear(&core_ctx);
+    dy_hash_cons_clear(&core_ctx);
+    dy_core_free_dead_nodes(&core_ctx);
+
+    dy_ast_do_block_release(ast);
+    dy_array_release(&utf8_to_ast_ctx.stream.buffer);
+    dy_array_release(&ast_to_core_ctx.variable_replacements);
+    dy_array_release(&ast_to_core_ctx.innermost_replacements);
+    dy_array_release(&ast_to_core_ctx.num_lookups_per_level);
+
+    dy_array_release(&core_ctx.free_variables);
+    dy_array_release(&core_ctx.captured_inference_vars);
+    dy_array_release(&core_ctx.recovered_negative_inference_ids);
+    dy_array_release(&core_ctx.recovered_positive_inference_ids);
+    dy_array_release(&core_ctx.past_subtype_checks);
+    dy_array_release(&core_ctx.past_checks);
+    dy_array_release(&core_ctx.equal_variables);
+    dy_array_release(&core_ctx.equal_variable_levels);
+    dy_array_release(&core_ctx.free_ids_arrays);
+    dy_array_release(&core_ctx.constraints);
+    dy_array_release(&core_ctx.constraint_index);
+    dy_array_release(&core_ctx.dead_nodes);
+    dy_array_release(&core_ctx.hash_consed_exprs);
+    dy_array_release(&core_ctx.custom_shared);
+
+    return times;
+}
+
+void generate_nesting(struct dy_writer *writer, size_t size)
+{
+    dy_write(writer, DY_STR_LIT("def n = "));
+    for (size_t i = 0; i < size; ++i) {
+        dy_write(writer, DY_STR_LIT("list { 'a' -> "));
+    }
+    dy_write(writer, DY_STR_LIT("'v'"));
+    for (size_t i = 0; i < size; ++i) {
+        dy_write(writer, DY_STR_LIT(" }"));
+    }
+    dy_write(writer, DY_STR_LIT("\n"));
+
+    for (size_t i = 0; i < size; ++i) {
+        dy_write(writer, DY_STR_LIT("("));
+    }
+    dy_write(writer, DY_STR_LIT("n"));
+    for (size_t i = 0; i < size; ++i) {
+        dy_write(writer, DY_STR_LIT(" 'a')"));
+    }
+    dy_write(writer, DY_STR_LIT("\n"));
+}
+
+void generate_list(struct dy_writer *writer, size_t size)
+{
+    dy_write(writer, DY_STR_LIT("def l = list {\n"));
+    for (size_t i = 0; i < size; ++i) {
+        dy_write(writer, DY_STR_LIT("    "));
+        write_name(writer, "'k", i);
+        dy_write(writer, DY_STR_LIT("' -> "));
+        write_name(writer, "'v", i);
+        dy_write(writer, i + 1 < size ? DY_STR_LIT("',\n") : DY_STR_LIT("'\n"));
+    }
+    dy_write(writer, DY_STR_LIT("}\n"));
+
+    dy_write(writer, DY_STR_LIT("'done'\n"));
+}
+
+void generate_either(struct dy_writer *writer, size_t size)
+{
+    dy_write(writer, DY_STR_LIT("def e = either {\n"));
+    for (size_t i = 0; i < size; ++i) {
+        dy_write(writer, DY_STR_LIT("    "));
+        write_name(writer, "'k", i);
+        dy_write(writer, DY_STR_LIT("' -> "));
+        write_name(writer, "'v", i);
+        dy_write(writer, i + 1 < size ? DY_STR_LIT("',\n") : DY_STR_LIT("'\n"));
+    }
+    dy_write(writer, DY_STR_LIT("}\n"));
+
+    dy_write(writer, DY_STR_LIT("'done'\n"));
+}
+
+void generate_defs(struct dy_writer *writer, size_t size)
+{
+    dy_write(writer, DY_STR_LIT("def d0 = 'v'\n"));
+    for (size_t i = 1; i < size; ++i) {
+        write_name(writer, "def d", i);
+        write_name(writer, " = d", i - 1);
+        dy_write(writer, DY_STR_LIT("\n"));
+    }
+
+    write_name(writer, "d", size == 0 ? 0 : size - 1);
+    dy_write(writer, DY_STR_LIT("\n"));
+}
+
+void generate_implicit(struct dy_writer *writer, size_t size)
+{
+    dy_write(writer, DY_STR_LIT("def id = fun @ t => fun x : t => x\n"));
+    dy_write(writer, DY_STR_LIT("def a0 = 'v'\n"));
+    for (size_t i = 1; i < size; ++i) {
+        write_name(writer, "def a", i);
+        write_name(writer, " = id a", i - 1);
+        dy_write(writer, DY_STR_LIT("\n"));
+    }
+
+    write_name(writer, "a", size == 0 ? 0 : size - 1);
+    dy_write(writer, DY_STR_LIT("\n"));
+}
+
+void generate_recursive(struct dy_writer *writer, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        if (i % 2 == 0) {
+            write_name(writer, "def t", i);
+            dy_write(writer, DY_STR_LIT(" = inf r = list { 'hd' -> String, 'tl' -> r }\n"));
+            write_name(writer, "def f", i);
+            write_name(writer, " = fun x : t", i);
+            dy_write(writer, DY_STR_LIT(" => ((x 'tl') 'tl') 'hd'\n"));
+        } else {
+            write_name(writer, "def t", i);
+            dy_write(writer, DY_STR_LIT(" = fin r = either { 'nil' -> String, 'cons' -> list { 'hd' -> String, 'tl' -> r } }\n"));
+            write_name(writer, "def f", i);
+            write_name(writer, " = fun x : t", i);
+            dy_write(writer, DY_STR_LIT(" => x\n"));
+        }
+    }
+
+    dy_write(writer, DY_STR_LIT("'done'\n"));
+}
+
+void write_name(struct dy_writer *writer, const char *prefix, size_t i)
+{
+    dy_write(writer, (dy_string_t){ .ptr = prefix, .size = strlen(prefix) });
+    dy_write_size_t_decimal(writer, i);
+}
+
+double median(double *values, size_t num_values)
+{
+    qsort(values, num_values, sizeof(double), compare_doubles);
+
+    if (num_values % 2 == 1) {
+        return values[num_values / 2];
+    } else {
+        return (values[num_values / 2 - 1] + values[num_values / 2]) / 2;
+    }
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+double seconds_since(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+long peak_rss_kb(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#    ifdef __APPLE__
+    // Bytes on macOS, kilobytes elsewhere.
+    return (long)(usage.ru_maxrss / 1024);
+#    else
+    return (long)usage.ru_maxrss;
+#    endif
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters)) {
+        return -1;
+    }
+
+    return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+    return -1;
+#endif
+}
+
+void null_stream(dy_array_t *buffer, void *env)
+{
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "../syntax/utf8_to_ast.h"
+#include "../syntax/ast_to_core.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Measures converting a parsed file to Core over and over, which is dominated by
+ * resolving names (see dy_ast_to_core_ctx.innermost_replacements), and reports
+ * how far away in scope the bindings the names resolved to were.
+ *
+ * Usage: resolve <file> [iterations]
+ */
+
+static void null_stream(dy_array_t *buffer, void *env);
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file> [iterations]\n", argv[0]);
+        return -1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror("Error reading file");
+        return -1;
+    }
+
+    size_t iterations = 100;
+    if (argc > 2) {
+        iterations = (size_t)strtoul(argv[2], NULL, 10);
+    }
+
+    dy_array_t buffer = dy_array_create(sizeof(char), DY_ALIGNOF(char), 4096);
+    for (;;) {
+        dy_array_set_excess_capacity(&buffer, 4096);
+
+        size_t n = fread(dy_array_excess_buffer(&buffer), 1, 4096, file);
+        dy_array_add_to_size(&buffer, n);
+
+        if (n < 4096) {
+            break;
+        }
+    }
+
+    fclose(file);
+
+    struct dy_utf8_to_ast_ctx utf8_to_ast_ctx = {
+        .stream = {
+            .get_chars = null_stream,
+            .buffer = buffer,
+            .env = NULL,
+            .current_index = 0 }
+    };
+
+    struct dy_ast_do_block ast;
+    if (!dy_utf8_to_ast_file(&utf8_to_ast_ctx, &ast)) {
+        dy_bail("Failed to parse program.");
+    }
+
+    size_t num_symbols = utf8_to_ast_ctx.symbols.num_symbols;
+
+    dy_interner_release(&utf8_to_ast_ctx.symbols);
+
+    dy_array_t custom_shared = dy_array_create(sizeof(struct dy_core_custom_shared), DY_ALIGNOF(struct dy_core_custom_shared), 5);
+
+    dy_uv_register(&custom_shared);
+    dy_def_register(&custom_shared);
+    dy_string_register(&custom_shared);
+    dy_string_type_register(&custom_shared);
+    dy_int_register(&custom_shared);
+    dy_int_type_register(&custom_shared);
+    dy_int_op_register(&custom_shared);
+    dy_string_op_register(&custom_shared);
+    dy_print_register(&custom_shared);
+
+    // Just enough to release the results.
+    struct dy_core_ctx core_ctx = {
+        .custom_shared = custom_shared
+    };
+
+    struct dy_ast_to_core_ctx ctx = {
+        .running_id = 0,
+        .variable_replacements = dy_array_create(sizeof(struct dy_variable_replacement), DY_ALIGNOF(struct dy_variable_replacement), 128),
+        .innermost_replacements = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 128),
+        .num_lookups_per_level = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 16)
+    };
+
+    clock_t start = clock();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        ctx.running_id = 0;
+
+        struct dy_core_expr core = dy_ast_do_block_to_core(&ctx, ast);
+
+        // Only the conversion itself is measured, not releasing its result.
+        clock_t pause = clock();
+        dy_core_expr_release(&core_ctx, core);
+        start += clock() - pause;
+    }
+
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    size_t num_bound_lookups = 0;
+    for (size_t i = 0; i < ctx.num_lookups_per_level.num_elems; ++i) {
+        num_bound_lookups += *(const size_t *)dy_array_pos(&ctx.num_lookups_per_level, i);
+    }
+
+    fprintf(stderr, "iterations:  %zu\n", iterations);
+    fprintf(stderr, "conversion:  %.3f ms/run\n", secs * 1000 / (double)iterations);
+    fprintf(stderr, "symbols:     %zu\n", num_symbols);
+    fprintf(stderr, "lookups:     %zu per run\n", (num_bound_lookups + ctx.num_builtin_lookups + ctx.num_unbound_lookups) / iterations);
+    fprintf(stderr, "  builtin:   %zu\n", ctx.num_builtin_lookups / iterations);
+    fprintf(stderr, "  unbound:   %zu\n", ctx.num_unbound_lookups / iterations);
+    fprintf(stderr, "  by number of bindings in scope that are closer:\n");
+
+    // Levels are summarized in power-of-two buckets: 0, 1, 2-3, 4-7, ...
+    for (size_t low = 0, high = 0; low < ctx.num_lookups_per_level.num_elems; low = high + 1, high = 2 * low - 1) {
+        size_t n = 0;
+        for (size_t i = low; i <= high && i < ctx.num_lookups_per_level.num_elems; ++i) {
+            n += *(const size_t *)dy_array_pos(&ctx.num_lookups_per_level, i);
+        }
+
+        if (n == 0) {
+            continue;
+        }
+
+        if (low == high) {
+            fprintf(stderr, "  %6zu: %zu\n", low, n / iterations);
+        } else {
+            fprintf(stderr, "  %6zu-%zu: %zu\n", low, high, n / iterations);
+        }
+    }
+
+    dy_ast_do_block_release(ast);
+    dy_array_release(&ctx.variable_replacements);
+    dy_array_release(&ctx.innermost_replacements);
+    dy_array_release(&ctx.num_lookups_per_level);
+    dy_array_release(&utf8_to_ast_ctx.stream.buffer);
+    dy_array_release(&core_ctx.custom_shared);
+
+    return 0;
+}
+
+void null_stream(dy_array_t *buffer, void *env)
+{
+    (void)buffer;
+    (void)env;
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "../support/scan.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Compares the throughput of the scanning functions the parser uses (support/scan.h)
+ * against their scalar versions.
+ *
+ * Each function is first run over one long run of what it skips, which shows the raw
+ * throughput; then a large generated source text is tokenized the way the parser does it
+ * (blanks, comments, identifiers and strings), where most runs are just a few bytes long.
+ *
+ * Usage: scan [megabytes] [iterations]
+ */
+
+struct scanner {
+    const char *(*blanks)(const char *ptr, const char *end, bool newlines);
+    const char *(*identifier_tail)(const char *ptr, const char *end);
+    const char *(*byte)(const char *ptr, const char *end, char c);
+};
+
+static char *generate_text(size_t size);
+
+static size_t tokenize(struct scanner scanner, const char *text, size_t size);
+
+static double time_scanner(struct scanner scanner, const char *text, size_t size, size_t iterations, size_t *num_tokens);
+
+static double time_run(struct scanner scanner, int which, const char *text, size_t size, size_t iterations);
+
+static void report(const char *what, double megabytes, double scalar_secs, double fast_secs);
+
+int main(int argc, const char *argv[])
+{
+    size_t megabytes = 64;
+    if (argc > 1) {
+        megabytes = (size_t)strtoul(argv[1], NULL, 10);
+    }
+
+    size_t iterations = 5;
+    if (argc > 2) {
+        iterations = (size_t)strtoul(argv[2], NULL, 10);
+    }
+
+    size_t size = megabytes * 1024 * 1024;
+
+    struct scanner scalar = {
+        .blanks = dy_scan_blanks_scalar,
+        .identifier_tail = dy_scan_identifier_tail_scalar,
+        .byte = dy_scan_byte_scalar
+    };
+
+    struct scanner fast = {
+        .blanks = dy_scan_blanks,
+        .identifier_tail = dy_scan_identifier_tail,
+        .byte = dy_scan_byte
+    };
+
+    double total_megabytes = (double)megabytes * (double)iterations;
+
+#ifdef DY_SCAN_SSE2
+    fprintf(stderr, "%-14s%14s%14s\n", "", "scalar", "sse2");
+#else
+    fprintf(stderr, "%-14s%14s%14s\n", "", "scalar", "fast");
+#endif
+
+    static const char *const run_names[] = { "blanks", "identifiers", "byte search" };
+    static const char run_chars[] = { ' ', 'a', 'x' };
+
+    char *run = malloc(size);
+    assert(run);
+
+    for (int which = 0; which < 3; ++which) {
+        memset(run, run_chars[which], size);
+
+        time_run(scalar, which, run, size, 1);
+        time_run(fast, which, run, size, 1);
+
+        double scalar_secs = time_run(scalar, which, run, size, iterations);
+        double fast_secs = time_run(fast, which, run, size, iterations);
+
+        report(run_names[which], total_megabytes, scalar_secs, fast_secs);
+    }
+
+    free(run);
+
+    char *text = generate_text(size);
+
+    size_t scalar_tokens, fast_tokens;
+
+    // Warm up both once.
+    time_scanner(scalar, text, size, 1, &scalar_tokens);
+    time_scanner(fast, text, size, 1, &fast_tokens);
+
+    double scalar_secs = time_scanner(scalar, text, size, iterations, &scalar_tokens);
+    double fast_secs = time_scanner(fast, text, size, iterations, &fast_tokens);
+
+    if (scalar_tokens != fast_tokens) {
+        fprintf(stderr, "Token counts differ: %zu vs %zu\n", scalar_tokens, fast_tokens);
+        return -1;
+    }
+
+    report("tokenize", total_megabytes, scalar_secs, fast_secs);
+
+    fprintf(stderr, "\nin MiB/s, %zu MiB x %zu iterations, %zu tokens\n", megabytes, iterations, scalar_tokens);
+
+    free(text);
+
+    return 0;
+}
+
+char *generate_text(size_t size)
+{
+    static const char *const fragments[] = {
+        "def some-rather-long-identifier? = fun x : String => x\n",
+        "    let value = apply-the-function-to-its-argument some-rather-long-identifier?\n",
+        "# A line comment that explains what the next definition is for.\n",
+        "/# A block comment\n   spanning /# nested #/ a few lines.\n#/\n",
+        "print 'a string literal of moderate length, as used in messages'\n",
+        "\n",
+        "        x y z\n"
+    };
+
+    size_t num_fragments = sizeof fragments / sizeof fragments[0];
+
+    char *text = malloc(size);
+    assert(text);
+
+    srand(42);
+
+    size_t pos = 0;
+    while (pos < size) {
+        const char *fragment = fragments[(size_t)rand() % num_fragments];
+        for (; *fragment != '\0' && pos < size; ++fragment, ++pos) {
+            text[pos] = *fragment;
+        }
+    }
+
+    return text;
+}
+
+size_t tokenize(struct scanner scanner, const char *text, size_t size)
+{
+    const char *ptr = text;
+    const char *end = text + size;
+
+    size_t num_tokens = 0;
+
+    while (ptr != end) {
+        ptr = scanner.blanks(ptr, end, true);
+        if (ptr == end) {
+            break;
+        }
+
+        ++num_tokens;
+
+        char c = *ptr++;
+
+        if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')) {
+            ptr = scanner.identifier_tail(ptr, end);
+        } else if (c == '\'') {
+            const char *quote = scanner.byte(ptr, end, '\'');
+            ptr = quote == end ? end : quote + 1;
+        } else if (c == '/' && ptr != end && *ptr == '#') {
+            // Nesting doesn't matter for counting, just skip to the terminator.
+            for (;;) {
+                const char *hash = scanner.byte(ptr, end, '#');
+                if (hash == end || hash + 1 == end) {
+                    ptr = end;
+                    break;
+                }
+
+                ptr = hash + 1;
+                if (*ptr == '/') {
+                    ++ptr;
+                    break;
+                }
+            }
+        } else if (c == '#') {
+            const char *newline = scanner.byte(ptr, end, '\n');
+            ptr = newline == end ? end : newline + 1;
+        }
+    }
+
+    return num_tokens;
+}
+
+double time_scanner(struct scanner scanner, const char *text, size_t size, size_t iterations, size_t *num_tokens)
+{
+    clock_t start = clock();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        *num_tokens = tokenize(scanner, text, size);
+    }
+
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+double time_run(struct scanner scanner, int which, const char *text, size_t size, size_t iterations)
+{
+    const char *end = text + size;
+    size_t skipped = 0;
+
+    clock_t start = clock();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        switch (which) {
+        case 0:
+            skipped += (size_t)(scanner.blanks(text, end, true) - text);
+            break;
+        case 1:
+            skipped += (size_t)(scanner.identifier_tail(text, end) - text);
+            break;
+        default:
+            skipped += (size_t)(scanner.byte(text, end, '\n') - text);
+            break;
+        }
+    }
+
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    assert(skipped == size * iterations);
+    (void)skipped;
+
+    return secs;
+}
+
+void report(const char *what, double megabytes, double scalar_secs, double fast_secs)
+{
+    fprintf(stderr, "%-14s%14.1f%14.1f   (%.2fx)\n", what, megabytes / scalar_secs, megabytes / fast_secs, scalar_secs / fast_secs);
+}
@@ -34,7 +34,11 @@ const char *process_code(const char *text, size_t text_length_in_bytes)
     };
 
     struct dy_ast_do_block ast;
-    if (!dy_utf8_to_ast_file(&utf8_to_ast_ctx, &ast)) {
+    bool parsed = dy_utf8_to_ast_file(&utf8_to_ast_ctx, &ast);
+
+    dy_interner_release(&utf8_to_ast_ctx.symbols);
+
+    if (!parsed) {
         return "Failed to parse program.\n";
     }
 
@@ -44,10 +48,16 @@ const char *process_code(const char *text, size_t text_length_in_bytes)
     dy_def_register(&custom_shared);
     dy_string_register(&custom_shared);
     dy_string_type_register(&custom_shared);
+    dy_int_register(&custom_shared);
+    dy_int_type_register(&custom_shared);
+    dy_int_op_register(&custom_shared);
+    dy_string_op_register(&custom_shared);
 
     struct dy_ast_to_core_ctx ast_to_core_ctx = {
         .running_id = 0,
-        .variable_replacements = dy_array_create(sizeof(struct dy_variable_replacement), DY_ALIGNOF(struct dy_variable_replacement), 128)
+        .variable_replacements = dy_array_create(sizeof(struct dy_variable_replacement), DY_ALIGNOF(struct dy_variable_replacement), 128),
+        .innermost_replacements = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 128),
+        .num_lookups_per_level = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 16)
     };
 
     struct dy_core_expr core = dy_ast_do_block_to_core(&ast_to_core_ctx, ast);
@@ -61,12 +71,19 @@ const char *process_code(const char *text, size_t text_length_in_bytes)
         .recovered_negative_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
         .recovered_positive_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
         .past_subtype_checks = dy_array_create(sizeof(struct dy_core_past_subtype_check), DY_ALIGNOF(struct dy_core_past_subtype_check), 64),
+        .past_checks = dy_array_create(sizeof(struct dy_core_past_check), DY_ALIGNOF(struct dy_core_past_check), 0),
         .equal_variables = dy_array_create(sizeof(struct dy_equal_variables), DY_ALIGNOF(struct dy_equal_variables), 64),
+        .equal_variable_levels = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 256),
         .free_ids_arrays = dy_array_create(sizeof(dy_array_t), DY_ALIGNOF(dy_array_t), 8),
         .constraints = dy_array_create(sizeof(struct dy_constraint), DY_ALIGNOF(struct dy_constraint), 64),
+        .constraint_index = dy_array_create(sizeof(struct dy_constraint_index_entry), DY_ALIGNOF(struct dy_constraint_index_entry), 0),
+        .dead_nodes = dy_array_create(sizeof(struct dy_core_expr *), DY_ALIGNOF(struct dy_core_expr *), 4096),
+        .hash_consed_exprs = dy_array_create(sizeof(struct dy_hash_consed_expr), DY_ALIGNOF(struct dy_hash_consed_expr), 1024),
         .custom_shared = custom_shared
     };
 
+    core = dy_hash_cons(&core_ctx, core);
+
     struct dy_core_expr new_core;
     if (dy_check_expr(&core_ctx, core, &new_core)) {
         dy_core_expr_release(&core_ctx, core);
@@ -79,14 +96,14 @@ const char *process_code(const char *text, size_t text_length_in_bytes)
         core = new_core;
     }
 
-    dy_array_t stringified_expr = dy_array_create(sizeof(char), DY_ALIGNOF(char), 64);
-    dy_core_expr_to_string(&core_ctx, core, &stringified_expr);
+    struct dy_writer writer = dy_writer_to_buffer(64);
+    dy_core_expr_to_string(&core_ctx, core, &writer);
 
     dy_core_expr_release(&core_ctx, core);
 
-    dy_array_add(&stringified_expr, &(char){ '\0' });
+    dy_write_char(&writer, '\0');
 
-    return stringified_expr.buffer;
+    return writer.buffer.buffer;
 }
 
 struct dy_stream stream_from_string(dy_string_t s)
@@ -12,11 +12,22 @@
  * The functions here define equality for all objects of Core.
  *
  * Equality is generally purely syntactical, except for the following objects:
- *   - Functions/Recursions are alpha-converted (might use De-Bruijn indices at some point).
+ *   - Functions/Recursions are alpha-converted. Bound variables are compared by binder level,
+ *     see dy_equal_variables_push().
  */
 
 static inline dy_ternary_t dy_are_equal(struct dy_core_ctx *ctx, struct dy_core_expr e1, struct dy_core_expr e2);
 
+/**
+ * Like dy_are_equal, but short-circuits if both pointers point to the same node.
+ *
+ * That's valid even though hash-consing (see hash_cons.h) shares alpha-equivalent nodes
+ * whose binders have different ids: A node is only ever identical to itself up to renaming
+ * of the binders inside it, and its free variables are the same wherever it is referenced.
+ * Hash-consing makes this the common case.
+ */
+static inline dy_ternary_t dy_are_equal_ptr(struct dy_core_ctx *ctx, const struct dy_core_expr *e1, const struct dy_core_expr *e2);
+
 static inline dy_ternary_t dy_assumptions_are_equal(struct dy_core_ctx *ctx, struct dy_core_assumption ass1, struct dy_core_assumption ass2);
 
 static inline dy_ternary_t dy_choices_are_equal(struct dy_core_ctx *ctx, struct dy_core_choice choice1, struct dy_core_choice choice2);
@@ -39,6 +50,8 @@ static inline dy_ternary_t dy_map_recursion_are_equal(struct dy_core_ctx *ctx, s
 
 dy_ternary_t dy_are_equal(struct dy_core_ctx *ctx, struct dy_core_expr e1, struct dy_core_expr e2)
 {
+    DY_STATS_COUNT(DY_STAT_ARE_EQUAL);
+
     if (e1.tag == DY_CORE_EXPR_INTRO && e2.tag == DY_CORE_EXPR_INTRO) {
         if (e1.intro.is_implicit != e2.intro.is_implicit || e1.intro.polarity != e2.intro.polarity || e1.intro.tag != e2.intro.tag) {
             return DY_NO;
@@ -83,6 +96,20 @@ dy_ternary_t dy_are_equal(struct dy_core_ctx *ctx, struct dy_core_expr e1, struc
         return dy_variables_are_equal(ctx, e1.inference_var_id, e2.inference_var_id);
     }
 
+    if (e1.tag == DY_CORE_EXPR_INFERENCE_CTX && e2.tag == DY_CORE_EXPR_INFERENCE_CTX) {
+        if (e1.inference_ctx.polarity != e2.inference_ctx.polarity) {
+            return DY_NO;
+        }
+
+        dy_equal_variables_push(ctx, e1.inference_ctx.id, e2.inference_ctx.id);
+
+        dy_ternary_t result = dy_are_equal_ptr(ctx, e1.inference_ctx.expr, e2.inference_ctx.expr);
+
+        dy_equal_variables_pop(ctx);
+
+        return result == DY_YES ? DY_YES : DY_NO;
+    }
+
     if (e1.tag == DY_CORE_EXPR_ANY && e2.tag == DY_CORE_EXPR_ANY) {
         return DY_YES;
     }
@@ -103,18 +130,24 @@ dy_ternary_t dy_are_equal(struct dy_core_ctx *ctx, struct dy_core_expr e1, struc
     }
 }
 
+dy_ternary_t dy_are_equal_ptr(struct dy_core_ctx *ctx, const struct dy_core_expr *e1, const struct dy_core_expr *e2)
+{
+    if (e1 == e2) {
+        return DY_YES;
+    }
+
+    return dy_are_equal(ctx, *e1, *e2);
+}
+
 dy_ternary_t dy_assumptions_are_equal(struct dy_core_ctx *ctx, struct dy_core_assumption ass1, struct dy_core_assumption ass2)
 {
-    dy_array_add(&ctx->equal_variables, &(struct dy_equal_variables){
-        .id1 = ass1.id,
-        .id2 = ass2.id
-    });
+    dy_equal_variables_push(ctx, ass1.id, ass2.id);
 
-    dy_ternary_t res1 = dy_are_equal(ctx, *ass1.type, *ass2.type);
+    dy_ternary_t res1 = dy_are_equal_ptr(ctx, ass1.type, ass2.type);
 
-    dy_ternary_t res2 = dy_are_equal(ctx, *ass1.expr, *ass2.expr);
+    dy_ternary_t res2 = dy_are_equal_ptr(ctx, ass1.expr, ass2.expr);
 
-    --ctx->equal_variables.num_elems;
+    dy_equal_variables_pop(ctx);
 
     if (res1 == DY_NO || res2 == DY_NO) {
         return DY_NO;
@@ -129,9 +162,9 @@ dy_ternary_t dy_assumptions_are_equal(struct dy_core_ctx *ctx, struct dy_core_as
 
 dy_ternary_t dy_choices_are_equal(struct dy_core_ctx *ctx, struct dy_core_choice choice1, struct dy_core_choice choice2)
 {
-    dy_ternary_t res1 = dy_are_equal(ctx, *choice1.left, *choice2.left);
+    dy_ternary_t res1 = dy_are_equal_ptr(ctx, choice1.left, choice2.left);
 
-    dy_ternary_t res2 = dy_are_equal(ctx, *choice1.right, *choice2.right);
+    dy_ternary_t res2 = dy_are_equal_ptr(ctx, choice1.right, choice2.right);
 
     if (res1 == DY_NO || res2 == DY_NO) {
         return DY_NO;
@@ -146,14 +179,11 @@ dy_ternary_t dy_choices_are_equal(struct dy_core_ctx *ctx, struct dy_core_choice
 
 dy_ternary_t dy_recursions_are_equal(struct dy_core_ctx *ctx, struct dy_core_recursion rec1, struct dy_core_recursion rec2)
 {
-    dy_array_add(&ctx->equal_variables, &(struct dy_equal_variables){
-        .id1 = rec1.id,
-        .id2 = rec2.id
-    });
+    dy_equal_variables_push(ctx, rec1.id, rec2.id);
 
-    dy_ternary_t result = dy_are_equal(ctx, *rec1.expr, *rec2.expr);
+    dy_ternary_t result = dy_are_equal_ptr(ctx, rec1.expr, rec2.expr);
 
-    --ctx->equal_variables.num_elems;
+    dy_equal_variables_pop(ctx);
 
     return result;
 }
@@ -166,10 +196,10 @@ dy_ternary_t dy_simples_are_equal(struct dy_core_ctx *ctx, struct dy_core_simple
 
     dy_ternary_t ret = DY_YES;
     if (simple1.tag == DY_CORE_SIMPLE_PROOF) {
-        ret = dy_are_equal(ctx, *simple1.proof, *simple2.proof);
+        ret = dy_are_equal_ptr(ctx, simple1.proof, simple2.proof);
     }
 
-    dy_ternary_t ret2 = dy_are_equal(ctx, *simple1.out, *simple2.out);
+    dy_ternary_t ret2 = dy_are_equal_ptr(ctx, simple1.out, simple2.out);
 
     if (ret == DY_NO || ret2 == DY_NO) {
         return DY_NO;
@@ -184,7 +214,7 @@ dy_ternary_t dy_simples_are_equal(struct dy_core_ctx *ctx, struct dy_core_simple
 
 dy_ternary_t dy_elims_are_equal(struct dy_core_ctx *ctx, struct dy_core_elim elim1, struct dy_core_elim elim2)
 {
-    if (dy_are_equal(ctx, *elim1.expr, *elim2.expr) != DY_YES) {
+    if (dy_are_equal_ptr(ctx, elim1.expr, elim2.expr) != DY_YES) {
         return DY_MAYBE;
     }
 
@@ -205,16 +235,9 @@ dy_ternary_t dy_variables_are_equal(struct dy_core_ctx *ctx, size_t id1, size_t
         return DY_YES;
     }
 
-    for (size_t i = 0, size = ctx->equal_variables.num_elems; i < size; ++i) {
-        const struct dy_equal_variables *v = dy_array_pos(&ctx->equal_variables, i);
-
-        if (v->id1 == id1 && v->id2 == id2) {
-            return true;
-        }
-
-        if (v->id1 == id2 && v->id2 == id1) {
-            return true;
-        }
+    size_t level = dy_equal_variables_level(ctx, id1);
+    if (level != 0 && level == dy_equal_variables_level(ctx, id2)) {
+        return DY_YES;
     }
 
     return DY_MAYBE;
@@ -240,16 +263,13 @@ dy_ternary_t dy_maps_are_equal(struct dy_core_ctx *ctx, struct dy_core_map f1, s
 
 dy_ternary_t dy_map_assumption_are_equal(struct dy_core_ctx *ctx, struct dy_core_map_assumption ass1, struct dy_core_map_assumption ass2)
 {
-    dy_array_add(&ctx->equal_variables, &(struct dy_equal_variables){
-        .id1 = ass1.id,
-        .id2 = ass2.id
-    });
+    dy_equal_variables_push(ctx, ass1.id, ass2.id);
 
-    dy_ternary_t res1 = dy_are_equal(ctx, *ass1.type, *ass2.type);
+    dy_ternary_t res1 = dy_are_equal_ptr(ctx, ass1.type, ass2.type);
 
     dy_ternary_t res2 = dy_assumptions_are_equal(ctx, ass1.assumption, ass2.assumption);
 
-    --ctx->equal_variables.num_elems;
+    dy_equal_variables_pop(ctx);
 
     if (res1 == DY_NO || res2 == DY_NO) {
         return DY_NO;
@@ -281,14 +301,11 @@ dy_ternary_t dy_map_choice_are_equal(struct dy_core_ctx *ctx, struct dy_core_map
 
 dy_ternary_t dy_map_recursion_are_equal(struct dy_core_ctx *ctx, struct dy_core_map_recursion rec1, struct dy_core_map_recursion rec2)
 {
-    dy_array_add(&ctx->equal_variables, &(struct dy_equal_variables){
-        .id1 = rec1.id,
-        .id2 = rec2.id
-    });
+    dy_equal_variables_push(ctx, rec1.id, rec2.id);
 
     dy_ternary_t res = dy_assumptions_are_equal(ctx, rec1.assumption, rec2.assumption);
 
-    --ctx->equal_variables.num_elems;
+    dy_equal_variables_pop(ctx);
 
     return res;
 }
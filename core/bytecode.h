@@ -0,0 +1,404 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "core.h"
+#include "eval.h"
+
+#include "../support/rc.h"
+
+/**
+ * A bytecode VM for checked Core, enabled by setting ctx->bytecode.
+ *
+ * It runs on the closures of the environment-based evaluator (see eval.h),
+ * but flattens chains of eliminations into linear code instead of recursing through them:
+ * The children of an elimination are compiled inline, and an elimination that steps
+ * calls the compiled body of the function it eliminates. Eliminations in tail position
+ * replace the current frame instead of pushing a new one, so unfolding a recursion is a loop.
+ *
+ * Bodies are compiled the first time they're called and are cached by address,
+ * which is stable since bodies are bound in environments, not substituted into.
+ * Everything that isn't an elimination or variable is handed to dy_eval_closure().
+ *
+ * Custom expressions evaluate through dy_eval_expr(), so the VM is re-entrant:
+ * Every run has its own segment of the value and frame stacks.
+ */
+
+enum dy_bytecode_op {
+    DY_BYTECODE_VARIABLE,
+    DY_BYTECODE_EVAL,
+    DY_BYTECODE_ELIM,
+    DY_BYTECODE_RETURN
+};
+
+struct dy_bytecode_instr {
+    enum dy_bytecode_op op;
+    bool is_tail;
+    size_t operand; // Variable id for VARIABLE, index into 'exprs' for EVAL and ELIM.
+};
+
+struct dy_bytecode_entry {
+    struct dy_core_expr *body; // NULL if the slot is unoccupied.
+    size_t pc;
+};
+
+struct dy_bytecode_value {
+    struct dy_eval_closure closure;
+    bool is_value;
+    bool is_new;
+};
+
+struct dy_bytecode_frame {
+    size_t return_pc;
+    struct dy_eval_env *env;
+    bool has_stepped;
+};
+
+struct dy_bytecode {
+    dy_array_t code;
+    dy_array_t exprs;
+    dy_array_t entries; // Open-addressed, power-of-two capacity, keyed on body addresses.
+    dy_array_t stack;
+    dy_array_t frames;
+};
+
+static inline struct dy_bytecode dy_bytecode_create(void);
+
+static inline void dy_bytecode_release(struct dy_core_ctx *ctx, struct dy_bytecode *bc);
+
+static inline size_t dy_bytecode_code_of(struct dy_core_ctx *ctx, struct dy_bytecode *bc, const struct dy_core_expr *body);
+
+static inline void dy_bytecode_compile(struct dy_bytecode *bc, struct dy_core_expr expr, bool is_tail);
+
+static inline void dy_bytecode_emit(struct dy_bytecode *bc, enum dy_bytecode_op op, bool is_tail, size_t operand);
+
+/** Runs the code at 'pc' in an empty environment until it returns. */
+static inline struct dy_bytecode_value dy_bytecode_run(struct dy_core_ctx *ctx, struct dy_bytecode *bc, size_t pc);
+
+static inline void dy_bytecode_elim(struct dy_core_ctx *ctx, struct dy_bytecode *bc, struct dy_bytecode_instr instr, size_t *pc);
+
+static inline void dy_bytecode_put(dy_array_t *entries, struct dy_bytecode_entry entry);
+
+static inline size_t dy_bytecode_hash(const struct dy_core_expr *body);
+
+struct dy_bytecode dy_bytecode_create(void)
+{
+    struct dy_bytecode bc = {
+        .code = dy_array_create(sizeof(struct dy_bytecode_instr), DY_ALIGNOF(struct dy_bytecode_instr), 256),
+        .exprs = dy_array_create(sizeof(struct dy_core_expr), DY_ALIGNOF(struct dy_core_expr), 128),
+        .entries = dy_array_create(sizeof(struct dy_bytecode_entry), DY_ALIGNOF(struct dy_bytecode_entry), 64),
+        .stack = dy_array_create(sizeof(struct dy_bytecode_value), DY_ALIGNOF(struct dy_bytecode_value), 64),
+        .frames = dy_array_create(sizeof(struct dy_bytecode_frame), DY_ALIGNOF(struct dy_bytecode_frame), 64)
+    };
+
+    memset(bc.entries.buffer, 0, bc.entries.elem_size * bc.entries.capacity);
+
+    return bc;
+}
+
+void dy_bytecode_release(struct dy_core_ctx *ctx, struct dy_bytecode *bc)
+{
+    assert(bc->stack.num_elems == 0 && bc->frames.num_elems == 0);
+
+    for (size_t i = 0, size = bc->entries.capacity; i < size; ++i) {
+        const struct dy_bytecode_entry *entry = dy_array_pos_uninit(&bc->entries, i);
+        if (entry->body != NULL) {
+            dy_core_expr_release_ptr(ctx, entry->body);
+        }
+    }
+
+    dy_array_release(&bc->code);
+    dy_array_release(&bc->exprs);
+    dy_array_release(&bc->entries);
+    dy_array_release(&bc->stack);
+    dy_array_release(&bc->frames);
+}
+
+bool dy_bytecode_eval(struct dy_core_ctx *ctx, struct dy_core_expr expr, bool *is_value, struct dy_core_expr *result)
+{
+    struct dy_bytecode *bc = ctx->bytecode;
+
+    size_t code_start = bc->code.num_elems;
+    size_t exprs_start = bc->exprs.num_elems;
+    size_t num_entries = bc->entries.num_elems;
+
+    dy_bytecode_compile(bc, expr, true);
+    dy_bytecode_emit(bc, DY_BYTECODE_RETURN, false, 0);
+
+    struct dy_bytecode_value value = dy_bytecode_run(ctx, bc, code_start);
+
+    // The code of 'expr' is only reachable from here, unless bodies got compiled after it.
+    if (bc->entries.num_elems == num_entries) {
+        bc->code.num_elems = code_start;
+        bc->exprs.num_elems = exprs_start;
+    }
+
+    *is_value = value.is_value;
+
+    if (!value.is_new) {
+        dy_eval_closure_release(ctx, value.closure);
+        return false;
+    }
+
+    *result = dy_eval_read_back(ctx, value.closure);
+
+    dy_eval_closure_release(ctx, value.closure);
+
+    return true;
+}
+
+size_t dy_bytecode_code_of(struct dy_core_ctx *ctx, struct dy_bytecode *bc, const struct dy_core_expr *body)
+{
+    size_t mask = bc->entries.capacity - 1;
+
+    for (size_t i = dy_bytecode_hash(body) & mask;; i = (i + 1) & mask) {
+        const struct dy_bytecode_entry *entry = dy_array_pos_uninit(&bc->entries, i);
+        if (entry->body == NULL) {
+            break;
+        }
+
+        if (entry->body == body) {
+            return entry->pc;
+        }
+    }
+
+    size_t pc = bc->code.num_elems;
+
+    dy_bytecode_compile(bc, *body, true);
+    dy_bytecode_emit(bc, DY_BYTECODE_RETURN, false, 0);
+
+    if (4 * (bc->entries.num_elems + 1) > 3 * bc->entries.capacity) {
+        dy_array_t old = bc->entries;
+
+        bc->entries = dy_array_create(old.elem_size, old.elem_alignment, old.capacity * 2);
+        memset(bc->entries.buffer, 0, bc->entries.elem_size * bc->entries.capacity);
+
+        for (size_t i = 0; i < old.capacity; ++i) {
+            const struct dy_bytecode_entry *entry = dy_array_pos_uninit(&old, i);
+            if (entry->body != NULL) {
+                dy_bytecode_put(&bc->entries, *entry);
+            }
+        }
+
+        dy_array_release(&old);
+    }
+
+    // Keeps 'body' alive, and with it every expression its code refers to.
+    dy_bytecode_put(&bc->entries, (struct dy_bytecode_entry){
+                                      .body = dy_core_expr_retain_ptr(ctx, (struct dy_core_expr *)body),
+                                      .pc = pc,
+                                  });
+
+    return pc;
+}
+
+void dy_bytecode_compile(struct dy_bytecode *bc, struct dy_core_expr expr, bool is_tail)
+{
+    switch (expr.tag) {
+    case DY_CORE_EXPR_ELIM:
+        dy_bytecode_compile(bc, *expr.elim.expr, false);
+
+        if (expr.elim.simple.tag == DY_CORE_SIMPLE_PROOF) {
+            dy_bytecode_compile(bc, *expr.elim.simple.proof, false);
+        }
+
+        dy_bytecode_emit(bc, DY_BYTECODE_ELIM, is_tail, dy_array_add(&bc->exprs, &expr));
+        return;
+    case DY_CORE_EXPR_VARIABLE:
+        dy_bytecode_emit(bc, DY_BYTECODE_VARIABLE, false, expr.variable_id);
+        return;
+    case DY_CORE_EXPR_INTRO:
+    case DY_CORE_EXPR_MAP:
+    case DY_CORE_EXPR_ANY:
+    case DY_CORE_EXPR_VOID:
+    case DY_CORE_EXPR_INFERENCE_VAR:
+    case DY_CORE_EXPR_INFERENCE_CTX:
+    case DY_CORE_EXPR_CUSTOM:
+        dy_bytecode_emit(bc, DY_BYTECODE_EVAL, false, dy_array_add(&bc->exprs, &expr));
+        return;
+    }
+
+    dy_bail("Impossible object type.");
+}
+
+void dy_bytecode_emit(struct dy_bytecode *bc, enum dy_bytecode_op op, bool is_tail, size_t operand)
+{
+    struct dy_bytecode_instr instr = {
+        .op = op,
+        .is_tail = is_tail,
+        .operand = operand
+    };
+
+    dy_array_add(&bc->code, &instr);
+}
+
+struct dy_bytecode_value dy_bytecode_run(struct dy_core_ctx *ctx, struct dy_bytecode *bc, size_t pc)
+{
+    size_t frames_base = bc->frames.num_elems;
+
+    struct dy_bytecode_frame entry_frame = {
+        .return_pc = pc,
+        .env = NULL,
+        .has_stepped = false
+    };
+
+    dy_array_add(&bc->frames, &entry_frame);
+
+    for (;;) {
+        struct dy_bytecode_instr instr = *(const struct dy_bytecode_instr *)dy_array_pos(&bc->code, pc);
+        struct dy_eval_env *env = ((const struct dy_bytecode_frame *)dy_array_last(&bc->frames))->env;
+
+        switch (instr.op) {
+        case DY_BYTECODE_VARIABLE: {
+            struct dy_bytecode_value value = {
+                .closure = {
+                    .expr = {
+                        .tag = DY_CORE_EXPR_VARIABLE,
+                        .variable_id = instr.operand },
+                    .env = NULL },
+                .is_value = true,
+                .is_new = false
+            };
+
+            for (struct dy_eval_env *e = env; e != NULL; e = e->next) {
+                if (e->id == instr.operand) {
+                    value.closure = dy_eval_closure_retain(ctx, e->value);
+                    value.is_new = true;
+                    break;
+                }
+            }
+
+            dy_array_add(&bc->stack, &value);
+            ++pc;
+            break;
+        }
+        case DY_BYTECODE_EVAL: {
+            struct dy_core_expr expr = *(const struct dy_core_expr *)dy_array_pos(&bc->exprs, instr.operand);
+
+            struct dy_bytecode_value value = { .is_value = false };
+            value.is_new = dy_eval_closure(ctx, expr, env, &value.is_value, &value.closure);
+            if (!value.is_new) {
+                value.closure = (struct dy_eval_closure){
+                    .expr = dy_core_expr_retain(ctx, expr),
+                    .env = dy_eval_env_retain(env)
+                };
+            }
+
+            dy_array_add(&bc->stack, &value);
+            ++pc;
+            break;
+        }
+        case DY_BYTECODE_ELIM:
+            dy_bytecode_elim(ctx, bc, instr, &pc);
+            break;
+        case DY_BYTECODE_RETURN: {
+            struct dy_bytecode_frame frame;
+            dy_array_pop(&bc->frames, &frame);
+
+            dy_eval_env_release(ctx, frame.env);
+
+            struct dy_bytecode_value *value = dy_array_last(&bc->stack);
+            value->is_new = value->is_new || frame.has_stepped;
+
+            if (bc->frames.num_elems == frames_base) {
+                struct dy_bytecode_value result;
+                dy_array_pop(&bc->stack, &result);
+                return result;
+            }
+
+            pc = frame.return_pc;
+            break;
+        }
+        }
+    }
+}
+
+void dy_bytecode_elim(struct dy_core_ctx *ctx, struct dy_bytecode *bc, struct dy_bytecode_instr instr, size_t *pc)
+{
+    struct dy_core_elim elim = ((const struct dy_core_expr *)dy_array_pos(&bc->exprs, instr.operand))->elim;
+    struct dy_eval_env *env = ((const struct dy_bytecode_frame *)dy_array_last(&bc->frames))->env;
+
+    bool have_proof = elim.simple.tag == DY_CORE_SIMPLE_PROOF;
+    struct dy_bytecode_value proof = {
+        .closure = { .env = NULL },
+        .is_value = true,
+        .is_new = false
+    };
+
+    if (have_proof) {
+        dy_array_pop(&bc->stack, &proof);
+    }
+
+    struct dy_bytecode_value expr;
+    dy_array_pop(&bc->stack, &expr);
+
+    const struct dy_core_expr *body;
+    struct dy_eval_env *body_env;
+    if (expr.is_value && proof.is_value && dy_eval_closure_step(ctx, elim, expr.closure, proof.closure, &have_proof, &body, &body_env)) {
+        // Compiling retains 'body', which might otherwise go away with 'expr'.
+        size_t body_pc = dy_bytecode_code_of(ctx, bc, body);
+
+        dy_eval_closure_release(ctx, expr.closure);
+        if (have_proof) {
+            dy_eval_closure_release(ctx, proof.closure);
+        }
+
+        if (instr.is_tail) {
+            struct dy_bytecode_frame *frame = dy_array_last(&bc->frames);
+            dy_eval_env_release(ctx, frame->env);
+            frame->env = body_env;
+            frame->has_stepped = true;
+        } else {
+            struct dy_bytecode_frame frame = {
+                .return_pc = *pc + 1,
+                .env = body_env,
+                .has_stepped = true
+            };
+
+            dy_array_add(&bc->frames, &frame);
+        }
+
+        *pc = body_pc;
+        return;
+    }
+
+    struct dy_bytecode_value value;
+    value.is_new = dy_eval_closure_elim_stuck(ctx, elim, env, expr.closure, expr.is_value, expr.is_new, proof.closure, have_proof, proof.is_value, proof.is_new, &value.is_value, &value.closure);
+    if (!value.is_new) {
+        value.closure = (struct dy_eval_closure){
+            .expr = {
+                .tag = DY_CORE_EXPR_ELIM,
+                .elim = elim },
+            .env = dy_eval_env_retain(env)
+        };
+
+        dy_core_expr_retain(ctx, value.closure.expr);
+    }
+
+    dy_array_add(&bc->stack, &value);
+    ++*pc;
+}
+
+void dy_bytecode_put(dy_array_t *entries, struct dy_bytecode_entry entry)
+{
+    size_t mask = entries->capacity - 1;
+
+    for (size_t i = dy_bytecode_hash(entry.body) & mask;; i = (i + 1) & mask) {
+        struct dy_bytecode_entry *slot = dy_array_pos_uninit(entries, i);
+        if (slot->body == NULL) {
+            *slot = entry;
+            ++entries->num_elems;
+            return;
+        }
+    }
+}
+
+size_t dy_bytecode_hash(const struct dy_core_expr *body)
+{
+    // Addresses are at least 8-byte aligned, so the low bits carry no information.
+    return dy_hash_combine(0, (size_t)(uintptr_t)body >> 3);
+}
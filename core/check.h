@@ -30,6 +30,12 @@
 
 static inline bool dy_check_expr(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_core_expr *result);
 
+/**
+ * A cancellation point: Whether to give up on the running check, see ctx->should_cancel_check.
+ * If so, callers leave what they were about to check unchecked.
+ */
+static inline bool dy_check_is_cancelled(struct dy_core_ctx *ctx);
+
 static inline bool dy_check_assumption(struct dy_core_ctx *ctx, struct dy_core_assumption assumption, struct dy_core_assumption *result);
 
 static inline bool dy_check_choice(struct dy_core_ctx *ctx, struct dy_core_choice choice, struct dy_core_choice *result);
@@ -163,6 +169,15 @@ bool dy_check_expr(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_
     dy_bail("Impossible object type.");
 }
 
+bool dy_check_is_cancelled(struct dy_core_ctx *ctx)
+{
+    if (!ctx->check_is_cancelled && ctx->should_cancel_check != NULL) {
+        ctx->check_is_cancelled = ctx->should_cancel_check(ctx->should_cancel_check_env);
+    }
+
+    return ctx->check_is_cancelled;
+}
+
 bool dy_check_assumption(struct dy_core_ctx *ctx, struct dy_core_assumption assumption, struct dy_core_assumption *result)
 {
     size_t constraint_start1 = ctx->constraints.num_elems;
@@ -592,7 +607,7 @@ bool dy_check_map_assumption_dependence(struct dy_core_ctx *ctx, struct dy_core_
         .type = *map.assumption.type
     });
 
-    struct dy_core_expr t = dy_type_of(ctx, *map.assumption.expr);
+    struct dy_core_expr t = dy_type_of_ptr(ctx, map.assumption.expr);
 
     if (dy_core_expr_contains_this_variable(ctx, map.assumption.id, t)) {
         map.dependence = DY_CORE_MAP_DEPENDENCE_DEPENDENT;
@@ -625,7 +640,7 @@ bool dy_check_map_choice_dependence(struct dy_core_ctx *ctx, struct dy_core_map_
             .type = *map.assumption_left.type
         });
 
-        struct dy_core_expr t = dy_type_of(ctx, *map.assumption_left.expr);
+        struct dy_core_expr t = dy_type_of_ptr(ctx, map.assumption_left.expr);
 
         if (dy_core_expr_contains_this_variable(ctx, map.assumption_left.id, t)) {
             map.left_dependence = DY_CORE_MAP_DEPENDENCE_DEPENDENT;
@@ -644,7 +659,7 @@ bool dy_check_map_choice_dependence(struct dy_core_ctx *ctx, struct dy_core_map_
             .type = *map.assumption_right.type
         });
 
-        struct dy_core_expr t = dy_type_of(ctx, *map.assumption_right.expr);
+        struct dy_core_expr t = dy_type_of_ptr(ctx, map.assumption_right.expr);
 
         if (dy_core_expr_contains_this_variable(ctx, map.assumption_right.id, t)) {
             map.right_dependence = DY_CORE_MAP_DEPENDENCE_DEPENDENT;
@@ -676,7 +691,7 @@ bool dy_check_map_recursion_dependence(struct dy_core_ctx *ctx, struct dy_core_m
         .type = *map.assumption.type
     });
 
-    struct dy_core_expr t = dy_type_of(ctx, *map.assumption.expr);
+    struct dy_core_expr t = dy_type_of_ptr(ctx, map.assumption.expr);
 
     if (dy_core_expr_contains_this_variable(ctx, map.assumption.id, t)) {
         map.dependence = DY_CORE_MAP_DEPENDENCE_DEPENDENT;
@@ -867,9 +882,7 @@ bool dy_resolve_inference_var(struct dy_core_ctx *ctx, size_t id, enum dy_polari
 void dy_remove_id(dy_array_t *ids, size_t id_to_remove)
 {
     for (size_t i = 0, size = ids->num_elems; i < size; ++i) {
-        size_t id = *(size_t *)dy_array_pos(ids, i);
-
-        if (id == id_to_remove) {
+        if (DY_ARRAY_AT(ids, size_t, i) == id_to_remove) {
             dy_array_remove(ids, i);
             return;
         }
@@ -979,7 +992,7 @@ bool dy_remove_mentions_in_type(struct dy_core_ctx *ctx, size_t id, enum dy_pola
                             .tag = DY_CORE_COMPLEX_ASSUMPTION,
                             .assumption = {
                                 .id = ctx->running_id++,
-                                .type = dy_core_expr_new(dy_type_of(ctx, *type.intro.simple.proof)),
+                                .type = dy_core_expr_new(dy_type_of_ptr(ctx, type.intro.simple.proof)),
                                 .expr = dy_core_expr_retain_ptr(ctx, type.intro.simple.out)
                             }
                         }
@@ -1079,21 +1092,19 @@ void dy_retire_ids_array(struct dy_core_ctx *ctx, dy_array_t array)
 
 bool dy_constraint_binds_id(struct dy_core_ctx *ctx, size_t constraint_id, size_t id)
 {
-    for (size_t i = 0; i < ctx->constraints.num_elems; ++i) {
-        const struct dy_constraint *c = dy_array_pos(&ctx->constraints, i);
-        if (c->id != constraint_id) {
-            continue;
-        }
+    size_t i = dy_constraint_find(ctx, constraint_id, 0, ctx->constraints.num_elems);
+    if (i == SIZE_MAX) {
+        return false;
+    }
 
-        if (c->have_lower && c->lower.tag == DY_CORE_EXPR_INFERENCE_VAR && c->lower.inference_var_id == id) {
-            return true;
-        }
+    const struct dy_constraint *c = dy_array_pos(&ctx->constraints, i);
 
-        if (c->have_upper && c->upper.tag == DY_CORE_EXPR_INFERENCE_VAR && c->upper.inference_var_id == id) {
-            return true;
-        }
+    if (c->have_lower && c->lower.tag == DY_CORE_EXPR_INFERENCE_VAR && c->lower.inference_var_id == id) {
+        return true;
+    }
 
-        return false;
+    if (c->have_upper && c->upper.tag == DY_CORE_EXPR_INFERENCE_VAR && c->upper.inference_var_id == id) {
+        return true;
     }
 
     return false;
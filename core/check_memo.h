@@ -0,0 +1,212 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "core.h"
+#include "are_equal.h"
+#include "constraint.h"
+#include "hash_cons.h"
+#include "subtype_memo.h"
+
+/**
+ * Memoization of checking (and evaluating) the arguments of definitions.
+ *
+ * This is what makes re-checking a slightly edited document cheap: Converting
+ * the document to Core again yields definitions whose arguments are equal to
+ * the previous ones except for the edited parts, so their checked results and
+ * the constraints they produced can be reused.
+ *
+ * Entries live in ctx->past_checks, an open-addressed table (power-of-two capacity)
+ * keyed on the content hash of the unchecked argument and the scope it's checked in.
+ * Since ids differ between conversions, arguments are compared with dy_are_equal().
+ *
+ * Side effects of evaluation are not replayed on a hit, so this is only
+ * enabled where those don't matter, i.e. in the language server.
+ *
+ * Entries that weren't used since the last call to dy_check_memo_sweep() are dropped by it.
+ */
+
+struct dy_core_check_memo_frame {
+    size_t hash;
+    size_t scope_hash;
+    struct dy_core_expr expr;
+    size_t constraints_start;
+    size_t num_recovered_negative_inference_ids;
+    size_t num_recovered_positive_inference_ids;
+};
+
+/** Above this capacity, the table is cleared instead of grown. */
+static const size_t dy_check_memo_max_capacity = 1 << 12;
+
+/**
+ * Looks up 'expr'. On a hit, re-adds the constraints its check produced.
+ * On a miss, fills in 'frame' to pass to dy_check_memo_insert() once 'expr' is checked.
+ */
+static inline bool dy_check_memo_lookup(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_core_check_memo_frame *frame, struct dy_core_expr *result, bool *result_is_value);
+
+/** Records the result of the check described by 'frame', unless it can't be replayed. */
+static inline void dy_check_memo_insert(struct dy_core_ctx *ctx, const struct dy_core_check_memo_frame *frame, struct dy_core_expr result, bool result_is_value);
+
+/** Drops all entries that weren't used since the last sweep. */
+static inline void dy_check_memo_sweep(struct dy_core_ctx *ctx);
+
+/** Releases all memoized checks. */
+static inline void dy_check_memo_clear(struct dy_core_ctx *ctx);
+
+static inline void dy_check_memo_release_entry(struct dy_core_ctx *ctx, struct dy_core_past_check *entry);
+
+static inline void dy_check_memo_rehash(dy_array_t *table, size_t capacity);
+
+static inline void dy_check_memo_put(dy_array_t *table, struct dy_core_past_check entry);
+
+bool dy_check_memo_lookup(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_core_check_memo_frame *frame, struct dy_core_expr *result, bool *result_is_value)
+{
+    if (ctx->past_checks.capacity == 0) {
+        return false;
+    }
+
+    *frame = (struct dy_core_check_memo_frame){
+        .hash = dy_hash_cons_content_hash(ctx, expr),
+        .scope_hash = dy_subtype_memo_scope_hash(ctx),
+        .expr = expr,
+        .constraints_start = ctx->constraints.num_elems,
+        .num_recovered_negative_inference_ids = ctx->recovered_negative_inference_ids.num_elems,
+        .num_recovered_positive_inference_ids = ctx->recovered_positive_inference_ids.num_elems
+    };
+
+    size_t mask = ctx->past_checks.capacity - 1;
+
+    for (size_t i = frame->hash & mask;; i = (i + 1) & mask) {
+        struct dy_core_past_check *entry = dy_array_pos_uninit(&ctx->past_checks, i);
+        if (!entry->is_occupied) {
+            return false;
+        }
+
+        if (entry->hash != frame->hash || entry->scope_hash != frame->scope_hash || dy_are_equal(ctx, entry->expr, expr) != DY_YES) {
+            continue;
+        }
+
+        dy_constraints_replay(ctx, &entry->constraints);
+
+        entry->is_live = true;
+
+        *result = dy_core_expr_retain(ctx, entry->result);
+        *result_is_value = entry->result_is_value;
+        return true;
+    }
+}
+
+void dy_check_memo_insert(struct dy_core_ctx *ctx, const struct dy_core_check_memo_frame *frame, struct dy_core_expr result, bool result_is_value)
+{
+    dy_array_t *table = &ctx->past_checks;
+
+    if (table->capacity == 0) {
+        return;
+    }
+
+    if (ctx->recovered_negative_inference_ids.num_elems != frame->num_recovered_negative_inference_ids
+        || ctx->recovered_positive_inference_ids.num_elems != frame->num_recovered_positive_inference_ids) {
+        return;
+    }
+
+    if (4 * (table->num_elems + 1) > 3 * table->capacity) {
+        if (table->capacity >= dy_check_memo_max_capacity) {
+            dy_check_memo_clear(ctx);
+        } else {
+            dy_check_memo_rehash(table, table->capacity * 2);
+        }
+    }
+
+    struct dy_core_past_check entry = {
+        .hash = frame->hash,
+        .scope_hash = frame->scope_hash,
+        .expr = dy_core_expr_retain(ctx, frame->expr),
+        .result = dy_core_expr_retain(ctx, result),
+        .result_is_value = result_is_value,
+        .is_live = true,
+        .is_occupied = true
+    };
+
+    dy_constraints_save(ctx, frame->constraints_start, &entry.constraints);
+
+    dy_check_memo_put(table, entry);
+}
+
+void dy_check_memo_sweep(struct dy_core_ctx *ctx)
+{
+    dy_array_t *table = &ctx->past_checks;
+
+    for (size_t i = 0, size = table->capacity; i < size; ++i) {
+        struct dy_core_past_check *entry = dy_array_pos_uninit(table, i);
+        if (!entry->is_occupied) {
+            continue;
+        }
+
+        if (entry->is_live) {
+            entry->is_live = false;
+        } else {
+            dy_check_memo_release_entry(ctx, entry);
+        }
+    }
+
+    if (table->capacity != 0) {
+        // Removing entries broke probe sequences, so re-insert the survivors.
+        dy_check_memo_rehash(table, table->capacity);
+    }
+}
+
+void dy_check_memo_clear(struct dy_core_ctx *ctx)
+{
+    for (size_t i = 0, size = ctx->past_checks.capacity; i < size; ++i) {
+        struct dy_core_past_check *entry = dy_array_pos_uninit(&ctx->past_checks, i);
+        if (entry->is_occupied) {
+            dy_check_memo_release_entry(ctx, entry);
+        }
+    }
+
+    ctx->past_checks.num_elems = 0;
+}
+
+void dy_check_memo_release_entry(struct dy_core_ctx *ctx, struct dy_core_past_check *entry)
+{
+    dy_core_expr_release(ctx, entry->expr);
+    dy_core_expr_release(ctx, entry->result);
+    dy_constraints_release_saved(ctx, &entry->constraints);
+
+    *entry = (struct dy_core_past_check){ 0 };
+}
+
+void dy_check_memo_rehash(dy_array_t *table, size_t capacity)
+{
+    dy_array_t old = *table;
+
+    *table = dy_array_create(old.elem_size, old.elem_alignment, capacity);
+    memset(table->buffer, 0, table->elem_size * table->capacity);
+
+    for (size_t i = 0; i < old.capacity; ++i) {
+        const struct dy_core_past_check *entry = dy_array_pos_uninit(&old, i);
+        if (entry->is_occupied) {
+            dy_check_memo_put(table, *entry);
+        }
+    }
+
+    dy_array_release(&old);
+}
+
+void dy_check_memo_put(dy_array_t *table, struct dy_core_past_check entry)
+{
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = entry.hash & mask;; i = (i + 1) & mask) {
+        struct dy_core_past_check *slot = dy_array_pos_uninit(table, i);
+        if (!slot->is_occupied) {
+            *slot = entry;
+            ++table->num_elems;
+            return;
+        }
+    }
+}
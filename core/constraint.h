@@ -9,9 +9,21 @@
 #include "core.h"
 #include "are_equal.h"
 #include "substitute.h"
+#include "hash_cons.h"
 
 /**
  * This file deals with collecting/resolving constraints.
+ *
+ * Constraints live on a stack (ctx->constraints); callers delimit the constraints
+ * they produced by remembering the size of the stack beforehand.
+ *
+ * To find the constraints on an inference variable without scanning, ctx->constraint_index
+ * maps every id to its topmost constraint, and every constraint links to the next one
+ * below it with the same id. Since the stack only ever grows or shrinks at the top,
+ * popping a constraint simply makes its link the new topmost one.
+ *
+ * Constraints must therefore only be added via dy_constraint_add(), and only be removed
+ * via dy_free_constraints_in_range() or dy_join_constraints().
  */
 
 struct dy_constraint {
@@ -20,152 +32,370 @@ struct dy_constraint {
     bool have_lower;
     struct dy_core_expr upper;
     bool have_upper;
+    size_t prev; // Index of the next constraint below with the same id, or SIZE_MAX.
+};
+
+/** An entry of ctx->constraint_index, an open-addressed table with power-of-two capacity. */
+struct dy_constraint_index_entry {
+    size_t id;
+    size_t top; // SIZE_MAX if there's no constraint on 'id' right now.
+    bool is_occupied;
 };
 
+static inline void dy_constraint_add(struct dy_core_ctx *ctx, struct dy_constraint constraint);
+
+/** Returns the index of the first constraint on 'id' in [start, end), or SIZE_MAX. */
+static inline size_t dy_constraint_find(struct dy_core_ctx *ctx, size_t id, size_t start, size_t end);
+
 static inline bool dy_constraint_get(struct dy_core_ctx *ctx, size_t id, enum dy_polarity polarity, size_t start, struct dy_core_expr *result);
 
+/** Merges the constraints from 'start2' on into the ones in [start1, start2). */
 static inline void dy_join_constraints(struct dy_core_ctx *ctx, size_t start1, size_t start2);
 
+/** 'end' has to be the top of the stack. */
 static inline void dy_free_constraints_in_range(struct dy_core_ctx *ctx, size_t start, size_t end);
 
-bool dy_constraint_get(struct dy_core_ctx *ctx, size_t id, enum dy_polarity polarity, size_t start, struct dy_core_expr *result)
+/** Appends retained copies of the constraints from 'start' on to 'saved', creating it if it's empty. */
+static inline void dy_constraints_save(struct dy_core_ctx *ctx, size_t start, dy_array_t *saved);
+
+/** Re-adds constraints saved by dy_constraints_save(). */
+static inline void dy_constraints_replay(struct dy_core_ctx *ctx, const dy_array_t *saved);
+
+static inline void dy_constraints_release_saved(struct dy_core_ctx *ctx, dy_array_t *saved);
+
+/** Removes the topmost constraint without releasing its bounds. */
+static inline struct dy_constraint dy_constraint_pop(struct dy_core_ctx *ctx);
+
+static inline struct dy_constraint_index_entry *dy_constraint_index_slot(struct dy_core_ctx *ctx, size_t id);
+
+/** Rebuilds the index from the stack, dropping ids without constraints. */
+static inline void dy_constraint_index_rebuild(struct dy_core_ctx *ctx);
+
+void dy_constraint_add(struct dy_core_ctx *ctx, struct dy_constraint constraint)
 {
-    for (size_t i = start, size = ctx->constraints.num_elems; i < size; ++i) {
-        const struct dy_constraint *c = dy_array_pos(&ctx->constraints, i);
-        if (c->id != id) {
-            continue;
-        }
+    struct dy_constraint_index_entry *slot = dy_constraint_index_slot(ctx, constraint.id);
 
-        struct dy_core_expr bound;
-        if (polarity == DY_POLARITY_POSITIVE) {
-            if (!c->have_lower) {
-                return false;
-            }
+    constraint.prev = slot->top;
+    slot->top = ctx->constraints.num_elems;
 
-            bound = c->lower;
-        } else {
-            if (!c->have_upper) {
-                return false;
-            }
+    dy_array_add(&ctx->constraints, &constraint);
+}
 
-            bound = c->upper;
+size_t dy_constraint_find(struct dy_core_ctx *ctx, size_t id, size_t start, size_t end)
+{
+    size_t result = SIZE_MAX;
+
+    for (size_t i = dy_constraint_index_slot(ctx, id)->top; i != SIZE_MAX && i >= start;) {
+        if (i < end) {
+            result = i;
         }
 
-        struct dy_core_expr var_expr = {
-            .tag = DY_CORE_EXPR_VARIABLE,
-            .variable_id = id
-        };
+        i = DY_ARRAY_AT(&ctx->constraints, struct dy_constraint, i).prev;
+    }
 
-        struct dy_core_expr rec_bound;
-        if (dy_substitute(ctx, bound, id, var_expr, &rec_bound)) {
-            *result = (struct dy_core_expr){
-                .tag = DY_CORE_EXPR_INTRO,
-                .intro = {
-                    .tag = DY_CORE_INTRO_COMPLEX,
-                    .complex = {
-                        .tag = DY_CORE_COMPLEX_RECURSION,
-                        .recursion = {
-                            .id = id,
-                            .expr = dy_core_expr_new(rec_bound)
-                        }
-                    },
-                    .is_implicit = true,
-                    .polarity = dy_flip_polarity(polarity)
-                }
-            };
-        } else {
-            *result = dy_core_expr_retain(ctx, bound);
+    return result;
+}
+
+bool dy_constraint_get(struct dy_core_ctx *ctx, size_t id, enum dy_polarity polarity, size_t start, struct dy_core_expr *result)
+{
+    size_t i = dy_constraint_find(ctx, id, start, ctx->constraints.num_elems);
+    if (i == SIZE_MAX) {
+        return false;
+    }
+
+    const struct dy_constraint *c = dy_array_pos(&ctx->constraints, i);
+
+    struct dy_core_expr bound;
+    if (polarity == DY_POLARITY_POSITIVE) {
+        if (!c->have_lower) {
+            return false;
+        }
+
+        bound = c->lower;
+    } else {
+        if (!c->have_upper) {
+            return false;
         }
 
-        return true;
+        bound = c->upper;
     }
 
-    return false;
+    struct dy_core_expr var_expr = {
+        .tag = DY_CORE_EXPR_VARIABLE,
+        .variable_id = id
+    };
+
+    struct dy_core_expr rec_bound;
+    if (dy_substitute(ctx, bound, id, var_expr, &rec_bound)) {
+        *result = (struct dy_core_expr){
+            .tag = DY_CORE_EXPR_INTRO,
+            .intro = {
+                .tag = DY_CORE_INTRO_COMPLEX,
+                .complex = {
+                    .tag = DY_CORE_COMPLEX_RECURSION,
+                    .recursion = {
+                        .id = id,
+                        .expr = dy_core_expr_new(rec_bound)
+                    }
+                },
+                .is_implicit = true,
+                .polarity = dy_flip_polarity(polarity)
+            }
+        };
+    } else {
+        *result = dy_core_expr_retain(ctx, bound);
+    }
+
+    return true;
 }
 
 void dy_join_constraints(struct dy_core_ctx *ctx, size_t start1, size_t start2)
 {
-    for (size_t i = start2; i < ctx->constraints.num_elems; ++i) {
-        const struct dy_constraint *c = dy_array_pos(&ctx->constraints, i);
-
-        bool merged = false;
-        for (size_t k = start1; k < start2; ++k) {
-            struct dy_constraint *c2 = dy_array_pos(&ctx->constraints, k);
-            if (c->id != c2->id) {
-                continue;
-            }
+    size_t num_new = ctx->constraints.num_elems - start2;
+    if (num_new == 0) {
+        return;
+    }
+
+    // Take the new constraints off the stack, so that lookups only see [start1, start2).
+    struct dy_constraint storage[8];
+    dy_array_t new_constraints = dy_array_create_small(storage, sizeof(struct dy_constraint), DY_ALIGNOF(struct dy_constraint), 8);
+    dy_array_reserve(&new_constraints, num_new);
+    for (size_t i = 0; i < num_new; ++i) {
+        struct dy_constraint c = dy_constraint_pop(ctx);
+        dy_array_add(&new_constraints, &c);
+    }
+
+    for (size_t i = num_new; i-- > 0;) {
+        const struct dy_constraint *c = dy_array_pos(&new_constraints, i);
+
+        size_t k = dy_constraint_find(ctx, c->id, start1, start2);
+        if (k == SIZE_MAX) {
+            dy_constraint_add(ctx, *c);
+            continue;
+        }
 
-            if (c->have_lower && c2->have_lower) {
-                if (dy_are_equal(ctx, c->lower, c2->lower) == DY_YES) {
-                    dy_core_expr_release(ctx, c->lower);
-                } else {
-                    c2->lower = (struct dy_core_expr){
-                        .tag = DY_CORE_EXPR_INTRO,
-                        .intro = {
-                            .is_implicit = true,
-                            .polarity = DY_POLARITY_NEGATIVE,
-                            .tag = DY_CORE_INTRO_COMPLEX,
-                            .complex = {
-                                .tag = DY_CORE_COMPLEX_CHOICE,
-                                .choice = {
-                                    .left = dy_core_expr_new(c2->lower),
-                                    .right = dy_core_expr_new(c->lower)
-                                }
+        struct dy_constraint *c2 = dy_array_pos(&ctx->constraints, k);
+
+        if (c->have_lower && c2->have_lower) {
+            if (dy_are_equal(ctx, c->lower, c2->lower) == DY_YES) {
+                dy_core_expr_release(ctx, c->lower);
+            } else {
+                c2->lower = (struct dy_core_expr){
+                    .tag = DY_CORE_EXPR_INTRO,
+                    .intro = {
+                        .is_implicit = true,
+                        .polarity = DY_POLARITY_NEGATIVE,
+                        .tag = DY_CORE_INTRO_COMPLEX,
+                        .complex = {
+                            .tag = DY_CORE_COMPLEX_CHOICE,
+                            .choice = {
+                                .left = dy_hash_cons_ptr(ctx, dy_core_expr_new(c2->lower)),
+                                .right = dy_hash_cons_ptr(ctx, dy_core_expr_new(c->lower))
                             }
                         }
-                    };
-                }
-            } else if (c->have_lower) {
-                c2->lower = c->lower;
-                c2->have_lower = true;
+                    }
+                };
             }
+        } else if (c->have_lower) {
+            c2->lower = c->lower;
+            c2->have_lower = true;
+        }
 
-            if (c->have_upper && c2->have_upper) {
-                if (dy_are_equal(ctx, c->upper, c2->upper) == DY_YES) {
-                    dy_core_expr_release(ctx, c->upper);
-                } else {
-                    c2->upper = (struct dy_core_expr){
-                        .tag = DY_CORE_EXPR_INTRO,
-                        .intro = {
-                            .is_implicit = true,
-                            .polarity = DY_POLARITY_POSITIVE,
-                            .tag = DY_CORE_INTRO_COMPLEX,
-                            .complex = {
-                                .tag = DY_CORE_COMPLEX_CHOICE,
-                                .choice = {
-                                    .left = dy_core_expr_new(c2->upper),
-                                    .right = dy_core_expr_new(c->upper)
-                                }
+        if (c->have_upper && c2->have_upper) {
+            if (dy_are_equal(ctx, c->upper, c2->upper) == DY_YES) {
+                dy_core_expr_release(ctx, c->upper);
+            } else {
+                c2->upper = (struct dy_core_expr){
+                    .tag = DY_CORE_EXPR_INTRO,
+                    .intro = {
+                        .is_implicit = true,
+                        .polarity = DY_POLARITY_POSITIVE,
+                        .tag = DY_CORE_INTRO_COMPLEX,
+                        .complex = {
+                            .tag = DY_CORE_COMPLEX_CHOICE,
+                            .choice = {
+                                .left = dy_hash_cons_ptr(ctx, dy_core_expr_new(c2->upper)),
+                                .right = dy_hash_cons_ptr(ctx, dy_core_expr_new(c->upper))
                             }
                         }
-                    };
-                }
-            } else if (c->have_upper) {
-                c2->upper = c->upper;
-                c2->have_upper = true;
+                    }
+                };
             }
+        } else if (c->have_upper) {
+            c2->upper = c->upper;
+            c2->have_upper = true;
+        }
+    }
+
+    dy_array_release(&new_constraints);
+}
+
+void dy_free_constraints_in_range(struct dy_core_ctx *ctx, size_t start, size_t end)
+{
+    assert(end == ctx->constraints.num_elems);
+
+    while (ctx->constraints.num_elems > start) {
+        struct dy_constraint c = dy_constraint_pop(ctx);
+        if (c.have_lower) {
+            dy_core_expr_release(ctx, c.lower);
+        }
+        if (c.have_upper) {
+            dy_core_expr_release(ctx, c.upper);
+        }
+    }
+}
+
+void dy_constraints_save(struct dy_core_ctx *ctx, size_t start, dy_array_t *saved)
+{
+    size_t num_constraints = ctx->constraints.num_elems - start;
+    if (num_constraints == 0) {
+        return;
+    }
 
-            merged = true;
-            break;
+    if (saved->buffer == NULL) {
+        *saved = dy_array_create(sizeof(struct dy_constraint), DY_ALIGNOF(struct dy_constraint), num_constraints);
+    }
+
+    for (size_t i = start; i < ctx->constraints.num_elems; ++i) {
+        struct dy_constraint c = *(const struct dy_constraint *)dy_array_pos(&ctx->constraints, i);
+
+        if (c.have_lower) {
+            c.lower = dy_core_expr_retain(ctx, c.lower);
         }
 
-        if (merged) {
-            dy_array_remove(&ctx->constraints, i);
-            --i;
+        if (c.have_upper) {
+            c.upper = dy_core_expr_retain(ctx, c.upper);
         }
+
+        dy_array_add(saved, &c);
     }
 }
 
-void dy_free_constraints_in_range(struct dy_core_ctx *ctx, size_t start, size_t end)
+void dy_constraints_replay(struct dy_core_ctx *ctx, const dy_array_t *saved)
 {
-    for (size_t i = end; i-- > start;) {
-        const struct dy_constraint *c = dy_array_pos(&ctx->constraints, i);
+    for (size_t i = 0; i < saved->num_elems; ++i) {
+        struct dy_constraint c = *(const struct dy_constraint *)dy_array_pos(saved, i);
+
+        if (c.have_lower) {
+            c.lower = dy_core_expr_retain(ctx, c.lower);
+        }
+
+        if (c.have_upper) {
+            c.upper = dy_core_expr_retain(ctx, c.upper);
+        }
+
+        dy_constraint_add(ctx, c);
+    }
+}
+
+void dy_constraints_release_saved(struct dy_core_ctx *ctx, dy_array_t *saved)
+{
+    if (saved->buffer == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < saved->num_elems; ++i) {
+        const struct dy_constraint *c = dy_array_pos(saved, i);
+
         if (c->have_lower) {
-             dy_core_expr_release(ctx, c->lower);
+            dy_core_expr_release(ctx, c->lower);
         }
+
         if (c->have_upper) {
-             dy_core_expr_release(ctx, c->upper);
+            dy_core_expr_release(ctx, c->upper);
+        }
+    }
+
+    dy_array_release(saved);
+}
+
+struct dy_constraint dy_constraint_pop(struct dy_core_ctx *ctx)
+{
+    struct dy_constraint c;
+    dy_array_pop(&ctx->constraints, &c);
+
+    dy_constraint_index_slot(ctx, c.id)->top = c.prev;
+
+    return c;
+}
+
+struct dy_constraint_index_entry *dy_constraint_index_slot(struct dy_core_ctx *ctx, size_t id)
+{
+    dy_array_t *index = &ctx->constraint_index;
+
+    if (4 * (index->num_elems + 1) > 3 * index->capacity) {
+        dy_constraint_index_rebuild(ctx);
+    }
+
+    size_t mask = index->capacity - 1;
+
+    for (size_t i = dy_hash_combine(0, id) & mask;; i = (i + 1) & mask) {
+        struct dy_constraint_index_entry *slot = dy_array_pos_uninit(index, i);
+        if (!slot->is_occupied) {
+            *slot = (struct dy_constraint_index_entry){
+                .id = id,
+                .top = SIZE_MAX,
+                .is_occupied = true
+            };
+
+            ++index->num_elems;
+
+            return slot;
+        }
+
+        if (slot->id == id) {
+            return slot;
+        }
+    }
+}
+
+void dy_constraint_index_rebuild(struct dy_core_ctx *ctx)
+{
+    dy_array_t *index = &ctx->constraint_index;
+
+    size_t num_live = 0;
+    for (size_t i = 0, size = index->capacity; i < size; ++i) {
+        const struct dy_constraint_index_entry *slot = dy_array_pos_uninit(index, i);
+        if (slot->is_occupied && slot->top != SIZE_MAX) {
+            ++num_live;
+        }
+    }
+
+    // Only grow if the ids that still have constraints fill half of the table.
+    size_t capacity = DY_MAX(index->capacity, 16);
+    if (2 * (num_live + 1) > capacity) {
+        capacity *= 2;
+    }
+
+    dy_array_t new_index = dy_array_create(index->elem_size, index->elem_alignment, capacity);
+    memset(new_index.buffer, 0, new_index.elem_size * new_index.capacity);
+
+    dy_array_release(index);
+    *index = new_index;
+
+    size_t mask = capacity - 1;
+
+    // Going bottom to top leaves every id at its topmost constraint.
+    for (size_t k = 0, size = ctx->constraints.num_elems; k < size; ++k) {
+        size_t id = ((const struct dy_constraint *)dy_array_pos(&ctx->constraints, k))->id;
+
+        for (size_t i = dy_hash_combine(0, id) & mask;; i = (i + 1) & mask) {
+            struct dy_constraint_index_entry *slot = dy_array_pos_uninit(index, i);
+            if (!slot->is_occupied) {
+                *slot = (struct dy_constraint_index_entry){
+                    .id = id,
+                    .top = k,
+                    .is_occupied = true
+                };
+
+                ++index->num_elems;
+                break;
+            }
+
+            if (slot->id == id) {
+                slot->top = k;
+                break;
+            }
         }
-        dy_array_remove(&ctx->constraints, i);
     }
 }
@@ -8,8 +8,10 @@
 
 #include "../support/string.h"
 #include "../support/array.h"
+#include "../support/writer.h"
 #include "../support/range.h"
 #include "../support/bail.h"
+#include "../support/stats.h"
 
 /**
  * This file implements the data structure that represents Core,
@@ -30,14 +32,62 @@ struct dy_core_ctx {
 
     dy_array_t recovered_positive_inference_ids;
 
+    /** Memoized subtype checks, see subtype_memo.h. A capacity of 0 disables memoization. */
     dy_array_t past_subtype_checks;
 
+    /** The memoizable subtype checks currently in progress, innermost first. */
+    struct dy_core_subtype_check_frame *subtype_check_frames;
+
+    /** Memoized checks of definitions, see check_memo.h. A capacity of 0 disables memoization. */
+    dy_array_t past_checks;
+
+    /**
+     * If non-NULL, asked at every cancellation point (see dy_check_is_cancelled())
+     * whether to give up on the running check.
+     */
+    bool (*should_cancel_check)(void *env);
+    void *should_cancel_check_env;
+
+    /** Set once the running check was cancelled. Its result is then only fit to be discarded. */
+    bool check_is_cancelled;
+
     dy_array_t constraints;
 
+    /** Maps inference variable ids to their constraints, see constraint.h. Grows on demand. */
+    dy_array_t constraint_index;
+
     dy_array_t equal_variables;
 
+    /** Indexed by variable id, see dy_equal_variables_push(). */
+    dy_array_t equal_variable_levels;
+
     dy_array_t free_ids_arrays;
 
+    /**
+     * The nodes still to be released by the running dy_core_expr_release(),
+     * or NULL if there is none. Releases started while one is running (e.g. by the
+     * release hook of a custom) just add to it, so deep expressions don't recurse.
+     */
+    dy_array_t *pending_releases;
+
+    /**
+     * Nodes whose reference count dropped to 0, but that haven't been freed yet.
+     * Releasing a node outside of a running dy_core_expr_release() merely adds it here,
+     * and once the capacity is reached, dy_core_free_dead_nodes() frees the whole batch.
+     * That takes walking and freeing large expressions off the hot path of evaluation.
+     * A capacity of 0 frees nodes right away.
+     */
+    dy_array_t dead_nodes;
+
+    /** Interned expressions, see hash_cons.h. A capacity of 0 disables hash-consing. */
+    dy_array_t hash_consed_exprs;
+
+    /** Evaluate with environments instead of substitution, see eval.h. */
+    bool eval_with_environments;
+
+    /** If non-NULL, evaluation runs on this bytecode VM, see bytecode.h. */
+    struct dy_bytecode *bytecode;
+
     dy_array_t custom_shared;
 };
 
@@ -49,6 +99,9 @@ typedef enum dy_ternary {
 
 struct dy_core_expr;
 
+struct dy_core_serializer;
+struct dy_core_deserializer;
+
 struct dy_core_assumption {
     size_t id;
     struct dy_core_expr *type;
@@ -187,6 +240,15 @@ struct dy_core_inference_ctx {
 struct dy_core_custom {
     size_t id;
     void *data;
+
+    /**
+     * The range of variable ids occurring in 'data', like that of struct dy_core_node.
+     * Customs that don't set 'has_id_range' are assumed to possibly contain any id,
+     * which makes every traversal looking for a variable call into them.
+     */
+    size_t min_id;
+    size_t max_id;
+    bool has_id_range;
 };
 
 struct dy_core_custom_shared {
@@ -212,7 +274,13 @@ struct dy_core_custom_shared {
 
     void (*release)(struct dy_core_ctx *ctx, void *data);
 
-    void (*to_string)(struct dy_core_ctx *ctx, void *data, dy_array_t *string);
+    void (*to_string)(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer);
+
+    /** Writes 'data' through the functions of serialize.h. Can be NULL, if the custom can't be serialized. */
+    void (*serialize)(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s);
+
+    /** Reads back what 'serialize' wrote. Returns false on malformed input. */
+    bool (*deserialize)(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result);
 };
 
 enum dy_core_expr_tag {
@@ -241,9 +309,29 @@ struct dy_core_expr {
     enum dy_core_expr_tag tag;
 };
 
+/**
+ * Expressions allocated by dy_core_expr_new() carry the range of variable ids occurring in them,
+ * so that traversals looking for a particular variable can skip whole subtrees in O(1).
+ * Nodes are immutable once allocated, so the range never goes stale.
+ *
+ * The exceptions are two caches:
+ * 'type' is filled in by dy_type_of_ptr() the first time the type of the node is asked for.
+ * It's only filled in if the type can't depend on the variables in scope,
+ * so it stays valid wherever the node is shared. Released with the node.
+ * 'hash' is filled in by hash-consing, see hash_cons.h.
+ */
+struct dy_core_node {
+    struct dy_core_expr expr; // Comes first, so a pointer to the node is a pointer to its expression.
+    size_t min_id;
+    size_t max_id; // Less than 'min_id' if no variable occurs.
+    struct dy_core_expr *type; // NULL until computed.
+    size_t hash; // 0 until computed.
+};
+
 struct dy_free_var {
     size_t id;
     struct dy_core_expr type;
+    size_t scope_hash; // See dy_subtype_memo_scope_hash(), 0 until computed.
 };
 
 struct dy_captured_inference_var {
@@ -254,17 +342,49 @@ struct dy_captured_inference_var {
 struct dy_equal_variables {
     size_t id1;
     size_t id2;
+    size_t prev_level1;
+    size_t prev_level2;
+    size_t scope_hash; // See dy_subtype_memo_scope_hash(), 0 until computed.
 };
 
 struct dy_core_past_subtype_check {
+    size_t hash;
+    size_t scope_hash;
     struct dy_core_expr subtype;
     struct dy_core_expr supertype;
-    size_t substitute_var_id;
-    bool have_substitute_var_id;
+    dy_ternary_t result;
+    dy_array_t constraints;
+    bool is_occupied;
+};
+
+struct dy_core_past_check {
+    size_t hash;
+    size_t scope_hash;
+    struct dy_core_expr expr;
+    struct dy_core_expr result;
+    bool result_is_value;
+    dy_array_t constraints;
+    bool is_live;
+    bool is_occupied;
 };
 
 static inline struct dy_core_expr *dy_core_expr_new(struct dy_core_expr expr);
 
+/** Computes the range of variable ids occurring in 'expr' from the ranges of its children. */
+static inline void dy_core_expr_id_range(struct dy_core_expr expr, size_t *min_id, size_t *max_id);
+
+/** Returns false if 'id' definitely doesn't occur in 'expr', which must come from dy_core_expr_new(). */
+static inline bool dy_core_expr_may_contain(const struct dy_core_expr *expr, size_t id);
+
+static inline void dy_core_id_range_add_ptr(const struct dy_core_expr *expr, size_t *min_id, size_t *max_id);
+
+static inline void dy_core_id_range_add(struct dy_core_expr expr, size_t *min_id, size_t *max_id);
+
+/** Like dy_core_expr_may_contain(), for the data of a custom. */
+static inline bool dy_core_custom_may_contain(struct dy_core_custom custom, size_t id);
+
+static inline void dy_core_id_range_add_assumption(struct dy_core_assumption assumption, size_t *min_id, size_t *max_id);
+
 static inline struct dy_core_expr dy_core_expr_retain(struct dy_core_ctx *ctx, struct dy_core_expr expr);
 static inline struct dy_core_expr *dy_core_expr_retain_ptr(struct dy_core_ctx *ctx, struct dy_core_expr *expr);
 static inline struct dy_core_assumption dy_core_assumption_retain(struct dy_core_ctx *ctx, struct dy_core_assumption assumption);
@@ -276,13 +396,44 @@ static inline void dy_core_expr_release_ptr(struct dy_core_ctx *ctx, struct dy_c
 static inline void dy_core_assumption_release(struct dy_core_ctx *ctx, struct dy_core_assumption assumption);
 static inline void dy_core_simple_release(struct dy_core_ctx *ctx, struct dy_core_simple simple);
 
+/** Hands the children of 'expr', whose own node is already gone, to ctx->pending_releases. */
+static inline void dy_core_expr_release_children(struct dy_core_ctx *ctx, struct dy_core_expr expr);
+
+/** Frees the nodes in ctx->dead_nodes, and everything only they kept alive. */
+static inline void dy_core_free_dead_nodes(struct dy_core_ctx *ctx);
+
+/** Releases the nodes in ctx->pending_releases until there are none left. */
+static inline void dy_core_drain_pending_releases(struct dy_core_ctx *ctx);
+
 static inline enum dy_polarity dy_flip_polarity(enum dy_polarity polarity);
 
 static inline void dy_variable_appears_in_polarity(struct dy_core_ctx *ctx, struct dy_core_expr expr, size_t id, enum dy_polarity current_polarity, bool *positive, bool *negative);
+static inline void dy_variable_appears_in_polarity_ptr(struct dy_core_ctx *ctx, const struct dy_core_expr *expr, size_t id, enum dy_polarity current_polarity, bool *positive, bool *negative);
 
 /** Returns whether 'id' occurs in expr at all. */
 static inline bool dy_core_expr_contains_this_variable(struct dy_core_ctx *ctx, size_t id, struct dy_core_expr expr);
 static inline bool dy_core_assumption_contains_this_variable(struct dy_core_ctx *ctx, size_t id, struct dy_core_assumption assumption);
+static inline bool dy_core_expr_ptr_contains_this_variable(struct dy_core_ctx *ctx, size_t id, const struct dy_core_expr *expr);
+
+/**
+ * Binds 'id1' and 'id2' to each other for alpha-equivalence.
+ *
+ * Both get the same binder level (the position of the pair in ctx->equal_variables, plus one),
+ * recorded in ctx->equal_variable_levels. Two bound variables are thus alpha-equivalent
+ * iff their levels are equal, which is a plain integer compare instead of a scan.
+ */
+static inline void dy_equal_variables_push(struct dy_core_ctx *ctx, size_t id1, size_t id2);
+
+/** Undoes the last dy_equal_variables_push(). */
+static inline void dy_equal_variables_pop(struct dy_core_ctx *ctx);
+
+/** Returns the binder level of 'id', or 0 if it isn't bound in ctx->equal_variables. */
+static inline size_t dy_equal_variables_level(struct dy_core_ctx *ctx, size_t id);
+
+/** Returns the innermost pair 'id' is part of, or NULL. */
+static inline const struct dy_equal_variables *dy_equal_variables_find(struct dy_core_ctx *ctx, size_t id);
+
+static inline void dy_equal_variables_set_level(struct dy_core_ctx *ctx, size_t id, size_t level);
 
 /**
  * Removes all mentions of 'id' in 'constraint', which may involve lowering/raising the subtype/supertype bounds.
@@ -295,16 +446,142 @@ static inline void dy_remove_mentions_in_constraints(struct dy_core_ctx *ctx, si
 static inline bool dy_remove_mentions_in_type(struct dy_core_ctx *ctx, size_t id, enum dy_polarity current_polarity, struct dy_core_expr type, struct dy_core_expr *result);
 
 /** Appends a utf8 represention of expr to 'string'. */
-static inline void dy_core_expr_to_string(struct dy_core_ctx *ctx, struct dy_core_expr expr, dy_array_t *string);
+/** Writes 'expr' to 'writer', eliding it if it nests deeper than the writer allows. */
+static inline void dy_core_expr_to_string(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_writer *writer);
 
-/** Helper to add a string literal to a dynamic char array. */
-static inline void add_string(dy_array_t *string, dy_string_t s);
-
-static inline void add_size_t_decimal(dy_array_t *string, size_t x);
+static inline void dy_core_expr_to_string_level(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_writer *writer);
 
 struct dy_core_expr *dy_core_expr_new(struct dy_core_expr expr)
 {
-    return dy_rc_new(&expr, sizeof expr, DY_ALIGNOF(struct dy_core_expr));
+    struct dy_core_node node = {
+        .expr = expr
+    };
+
+    dy_core_expr_id_range(expr, &node.min_id, &node.max_id);
+
+    // Retain and release only know about the alignment, which has to match theirs.
+    return dy_rc_new(&node, sizeof node, DY_ALIGNOF(struct dy_core_expr));
+}
+
+void dy_core_expr_id_range(struct dy_core_expr expr, size_t *min_id, size_t *max_id)
+{
+    *min_id = SIZE_MAX;
+    *max_id = 0;
+
+    switch (expr.tag) {
+    case DY_CORE_EXPR_INTRO:
+        switch (expr.intro.tag) {
+        case DY_CORE_INTRO_COMPLEX:
+            switch (expr.intro.complex.tag) {
+            case DY_CORE_COMPLEX_ASSUMPTION:
+                dy_core_id_range_add_assumption(expr.intro.complex.assumption, min_id, max_id);
+                return;
+            case DY_CORE_COMPLEX_CHOICE:
+                dy_core_id_range_add_ptr(expr.intro.complex.choice.left, min_id, max_id);
+                dy_core_id_range_add_ptr(expr.intro.complex.choice.right, min_id, max_id);
+                return;
+            case DY_CORE_COMPLEX_RECURSION:
+                dy_core_id_range_add_ptr(expr.intro.complex.recursion.expr, min_id, max_id);
+                return;
+            }
+
+            dy_bail("impossible");
+        case DY_CORE_INTRO_SIMPLE:
+            if (expr.intro.simple.tag == DY_CORE_SIMPLE_PROOF) {
+                dy_core_id_range_add_ptr(expr.intro.simple.proof, min_id, max_id);
+            }
+
+            dy_core_id_range_add_ptr(expr.intro.simple.out, min_id, max_id);
+            return;
+        }
+
+        dy_bail("impossible");
+    case DY_CORE_EXPR_ELIM:
+        dy_core_id_range_add_ptr(expr.elim.expr, min_id, max_id);
+
+        if (expr.elim.simple.tag == DY_CORE_SIMPLE_PROOF) {
+            dy_core_id_range_add_ptr(expr.elim.simple.proof, min_id, max_id);
+        }
+
+        dy_core_id_range_add_ptr(expr.elim.simple.out, min_id, max_id);
+        return;
+    case DY_CORE_EXPR_MAP:
+        switch (expr.map.tag) {
+        case DY_CORE_MAP_ASSUMPTION:
+            dy_core_id_range_add_ptr(expr.map.assumption.type, min_id, max_id);
+            dy_core_id_range_add_assumption(expr.map.assumption.assumption, min_id, max_id);
+            return;
+        case DY_CORE_MAP_CHOICE:
+            dy_core_id_range_add_assumption(expr.map.choice.assumption_left, min_id, max_id);
+            dy_core_id_range_add_assumption(expr.map.choice.assumption_right, min_id, max_id);
+            return;
+        case DY_CORE_MAP_RECURSION:
+            dy_core_id_range_add_assumption(expr.map.recursion.assumption, min_id, max_id);
+            return;
+        }
+
+        dy_bail("impossible");
+    case DY_CORE_EXPR_VARIABLE:
+        *min_id = expr.variable_id;
+        *max_id = expr.variable_id;
+        return;
+    case DY_CORE_EXPR_INFERENCE_VAR:
+        *min_id = expr.inference_var_id;
+        *max_id = expr.inference_var_id;
+        return;
+    case DY_CORE_EXPR_ANY:
+    case DY_CORE_EXPR_VOID:
+        return;
+    case DY_CORE_EXPR_INFERENCE_CTX:
+        dy_core_id_range_add_ptr(expr.inference_ctx.expr, min_id, max_id);
+        return;
+    case DY_CORE_EXPR_CUSTOM:
+        if (expr.custom.has_id_range) {
+            *min_id = expr.custom.min_id;
+            *max_id = expr.custom.max_id;
+            return;
+        }
+
+        // Opaque, so assume anything can occur.
+        *min_id = 0;
+        *max_id = SIZE_MAX;
+        return;
+    }
+
+    dy_bail("Impossible object type.");
+}
+
+bool dy_core_expr_may_contain(const struct dy_core_expr *expr, size_t id)
+{
+    const struct dy_core_node *node = (const struct dy_core_node *)expr;
+    return node->min_id <= id && id <= node->max_id;
+}
+
+void dy_core_id_range_add_ptr(const struct dy_core_expr *expr, size_t *min_id, size_t *max_id)
+{
+    const struct dy_core_node *node = (const struct dy_core_node *)expr;
+    *min_id = DY_MIN(*min_id, node->min_id);
+    *max_id = DY_MAX(*max_id, node->max_id);
+}
+
+void dy_core_id_range_add(struct dy_core_expr expr, size_t *min_id, size_t *max_id)
+{
+    size_t expr_min_id, expr_max_id;
+    dy_core_expr_id_range(expr, &expr_min_id, &expr_max_id);
+
+    *min_id = DY_MIN(*min_id, expr_min_id);
+    *max_id = DY_MAX(*max_id, expr_max_id);
+}
+
+bool dy_core_custom_may_contain(struct dy_core_custom custom, size_t id)
+{
+    return !custom.has_id_range || (custom.min_id <= id && id <= custom.max_id);
+}
+
+void dy_core_id_range_add_assumption(struct dy_core_assumption assumption, size_t *min_id, size_t *max_id)
+{
+    dy_core_id_range_add_ptr(assumption.type, min_id, max_id);
+    dy_core_id_range_add_ptr(assumption.expr, min_id, max_id);
 }
 
 struct dy_core_expr dy_core_expr_retain(struct dy_core_ctx *ctx, struct dy_core_expr expr)
@@ -393,6 +670,125 @@ struct dy_core_simple dy_core_simple_retain(struct dy_core_ctx *ctx, struct dy_c
 }
 
 void dy_core_expr_release(struct dy_core_ctx *ctx, struct dy_core_expr expr)
+{
+    if (ctx->pending_releases != NULL || ctx->dead_nodes.capacity != 0) {
+        dy_core_expr_release_children(ctx, expr);
+        return;
+    }
+
+    // Works off an explicit stack instead of recursing,
+    // since the depth of Core grows with the length of a program.
+    struct dy_core_expr *storage[64];
+    dy_array_t pending = dy_array_create_small(storage, sizeof(struct dy_core_expr *), DY_ALIGNOF(struct dy_core_expr *), 64);
+
+    ctx->pending_releases = &pending;
+
+    dy_core_expr_release_children(ctx, expr);
+
+    dy_core_drain_pending_releases(ctx);
+
+    ctx->pending_releases = NULL;
+
+    dy_array_release(&pending);
+}
+
+void dy_core_expr_release_ptr(struct dy_core_ctx *ctx, struct dy_core_expr *expr)
+{
+    if (ctx->pending_releases != NULL) {
+        DY_ARRAY_PUSH(ctx->pending_releases, struct dy_core_expr *, expr);
+        return;
+    }
+
+    if (ctx->dead_nodes.capacity != 0) {
+        if (dy_rc_decrement(expr, DY_ALIGNOF(struct dy_core_expr)) == 0) {
+            DY_ARRAY_PUSH(&ctx->dead_nodes, struct dy_core_expr *, expr);
+
+            if (ctx->dead_nodes.num_elems == ctx->dead_nodes.capacity) {
+                dy_core_free_dead_nodes(ctx);
+            }
+        }
+
+        return;
+    }
+
+    struct dy_core_expr e = *expr;
+    struct dy_core_expr *type = ((struct dy_core_node *)expr)->type;
+    if (dy_rc_release(expr, DY_ALIGNOF(struct dy_core_expr)) == 0) {
+        dy_core_expr_release(ctx, e);
+
+        if (type != NULL) {
+            dy_core_expr_release_ptr(ctx, type);
+        }
+    }
+}
+
+void dy_core_free_dead_nodes(struct dy_core_ctx *ctx)
+{
+    assert(ctx->pending_releases == NULL);
+
+    struct dy_core_expr *storage[64];
+    dy_array_t pending = dy_array_create_small(storage, sizeof(struct dy_core_expr *), DY_ALIGNOF(struct dy_core_expr *), 64);
+
+    ctx->pending_releases = &pending;
+
+    for (size_t i = 0; i < ctx->dead_nodes.num_elems; ++i) {
+        struct dy_core_expr *ptr = DY_ARRAY_AT(&ctx->dead_nodes, struct dy_core_expr *, i);
+
+        struct dy_core_expr e = *ptr;
+        struct dy_core_expr *type = ((struct dy_core_node *)ptr)->type;
+        dy_rc_free(ptr, DY_ALIGNOF(struct dy_core_expr));
+
+        dy_core_expr_release_children(ctx, e);
+
+        if (type != NULL) {
+            DY_ARRAY_PUSH(&pending, struct dy_core_expr *, type);
+        }
+    }
+
+    ctx->dead_nodes.num_elems = 0;
+
+    dy_core_drain_pending_releases(ctx);
+
+    ctx->pending_releases = NULL;
+
+    dy_array_release(&pending);
+}
+
+void dy_core_drain_pending_releases(struct dy_core_ctx *ctx)
+{
+    dy_array_t *pending = ctx->pending_releases;
+
+    while (pending->num_elems != 0) {
+        struct dy_core_expr *ptr = DY_ARRAY_AT(pending, struct dy_core_expr *, --pending->num_elems);
+
+        struct dy_core_expr e = *ptr;
+        struct dy_core_expr *type = ((struct dy_core_node *)ptr)->type;
+        if (dy_rc_release(ptr, DY_ALIGNOF(struct dy_core_expr)) == 0) {
+            dy_core_expr_release_children(ctx, e);
+
+            if (type != NULL) {
+                DY_ARRAY_PUSH(pending, struct dy_core_expr *, type);
+            }
+        }
+    }
+}
+
+void dy_core_assumption_release(struct dy_core_ctx *ctx, struct dy_core_assumption assumption)
+{
+    dy_core_expr_release_ptr(ctx, assumption.type);
+    dy_core_expr_release_ptr(ctx, assumption.expr);
+}
+
+void dy_core_simple_release(struct dy_core_ctx *ctx, struct dy_core_simple simple)
+{
+    if (simple.tag == DY_CORE_SIMPLE_PROOF) {
+        dy_core_expr_release_ptr(ctx, simple.proof);
+    }
+
+    dy_core_expr_release_ptr(ctx, simple.out);
+}
+
+void dy_core_expr_release_children(struct dy_core_ctx *ctx, struct dy_core_expr expr)
 {
     switch (expr.tag) {
     case DY_CORE_EXPR_INTRO:
@@ -457,29 +853,6 @@ void dy_core_expr_release(struct dy_core_ctx *ctx, struct dy_core_expr expr)
     dy_bail("Impossible object type.");
 }
 
-void dy_core_expr_release_ptr(struct dy_core_ctx *ctx, struct dy_core_expr *expr)
-{
-    struct dy_core_expr e = *expr;
-    if (dy_rc_release(expr, DY_ALIGNOF(struct dy_core_expr)) == 0) {
-        dy_core_expr_release(ctx, e);
-    }
-}
-
-void dy_core_assumption_release(struct dy_core_ctx *ctx, struct dy_core_assumption assumption)
-{
-    dy_core_expr_release_ptr(ctx, assumption.type);
-    dy_core_expr_release_ptr(ctx, assumption.expr);
-}
-
-void dy_core_simple_release(struct dy_core_ctx *ctx, struct dy_core_simple simple)
-{
-    if (simple.tag == DY_CORE_SIMPLE_PROOF) {
-        dy_core_expr_release_ptr(ctx, simple.proof);
-    }
-
-    dy_core_expr_release_ptr(ctx, simple.out);
-}
-
 enum dy_polarity dy_flip_polarity(enum dy_polarity polarity)
 {
     switch (polarity) {
@@ -500,27 +873,27 @@ void dy_variable_appears_in_polarity(struct dy_core_ctx *ctx, struct dy_core_exp
         case DY_CORE_INTRO_COMPLEX:
             switch (expr.intro.complex.tag) {
             case DY_CORE_COMPLEX_ASSUMPTION:
-                dy_variable_appears_in_polarity(ctx, *expr.intro.complex.assumption.type, id, expr.intro.polarity == DY_POLARITY_POSITIVE ? dy_flip_polarity(current_polarity) : current_polarity, positive, negative);
+                dy_variable_appears_in_polarity_ptr(ctx, expr.intro.complex.assumption.type, id, expr.intro.polarity == DY_POLARITY_POSITIVE ? dy_flip_polarity(current_polarity) : current_polarity, positive, negative);
                 if (*positive && *negative) {
                     return;
                 }
-                dy_variable_appears_in_polarity(ctx, *expr.intro.complex.assumption.expr, id, current_polarity, positive, negative);
+                dy_variable_appears_in_polarity_ptr(ctx, expr.intro.complex.assumption.expr, id, current_polarity, positive, negative);
                 return;
             case DY_CORE_COMPLEX_CHOICE:
-                dy_variable_appears_in_polarity(ctx, *expr.intro.complex.choice.left, id, current_polarity, positive, negative);
+                dy_variable_appears_in_polarity_ptr(ctx, expr.intro.complex.choice.left, id, current_polarity, positive, negative);
                 if (*positive && *negative) {
                     return;
                 }
-                dy_variable_appears_in_polarity(ctx, *expr.intro.complex.choice.right, id, current_polarity, positive, negative);
+                dy_variable_appears_in_polarity_ptr(ctx, expr.intro.complex.choice.right, id, current_polarity, positive, negative);
                 return;
             case DY_CORE_COMPLEX_RECURSION:
-                dy_variable_appears_in_polarity(ctx, *expr.intro.complex.recursion.expr, id, current_polarity, positive, negative);
+                dy_variable_appears_in_polarity_ptr(ctx, expr.intro.complex.recursion.expr, id, current_polarity, positive, negative);
                 return;
             }
 
             dy_bail("impossible");
         case DY_CORE_INTRO_SIMPLE:
-            dy_variable_appears_in_polarity(ctx, *expr.intro.simple.out, id, current_polarity, positive, negative);
+            dy_variable_appears_in_polarity_ptr(ctx, expr.intro.simple.out, id, current_polarity, positive, negative);
             return;
         }
 
@@ -554,6 +927,10 @@ void dy_variable_appears_in_polarity(struct dy_core_ctx *ctx, struct dy_core_exp
     case DY_CORE_EXPR_INFERENCE_CTX:
         dy_bail("impossible");
     case DY_CORE_EXPR_CUSTOM: {
+        if (!dy_core_custom_may_contain(expr.custom, id)) {
+            return;
+        }
+
         const struct dy_core_custom_shared *vtab = dy_array_pos(&ctx->custom_shared, expr.custom.id);
         vtab->variable_appears_in_polarity(ctx, expr.custom.data, id, current_polarity, positive, negative);
         return;
@@ -563,6 +940,83 @@ void dy_variable_appears_in_polarity(struct dy_core_ctx *ctx, struct dy_core_exp
     dy_bail("Impossible");
 }
 
+void dy_variable_appears_in_polarity_ptr(struct dy_core_ctx *ctx, const struct dy_core_expr *expr, size_t id, enum dy_polarity current_polarity, bool *positive, bool *negative)
+{
+    if (!dy_core_expr_may_contain(expr, id)) {
+        return;
+    }
+
+    dy_variable_appears_in_polarity(ctx, *expr, id, current_polarity, positive, negative);
+}
+
+void dy_equal_variables_push(struct dy_core_ctx *ctx, size_t id1, size_t id2)
+{
+    size_t level = ctx->equal_variables.num_elems + 1;
+
+    struct dy_equal_variables v = {
+        .id1 = id1,
+        .id2 = id2,
+        .prev_level1 = dy_equal_variables_level(ctx, id1)
+    };
+
+    dy_equal_variables_set_level(ctx, id1, level);
+
+    // Read after setting the first level in case id1 == id2, so popping restores in reverse.
+    v.prev_level2 = dy_equal_variables_level(ctx, id2);
+
+    dy_equal_variables_set_level(ctx, id2, level);
+
+    dy_array_add(&ctx->equal_variables, &v);
+}
+
+void dy_equal_variables_pop(struct dy_core_ctx *ctx)
+{
+    struct dy_equal_variables v;
+    dy_array_pop(&ctx->equal_variables, &v);
+
+    dy_equal_variables_set_level(ctx, v.id2, v.prev_level2);
+    dy_equal_variables_set_level(ctx, v.id1, v.prev_level1);
+}
+
+size_t dy_equal_variables_level(struct dy_core_ctx *ctx, size_t id)
+{
+    if (id >= ctx->equal_variable_levels.num_elems) {
+        return 0;
+    }
+
+    return *(const size_t *)dy_array_pos(&ctx->equal_variable_levels, id);
+}
+
+const struct dy_equal_variables *dy_equal_variables_find(struct dy_core_ctx *ctx, size_t id)
+{
+    size_t level = dy_equal_variables_level(ctx, id);
+    if (level == 0) {
+        return NULL;
+    }
+
+    return dy_array_pos(&ctx->equal_variables, level - 1);
+}
+
+void dy_equal_variables_set_level(struct dy_core_ctx *ctx, size_t id, size_t level)
+{
+    dy_array_t *levels = &ctx->equal_variable_levels;
+
+    if (id >= levels->num_elems) {
+        if (level == 0) {
+            return;
+        }
+
+        size_t size = levels->num_elems;
+
+        // Ids are handed out sequentially, so grow geometrically.
+        dy_array_set_excess_capacity(levels, DY_MAX(id + 1 - size, size));
+        memset(dy_array_excess_buffer(levels), 0, (id + 1 - size) * sizeof(size_t));
+        dy_array_add_to_size(levels, id + 1 - size);
+    }
+
+    *(size_t *)dy_array_pos(levels, id) = level;
+}
+
 bool dy_core_expr_contains_this_variable(struct dy_core_ctx *ctx, size_t id, struct dy_core_expr expr)
 {
     switch (expr.tag) {
@@ -573,40 +1027,40 @@ bool dy_core_expr_contains_this_variable(struct dy_core_ctx *ctx, size_t id, str
             case DY_CORE_COMPLEX_ASSUMPTION:
                 return dy_core_assumption_contains_this_variable(ctx, id, expr.intro.complex.assumption);
             case DY_CORE_COMPLEX_CHOICE:
-                return dy_core_expr_contains_this_variable(ctx, id, *expr.intro.complex.choice.left)
-                    || dy_core_expr_contains_this_variable(ctx, id, *expr.intro.complex.choice.right);
+                return dy_core_expr_ptr_contains_this_variable(ctx, id, expr.intro.complex.choice.left)
+                    || dy_core_expr_ptr_contains_this_variable(ctx, id, expr.intro.complex.choice.right);
             case DY_CORE_COMPLEX_RECURSION:
                 if (expr.intro.complex.recursion.id == id) {
                     return false;
                 }
 
-                return dy_core_expr_contains_this_variable(ctx, id, *expr.intro.complex.recursion.expr);
+                return dy_core_expr_ptr_contains_this_variable(ctx, id, expr.intro.complex.recursion.expr);
             }
 
             dy_bail("impossible");
         case DY_CORE_INTRO_SIMPLE:
-            if (expr.intro.simple.tag == DY_CORE_SIMPLE_PROOF && dy_core_expr_contains_this_variable(ctx, id, *expr.intro.simple.proof)) {
+            if (expr.intro.simple.tag == DY_CORE_SIMPLE_PROOF && dy_core_expr_ptr_contains_this_variable(ctx, id, expr.intro.simple.proof)) {
                 return true;
             }
 
-            return dy_core_expr_contains_this_variable(ctx, id, *expr.intro.simple.out);
+            return dy_core_expr_ptr_contains_this_variable(ctx, id, expr.intro.simple.out);
         }
 
         dy_bail("Impossible object type.");
     case DY_CORE_EXPR_ELIM:
-        if (dy_core_expr_contains_this_variable(ctx, id, *expr.elim.expr)) {
+        if (dy_core_expr_ptr_contains_this_variable(ctx, id, expr.elim.expr)) {
             return true;
         }
 
-        if (expr.elim.simple.tag == DY_CORE_SIMPLE_PROOF && dy_core_expr_contains_this_variable(ctx, id, *expr.elim.simple.proof)) {
+        if (expr.elim.simple.tag == DY_CORE_SIMPLE_PROOF && dy_core_expr_ptr_contains_this_variable(ctx, id, expr.elim.simple.proof)) {
             return true;
         }
 
-        return dy_core_expr_contains_this_variable(ctx, id, *expr.elim.simple.out);
+        return dy_core_expr_ptr_contains_this_variable(ctx, id, expr.elim.simple.out);
     case DY_CORE_EXPR_MAP:
         switch (expr.map.tag) {
         case DY_CORE_MAP_ASSUMPTION:
-            if (dy_core_expr_contains_this_variable(ctx, id, *expr.map.assumption.type)) {
+            if (dy_core_expr_ptr_contains_this_variable(ctx, id, expr.map.assumption.type)) {
                 return true;
             }
 
@@ -639,8 +1093,12 @@ bool dy_core_expr_contains_this_variable(struct dy_core_ctx *ctx, size_t id, str
             return false;
         }
 
-        return dy_core_expr_contains_this_variable(ctx, id, *expr.inference_ctx.expr);
+        return dy_core_expr_ptr_contains_this_variable(ctx, id, expr.inference_ctx.expr);
     case DY_CORE_EXPR_CUSTOM: {
+        if (!dy_core_custom_may_contain(expr.custom, id)) {
+            return false;
+        }
+
         const struct dy_core_custom_shared *vtab = dy_array_pos(&ctx->custom_shared, expr.custom.id);
         return vtab->contains_this_variable(ctx, expr.custom.data, id);
     }
@@ -649,9 +1107,18 @@ bool dy_core_expr_contains_this_variable(struct dy_core_ctx *ctx, size_t id, str
     dy_bail("Impossible object type.");
 }
 
+bool dy_core_expr_ptr_contains_this_variable(struct dy_core_ctx *ctx, size_t id, const struct dy_core_expr *expr)
+{
+    if (!dy_core_expr_may_contain(expr, id)) {
+        return false;
+    }
+
+    return dy_core_expr_contains_this_variable(ctx, id, *expr);
+}
+
 bool dy_core_assumption_contains_this_variable(struct dy_core_ctx *ctx, size_t id, struct dy_core_assumption assumption)
 {
-    if (dy_core_expr_contains_this_variable(ctx, id, *assumption.type)) {
+    if (dy_core_expr_ptr_contains_this_variable(ctx, id, assumption.type)) {
         return true;
     }
 
@@ -659,10 +1126,21 @@ bool dy_core_assumption_contains_this_variable(struct dy_core_ctx *ctx, size_t i
         return false;
     }
 
-    return dy_core_expr_contains_this_variable(ctx, id, *assumption.expr);
+    return dy_core_expr_ptr_contains_this_variable(ctx, id, assumption.expr);
 }
 
-void dy_core_expr_to_string(struct dy_core_ctx *ctx, struct dy_core_expr expr, dy_array_t *string)
+void dy_core_expr_to_string(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_writer *writer)
+{
+    if (!dy_writer_enter(writer)) {
+        return;
+    }
+
+    dy_core_expr_to_string_level(ctx, expr, writer);
+
+    dy_writer_leave(writer);
+}
+
+void dy_core_expr_to_string_level(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_writer *writer)
 {
     switch (expr.tag) {
     case DY_CORE_EXPR_INTRO:
@@ -671,70 +1149,70 @@ void dy_core_expr_to_string(struct dy_core_ctx *ctx, struct dy_core_expr expr, d
             switch (expr.intro.complex.tag) {
             case DY_CORE_COMPLEX_ASSUMPTION:
                 if (expr.intro.polarity == DY_POLARITY_POSITIVE) {
-                    add_string(string, DY_STR_LIT("fun "));
+                    dy_write(writer, DY_STR_LIT("fun "));
                 } else {
-                    add_string(string, DY_STR_LIT("some "));
+                    dy_write(writer, DY_STR_LIT("some "));
                 }
 
                 if (expr.intro.is_implicit) {
-                    add_string(string, DY_STR_LIT("@ "));
+                    dy_write(writer, DY_STR_LIT("@ "));
                 }
 
                 if (dy_core_expr_contains_this_variable(ctx, expr.intro.complex.assumption.id, *expr.intro.complex.assumption.expr)) {
-                    add_size_t_decimal(string, expr.intro.complex.assumption.id);
+                    dy_write_size_t_decimal(writer, expr.intro.complex.assumption.id);
                 } else {
-                    add_string(string, DY_STR_LIT("_"));
+                    dy_write(writer, DY_STR_LIT("_"));
                 }
 
-                add_string(string, DY_STR_LIT(" : "));
+                dy_write(writer, DY_STR_LIT(" : "));
 
-                dy_core_expr_to_string(ctx, *expr.intro.complex.assumption.type, string);
+                dy_core_expr_to_string(ctx, *expr.intro.complex.assumption.type, writer);
 
-                add_string(string, DY_STR_LIT(" => "));
+                dy_write(writer, DY_STR_LIT(" => "));
 
-                dy_core_expr_to_string(ctx, *expr.intro.complex.assumption.expr, string);
+                dy_core_expr_to_string(ctx, *expr.intro.complex.assumption.expr, writer);
                 return;
             case DY_CORE_COMPLEX_CHOICE:
                 if (expr.intro.polarity == DY_POLARITY_POSITIVE) {
-                    add_string(string, DY_STR_LIT("list "));
+                    dy_write(writer, DY_STR_LIT("list "));
                 } else {
-                    add_string(string, DY_STR_LIT("either "));
+                    dy_write(writer, DY_STR_LIT("either "));
                 }
 
                 if (expr.intro.is_implicit) {
-                    add_string(string, DY_STR_LIT("@ "));
+                    dy_write(writer, DY_STR_LIT("@ "));
                 }
 
-                add_string(string, DY_STR_LIT("{ "));
+                dy_write(writer, DY_STR_LIT("{ "));
 
-                dy_core_expr_to_string(ctx, *expr.intro.complex.choice.left, string);
+                dy_core_expr_to_string(ctx, *expr.intro.complex.choice.left, writer);
 
-                add_string(string, DY_STR_LIT(", "));
+                dy_write(writer, DY_STR_LIT(", "));
 
-                dy_core_expr_to_string(ctx, *expr.intro.complex.choice.right, string);
+                dy_core_expr_to_string(ctx, *expr.intro.complex.choice.right, writer);
 
-                add_string(string, DY_STR_LIT(" }"));
+                dy_write(writer, DY_STR_LIT(" }"));
                 return;
             case DY_CORE_COMPLEX_RECURSION:
                 if (expr.intro.polarity == DY_POLARITY_POSITIVE) {
-                    add_string(string, DY_STR_LIT("inf "));
+                    dy_write(writer, DY_STR_LIT("inf "));
                 } else {
-                    add_string(string, DY_STR_LIT("fin "));
+                    dy_write(writer, DY_STR_LIT("fin "));
                 }
 
                 if (expr.intro.is_implicit) {
-                    add_string(string, DY_STR_LIT("@ "));
+                    dy_write(writer, DY_STR_LIT("@ "));
                 }
 
                 if (dy_core_expr_contains_this_variable(ctx, expr.intro.complex.recursion.id, *expr.intro.complex.recursion.expr)) {
-                    add_size_t_decimal(string, expr.intro.complex.recursion.id);
+                    dy_write_size_t_decimal(writer, expr.intro.complex.recursion.id);
                 } else {
-                    add_string(string, DY_STR_LIT("_"));
+                    dy_write(writer, DY_STR_LIT("_"));
                 }
 
-                add_string(string, DY_STR_LIT(" = "));
+                dy_write(writer, DY_STR_LIT(" = "));
 
-                dy_core_expr_to_string(ctx, *expr.intro.complex.recursion.expr, string);
+                dy_core_expr_to_string(ctx, *expr.intro.complex.recursion.expr, writer);
                 return;
             }
 
@@ -742,246 +1220,214 @@ void dy_core_expr_to_string(struct dy_core_ctx *ctx, struct dy_core_expr expr, d
         case DY_CORE_INTRO_SIMPLE:
             switch (expr.intro.simple.tag) {
             case DY_CORE_SIMPLE_PROOF:
-                add_string(string, DY_STR_LIT("("));
-                dy_core_expr_to_string(ctx, *expr.intro.simple.proof, string);
-                add_string(string, DY_STR_LIT(")"));
+                dy_write(writer, DY_STR_LIT("("));
+                dy_core_expr_to_string(ctx, *expr.intro.simple.proof, writer);
+                dy_write(writer, DY_STR_LIT(")"));
                 break;
             case DY_CORE_SIMPLE_DECISION:
                 if (expr.intro.simple.direction == DY_LEFT) {
-                    add_string(string, DY_STR_LIT("L"));
+                    dy_write(writer, DY_STR_LIT("L"));
                 } else {
-                    add_string(string, DY_STR_LIT("R"));
+                    dy_write(writer, DY_STR_LIT("R"));
                 }
                 break;
             case DY_CORE_SIMPLE_UNFOLD:
-                add_string(string, DY_STR_LIT("Unfold"));
+                dy_write(writer, DY_STR_LIT("Unfold"));
                 break;
             case DY_CORE_SIMPLE_UNWRAP:
-                add_string(string, DY_STR_LIT("Unwrap"));
+                dy_write(writer, DY_STR_LIT("Unwrap"));
                 break;
             }
 
             if (expr.intro.polarity == DY_POLARITY_POSITIVE) {
                 if (expr.intro.is_implicit) {
-                    add_string(string, DY_STR_LIT(" @-> "));
+                    dy_write(writer, DY_STR_LIT(" @-> "));
                 } else {
-                    add_string(string, DY_STR_LIT(" -> "));
+                    dy_write(writer, DY_STR_LIT(" -> "));
                 }
             } else {
                 if (expr.intro.is_implicit) {
-                    add_string(string, DY_STR_LIT(" @~> "));
+                    dy_write(writer, DY_STR_LIT(" @~> "));
                 } else {
-                    add_string(string, DY_STR_LIT(" ~> "));
+                    dy_write(writer, DY_STR_LIT(" ~> "));
                 }
             }
 
-            dy_core_expr_to_string(ctx, *expr.intro.simple.out, string);
+            dy_core_expr_to_string(ctx, *expr.intro.simple.out, writer);
             return;
         }
 
         dy_bail("impossible");
     case DY_CORE_EXPR_ELIM:
-        add_string(string, DY_STR_LIT("("));
-        dy_core_expr_to_string(ctx, *expr.elim.expr, string);
-        add_string(string, DY_STR_LIT(")"));
+        dy_write(writer, DY_STR_LIT("("));
+        dy_core_expr_to_string(ctx, *expr.elim.expr, writer);
+        dy_write(writer, DY_STR_LIT(")"));
 
         if (expr.elim.is_implicit) {
-            add_string(string, DY_STR_LIT(" @ "));
+            dy_write(writer, DY_STR_LIT(" @ "));
         } else {
-            add_string(string, DY_STR_LIT(" "));
+            dy_write(writer, DY_STR_LIT(" "));
         }
 
         switch (expr.elim.simple.tag) {
         case DY_CORE_SIMPLE_PROOF:
-            add_string(string, DY_STR_LIT("("));
-            dy_core_expr_to_string(ctx, *expr.elim.simple.proof, string);
-            add_string(string, DY_STR_LIT(")"));
+            dy_write(writer, DY_STR_LIT("("));
+            dy_core_expr_to_string(ctx, *expr.elim.simple.proof, writer);
+            dy_write(writer, DY_STR_LIT(")"));
             break;
         case DY_CORE_SIMPLE_DECISION:
             if (expr.elim.simple.direction == DY_LEFT) {
-                add_string(string, DY_STR_LIT("L"));
+                dy_write(writer, DY_STR_LIT("L"));
             } else {
-                add_string(string, DY_STR_LIT("R"));
+                dy_write(writer, DY_STR_LIT("R"));
             }
             break;
         case DY_CORE_SIMPLE_UNFOLD:
-            add_string(string, DY_STR_LIT("Unfold"));
+            dy_write(writer, DY_STR_LIT("Unfold"));
             break;
         case DY_CORE_SIMPLE_UNWRAP:
-            add_string(string, DY_STR_LIT("Unwrap"));
+            dy_write(writer, DY_STR_LIT("Unwrap"));
             break;
         }
 
-        add_string(string, DY_STR_LIT(" : "));
+        dy_write(writer, DY_STR_LIT(" : "));
 
         if (expr.elim.eval_immediately) {
-            add_string(string, DY_STR_LIT("$$$ "));
+            dy_write(writer, DY_STR_LIT("$$$ "));
         }
 
         if (expr.elim.check_result == DY_NO) {
-            add_string(string, DY_STR_LIT("FAIL "));
+            dy_write(writer, DY_STR_LIT("FAIL "));
         } else if (expr.elim.check_result == DY_MAYBE) {
-            add_string(string, DY_STR_LIT("MAYBE "));
+            dy_write(writer, DY_STR_LIT("MAYBE "));
         }
 
-        dy_core_expr_to_string(ctx, *expr.elim.simple.out, string);
+        dy_core_expr_to_string(ctx, *expr.elim.simple.out, writer);
         return;
     case DY_CORE_EXPR_MAP:
         switch (expr.map.tag) {
         case DY_CORE_MAP_ASSUMPTION:
-            add_string(string, DY_STR_LIT("map some "));
+            dy_write(writer, DY_STR_LIT("map some "));
 
             if (expr.map.is_implicit) {
-                add_string(string, DY_STR_LIT("@ "));
+                dy_write(writer, DY_STR_LIT("@ "));
             }
 
-            add_size_t_decimal(string, expr.map.assumption.id);
+            dy_write_size_t_decimal(writer, expr.map.assumption.id);
 
-            add_string(string, DY_STR_LIT(" : "));
+            dy_write(writer, DY_STR_LIT(" : "));
 
-            dy_core_expr_to_string(ctx, *expr.map.assumption.type, string);
+            dy_core_expr_to_string(ctx, *expr.map.assumption.type, writer);
 
-            add_string(string, DY_STR_LIT(" => "));
+            dy_write(writer, DY_STR_LIT(" => "));
 
-            add_size_t_decimal(string, expr.map.assumption.assumption.id);
+            dy_write_size_t_decimal(writer, expr.map.assumption.assumption.id);
 
-            add_string(string, DY_STR_LIT(" : "));
+            dy_write(writer, DY_STR_LIT(" : "));
 
-            dy_core_expr_to_string(ctx, *expr.map.assumption.assumption.type, string);
+            dy_core_expr_to_string(ctx, *expr.map.assumption.assumption.type, writer);
 
-            add_string(string, DY_STR_LIT(" => "));
+            dy_write(writer, DY_STR_LIT(" => "));
 
-            dy_core_expr_to_string(ctx, *expr.map.assumption.assumption.expr, string);
+            dy_core_expr_to_string(ctx, *expr.map.assumption.assumption.expr, writer);
 
             return;
         case DY_CORE_MAP_CHOICE:
-            add_string(string, DY_STR_LIT("map either "));
+            dy_write(writer, DY_STR_LIT("map either "));
 
             if (expr.map.is_implicit) {
-                add_string(string, DY_STR_LIT("@ "));
+                dy_write(writer, DY_STR_LIT("@ "));
             }
 
-            add_string(string, DY_STR_LIT("{ "));
+            dy_write(writer, DY_STR_LIT("{ "));
 
-            add_size_t_decimal(string, expr.map.choice.assumption_left.id);
+            dy_write_size_t_decimal(writer, expr.map.choice.assumption_left.id);
 
-            add_string(string, DY_STR_LIT(" : "));
+            dy_write(writer, DY_STR_LIT(" : "));
 
-            dy_core_expr_to_string(ctx, *expr.map.choice.assumption_left.type, string);
+            dy_core_expr_to_string(ctx, *expr.map.choice.assumption_left.type, writer);
 
-            add_string(string, DY_STR_LIT(" => "));
+            dy_write(writer, DY_STR_LIT(" => "));
 
-            dy_core_expr_to_string(ctx, *expr.map.choice.assumption_left.expr, string);
+            dy_core_expr_to_string(ctx, *expr.map.choice.assumption_left.expr, writer);
 
-            add_string(string, DY_STR_LIT(", "));
+            dy_write(writer, DY_STR_LIT(", "));
 
-            add_size_t_decimal(string, expr.map.choice.assumption_right.id);
+            dy_write_size_t_decimal(writer, expr.map.choice.assumption_right.id);
 
-            add_string(string, DY_STR_LIT(" : "));
+            dy_write(writer, DY_STR_LIT(" : "));
 
-            dy_core_expr_to_string(ctx, *expr.map.choice.assumption_right.type, string);
+            dy_core_expr_to_string(ctx, *expr.map.choice.assumption_right.type, writer);
 
-            add_string(string, DY_STR_LIT(" => "));
+            dy_write(writer, DY_STR_LIT(" => "));
 
-            dy_core_expr_to_string(ctx, *expr.map.choice.assumption_right.expr, string);
+            dy_core_expr_to_string(ctx, *expr.map.choice.assumption_right.expr, writer);
 
-            add_string(string, DY_STR_LIT(" }"));
+            dy_write(writer, DY_STR_LIT(" }"));
 
             return;
         case DY_CORE_MAP_RECURSION:
-            add_string(string, DY_STR_LIT("map fin "));
+            dy_write(writer, DY_STR_LIT("map fin "));
 
             if (expr.map.is_implicit) {
-                add_string(string, DY_STR_LIT("@ "));
+                dy_write(writer, DY_STR_LIT("@ "));
             }
 
-            add_size_t_decimal(string, expr.map.recursion.id);
+            dy_write_size_t_decimal(writer, expr.map.recursion.id);
 
-            add_string(string, DY_STR_LIT(" = "));
+            dy_write(writer, DY_STR_LIT(" = "));
 
-            add_size_t_decimal(string, expr.map.recursion.assumption.id);
+            dy_write_size_t_decimal(writer, expr.map.recursion.assumption.id);
 
-            add_string(string, DY_STR_LIT(" : "));
+            dy_write(writer, DY_STR_LIT(" : "));
 
-            dy_core_expr_to_string(ctx, *expr.map.recursion.assumption.type, string);
+            dy_core_expr_to_string(ctx, *expr.map.recursion.assumption.type, writer);
 
-            add_string(string, DY_STR_LIT(" => "));
+            dy_write(writer, DY_STR_LIT(" => "));
 
-            dy_core_expr_to_string(ctx, *expr.map.recursion.assumption.expr, string);
+            dy_core_expr_to_string(ctx, *expr.map.recursion.assumption.expr, writer);
 
             return;
         }
 
         dy_bail("impossible");
     case DY_CORE_EXPR_VARIABLE:
-        add_size_t_decimal(string, expr.variable_id);
+        dy_write_size_t_decimal(writer, expr.variable_id);
         return;
     case DY_CORE_EXPR_ANY:
-        add_string(string, DY_STR_LIT("Any"));
+        dy_write(writer, DY_STR_LIT("Any"));
         return;
     case DY_CORE_EXPR_VOID:
-        add_string(string, DY_STR_LIT("Void"));
+        dy_write(writer, DY_STR_LIT("Void"));
         return;
     case DY_CORE_EXPR_INFERENCE_CTX:
-        add_string(string, DY_STR_LIT("[INFER "));
+        dy_write(writer, DY_STR_LIT("[INFER "));
 
-        add_size_t_decimal(string, expr.inference_ctx.id);
+        dy_write_size_t_decimal(writer, expr.inference_ctx.id);
 
         if (expr.inference_ctx.polarity == DY_POLARITY_POSITIVE) {
-            add_string(string, DY_STR_LIT("+"));
+            dy_write(writer, DY_STR_LIT("+"));
         } else {
-            add_string(string, DY_STR_LIT("-"));
+            dy_write(writer, DY_STR_LIT("-"));
         }
 
-        add_string(string, DY_STR_LIT("] "));
+        dy_write(writer, DY_STR_LIT("] "));
 
-        dy_core_expr_to_string(ctx, *expr.inference_ctx.expr, string);
+        dy_core_expr_to_string(ctx, *expr.inference_ctx.expr, writer);
 
         return;
     case DY_CORE_EXPR_INFERENCE_VAR:
-        add_string(string, DY_STR_LIT("?"));
+        dy_write(writer, DY_STR_LIT("?"));
 
-        add_size_t_decimal(string, expr.inference_var_id);
+        dy_write_size_t_decimal(writer, expr.inference_var_id);
 
         return;
     case DY_CORE_EXPR_CUSTOM: {
         const struct dy_core_custom_shared *s = dy_array_pos(&ctx->custom_shared, expr.custom.id);
-        s->to_string(ctx, expr.custom.data, string);
+        s->to_string(ctx, expr.custom.data, writer);
         return;
     }
     }
 
     dy_bail("Impossible object type.");
 }
-
-void add_string(dy_array_t *string, dy_string_t s)
-{
-    for (size_t i = 0; i < s.size; ++i) {
-        dy_array_add(string, s.ptr + i);
-    }
-}
-
-void add_size_t_decimal(dy_array_t *string, size_t x)
-{
-    size_t start_size = string->num_elems;
-
-    // Add digits in reverse order.
-    for (;;) {
-        char digit = x % 10 + '0';
-
-        dy_array_add(string, &digit);
-
-        x /= 10;
-
-        if (x == 0) {
-            break;
-        }
-    }
-
-    // Reverse digits in buffer.
-    for (size_t i = start_size, k = string->num_elems - 1; i < k; ++i, --k) {
-        char c = *(char *)dy_array_pos(string, i);
-        *(char *)dy_array_pos(string, i) = *(char *)dy_array_pos(string, k);
-        *(char *)dy_array_pos(string, k) = c;
-    }
-}
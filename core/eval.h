@@ -10,6 +10,34 @@
 #include "type_of.h"
 #include "is_subtype.h"
 
+/**
+ * Evaluation of Core expressions.
+ *
+ * There are two engines: The default one steps by substituting arguments into bodies.
+ * The other one, enabled by ctx->eval_with_environments, evaluates bodies in an
+ * environment that binds their variables instead, and only turns the result back
+ * into plain Core ("reading back") once it leaves the evaluator, or when a runtime
+ * subtype check or custom expression needs to look at it.
+ * The bytecode VM in bytecode.h builds on the latter.
+ *
+ * Since evaluation never happens under a binder, everything bound in an
+ * environment is closed, so reading back is just substitution.
+ */
+
+struct dy_eval_env;
+
+struct dy_eval_closure {
+    struct dy_core_expr expr;
+    struct dy_eval_env *env; // NULL if 'expr' is closed.
+};
+
+/** Environments are immutable and share their tails, so they're reference-counted. */
+struct dy_eval_env {
+    size_t id;
+    struct dy_eval_closure value;
+    struct dy_eval_env *next;
+};
+
 static inline bool dy_eval_expr(struct dy_core_ctx *ctx, struct dy_core_expr expr, bool *is_value, struct dy_core_expr *result);
 
 static inline bool dy_eval_elim(struct dy_core_ctx *ctx, struct dy_core_elim elim, bool *is_value, struct dy_core_expr *result);
@@ -24,8 +52,57 @@ static inline bool dy_eval_map_choice_elim(struct dy_core_ctx *ctx, struct dy_co
 
 static inline bool dy_eval_map_recursion_elim(struct dy_core_ctx *ctx, struct dy_core_map_recursion rec, struct dy_core_expr out, bool is_implicit, enum dy_polarity polarity, struct dy_core_expr *result);
 
+
+/** Defined in bytecode.h. */
+static inline bool dy_bytecode_eval(struct dy_core_ctx *ctx, struct dy_core_expr expr, bool *is_value, struct dy_core_expr *result);
+
+static inline bool dy_eval_env_expr(struct dy_core_ctx *ctx, struct dy_core_expr expr, bool *is_value, struct dy_core_expr *result);
+
+/** Evaluates 'expr' in 'env'. Returns false if (expr, env) already is the result. */
+static inline bool dy_eval_closure(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_eval_env *env, bool *is_value, struct dy_eval_closure *result);
+
+static inline bool dy_eval_closure_elim(struct dy_core_ctx *ctx, struct dy_core_elim elim, struct dy_eval_env *env, bool *is_value, struct dy_eval_closure *result);
+
+/**
+ * If 'elim' can step given its evaluated children, returns the expression to continue with
+ * and the environment to continue in. If 'proof' gets bound in that environment, '*have_proof' is cleared.
+ */
+static inline bool dy_eval_closure_step(struct dy_core_ctx *ctx, struct dy_core_elim elim, struct dy_eval_closure expr, struct dy_eval_closure proof, bool *have_proof, const struct dy_core_expr **body, struct dy_eval_env **body_env);
+
+/** Evaluates an elimination that can't step by itself. Consumes 'expr' and 'proof'. */
+static inline bool dy_eval_closure_elim_stuck(struct dy_core_ctx *ctx, struct dy_core_elim elim, struct dy_eval_env *env, struct dy_eval_closure expr, bool expr_is_value, bool expr_is_new, struct dy_eval_closure proof, bool have_proof, bool proof_is_value, bool proof_is_new, bool *is_value, struct dy_eval_closure *result);
+
+static inline bool dy_eval_closure_custom(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_eval_env *env, bool *is_value, struct dy_eval_closure *result);
+
+/** Substitutes everything bound in 'env' into 'expr'. Returns false if nothing changed. */
+static inline bool dy_eval_substitute_env(struct dy_core_ctx *ctx, struct dy_core_expr expr, const struct dy_eval_env *env, struct dy_core_expr *result);
+
+static inline struct dy_core_expr dy_eval_read_back(struct dy_core_ctx *ctx, struct dy_eval_closure closure);
+
+/** Turns 'closure' into an expression that is valid in 'env'. Consumes 'closure'. */
+static inline struct dy_core_expr dy_eval_embed(struct dy_core_ctx *ctx, struct dy_eval_closure closure, const struct dy_eval_env *env);
+
+/** Consumes 'value' and 'next'. */
+static inline struct dy_eval_env *dy_eval_env_bind(size_t id, struct dy_eval_closure value, struct dy_eval_env *next);
+
+static inline struct dy_eval_env *dy_eval_env_retain(struct dy_eval_env *env);
+
+static inline void dy_eval_env_release(struct dy_core_ctx *ctx, struct dy_eval_env *env);
+
+static inline struct dy_eval_closure dy_eval_closure_retain(struct dy_core_ctx *ctx, struct dy_eval_closure closure);
+
+static inline void dy_eval_closure_release(struct dy_core_ctx *ctx, struct dy_eval_closure closure);
+
 bool dy_eval_expr(struct dy_core_ctx *ctx, struct dy_core_expr expr, bool *is_value, struct dy_core_expr *result)
 {
+    if (ctx->bytecode != NULL) {
+        return dy_bytecode_eval(ctx, expr, is_value, result);
+    }
+
+    if (ctx->eval_with_environments) {
+        return dy_eval_env_expr(ctx, expr, is_value, result);
+    }
+
     switch (expr.tag) {
     case DY_CORE_EXPR_INTRO:
         switch (expr.intro.tag) {
@@ -129,7 +206,8 @@ bool dy_eval_elim(struct dy_core_ctx *ctx, struct dy_core_elim elim, bool *is_va
     bool did_transform = false;
     bool changed_check_result = false;
     if (elim.check_result == DY_MAYBE) {
-        struct dy_core_expr subtype = dy_type_of(ctx, new_expr);
+        // Unless evaluating changed it, the function is still the node of the elimination.
+        struct dy_core_expr subtype = expr_is_new ? dy_type_of(ctx, new_expr) : dy_type_of_ptr(ctx, elim.expr);
 
         struct dy_core_expr supertype = {
             .tag = DY_CORE_EXPR_INTRO,
@@ -215,6 +293,8 @@ bool dy_eval_simple(struct dy_core_ctx *ctx, struct dy_core_simple simple, bool
 
 bool dy_eval_elim_single_step(struct dy_core_ctx *ctx, struct dy_core_elim elim, struct dy_core_expr *result)
 {
+    DY_STATS_COUNT(DY_STAT_EVAL_ELIM_STEP);
+
     if (elim.check_result != DY_YES) {
         return false;
     }
@@ -283,7 +363,7 @@ bool dy_eval_map_assumption_elim(struct dy_core_ctx *ctx, struct dy_core_map_ass
         .type = *subst_ass.type
     });
 
-    struct dy_core_expr type = dy_type_of(ctx, *subst_ass.expr);
+    struct dy_core_expr type = dy_type_of_ptr(ctx, subst_ass.expr);
 
     ctx->free_variables.num_elems--;
 
@@ -346,7 +426,7 @@ bool dy_eval_map_choice_elim(struct dy_core_ctx *ctx, struct dy_core_map_choice
         .type = *ass.type
     });
 
-    struct dy_core_expr type = dy_type_of(ctx, *ass.expr);
+    struct dy_core_expr type = dy_type_of_ptr(ctx, ass.expr);
 
     ctx->free_variables.num_elems--;
 
@@ -399,3 +479,395 @@ bool dy_eval_map_recursion_elim(struct dy_core_ctx *ctx, struct dy_core_map_recu
 {
     dy_bail("not yet");
 }
+
+bool dy_eval_env_expr(struct dy_core_ctx *ctx, struct dy_core_expr expr, bool *is_value, struct dy_core_expr *result)
+{
+    struct dy_eval_closure closure;
+    if (!dy_eval_closure(ctx, expr, NULL, is_value, &closure)) {
+        return false;
+    }
+
+    *result = dy_eval_read_back(ctx, closure);
+
+    dy_eval_closure_release(ctx, closure);
+
+    return true;
+}
+
+bool dy_eval_closure(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_eval_env *env, bool *is_value, struct dy_eval_closure *result)
+{
+    switch (expr.tag) {
+    case DY_CORE_EXPR_INTRO:
+        switch (expr.intro.tag) {
+        case DY_CORE_INTRO_COMPLEX:
+            switch (expr.intro.complex.tag) {
+            case DY_CORE_COMPLEX_ASSUMPTION: {
+                struct dy_eval_closure new_type;
+                if (!dy_eval_closure(ctx, *expr.intro.complex.assumption.type, env, is_value, &new_type)) {
+                    return false;
+                }
+
+                expr.intro.complex.assumption.type = dy_core_expr_new(dy_eval_embed(ctx, new_type, env));
+                dy_core_expr_retain_ptr(ctx, expr.intro.complex.assumption.expr);
+
+                *result = (struct dy_eval_closure){
+                    .expr = expr,
+                    .env = dy_eval_env_retain(env)
+                };
+                return true;
+            }
+            case DY_CORE_COMPLEX_CHOICE:
+            case DY_CORE_COMPLEX_RECURSION:
+                *is_value = true;
+                return false;
+            }
+
+            dy_bail("impossible");
+        case DY_CORE_INTRO_SIMPLE: {
+            if (expr.intro.simple.tag != DY_CORE_SIMPLE_PROOF) {
+                *is_value = true;
+                return false;
+            }
+
+            struct dy_eval_closure new_proof;
+            if (!dy_eval_closure(ctx, *expr.intro.simple.proof, env, is_value, &new_proof)) {
+                return false;
+            }
+
+            expr.intro.simple.proof = dy_core_expr_new(dy_eval_embed(ctx, new_proof, env));
+            dy_core_expr_retain_ptr(ctx, expr.intro.simple.out);
+
+            *result = (struct dy_eval_closure){
+                .expr = expr,
+                .env = dy_eval_env_retain(env)
+            };
+            return true;
+        }
+        }
+
+        dy_bail("impossible");
+    case DY_CORE_EXPR_ELIM:
+        return dy_eval_closure_elim(ctx, expr.elim, env, is_value, result);
+    case DY_CORE_EXPR_VARIABLE:
+        *is_value = true;
+
+        for (struct dy_eval_env *e = env; e != NULL; e = e->next) {
+            if (e->id == expr.variable_id) {
+                *result = dy_eval_closure_retain(ctx, e->value);
+                return true;
+            }
+        }
+
+        return false;
+    case DY_CORE_EXPR_MAP:
+    case DY_CORE_EXPR_ANY:
+    case DY_CORE_EXPR_VOID:
+    case DY_CORE_EXPR_INFERENCE_VAR:
+        *is_value = true;
+        return false;
+    case DY_CORE_EXPR_INFERENCE_CTX:
+        dy_bail("impossible");
+    case DY_CORE_EXPR_CUSTOM:
+        return dy_eval_closure_custom(ctx, expr, env, is_value, result);
+    }
+
+    dy_bail("Impossible object type.");
+}
+
+bool dy_eval_closure_elim(struct dy_core_ctx *ctx, struct dy_core_elim elim, struct dy_eval_env *env, bool *is_value, struct dy_eval_closure *result)
+{
+    bool expr_is_value;
+    struct dy_eval_closure expr;
+    bool expr_is_new = dy_eval_closure(ctx, *elim.expr, env, &expr_is_value, &expr);
+    if (!expr_is_new) {
+        expr = (struct dy_eval_closure){
+            .expr = dy_core_expr_retain(ctx, *elim.expr),
+            .env = dy_eval_env_retain(env)
+        };
+    }
+
+    bool have_proof = elim.simple.tag == DY_CORE_SIMPLE_PROOF;
+    bool proof_is_value = true;
+    bool proof_is_new = false;
+    struct dy_eval_closure proof = { .env = NULL };
+    if (have_proof) {
+        proof_is_new = dy_eval_closure(ctx, *elim.simple.proof, env, &proof_is_value, &proof);
+        if (!proof_is_new) {
+            proof = (struct dy_eval_closure){
+                .expr = dy_core_expr_retain(ctx, *elim.simple.proof),
+                .env = dy_eval_env_retain(env)
+            };
+        }
+    }
+
+    const struct dy_core_expr *body;
+    struct dy_eval_env *body_env;
+    if (expr_is_value && proof_is_value && dy_eval_closure_step(ctx, elim, expr, proof, &have_proof, &body, &body_env)) {
+        if (!dy_eval_closure(ctx, *body, body_env, is_value, result)) {
+            *result = (struct dy_eval_closure){
+                .expr = dy_core_expr_retain(ctx, *body),
+                .env = body_env
+            };
+        } else {
+            dy_eval_env_release(ctx, body_env);
+        }
+
+        dy_eval_closure_release(ctx, expr);
+        if (have_proof) {
+            dy_eval_closure_release(ctx, proof);
+        }
+
+        return true;
+    }
+
+    return dy_eval_closure_elim_stuck(ctx, elim, env, expr, expr_is_value, expr_is_new, proof, have_proof, proof_is_value, proof_is_new, is_value, result);
+}
+
+bool dy_eval_closure_step(struct dy_core_ctx *ctx, struct dy_core_elim elim, struct dy_eval_closure expr, struct dy_eval_closure proof, bool *have_proof, const struct dy_core_expr **body, struct dy_eval_env **body_env)
+{
+    if (elim.check_result != DY_YES || expr.expr.tag != DY_CORE_EXPR_INTRO) {
+        return false;
+    }
+
+    if (expr.expr.intro.tag == DY_CORE_INTRO_SIMPLE) {
+        *body = expr.expr.intro.simple.out;
+        *body_env = dy_eval_env_retain(expr.env);
+        return true;
+    }
+
+    switch (expr.expr.intro.complex.tag) {
+    case DY_CORE_COMPLEX_ASSUMPTION:
+        assert(*have_proof);
+        *body = expr.expr.intro.complex.assumption.expr;
+        *body_env = dy_eval_env_bind(expr.expr.intro.complex.assumption.id, proof, dy_eval_env_retain(expr.env));
+        *have_proof = false; // Moved into the environment.
+        return true;
+    case DY_CORE_COMPLEX_CHOICE:
+        if (elim.simple.direction == DY_LEFT) {
+            *body = expr.expr.intro.complex.choice.left;
+        } else {
+            *body = expr.expr.intro.complex.choice.right;
+        }
+
+        *body_env = dy_eval_env_retain(expr.env);
+        return true;
+    case DY_CORE_COMPLEX_RECURSION:
+        // The recursion is bound to itself instead of being substituted into its body.
+        *body = expr.expr.intro.complex.recursion.expr;
+        *body_env = dy_eval_env_bind(expr.expr.intro.complex.recursion.id, dy_eval_closure_retain(ctx, expr), dy_eval_env_retain(expr.env));
+        return true;
+    }
+
+    dy_bail("impossible");
+}
+
+bool dy_eval_closure_elim_stuck(struct dy_core_ctx *ctx, struct dy_core_elim elim, struct dy_eval_env *env, struct dy_eval_closure expr, bool expr_is_value, bool expr_is_new, struct dy_eval_closure proof, bool have_proof, bool proof_is_value, bool proof_is_new, bool *is_value, struct dy_eval_closure *result)
+{
+    if (expr_is_value && proof_is_value && (elim.check_result == DY_MAYBE || (elim.check_result == DY_YES && expr.expr.tag == DY_CORE_EXPR_MAP))) {
+        // Runtime subtype checks and maps are left to the substituting engine.
+        struct dy_core_elim read_back = elim;
+        read_back.expr = dy_core_expr_new(dy_eval_read_back(ctx, expr));
+
+        if (have_proof) {
+            read_back.simple.proof = dy_core_expr_new(dy_eval_read_back(ctx, proof));
+        }
+
+        read_back.simple.out = dy_core_expr_new(dy_eval_read_back(ctx, (struct dy_eval_closure){ .expr = *elim.simple.out, .env = env }));
+
+        struct dy_core_expr read_back_expr = {
+            .tag = DY_CORE_EXPR_ELIM,
+            .elim = read_back
+        };
+
+        dy_eval_closure_release(ctx, expr);
+        if (have_proof) {
+            dy_eval_closure_release(ctx, proof);
+        }
+
+        struct dy_core_expr new_expr;
+        if (dy_eval_elim(ctx, read_back, is_value, &new_expr)) {
+            dy_core_expr_release(ctx, read_back_expr);
+            *result = (struct dy_eval_closure){ .expr = new_expr, .env = NULL };
+            return true;
+        }
+
+        if (!expr_is_new && !proof_is_new && env == NULL) {
+            dy_core_expr_release(ctx, read_back_expr);
+            return false;
+        }
+
+        *result = (struct dy_eval_closure){ .expr = read_back_expr, .env = NULL };
+        return true;
+    }
+
+    *is_value = false;
+
+    if (!expr_is_new && !proof_is_new) {
+        dy_eval_closure_release(ctx, expr);
+        if (have_proof) {
+            dy_eval_closure_release(ctx, proof);
+        }
+
+        return false;
+    }
+
+    elim.expr = dy_core_expr_new(dy_eval_embed(ctx, expr, env));
+
+    if (have_proof) {
+        elim.simple.proof = dy_core_expr_new(dy_eval_embed(ctx, proof, env));
+    }
+
+    dy_core_expr_retain_ptr(ctx, elim.simple.out);
+
+    *result = (struct dy_eval_closure){
+        .expr = {
+            .tag = DY_CORE_EXPR_ELIM,
+            .elim = elim },
+        .env = dy_eval_env_retain(env)
+    };
+
+    return true;
+}
+
+bool dy_eval_closure_custom(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_eval_env *env, bool *is_value, struct dy_eval_closure *result)
+{
+    // Custom expressions only know how to evaluate themselves when closed.
+    struct dy_core_expr closed;
+    bool is_new = dy_eval_substitute_env(ctx, expr, env, &closed);
+    if (!is_new) {
+        closed = expr;
+    }
+
+    const struct dy_core_custom_shared *s = dy_array_pos(&ctx->custom_shared, closed.custom.id);
+
+    struct dy_core_expr new_expr;
+    if (s->eval(ctx, closed.custom.data, is_value, &new_expr)) {
+        if (is_new) {
+            dy_core_expr_release(ctx, closed);
+        }
+
+        *result = (struct dy_eval_closure){ .expr = new_expr, .env = NULL };
+        return true;
+    }
+
+    if (!is_new) {
+        return false;
+    }
+
+    *result = (struct dy_eval_closure){ .expr = closed, .env = NULL };
+    return true;
+}
+
+bool dy_eval_substitute_env(struct dy_core_ctx *ctx, struct dy_core_expr expr, const struct dy_eval_env *env, struct dy_core_expr *result)
+{
+    bool is_new = false;
+
+    for (const struct dy_eval_env *e = env; e != NULL; e = e->next) {
+        bool is_shadowed = false;
+        for (const struct dy_eval_env *e2 = env; e2 != e; e2 = e2->next) {
+            if (e2->id == e->id) {
+                is_shadowed = true;
+                break;
+            }
+        }
+
+        if (is_shadowed || !dy_core_expr_contains_this_variable(ctx, e->id, expr)) {
+            continue;
+        }
+
+        struct dy_core_expr value = dy_eval_read_back(ctx, e->value);
+
+        struct dy_core_expr new_expr;
+        if (dy_substitute(ctx, expr, e->id, value, &new_expr)) {
+            if (is_new) {
+                dy_core_expr_release(ctx, expr);
+            }
+
+            expr = new_expr;
+            is_new = true;
+        }
+
+        dy_core_expr_release(ctx, value);
+    }
+
+    if (is_new) {
+        *result = expr;
+    }
+
+    return is_new;
+}
+
+struct dy_core_expr dy_eval_read_back(struct dy_core_ctx *ctx, struct dy_eval_closure closure)
+{
+    struct dy_core_expr result;
+    if (!dy_eval_substitute_env(ctx, closure.expr, closure.env, &result)) {
+        result = dy_core_expr_retain(ctx, closure.expr);
+    }
+
+    return result;
+}
+
+struct dy_core_expr dy_eval_embed(struct dy_core_ctx *ctx, struct dy_eval_closure closure, const struct dy_eval_env *env)
+{
+    if (closure.env == NULL || closure.env == env) {
+        dy_eval_env_release(ctx, closure.env);
+        return closure.expr;
+    }
+
+    struct dy_core_expr result = dy_eval_read_back(ctx, closure);
+
+    dy_eval_closure_release(ctx, closure);
+
+    return result;
+}
+
+struct dy_eval_env *dy_eval_env_bind(size_t id, struct dy_eval_closure value, struct dy_eval_env *next)
+{
+    struct dy_eval_env env = {
+        .id = id,
+        .value = value,
+        .next = next
+    };
+
+    return dy_rc_new(&env, sizeof env, DY_ALIGNOF(struct dy_eval_env));
+}
+
+struct dy_eval_env *dy_eval_env_retain(struct dy_eval_env *env)
+{
+    if (env == NULL) {
+        return NULL;
+    }
+
+    return dy_rc_retain(env, DY_ALIGNOF(struct dy_eval_env));
+}
+
+void dy_eval_env_release(struct dy_core_ctx *ctx, struct dy_eval_env *env)
+{
+    // Iterative, since environments can get long.
+    while (env != NULL) {
+        struct dy_eval_env e = *env;
+        if (dy_rc_release(env, DY_ALIGNOF(struct dy_eval_env)) != 0) {
+            return;
+        }
+
+        dy_eval_closure_release(ctx, e.value);
+
+        env = e.next;
+    }
+}
+
+struct dy_eval_closure dy_eval_closure_retain(struct dy_core_ctx *ctx, struct dy_eval_closure closure)
+{
+    dy_core_expr_retain(ctx, closure.expr);
+    dy_eval_env_retain(closure.env);
+    return closure;
+}
+
+void dy_eval_closure_release(struct dy_core_ctx *ctx, struct dy_eval_closure closure)
+{
+    dy_core_expr_release(ctx, closure.expr);
+    dy_eval_env_release(ctx, closure.env);
+}
+
+// The VM and the evaluator call each other.
+#include "bytecode.h"
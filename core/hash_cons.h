@@ -0,0 +1,711 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "core.h"
+
+#include <stdint.h>
+
+/**
+ * This file implements hash-consing of Core expressions.
+ *
+ * Interned nodes live in ctx->hash_consed_exprs, an open-addressed table whose
+ * capacity is always a power of two. A capacity of 0 disables hash-consing altogether.
+ *
+ * The hash of an expression is computed modulo alpha-renaming: Variables bound
+ * inside the hashed expression contribute their De-Bruijn index, all others their id.
+ * Two nodes are only ever shared if they are alpha-equivalent *and* agree on all the
+ * bookkeeping that dy_are_equal ignores (check results, map dependences).
+ *
+ * The hash of a node on its own is stored in the node (see struct dy_core_node).
+ * It's reused wherever none of the enclosing binders occurs in the node,
+ * since the node then hashes the same as on its own. Already interned
+ * expressions are thus hashed, and found in the table, without walking them.
+ */
+
+struct dy_hash_consed_expr {
+    size_t hash;
+    struct dy_core_expr *expr;
+};
+
+/** Binders nest about this deep at most in typical code, so scratch arrays start out on the stack. */
+#define DY_HASH_CONS_SMALL_SIZE 16
+
+/**
+ * Scratch space of one hash-consing run.
+ *
+ * 'equal_variables' deliberately doesn't reuse ctx->equal_variables,
+ * since hash-consing can happen while substitution has pushed renamings there.
+ */
+struct dy_hash_cons_state {
+    dy_array_t binders;
+    dy_array_t equal_variables;
+    bool hash_only;
+    bool content_only; // See dy_hash_cons_content_hash().
+};
+
+/**
+ * Interns all subexpressions of 'expr'. Consumes 'expr'.
+ *
+ * The top-level node itself is a value and can therefore not be shared.
+ */
+static inline struct dy_core_expr dy_hash_cons(struct dy_core_ctx *ctx, struct dy_core_expr expr);
+
+/** Consumes the reference to 'expr' and returns a reference to its canonical node. */
+static inline struct dy_core_expr *dy_hash_cons_ptr(struct dy_core_ctx *ctx, struct dy_core_expr *expr);
+
+/**
+ * Computes the hash hash-consing would use for 'expr', without interning anything.
+ * Works regardless of whether hash-consing is enabled.
+ */
+static inline size_t dy_hash_cons_hash(struct dy_core_ctx *ctx, struct dy_core_expr expr);
+
+/**
+ * Like dy_hash_cons_hash(), but custom nodes only contribute their kind and inference
+ * contexts are hashed independently of their ids, just like other binders.
+ * Suitable for keys compared with dy_are_equal(), which looks inside custom data.
+ */
+static inline size_t dy_hash_cons_content_hash(struct dy_core_ctx *ctx, struct dy_core_expr expr);
+
+/** Whether 'e1' and 'e2' would be interned as the same node. */
+static inline bool dy_hash_cons_exprs_are_identical(struct dy_core_ctx *ctx, struct dy_core_expr e1, struct dy_core_expr e2);
+
+/** Releases every interned node. */
+static inline void dy_hash_cons_clear(struct dy_core_ctx *ctx);
+
+static inline struct dy_core_expr dy_hash_cons_children(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_hash_cons_state *state, size_t *hash);
+
+static inline struct dy_core_expr *dy_hash_cons_child(struct dy_core_ctx *ctx, struct dy_core_expr *expr, struct dy_hash_cons_state *state, size_t *hash);
+
+static inline struct dy_core_assumption dy_hash_cons_assumption(struct dy_core_ctx *ctx, struct dy_core_assumption assumption, struct dy_hash_cons_state *state, size_t *hash);
+
+static inline struct dy_core_simple dy_hash_cons_simple(struct dy_core_ctx *ctx, struct dy_core_simple simple, struct dy_hash_cons_state *state, size_t *hash);
+
+/** Whether the hash of 'expr' in the scope of the binders in 'state' is the one stored in its node. */
+static inline bool dy_hash_cons_stored_hash_applies(const struct dy_hash_cons_state *state, const struct dy_core_expr *expr);
+
+static inline struct dy_core_expr *dy_hash_cons_find(struct dy_core_ctx *ctx, struct dy_hash_cons_state *state, struct dy_core_expr expr, size_t hash);
+
+static inline void dy_hash_cons_insert(struct dy_core_ctx *ctx, struct dy_core_expr *expr, size_t hash);
+
+static inline void dy_hash_cons_put(dy_array_t *table, struct dy_hash_consed_expr entry);
+
+static inline bool dy_hash_cons_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, struct dy_core_expr e1, struct dy_core_expr e2);
+
+static inline bool dy_hash_cons_ptrs_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, const struct dy_core_expr *e1, const struct dy_core_expr *e2);
+
+static inline bool dy_hash_cons_assumptions_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, struct dy_core_assumption ass1, struct dy_core_assumption ass2);
+
+static inline bool dy_hash_cons_simples_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, struct dy_core_simple simple1, struct dy_core_simple simple2);
+
+static inline bool dy_hash_cons_variables_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, size_t id1, size_t id2);
+
+static inline size_t dy_hash_combine(size_t hash, size_t value);
+
+struct dy_core_expr dy_hash_cons(struct dy_core_ctx *ctx, struct dy_core_expr expr)
+{
+    if (ctx->hash_consed_exprs.capacity == 0) {
+        return expr;
+    }
+
+    size_t binders[DY_HASH_CONS_SMALL_SIZE];
+    struct dy_equal_variables equal_variables[DY_HASH_CONS_SMALL_SIZE];
+
+    struct dy_hash_cons_state state = {
+        .binders = dy_array_create_small(binders, sizeof(size_t), DY_ALIGNOF(size_t), DY_HASH_CONS_SMALL_SIZE),
+        .equal_variables = dy_array_create_small(equal_variables, sizeof(struct dy_equal_variables), DY_ALIGNOF(struct dy_equal_variables), DY_HASH_CONS_SMALL_SIZE)
+    };
+
+    size_t hash;
+    struct dy_core_expr ret = dy_hash_cons_children(ctx, expr, &state, &hash);
+
+    dy_array_release(&state.binders);
+    dy_array_release(&state.equal_variables);
+
+    return ret;
+}
+
+struct dy_core_expr *dy_hash_cons_ptr(struct dy_core_ctx *ctx, struct dy_core_expr *expr)
+{
+    if (ctx->hash_consed_exprs.capacity == 0) {
+        return expr;
+    }
+
+    size_t binders[DY_HASH_CONS_SMALL_SIZE];
+    struct dy_equal_variables equal_variables[DY_HASH_CONS_SMALL_SIZE];
+
+    struct dy_hash_cons_state state = {
+        .binders = dy_array_create_small(binders, sizeof(size_t), DY_ALIGNOF(size_t), DY_HASH_CONS_SMALL_SIZE),
+        .equal_variables = dy_array_create_small(equal_variables, sizeof(struct dy_equal_variables), DY_ALIGNOF(struct dy_equal_variables), DY_HASH_CONS_SMALL_SIZE)
+    };
+
+    size_t hash;
+    struct dy_core_expr *ret = dy_hash_cons_child(ctx, expr, &state, &hash);
+
+    dy_array_release(&state.binders);
+    dy_array_release(&state.equal_variables);
+
+    return ret;
+}
+
+size_t dy_hash_cons_hash(struct dy_core_ctx *ctx, struct dy_core_expr expr)
+{
+    size_t binders[DY_HASH_CONS_SMALL_SIZE];
+
+    struct dy_hash_cons_state state = {
+        .binders = dy_array_create_small(binders, sizeof(size_t), DY_ALIGNOF(size_t), DY_HASH_CONS_SMALL_SIZE),
+        .hash_only = true
+    };
+
+    size_t hash;
+    dy_hash_cons_children(ctx, expr, &state, &hash);
+
+    dy_array_release(&state.binders);
+
+    return hash;
+}
+
+size_t dy_hash_cons_content_hash(struct dy_core_ctx *ctx, struct dy_core_expr expr)
+{
+    size_t binders[DY_HASH_CONS_SMALL_SIZE];
+
+    struct dy_hash_cons_state state = {
+        .binders = dy_array_create_small(binders, sizeof(size_t), DY_ALIGNOF(size_t), DY_HASH_CONS_SMALL_SIZE),
+        .hash_only = true,
+        .content_only = true
+    };
+
+    size_t hash;
+    dy_hash_cons_children(ctx, expr, &state, &hash);
+
+    dy_array_release(&state.binders);
+
+    return hash;
+}
+
+bool dy_hash_cons_exprs_are_identical(struct dy_core_ctx *ctx, struct dy_core_expr e1, struct dy_core_expr e2)
+{
+    struct dy_equal_variables storage[DY_HASH_CONS_SMALL_SIZE];
+    dy_array_t equal_variables = dy_array_create_small(storage, sizeof(struct dy_equal_variables), DY_ALIGNOF(struct dy_equal_variables), DY_HASH_CONS_SMALL_SIZE);
+
+    bool res = dy_hash_cons_are_identical(ctx, &equal_variables, e1, e2);
+
+    dy_array_release(&equal_variables);
+
+    return res;
+}
+
+void dy_hash_cons_clear(struct dy_core_ctx *ctx)
+{
+    for (size_t i = 0, size = ctx->hash_consed_exprs.capacity; i < size; ++i) {
+        struct dy_hash_consed_expr *entry = dy_array_pos_uninit(&ctx->hash_consed_exprs, i);
+        if (entry->expr != NULL) {
+            dy_core_expr_release_ptr(ctx, entry->expr);
+            entry->expr = NULL;
+        }
+    }
+
+    ctx->hash_consed_exprs.num_elems = 0;
+}
+
+struct dy_core_expr dy_hash_cons_children(struct dy_core_ctx *ctx, struct dy_core_expr expr, struct dy_hash_cons_state *state, size_t *hash)
+{
+    size_t h = dy_hash_combine(0, expr.tag);
+
+    switch (expr.tag) {
+    case DY_CORE_EXPR_INTRO:
+        h = dy_hash_combine(h, expr.intro.tag);
+        h = dy_hash_combine(h, expr.intro.polarity);
+        h = dy_hash_combine(h, expr.intro.is_implicit);
+
+        switch (expr.intro.tag) {
+        case DY_CORE_INTRO_COMPLEX:
+            h = dy_hash_combine(h, expr.intro.complex.tag);
+
+            switch (expr.intro.complex.tag) {
+            case DY_CORE_COMPLEX_ASSUMPTION:
+                expr.intro.complex.assumption = dy_hash_cons_assumption(ctx, expr.intro.complex.assumption, state, &h);
+                break;
+            case DY_CORE_COMPLEX_CHOICE: {
+                size_t h_left, h_right;
+                expr.intro.complex.choice.left = dy_hash_cons_child(ctx, expr.intro.complex.choice.left, state, &h_left);
+                expr.intro.complex.choice.right = dy_hash_cons_child(ctx, expr.intro.complex.choice.right, state, &h_right);
+                h = dy_hash_combine(dy_hash_combine(h, h_left), h_right);
+                break;
+            }
+            case DY_CORE_COMPLEX_RECURSION: {
+                DY_ARRAY_PUSH(&state->binders, size_t, expr.intro.complex.recursion.id);
+                size_t h_expr;
+                expr.intro.complex.recursion.expr = dy_hash_cons_child(ctx, expr.intro.complex.recursion.expr, state, &h_expr);
+                --state->binders.num_elems;
+                h = dy_hash_combine(h, h_expr);
+                break;
+            }
+            }
+
+            break;
+        case DY_CORE_INTRO_SIMPLE:
+            expr.intro.simple = dy_hash_cons_simple(ctx, expr.intro.simple, state, &h);
+            break;
+        }
+
+        break;
+    case DY_CORE_EXPR_ELIM: {
+        size_t h_expr;
+        expr.elim.expr = dy_hash_cons_child(ctx, expr.elim.expr, state, &h_expr);
+        h = dy_hash_combine(h, h_expr);
+        expr.elim.simple = dy_hash_cons_simple(ctx, expr.elim.simple, state, &h);
+        h = dy_hash_combine(h, expr.elim.is_implicit);
+        h = dy_hash_combine(h, expr.elim.check_result);
+        h = dy_hash_combine(h, expr.elim.eval_immediately);
+        break;
+    }
+    case DY_CORE_EXPR_MAP:
+        h = dy_hash_combine(h, expr.map.tag);
+        h = dy_hash_combine(h, expr.map.is_implicit);
+
+        switch (expr.map.tag) {
+        case DY_CORE_MAP_ASSUMPTION: {
+            DY_ARRAY_PUSH(&state->binders, size_t, expr.map.assumption.id);
+            size_t h_type;
+            expr.map.assumption.type = dy_hash_cons_child(ctx, expr.map.assumption.type, state, &h_type);
+            h = dy_hash_combine(h, h_type);
+            expr.map.assumption.assumption = dy_hash_cons_assumption(ctx, expr.map.assumption.assumption, state, &h);
+            --state->binders.num_elems;
+            h = dy_hash_combine(h, expr.map.assumption.dependence);
+            break;
+        }
+        case DY_CORE_MAP_CHOICE:
+            expr.map.choice.assumption_left = dy_hash_cons_assumption(ctx, expr.map.choice.assumption_left, state, &h);
+            expr.map.choice.assumption_right = dy_hash_cons_assumption(ctx, expr.map.choice.assumption_right, state, &h);
+            h = dy_hash_combine(h, expr.map.choice.left_dependence);
+            h = dy_hash_combine(h, expr.map.choice.right_dependence);
+            break;
+        case DY_CORE_MAP_RECURSION:
+            DY_ARRAY_PUSH(&state->binders, size_t, expr.map.recursion.id);
+            expr.map.recursion.assumption = dy_hash_cons_assumption(ctx, expr.map.recursion.assumption, state, &h);
+            --state->binders.num_elems;
+            h = dy_hash_combine(h, expr.map.recursion.dependence);
+            break;
+        }
+
+        break;
+    case DY_CORE_EXPR_VARIABLE: {
+        bool is_bound = false;
+        for (size_t i = state->binders.num_elems; i-- > 0;) {
+            if (DY_ARRAY_AT(&state->binders, size_t, i) == expr.variable_id) {
+                h = dy_hash_combine(dy_hash_combine(h, true), state->binders.num_elems - i);
+                is_bound = true;
+                break;
+            }
+        }
+
+        if (!is_bound) {
+            h = dy_hash_combine(dy_hash_combine(h, false), expr.variable_id);
+        }
+
+        break;
+    }
+    case DY_CORE_EXPR_INFERENCE_VAR: {
+        bool is_bound = false;
+        if (state->content_only) {
+            for (size_t i = state->binders.num_elems; i-- > 0;) {
+                if (DY_ARRAY_AT(&state->binders, size_t, i) == expr.inference_var_id) {
+                    h = dy_hash_combine(dy_hash_combine(h, true), state->binders.num_elems - i);
+                    is_bound = true;
+                    break;
+                }
+            }
+        }
+
+        if (!is_bound) {
+            h = dy_hash_combine(h, expr.inference_var_id);
+        }
+
+        break;
+    }
+    case DY_CORE_EXPR_INFERENCE_CTX: {
+        if (state->content_only) {
+            DY_ARRAY_PUSH(&state->binders, size_t, expr.inference_ctx.id);
+        }
+
+        size_t h_expr;
+        expr.inference_ctx.expr = dy_hash_cons_child(ctx, expr.inference_ctx.expr, state, &h_expr);
+
+        if (state->content_only) {
+            --state->binders.num_elems;
+            h = dy_hash_combine(dy_hash_combine(h, expr.inference_ctx.polarity), h_expr);
+        } else {
+            h = dy_hash_combine(dy_hash_combine(h, expr.inference_ctx.id), h_expr);
+        }
+
+        break;
+    }
+    case DY_CORE_EXPR_ANY:
+    case DY_CORE_EXPR_VOID:
+        break;
+    case DY_CORE_EXPR_CUSTOM:
+        // Custom data is opaque, so custom nodes are only identical if they share their data.
+        h = dy_hash_combine(h, expr.custom.id);
+        if (!state->content_only) {
+            h = dy_hash_combine(h, (size_t)(uintptr_t)expr.custom.data);
+        }
+        break;
+    }
+
+    *hash = h;
+
+    return expr;
+}
+
+struct dy_core_expr *dy_hash_cons_child(struct dy_core_ctx *ctx, struct dy_core_expr *expr, struct dy_hash_cons_state *state, size_t *hash)
+{
+    bool stored_hash_applies = dy_hash_cons_stored_hash_applies(state, expr);
+    size_t stored_hash = ((struct dy_core_node *)expr)->hash;
+
+    if (state->hash_only) {
+        if (stored_hash_applies && stored_hash != 0) {
+            *hash = stored_hash;
+            return expr;
+        }
+
+        dy_hash_cons_children(ctx, *expr, state, hash);
+
+        if (stored_hash_applies) {
+            ((struct dy_core_node *)expr)->hash = *hash;
+        }
+
+        return expr;
+    }
+
+    // Inference contexts are never equal to anything, so there's no point in interning them.
+    if (stored_hash_applies && stored_hash != 0 && expr->tag != DY_CORE_EXPR_INFERENCE_CTX) {
+        struct dy_core_expr *canonical = dy_hash_cons_find(ctx, state, *expr, stored_hash);
+        if (canonical != NULL) {
+            *hash = stored_hash;
+            dy_core_expr_release_ptr(ctx, expr);
+            return dy_core_expr_retain_ptr(ctx, canonical);
+        }
+    }
+
+    struct dy_core_expr e = dy_hash_cons_children(ctx, dy_core_expr_retain(ctx, *expr), state, hash);
+
+    if (e.tag != DY_CORE_EXPR_INFERENCE_CTX) {
+        struct dy_core_expr *canonical = dy_hash_cons_find(ctx, state, e, *hash);
+        if (canonical != NULL) {
+            if (stored_hash_applies) {
+                // 'canonical' is identical to 'expr', so it has the same hash on its own.
+                ((struct dy_core_node *)canonical)->hash = *hash;
+            }
+
+            dy_core_expr_release(ctx, e);
+            dy_core_expr_release_ptr(ctx, expr);
+            return dy_core_expr_retain_ptr(ctx, canonical);
+        }
+    }
+
+    // Reuse the existing node if none of its children were replaced.
+    struct dy_core_expr *node;
+    if (memcmp(expr, &e, sizeof e) == 0) {
+        dy_core_expr_release(ctx, e);
+        node = expr;
+    } else {
+        dy_core_expr_release_ptr(ctx, expr);
+        node = dy_core_expr_new(e);
+    }
+
+    if (e.tag != DY_CORE_EXPR_INFERENCE_CTX) {
+        dy_hash_cons_insert(ctx, node, *hash);
+    }
+
+    if (dy_hash_cons_stored_hash_applies(state, node)) {
+        ((struct dy_core_node *)node)->hash = *hash;
+    }
+
+    return node;
+}
+
+struct dy_core_assumption dy_hash_cons_assumption(struct dy_core_ctx *ctx, struct dy_core_assumption assumption, struct dy_hash_cons_state *state, size_t *hash)
+{
+    DY_ARRAY_PUSH(&state->binders, size_t, assumption.id);
+
+    size_t h_type, h_expr;
+    assumption.type = dy_hash_cons_child(ctx, assumption.type, state, &h_type);
+    assumption.expr = dy_hash_cons_child(ctx, assumption.expr, state, &h_expr);
+
+    --state->binders.num_elems;
+
+    *hash = dy_hash_combine(dy_hash_combine(*hash, h_type), h_expr);
+
+    return assumption;
+}
+
+struct dy_core_simple dy_hash_cons_simple(struct dy_core_ctx *ctx, struct dy_core_simple simple, struct dy_hash_cons_state *state, size_t *hash)
+{
+    size_t h = dy_hash_combine(*hash, simple.tag);
+
+    if (simple.tag == DY_CORE_SIMPLE_PROOF) {
+        size_t h_proof;
+        simple.proof = dy_hash_cons_child(ctx, simple.proof, state, &h_proof);
+        h = dy_hash_combine(h, h_proof);
+    } else if (simple.tag == DY_CORE_SIMPLE_DECISION) {
+        h = dy_hash_combine(h, simple.direction);
+    }
+
+    size_t h_out;
+    simple.out = dy_hash_cons_child(ctx, simple.out, state, &h_out);
+
+    *hash = dy_hash_combine(h, h_out);
+
+    return simple;
+}
+
+bool dy_hash_cons_stored_hash_applies(const struct dy_hash_cons_state *state, const struct dy_core_expr *expr)
+{
+    // Content hashes are never stored.
+    if (state->content_only) {
+        return false;
+    }
+
+    for (size_t i = 0, size = state->binders.num_elems; i < size; ++i) {
+        if (dy_core_expr_may_contain(expr, DY_ARRAY_AT(&state->binders, size_t, i))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct dy_core_expr *dy_hash_cons_find(struct dy_core_ctx *ctx, struct dy_hash_cons_state *state, struct dy_core_expr expr, size_t hash)
+{
+    size_t mask = ctx->hash_consed_exprs.capacity - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const struct dy_hash_consed_expr *entry = dy_array_pos_uninit(&ctx->hash_consed_exprs, i);
+        if (entry->expr == NULL) {
+            return NULL;
+        }
+
+        if (entry->hash == hash && dy_hash_cons_are_identical(ctx, &state->equal_variables, *entry->expr, expr)) {
+            return entry->expr;
+        }
+    }
+}
+
+void dy_hash_cons_insert(struct dy_core_ctx *ctx, struct dy_core_expr *expr, size_t hash)
+{
+    dy_array_t *table = &ctx->hash_consed_exprs;
+
+    // Keep the load factor below 3/4, otherwise probe sequences get long.
+    if (4 * (table->num_elems + 1) > 3 * table->capacity) {
+        dy_array_t old = *table;
+
+        *table = dy_array_create(old.elem_size, old.elem_alignment, old.capacity * 2);
+        memset(table->buffer, 0, table->elem_size * table->capacity);
+
+        for (size_t i = 0; i < old.capacity; ++i) {
+            const struct dy_hash_consed_expr *entry = dy_array_pos_uninit(&old, i);
+            if (entry->expr != NULL) {
+                dy_hash_cons_put(table, *entry);
+            }
+        }
+
+        dy_array_release(&old);
+    }
+
+    dy_hash_cons_put(table, (struct dy_hash_consed_expr){
+        .hash = hash,
+        .expr = dy_core_expr_retain_ptr(ctx, expr)
+    });
+}
+
+void dy_hash_cons_put(dy_array_t *table, struct dy_hash_consed_expr entry)
+{
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = entry.hash & mask;; i = (i + 1) & mask) {
+        struct dy_hash_consed_expr *slot = dy_array_pos_uninit(table, i);
+        if (slot->expr == NULL) {
+            *slot = entry;
+            ++table->num_elems;
+            return;
+        }
+    }
+}
+
+bool dy_hash_cons_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, struct dy_core_expr e1, struct dy_core_expr e2)
+{
+    if (e1.tag != e2.tag) {
+        return false;
+    }
+
+    switch (e1.tag) {
+    case DY_CORE_EXPR_INTRO:
+        if (e1.intro.tag != e2.intro.tag || e1.intro.polarity != e2.intro.polarity || e1.intro.is_implicit != e2.intro.is_implicit) {
+            return false;
+        }
+
+        switch (e1.intro.tag) {
+        case DY_CORE_INTRO_COMPLEX:
+            if (e1.intro.complex.tag != e2.intro.complex.tag) {
+                return false;
+            }
+
+            switch (e1.intro.complex.tag) {
+            case DY_CORE_COMPLEX_ASSUMPTION:
+                return dy_hash_cons_assumptions_are_identical(ctx, equal_variables, e1.intro.complex.assumption, e2.intro.complex.assumption);
+            case DY_CORE_COMPLEX_CHOICE:
+                return dy_hash_cons_ptrs_are_identical(ctx, equal_variables, e1.intro.complex.choice.left, e2.intro.complex.choice.left)
+                    && dy_hash_cons_ptrs_are_identical(ctx, equal_variables, e1.intro.complex.choice.right, e2.intro.complex.choice.right);
+            case DY_CORE_COMPLEX_RECURSION: {
+                dy_array_add(equal_variables, &(struct dy_equal_variables){
+                    .id1 = e1.intro.complex.recursion.id,
+                    .id2 = e2.intro.complex.recursion.id
+                });
+
+                bool res = dy_hash_cons_ptrs_are_identical(ctx, equal_variables, e1.intro.complex.recursion.expr, e2.intro.complex.recursion.expr);
+
+                --equal_variables->num_elems;
+
+                return res;
+            }
+            }
+
+            dy_bail("impossible");
+        case DY_CORE_INTRO_SIMPLE:
+            return dy_hash_cons_simples_are_identical(ctx, equal_variables, e1.intro.simple, e2.intro.simple);
+        }
+
+        dy_bail("impossible");
+    case DY_CORE_EXPR_ELIM:
+        return e1.elim.is_implicit == e2.elim.is_implicit
+            && e1.elim.check_result == e2.elim.check_result
+            && e1.elim.eval_immediately == e2.elim.eval_immediately
+            && dy_hash_cons_ptrs_are_identical(ctx, equal_variables, e1.elim.expr, e2.elim.expr)
+            && dy_hash_cons_simples_are_identical(ctx, equal_variables, e1.elim.simple, e2.elim.simple);
+    case DY_CORE_EXPR_MAP:
+        if (e1.map.tag != e2.map.tag || e1.map.is_implicit != e2.map.is_implicit) {
+            return false;
+        }
+
+        switch (e1.map.tag) {
+        case DY_CORE_MAP_ASSUMPTION: {
+            if (e1.map.assumption.dependence != e2.map.assumption.dependence) {
+                return false;
+            }
+
+            dy_array_add(equal_variables, &(struct dy_equal_variables){
+                .id1 = e1.map.assumption.id,
+                .id2 = e2.map.assumption.id
+            });
+
+            bool res = dy_hash_cons_ptrs_are_identical(ctx, equal_variables, e1.map.assumption.type, e2.map.assumption.type)
+                && dy_hash_cons_assumptions_are_identical(ctx, equal_variables, e1.map.assumption.assumption, e2.map.assumption.assumption);
+
+            --equal_variables->num_elems;
+
+            return res;
+        }
+        case DY_CORE_MAP_CHOICE:
+            return e1.map.choice.left_dependence == e2.map.choice.left_dependence
+                && e1.map.choice.right_dependence == e2.map.choice.right_dependence
+                && dy_hash_cons_assumptions_are_identical(ctx, equal_variables, e1.map.choice.assumption_left, e2.map.choice.assumption_left)
+                && dy_hash_cons_assumptions_are_identical(ctx, equal_variables, e1.map.choice.assumption_right, e2.map.choice.assumption_right);
+        case DY_CORE_MAP_RECURSION: {
+            if (e1.map.recursion.dependence != e2.map.recursion.dependence) {
+                return false;
+            }
+
+            dy_array_add(equal_variables, &(struct dy_equal_variables){
+                .id1 = e1.map.recursion.id,
+                .id2 = e2.map.recursion.id
+            });
+
+            bool res = dy_hash_cons_assumptions_are_identical(ctx, equal_variables, e1.map.recursion.assumption, e2.map.recursion.assumption);
+
+            --equal_variables->num_elems;
+
+            return res;
+        }
+        }
+
+        dy_bail("impossible");
+    case DY_CORE_EXPR_VARIABLE:
+        return dy_hash_cons_variables_are_identical(ctx, equal_variables, e1.variable_id, e2.variable_id);
+    case DY_CORE_EXPR_INFERENCE_VAR:
+        return e1.inference_var_id == e2.inference_var_id;
+    case DY_CORE_EXPR_INFERENCE_CTX:
+        return false;
+    case DY_CORE_EXPR_ANY:
+    case DY_CORE_EXPR_VOID:
+        return true;
+    case DY_CORE_EXPR_CUSTOM:
+        return e1.custom.id == e2.custom.id && e1.custom.data == e2.custom.data;
+    }
+
+    dy_bail("impossible");
+}
+
+bool dy_hash_cons_ptrs_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, const struct dy_core_expr *e1, const struct dy_core_expr *e2)
+{
+    if (e1 == e2) {
+        return true;
+    }
+
+    return dy_hash_cons_are_identical(ctx, equal_variables, *e1, *e2);
+}
+
+bool dy_hash_cons_assumptions_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, struct dy_core_assumption ass1, struct dy_core_assumption ass2)
+{
+    dy_array_add(equal_variables, &(struct dy_equal_variables){
+        .id1 = ass1.id,
+        .id2 = ass2.id
+    });
+
+    bool res = dy_hash_cons_ptrs_are_identical(ctx, equal_variables, ass1.type, ass2.type)
+        && dy_hash_cons_ptrs_are_identical(ctx, equal_variables, ass1.expr, ass2.expr);
+
+    --equal_variables->num_elems;
+
+    return res;
+}
+
+bool dy_hash_cons_simples_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, struct dy_core_simple simple1, struct dy_core_simple simple2)
+{
+    if (simple1.tag != simple2.tag) {
+        return false;
+    }
+
+    if (simple1.tag == DY_CORE_SIMPLE_PROOF && !dy_hash_cons_ptrs_are_identical(ctx, equal_variables, simple1.proof, simple2.proof)) {
+        return false;
+    }
+
+    if (simple1.tag == DY_CORE_SIMPLE_DECISION && simple1.direction != simple2.direction) {
+        return false;
+    }
+
+    return dy_hash_cons_ptrs_are_identical(ctx, equal_variables, simple1.out, simple2.out);
+}
+
+bool dy_hash_cons_variables_are_identical(struct dy_core_ctx *ctx, dy_array_t *equal_variables, size_t id1, size_t id2)
+{
+    // The innermost binder wins, so search from the back.
+    for (size_t i = equal_variables->num_elems; i-- > 0;) {
+        struct dy_equal_variables v = DY_ARRAY_AT(equal_variables, struct dy_equal_variables, i);
+
+        if (v.id1 == id1 || v.id2 == id2) {
+            return v.id1 == id1 && v.id2 == id2;
+        }
+    }
+
+    return id1 == id2;
+}
+
+size_t dy_hash_combine(size_t hash, size_t value)
+{
+    return hash ^ (value + (size_t)0x9e3779b9 + (hash << 6) + (hash >> 2));
+}
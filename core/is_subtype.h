@@ -11,6 +11,8 @@
 #include "type_of.h"
 #include "substitute.h"
 #include "are_equal.h"
+#include "hash_cons.h"
+#include "subtype_memo.h"
 
 /**
  * Implementation of the subtype check.
@@ -30,6 +32,8 @@
 
 static inline dy_ternary_t dy_is_subtype(struct dy_core_ctx *ctx, struct dy_core_expr subtype, struct dy_core_expr supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr);
 
+static inline dy_ternary_t dy_is_subtype_no_memo(struct dy_core_ctx *ctx, struct dy_core_expr subtype, struct dy_core_expr supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr);
+
 
 static inline dy_ternary_t dy_complex_are_subtypes(struct dy_core_ctx *ctx, struct dy_core_intro subtype, struct dy_core_intro supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr);
 
@@ -98,6 +102,56 @@ static inline dy_ternary_t dy_is_subtype_of_implicit_recursion(struct dy_core_ct
 
 
 dy_ternary_t dy_is_subtype(struct dy_core_ctx *ctx, struct dy_core_expr subtype, struct dy_core_expr supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr)
+{
+    DY_STATS_COUNT(DY_STAT_IS_SUBTYPE);
+
+    if (!dy_subtype_memo_applies(ctx, subtype, supertype)) {
+        return dy_is_subtype_no_memo(ctx, subtype, supertype, subtype_expr, new_subtype_expr, did_transform_subtype_expr);
+    }
+
+    struct dy_core_subtype_check_frame frame = {
+        .hash = dy_hash_combine(dy_hash_cons_hash(ctx, subtype), dy_hash_cons_hash(ctx, supertype)),
+        .scope_hash = dy_subtype_memo_scope_hash(ctx),
+        .subtype = subtype,
+        .supertype = supertype,
+        .is_coinductive = dy_subtype_memo_is_recursion(subtype) || dy_subtype_memo_is_recursion(supertype),
+        .relied_on_assumption = false,
+        .next = ctx->subtype_check_frames
+    };
+
+    dy_ternary_t res;
+    if (dy_subtype_memo_lookup(ctx, &frame, &res)) {
+        return res;
+    }
+
+    size_t constraints_start = ctx->constraints.num_elems;
+    size_t recovered_pos_inf_vars_start = ctx->recovered_positive_inference_ids.num_elems;
+    size_t recovered_neg_inf_vars_start = ctx->recovered_negative_inference_ids.num_elems;
+    size_t captured_inference_vars_start = ctx->captured_inference_vars.num_elems;
+
+    ctx->subtype_check_frames = &frame;
+
+    bool did_transform = false;
+    res = dy_is_subtype_no_memo(ctx, subtype, supertype, subtype_expr, new_subtype_expr, &did_transform);
+
+    ctx->subtype_check_frames = frame.next;
+
+    if (did_transform) {
+        *did_transform_subtype_expr = true;
+        return res;
+    }
+
+    if (!frame.relied_on_assumption
+        && ctx->recovered_positive_inference_ids.num_elems == recovered_pos_inf_vars_start
+        && ctx->recovered_negative_inference_ids.num_elems == recovered_neg_inf_vars_start
+        && ctx->captured_inference_vars.num_elems == captured_inference_vars_start) {
+        dy_subtype_memo_insert(ctx, &frame, res, constraints_start);
+    }
+
+    return res;
+}
+
+dy_ternary_t dy_is_subtype_no_memo(struct dy_core_ctx *ctx, struct dy_core_expr subtype, struct dy_core_expr supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr)
 {
     if (subtype.tag == DY_CORE_EXPR_INTRO && supertype.tag == DY_CORE_EXPR_INTRO && subtype.intro.is_implicit == supertype.intro.is_implicit) {
         if (subtype.intro.polarity == DY_POLARITY_NEGATIVE && supertype.intro.polarity == DY_POLARITY_POSITIVE) {
@@ -176,16 +230,16 @@ dy_ternary_t dy_is_subtype(struct dy_core_ctx *ctx, struct dy_core_expr subtype,
 
         size_t constraint_start1 = ctx->constraints.num_elems;
 
-        dy_array_add(&ctx->constraints, &(struct dy_constraint){
+        dy_constraint_add(ctx, (struct dy_constraint){
             .id = subtype.inference_var_id,
-            .upper = dy_core_expr_retain(ctx, supertype),
+            .upper = dy_hash_cons(ctx, dy_core_expr_retain(ctx, supertype)),
             .have_lower = false,
             .have_upper = true
         });
 
-        dy_array_add(&ctx->constraints, &(struct dy_constraint){
+        dy_constraint_add(ctx, (struct dy_constraint){
             .id = supertype.inference_var_id,
-            .lower = dy_core_expr_retain(ctx, subtype),
+            .lower = dy_hash_cons(ctx, dy_core_expr_retain(ctx, subtype)),
             .have_lower = true,
             .have_upper = false
         });
@@ -217,9 +271,9 @@ dy_ternary_t dy_is_subtype(struct dy_core_ctx *ctx, struct dy_core_expr subtype,
     }
 
     if (subtype.tag == DY_CORE_EXPR_INFERENCE_VAR) {
-        dy_array_add(&ctx->constraints, &(struct dy_constraint){
+        dy_constraint_add(ctx, (struct dy_constraint){
             .id = subtype.inference_var_id,
-            .upper = dy_core_expr_retain(ctx, supertype),
+            .upper = dy_hash_cons(ctx, dy_core_expr_retain(ctx, supertype)),
             .have_upper = true,
             .have_lower = false
         });
@@ -228,9 +282,9 @@ dy_ternary_t dy_is_subtype(struct dy_core_ctx *ctx, struct dy_core_expr subtype,
     }
 
     if (supertype.tag == DY_CORE_EXPR_INFERENCE_VAR) {
-        dy_array_add(&ctx->constraints, &(struct dy_constraint){
+        dy_constraint_add(ctx, (struct dy_constraint){
             .id = supertype.inference_var_id,
-            .lower = dy_core_expr_retain(ctx, subtype),
+            .lower = dy_hash_cons(ctx, dy_core_expr_retain(ctx, subtype)),
             .have_lower = true,
             .have_upper = false
         });
@@ -594,10 +648,7 @@ dy_ternary_t dy_negative_assumptions_are_subtypes(struct dy_core_ctx *ctx, struc
         return DY_NO;
     }
 
-    dy_array_add(&ctx->equal_variables, &(struct dy_equal_variables){
-        .id1 = subtype.id,
-        .id2 = supertype.id
-    });
+    dy_equal_variables_push(ctx, subtype.id, supertype.id);
 
     size_t id = ctx->running_id++;
     struct dy_core_expr id_expr = {
@@ -609,7 +660,7 @@ dy_ternary_t dy_negative_assumptions_are_subtypes(struct dy_core_ctx *ctx, struc
     bool did_transform_id_expr = false;
     dy_ternary_t res2 = dy_is_subtype(ctx, *subtype.expr, *supertype.expr, id_expr, &transformed_id_expr, &did_transform_id_expr);
 
-    ctx->equal_variables.num_elems--;
+    dy_equal_variables_pop(ctx);
 
     if (res2 == DY_NO) {
         return DY_NO;
@@ -1124,7 +1175,7 @@ dy_ternary_t dy_negative_recursion_is_subtype_of_unwrap(struct dy_core_ctx *ctx,
 
 dy_ternary_t dy_assumption_is_subtype_of_proof(struct dy_core_ctx *ctx, struct dy_core_assumption subtype, struct dy_core_simple supertype, bool is_implicit, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr)
 {
-    struct dy_core_expr type_of_proof = dy_type_of(ctx, *supertype.proof);
+    struct dy_core_expr type_of_proof = dy_type_of_ptr(ctx, supertype.proof);
 
     size_t constraint_start1 = ctx->constraints.num_elems;
 
@@ -1364,7 +1415,7 @@ dy_ternary_t dy_recursion_is_subtype_of_unfold(struct dy_core_ctx *ctx, struct d
 
 dy_ternary_t dy_proof_is_subtype_of_assumption(struct dy_core_ctx *ctx, struct dy_core_simple subtype, struct dy_core_assumption supertype, bool is_implicit, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr)
 {
-    struct dy_core_expr type_of_proof = dy_type_of(ctx, *subtype.proof);
+    struct dy_core_expr type_of_proof = dy_type_of_ptr(ctx, subtype.proof);
 
     size_t constraint_start1 = ctx->constraints.num_elems;
 
@@ -0,0 +1,643 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "core.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * A compact binary format for Core, used to cache checked programs (see duality.c).
+ *
+ * Numbers are written as unsigned LEB128. Nodes behind pointers are written only
+ * the first time they are encountered; later occurrences refer back to them by index,
+ * so the DAGs produced by hash-consing (see hash_cons.h) stay DAGs.
+ *
+ * Customs take part through the 'serialize' and 'deserialize' hooks of struct dy_core_custom_shared.
+ * Customs without them can't be serialized, which makes the serializer fail.
+ *
+ * Reading is bounds-checked throughout, so damaged input just fails to deserialize.
+ */
+
+struct dy_core_serialized_node {
+    const struct dy_core_expr *node;
+    size_t index;
+};
+
+struct dy_core_serializer {
+    struct dy_writer *writer;
+
+    /** Maps the nodes written so far to their index. Open-addressed with a power-of-two capacity. */
+    dy_array_t written_nodes;
+    size_t num_nodes;
+
+    /** Set once something couldn't be serialized, after which the output is useless. */
+    bool failed;
+};
+
+struct dy_core_deserializer {
+    dy_string_t bytes;
+    size_t pos;
+
+    /** The nodes read so far, by index. Each holds one reference until dy_core_deserializer_release(). */
+    dy_array_t nodes;
+};
+
+static inline struct dy_core_serializer dy_core_serializer_create(struct dy_writer *writer);
+
+static inline void dy_core_serializer_release(struct dy_core_ctx *ctx, struct dy_core_serializer *s);
+
+static inline void dy_serialize_size_t(struct dy_core_serializer *s, size_t x);
+
+/** Writes 'bytes' preceded by their size. */
+static inline void dy_serialize_bytes(struct dy_core_serializer *s, dy_string_t bytes);
+
+static inline void dy_serialize_expr(struct dy_core_ctx *ctx, struct dy_core_serializer *s, struct dy_core_expr expr);
+
+static inline void dy_serialize_expr_ptr(struct dy_core_ctx *ctx, struct dy_core_serializer *s, const struct dy_core_expr *expr);
+
+static inline void dy_serialize_assumption(struct dy_core_ctx *ctx, struct dy_core_serializer *s, struct dy_core_assumption assumption);
+
+static inline void dy_serialize_simple(struct dy_core_ctx *ctx, struct dy_core_serializer *s, struct dy_core_simple simple);
+
+static inline struct dy_core_deserializer dy_core_deserializer_create(dy_string_t bytes);
+
+static inline void dy_core_deserializer_release(struct dy_core_ctx *ctx, struct dy_core_deserializer *d);
+
+static inline bool dy_deserialize_size_t(struct dy_core_deserializer *d, size_t *x);
+
+/** Reads a number that has to be less than 'bound', like the tag of an enum. */
+static inline bool dy_deserialize_bounded(struct dy_core_deserializer *d, size_t bound, size_t *x);
+
+static inline bool dy_deserialize_bool(struct dy_core_deserializer *d, bool *x);
+
+/** The result points into the input, so it has to be copied to outlive it. */
+static inline bool dy_deserialize_bytes(struct dy_core_deserializer *d, dy_string_t *bytes);
+
+/** On success, the caller owns 'result'. */
+static inline bool dy_deserialize_expr(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_expr *result);
+
+/** On success, 'result' is borrowed from 'd' and has to be retained to outlive it. */
+static inline bool dy_deserialize_expr_ptr(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_expr **result);
+
+static inline bool dy_deserialize_assumption(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_assumption *result);
+
+static inline bool dy_deserialize_simple(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_simple *result);
+
+static inline size_t dy_core_serializer_hash(const struct dy_core_expr *node);
+
+static inline void dy_core_serializer_put(dy_array_t *table, struct dy_core_serialized_node entry);
+
+struct dy_core_serializer dy_core_serializer_create(struct dy_writer *writer)
+{
+    struct dy_core_serializer s = {
+        .writer = writer,
+        .written_nodes = dy_array_create(sizeof(struct dy_core_serialized_node), DY_ALIGNOF(struct dy_core_serialized_node), 256)
+    };
+
+    memset(s.written_nodes.buffer, 0, s.written_nodes.elem_size * s.written_nodes.capacity);
+
+    return s;
+}
+
+void dy_core_serializer_release(struct dy_core_ctx *ctx, struct dy_core_serializer *s)
+{
+    dy_array_release(&s->written_nodes);
+}
+
+void dy_serialize_size_t(struct dy_core_serializer *s, size_t x)
+{
+    // Enough for 64 bits, 7 at a time.
+    char bytes[10];
+    size_t size = 0;
+
+    do {
+        char byte = (char)(x & 0x7f);
+        x >>= 7;
+
+        if (x != 0) {
+            byte = (char)(byte | 0x80);
+        }
+
+        bytes[size++] = byte;
+    } while (x != 0);
+
+    dy_write(s->writer, (dy_string_t){ .ptr = bytes, .size = size });
+}
+
+void dy_serialize_bytes(struct dy_core_serializer *s, dy_string_t bytes)
+{
+    dy_serialize_size_t(s, bytes.size);
+    dy_write(s->writer, bytes);
+}
+
+void dy_serialize_expr(struct dy_core_ctx *ctx, struct dy_core_serializer *s, struct dy_core_expr expr)
+{
+    dy_serialize_size_t(s, expr.tag);
+
+    switch (expr.tag) {
+    case DY_CORE_EXPR_INTRO:
+        dy_serialize_size_t(s, expr.intro.tag);
+        dy_serialize_size_t(s, expr.intro.polarity);
+        dy_serialize_size_t(s, expr.intro.is_implicit);
+
+        switch (expr.intro.tag) {
+        case DY_CORE_INTRO_COMPLEX:
+            dy_serialize_size_t(s, expr.intro.complex.tag);
+
+            switch (expr.intro.complex.tag) {
+            case DY_CORE_COMPLEX_ASSUMPTION:
+                dy_serialize_assumption(ctx, s, expr.intro.complex.assumption);
+                return;
+            case DY_CORE_COMPLEX_CHOICE:
+                dy_serialize_expr_ptr(ctx, s, expr.intro.complex.choice.left);
+                dy_serialize_expr_ptr(ctx, s, expr.intro.complex.choice.right);
+                return;
+            case DY_CORE_COMPLEX_RECURSION:
+                dy_serialize_size_t(s, expr.intro.complex.recursion.id);
+                dy_serialize_expr_ptr(ctx, s, expr.intro.complex.recursion.expr);
+                return;
+            }
+
+            dy_bail("impossible");
+        case DY_CORE_INTRO_SIMPLE:
+            dy_serialize_simple(ctx, s, expr.intro.simple);
+            return;
+        }
+
+        dy_bail("impossible");
+    case DY_CORE_EXPR_ELIM:
+        dy_serialize_expr_ptr(ctx, s, expr.elim.expr);
+        dy_serialize_simple(ctx, s, expr.elim.simple);
+        dy_serialize_size_t(s, expr.elim.is_implicit);
+        dy_serialize_size_t(s, expr.elim.check_result);
+        dy_serialize_size_t(s, expr.elim.eval_immediately);
+        return;
+    case DY_CORE_EXPR_MAP:
+        dy_serialize_size_t(s, expr.map.tag);
+        dy_serialize_size_t(s, expr.map.is_implicit);
+
+        switch (expr.map.tag) {
+        case DY_CORE_MAP_ASSUMPTION:
+            dy_serialize_size_t(s, expr.map.assumption.id);
+            dy_serialize_expr_ptr(ctx, s, expr.map.assumption.type);
+            dy_serialize_assumption(ctx, s, expr.map.assumption.assumption);
+            dy_serialize_size_t(s, expr.map.assumption.dependence);
+            return;
+        case DY_CORE_MAP_CHOICE:
+            dy_serialize_assumption(ctx, s, expr.map.choice.assumption_left);
+            dy_serialize_assumption(ctx, s, expr.map.choice.assumption_right);
+            dy_serialize_size_t(s, expr.map.choice.left_dependence);
+            dy_serialize_size_t(s, expr.map.choice.right_dependence);
+            return;
+        case DY_CORE_MAP_RECURSION:
+            dy_serialize_size_t(s, expr.map.recursion.id);
+            dy_serialize_assumption(ctx, s, expr.map.recursion.assumption);
+            dy_serialize_size_t(s, expr.map.recursion.dependence);
+            return;
+        }
+
+        dy_bail("impossible");
+    case DY_CORE_EXPR_VARIABLE:
+        dy_serialize_size_t(s, expr.variable_id);
+        return;
+    case DY_CORE_EXPR_ANY:
+    case DY_CORE_EXPR_VOID:
+        return;
+    case DY_CORE_EXPR_INFERENCE_CTX:
+        dy_serialize_size_t(s, expr.inference_ctx.id);
+        dy_serialize_size_t(s, expr.inference_ctx.polarity);
+        dy_serialize_expr_ptr(ctx, s, expr.inference_ctx.expr);
+        return;
+    case DY_CORE_EXPR_INFERENCE_VAR:
+        dy_serialize_size_t(s, expr.inference_var_id);
+        return;
+    case DY_CORE_EXPR_CUSTOM: {
+        const struct dy_core_custom_shared *shared = dy_array_pos(&ctx->custom_shared, expr.custom.id);
+        if (shared->serialize == NULL) {
+            s->failed = true;
+            return;
+        }
+
+        dy_serialize_size_t(s, expr.custom.id);
+        shared->serialize(ctx, expr.custom.data, s);
+        return;
+    }
+    }
+
+    dy_bail("Impossible object type.");
+}
+
+void dy_serialize_expr_ptr(struct dy_core_ctx *ctx, struct dy_core_serializer *s, const struct dy_core_expr *expr)
+{
+    dy_array_t *table = &s->written_nodes;
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = dy_core_serializer_hash(expr) & mask;; i = (i + 1) & mask) {
+        const struct dy_core_serialized_node *entry = dy_array_pos_uninit(table, i);
+        if (entry->node == NULL) {
+            break;
+        }
+
+        if (entry->node == expr) {
+            // Back-references are offset by one, 0 introduces a new node.
+            dy_serialize_size_t(s, entry->index + 1);
+            return;
+        }
+    }
+
+    dy_serialize_size_t(s, 0);
+    dy_serialize_expr(ctx, s, *expr);
+
+    // Numbered after its children, which is the order they get read back in.
+    if (4 * (table->num_elems + 1) > 3 * table->capacity) {
+        dy_array_t old = *table;
+
+        *table = dy_array_create(old.elem_size, old.elem_alignment, old.capacity * 2);
+        memset(table->buffer, 0, table->elem_size * table->capacity);
+
+        for (size_t i = 0; i < old.capacity; ++i) {
+            const struct dy_core_serialized_node *entry = dy_array_pos_uninit(&old, i);
+            if (entry->node != NULL) {
+                dy_core_serializer_put(table, *entry);
+            }
+        }
+
+        dy_array_release(&old);
+    }
+
+    dy_core_serializer_put(table, (struct dy_core_serialized_node){
+        .node = expr,
+        .index = s->num_nodes++
+    });
+}
+
+void dy_serialize_assumption(struct dy_core_ctx *ctx, struct dy_core_serializer *s, struct dy_core_assumption assumption)
+{
+    dy_serialize_size_t(s, assumption.id);
+    dy_serialize_expr_ptr(ctx, s, assumption.type);
+    dy_serialize_expr_ptr(ctx, s, assumption.expr);
+}
+
+void dy_serialize_simple(struct dy_core_ctx *ctx, struct dy_core_serializer *s, struct dy_core_simple simple)
+{
+    dy_serialize_size_t(s, simple.tag);
+
+    switch (simple.tag) {
+    case DY_CORE_SIMPLE_PROOF:
+        dy_serialize_expr_ptr(ctx, s, simple.proof);
+        break;
+    case DY_CORE_SIMPLE_DECISION:
+        dy_serialize_size_t(s, simple.direction);
+        break;
+    case DY_CORE_SIMPLE_UNFOLD:
+    case DY_CORE_SIMPLE_UNWRAP:
+        break;
+    }
+
+    dy_serialize_expr_ptr(ctx, s, simple.out);
+}
+
+struct dy_core_deserializer dy_core_deserializer_create(dy_string_t bytes)
+{
+    return (struct dy_core_deserializer){
+        .bytes = bytes,
+        .nodes = dy_array_create(sizeof(struct dy_core_expr *), DY_ALIGNOF(struct dy_core_expr *), 256)
+    };
+}
+
+void dy_core_deserializer_release(struct dy_core_ctx *ctx, struct dy_core_deserializer *d)
+{
+    for (size_t i = 0; i < d->nodes.num_elems; ++i) {
+        dy_core_expr_release_ptr(ctx, DY_ARRAY_AT(&d->nodes, struct dy_core_expr *, i));
+    }
+
+    dy_array_release(&d->nodes);
+}
+
+bool dy_deserialize_size_t(struct dy_core_deserializer *d, size_t *x)
+{
+    size_t result = 0;
+
+    for (size_t shift = 0; shift < sizeof(size_t) * CHAR_BIT; shift += 7) {
+        if (d->pos == d->bytes.size) {
+            return false;
+        }
+
+        unsigned char byte = (unsigned char)d->bytes.ptr[d->pos++];
+
+        result |= (size_t)(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            *x = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool dy_deserialize_bounded(struct dy_core_deserializer *d, size_t bound, size_t *x)
+{
+    return dy_deserialize_size_t(d, x) && *x < bound;
+}
+
+bool dy_deserialize_bool(struct dy_core_deserializer *d, bool *x)
+{
+    size_t n;
+    if (!dy_deserialize_bounded(d, 2, &n)) {
+        return false;
+    }
+
+    *x = n != 0;
+    return true;
+}
+
+bool dy_deserialize_bytes(struct dy_core_deserializer *d, dy_string_t *bytes)
+{
+    size_t size;
+    if (!dy_deserialize_size_t(d, &size) || size > d->bytes.size - d->pos) {
+        return false;
+    }
+
+    *bytes = (dy_string_t){ .ptr = d->bytes.ptr + d->pos, .size = size };
+    d->pos += size;
+
+    return true;
+}
+
+bool dy_deserialize_expr(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_expr *result)
+{
+    // Children are borrowed from 'd' until everything was read, and only retained at the end.
+    struct dy_core_expr expr;
+    size_t n;
+
+    if (!dy_deserialize_bounded(d, DY_CORE_EXPR_CUSTOM + 1, &n)) {
+        return false;
+    }
+
+    expr.tag = (enum dy_core_expr_tag)n;
+
+    switch (expr.tag) {
+    case DY_CORE_EXPR_INTRO:
+        if (!dy_deserialize_bounded(d, DY_CORE_INTRO_SIMPLE + 1, &n)) {
+            return false;
+        }
+
+        expr.intro.tag = (enum dy_core_intro_tag)n;
+
+        if (!dy_deserialize_bounded(d, DY_POLARITY_NEGATIVE + 1, &n)) {
+            return false;
+        }
+
+        expr.intro.polarity = (enum dy_polarity)n;
+
+        if (!dy_deserialize_bool(d, &expr.intro.is_implicit)) {
+            return false;
+        }
+
+        switch (expr.intro.tag) {
+        case DY_CORE_INTRO_COMPLEX:
+            if (!dy_deserialize_bounded(d, DY_CORE_COMPLEX_RECURSION + 1, &n)) {
+                return false;
+            }
+
+            expr.intro.complex.tag = (enum dy_core_complex_tag)n;
+
+            switch (expr.intro.complex.tag) {
+            case DY_CORE_COMPLEX_ASSUMPTION:
+                if (!dy_deserialize_assumption(ctx, d, &expr.intro.complex.assumption)) {
+                    return false;
+                }
+
+                break;
+            case DY_CORE_COMPLEX_CHOICE:
+                if (!dy_deserialize_expr_ptr(ctx, d, &expr.intro.complex.choice.left)
+                    || !dy_deserialize_expr_ptr(ctx, d, &expr.intro.complex.choice.right)) {
+                    return false;
+                }
+
+                break;
+            case DY_CORE_COMPLEX_RECURSION:
+                if (!dy_deserialize_size_t(d, &expr.intro.complex.recursion.id)
+                    || !dy_deserialize_expr_ptr(ctx, d, &expr.intro.complex.recursion.expr)) {
+                    return false;
+                }
+
+                break;
+            }
+
+            break;
+        case DY_CORE_INTRO_SIMPLE:
+            if (!dy_deserialize_simple(ctx, d, &expr.intro.simple)) {
+                return false;
+            }
+
+            break;
+        }
+
+        break;
+    case DY_CORE_EXPR_ELIM:
+        if (!dy_deserialize_expr_ptr(ctx, d, &expr.elim.expr)
+            || !dy_deserialize_simple(ctx, d, &expr.elim.simple)
+            || !dy_deserialize_bool(d, &expr.elim.is_implicit)
+            || !dy_deserialize_bounded(d, DY_MAYBE + 1, &n)) {
+            return false;
+        }
+
+        expr.elim.check_result = (dy_ternary_t)n;
+
+        if (!dy_deserialize_bool(d, &expr.elim.eval_immediately)) {
+            return false;
+        }
+
+        break;
+    case DY_CORE_EXPR_MAP:
+        if (!dy_deserialize_bounded(d, DY_CORE_MAP_RECURSION + 1, &n)) {
+            return false;
+        }
+
+        expr.map.tag = (enum dy_core_map_tag)n;
+
+        if (!dy_deserialize_bool(d, &expr.map.is_implicit)) {
+            return false;
+        }
+
+        switch (expr.map.tag) {
+        case DY_CORE_MAP_ASSUMPTION:
+            if (!dy_deserialize_size_t(d, &expr.map.assumption.id)
+                || !dy_deserialize_expr_ptr(ctx, d, &expr.map.assumption.type)
+                || !dy_deserialize_assumption(ctx, d, &expr.map.assumption.assumption)
+                || !dy_deserialize_bounded(d, DY_CORE_MAP_DEPENDENCE_INDEPENDENT + 1, &n)) {
+                return false;
+            }
+
+            expr.map.assumption.dependence = (enum dy_core_map_dependence)n;
+            break;
+        case DY_CORE_MAP_CHOICE:
+            if (!dy_deserialize_assumption(ctx, d, &expr.map.choice.assumption_left)
+                || !dy_deserialize_assumption(ctx, d, &expr.map.choice.assumption_right)
+                || !dy_deserialize_bounded(d, DY_CORE_MAP_DEPENDENCE_INDEPENDENT + 1, &n)) {
+                return false;
+            }
+
+            expr.map.choice.left_dependence = (enum dy_core_map_dependence)n;
+
+            if (!dy_deserialize_bounded(d, DY_CORE_MAP_DEPENDENCE_INDEPENDENT + 1, &n)) {
+                return false;
+            }
+
+            expr.map.choice.right_dependence = (enum dy_core_map_dependence)n;
+            break;
+        case DY_CORE_MAP_RECURSION:
+            if (!dy_deserialize_size_t(d, &expr.map.recursion.id)
+                || !dy_deserialize_assumption(ctx, d, &expr.map.recursion.assumption)
+                || !dy_deserialize_bounded(d, DY_CORE_MAP_DEPENDENCE_INDEPENDENT + 1, &n)) {
+                return false;
+            }
+
+            expr.map.recursion.dependence = (enum dy_core_map_dependence)n;
+            break;
+        }
+
+        break;
+    case DY_CORE_EXPR_VARIABLE:
+        if (!dy_deserialize_size_t(d, &expr.variable_id)) {
+            return false;
+        }
+
+        break;
+    case DY_CORE_EXPR_ANY:
+    case DY_CORE_EXPR_VOID:
+        break;
+    case DY_CORE_EXPR_INFERENCE_CTX:
+        if (!dy_deserialize_size_t(d, &expr.inference_ctx.id)
+            || !dy_deserialize_bounded(d, DY_POLARITY_NEGATIVE + 1, &n)) {
+            return false;
+        }
+
+        expr.inference_ctx.polarity = (enum dy_polarity)n;
+
+        if (!dy_deserialize_expr_ptr(ctx, d, &expr.inference_ctx.expr)) {
+            return false;
+        }
+
+        break;
+    case DY_CORE_EXPR_INFERENCE_VAR:
+        if (!dy_deserialize_size_t(d, &expr.inference_var_id)) {
+            return false;
+        }
+
+        break;
+    case DY_CORE_EXPR_CUSTOM: {
+        if (!dy_deserialize_bounded(d, ctx->custom_shared.num_elems, &n)) {
+            return false;
+        }
+
+        const struct dy_core_custom_shared *s = dy_array_pos(&ctx->custom_shared, n);
+        if (s->deserialize == NULL || !s->deserialize(ctx, d, &expr.custom)) {
+            return false;
+        }
+
+        // The custom is already owned, nothing to retain.
+        *result = expr;
+        return true;
+    }
+    }
+
+    *result = dy_core_expr_retain(ctx, expr);
+    return true;
+}
+
+bool dy_deserialize_expr_ptr(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_expr **result)
+{
+    size_t ref;
+    if (!dy_deserialize_size_t(d, &ref)) {
+        return false;
+    }
+
+    if (ref != 0) {
+        if (ref > d->nodes.num_elems) {
+            return false;
+        }
+
+        *result = DY_ARRAY_AT(&d->nodes, struct dy_core_expr *, ref - 1);
+        return true;
+    }
+
+    struct dy_core_expr expr;
+    if (!dy_deserialize_expr(ctx, d, &expr)) {
+        return false;
+    }
+
+    *result = dy_core_expr_new(expr);
+
+    DY_ARRAY_PUSH(&d->nodes, struct dy_core_expr *, *result);
+
+    return true;
+}
+
+bool dy_deserialize_assumption(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_assumption *result)
+{
+    return dy_deserialize_size_t(d, &result->id)
+        && dy_deserialize_expr_ptr(ctx, d, &result->type)
+        && dy_deserialize_expr_ptr(ctx, d, &result->expr);
+}
+
+bool dy_deserialize_simple(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_simple *result)
+{
+    size_t n;
+    if (!dy_deserialize_bounded(d, DY_CORE_SIMPLE_UNWRAP + 1, &n)) {
+        return false;
+    }
+
+    result->tag = (enum dy_core_simple_tag)n;
+
+    switch (result->tag) {
+    case DY_CORE_SIMPLE_PROOF:
+        if (!dy_deserialize_expr_ptr(ctx, d, &result->proof)) {
+            return false;
+        }
+
+        break;
+    case DY_CORE_SIMPLE_DECISION:
+        if (!dy_deserialize_bounded(d, DY_RIGHT + 1, &n)) {
+            return false;
+        }
+
+        result->direction = (enum dy_direction)n;
+        break;
+    case DY_CORE_SIMPLE_UNFOLD:
+    case DY_CORE_SIMPLE_UNWRAP:
+        break;
+    }
+
+    return dy_deserialize_expr_ptr(ctx, d, &result->out);
+}
+
+size_t dy_core_serializer_hash(const struct dy_core_expr *node)
+{
+    // Nodes are at least 8-byte aligned, so the low bits carry no information.
+    size_t x = (size_t)(uintptr_t)node >> 3;
+    return x ^ (x >> 16) ^ (x * (size_t)0x9e3779b97f4a7c15ull);
+}
+
+void dy_core_serializer_put(dy_array_t *table, struct dy_core_serialized_node entry)
+{
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = dy_core_serializer_hash(entry.node) & mask;; i = (i + 1) & mask) {
+        struct dy_core_serialized_node *slot = dy_array_pos_uninit(table, i);
+        if (slot->node == NULL) {
+            *slot = entry;
+            ++table->num_elems;
+            return;
+        }
+    }
+}
@@ -1,515 +1,481 @@
-/*
- * Copyright 2017-2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
- *
- * SPDX-License-Identifier: MIT
- */
-
-#pragma once
-
-#include "core.h"
-
-#include "../support/util.h"
-
-/**
- * This file implements substitution for every object of Core.
- */
-
-static inline bool dy_substitute(struct dy_core_ctx *ctx, struct dy_core_expr expr, size_t id, struct dy_core_expr sub, struct dy_core_expr *result);
-
-static inline bool dy_substitute_assumption(struct dy_core_ctx *ctx, struct dy_core_assumption function, size_t id, struct dy_core_expr sub, struct dy_core_assumption *result);
-
-static inline bool dy_substitute_recursion(struct dy_core_ctx *ctx, struct dy_core_recursion recursion, size_t id, struct dy_core_expr sub, struct dy_core_recursion *result);
-
-static inline bool dy_substitute_simple(struct dy_core_ctx *ctx, struct dy_core_simple simple, size_t id, struct dy_core_expr sub, struct dy_core_simple *result);
-
-static inline bool dy_substitute_map_assumption(struct dy_core_ctx *ctx, struct dy_core_map_assumption ass, size_t id, struct dy_core_expr sub, struct dy_core_map_assumption *result);
-
-static inline bool dy_substitute_map_choice(struct dy_core_ctx *ctx, struct dy_core_map_choice choice, size_t id, struct dy_core_expr sub, struct dy_core_map_choice *result);
-
-static inline bool dy_substitute_map_recursion(struct dy_core_ctx *ctx, struct dy_core_map_recursion rec, size_t id, struct dy_core_expr sub, struct dy_core_map_recursion *result);
-
-bool dy_substitute(struct dy_core_ctx *ctx, struct dy_core_expr expr, size_t id, struct dy_core_expr sub, struct dy_core_expr *result)
-{
-    switch (expr.tag) {
-    case DY_CORE_EXPR_INTRO:
-        switch (expr.intro.tag) {
-        case DY_CORE_INTRO_COMPLEX:
-            switch (expr.intro.complex.tag) {
-            case DY_CORE_COMPLEX_ASSUMPTION:
-                if (dy_substitute_assumption(ctx, expr.intro.complex.assumption, id, sub, &expr.intro.complex.assumption)) {
-                    *result = expr;
-                    return true;
-                } else {
-                    return false;
-                }
-            case DY_CORE_COMPLEX_CHOICE: {
-                struct dy_core_expr left;
-                bool left_is_new = dy_substitute(ctx, *expr.intro.complex.choice.left, id, sub, &left);
-
-                struct dy_core_expr right;
-                bool right_is_new = dy_substitute(ctx, *expr.intro.complex.choice.right, id, sub, &right);
-
-                if (!left_is_new && !right_is_new) {
-                    return false;
-                }
-
-                if (left_is_new) {
-                    expr.intro.complex.choice.left = dy_core_expr_new(left);
-                } else {
-                    dy_core_expr_retain_ptr(ctx, expr.intro.complex.choice.left);
-                }
-
-                if (right_is_new) {
-                    expr.intro.complex.choice.right = dy_core_expr_new(right);
-                } else {
-                    dy_core_expr_retain_ptr(ctx, expr.intro.complex.choice.right);
-                }
-
-                *result = expr;
-                return true;
-            }
-            case DY_CORE_COMPLEX_RECURSION:
-                if (dy_substitute_recursion(ctx, expr.intro.complex.recursion, id, sub, &expr.intro.complex.recursion)) {
-                    *result = expr;
-                    return true;
-                } else {
-                    return false;
-                }
-            }
-
-            dy_bail("Impossible");
-        case DY_CORE_INTRO_SIMPLE:
-            if (dy_substitute_simple(ctx, expr.intro.simple, id, sub, &expr.intro.simple)) {
-                *result = expr;
-                return true;
-            } else {
-                return false;
-            }
-        }
-
-        dy_bail("impossible");
-    case DY_CORE_EXPR_VARIABLE:
-        if (expr.variable_id == id) {
-            *result = dy_core_expr_retain(ctx, sub);
-            return true;
-        }
-
-        for (size_t i = 0, size = ctx->equal_variables.num_elems; i < size; ++i) {
-            const struct dy_equal_variables *v = dy_array_pos(&ctx->equal_variables, i);
-
-            if (v->id1 == expr.variable_id) {
-                expr.variable_id = v->id2;
-                *result = expr;
-                return true;
-            }
-        }
-
-        return false;
-    case DY_CORE_EXPR_ELIM: {
-        struct dy_core_expr new_expr;
-        bool expr_is_new = dy_substitute(ctx, *expr.elim.expr, id, sub, &new_expr);
-
-        struct dy_core_simple new_simple;
-        bool simple_is_new = dy_substitute_simple(ctx, expr.elim.simple, id, sub, &new_simple);
-
-        if (!expr_is_new && !simple_is_new) {
-            return false;
-        }
-
-        if (expr_is_new) {
-            expr.elim.expr = dy_core_expr_new(new_expr);
-        } else {
-            dy_core_expr_retain_ptr(ctx, expr.elim.expr);
-        }
-
-        if (simple_is_new) {
-            expr.elim.simple = new_simple;
-        } else {
-            dy_core_simple_retain(ctx, expr.elim.simple);
-        }
-
-        *result = expr;
-        return true;
-    }
-    case DY_CORE_EXPR_MAP:
-        switch (expr.map.tag) {
-        case DY_CORE_MAP_ASSUMPTION:
-            if (dy_substitute_map_assumption(ctx, expr.map.assumption, id, sub, &expr.map.assumption)) {
-                *result = expr;
-                return true;
-            } else {
-                return false;
-            }
-        case DY_CORE_MAP_CHOICE:
-            if (dy_substitute_map_choice(ctx, expr.map.choice, id, sub, &expr.map.choice)) {
-                *result = expr;
-                return true;
-            } else {
-                return false;
-            }
-        case DY_CORE_MAP_RECURSION:
-            if (dy_substitute_map_recursion(ctx, expr.map.recursion, id, sub, &expr.map.recursion)) {
-                *result = expr;
-                return true;
-            } else {
-                return false;
-            }
-        }
-
-        dy_bail("impossible");
-    case DY_CORE_EXPR_ANY:
-    case DY_CORE_EXPR_VOID:
-        return false;
-    case DY_CORE_EXPR_INFERENCE_CTX: {
-        if (id == expr.inference_ctx.id) {
-            return false;
-        }
-
-        struct dy_core_expr new_expr;
-        if (!dy_substitute(ctx, *expr.inference_ctx.expr, id, sub, &new_expr)) {
-            return false;
-        }
-
-        expr.inference_ctx.expr = dy_core_expr_new(new_expr);
-
-        *result = expr;
-
-        return true;
-    }
-    case DY_CORE_EXPR_INFERENCE_VAR:
-        if (expr.inference_var_id == id) {
-            *result = dy_core_expr_retain(ctx, sub);
-            return true;
-        }
-
-        for (size_t i = 0, size = ctx->equal_variables.num_elems; i < size; ++i) {
-            const struct dy_equal_variables *v = dy_array_pos(&ctx->equal_variables, i);
-
-            if (v->id1 == expr.inference_var_id) {
-                expr.inference_var_id = v->id2;
-                *result = expr;
-                return true;
-            }
-        }
-
-        return false;
-    case DY_CORE_EXPR_CUSTOM: {
-        const struct dy_core_custom_shared *s = dy_array_pos(&ctx->custom_shared, expr.custom.id);
-        return s->substitute(ctx, expr.custom.data, id, sub, result);
-    }
-    }
-
-    dy_bail("Impossible object type.");
-}
-
-bool dy_substitute_assumption(struct dy_core_ctx *ctx, struct dy_core_assumption function, size_t id, struct dy_core_expr sub, struct dy_core_assumption *result)
-{
-    struct dy_core_expr type;
-    bool type_is_new = dy_substitute(ctx, *function.type, id, sub, &type);
-
-    if (id != function.id) {
-        if (dy_core_expr_contains_this_variable(ctx, function.id, sub)) {
-            size_t new_id = ctx->running_id++;
-
-            dy_array_add(&ctx->equal_variables, &(struct dy_equal_variables){
-                .id1 = function.id,
-                .id2 = new_id
-            });
-
-            struct dy_core_expr expr;
-            bool expr_is_new = dy_substitute(ctx, *function.expr, id, sub, &expr);
-
-            --ctx->equal_variables.num_elems;
-
-            if (!type_is_new && !expr_is_new) {
-                return false;
-            }
-
-            if (type_is_new) {
-                function.type = dy_core_expr_new(type);
-            } else {
-                dy_core_expr_retain_ptr(ctx, function.type);
-            }
-
-            if (expr_is_new) {
-                function.expr = dy_core_expr_new(expr);
-            } else {
-                dy_core_expr_retain_ptr(ctx, function.expr);
-            }
-
-            function.id = new_id;
-
-            *result = function;
-            return true;
-        } else {
-            struct dy_core_expr expr;
-            bool expr_is_new = dy_substitute(ctx, *function.expr, id, sub, &expr);
-
-            if (!type_is_new && !expr_is_new) {
-                return false;
-            }
-
-            if (type_is_new) {
-                function.type = dy_core_expr_new(type);
-            } else {
-                dy_core_expr_retain_ptr(ctx, function.type);
-            }
-
-            if (expr_is_new) {
-                function.expr = dy_core_expr_new(expr);
-            } else {
-                dy_core_expr_retain_ptr(ctx, function.expr);
-            }
-
-            *result = function;
-            return true;
-        }
-    } else {
-        if (!type_is_new) {
-            return false;
-        }
-
-        if (type_is_new) {
-            function.type = dy_core_expr_new(type);
-        } else {
-            dy_core_expr_retain_ptr(ctx, function.type);
-        }
-
-        function.expr = dy_core_expr_retain_ptr(ctx, function.expr);
-
-        *result = function;
-        return true;
-    }
-}
-
-bool dy_substitute_recursion(struct dy_core_ctx *ctx, struct dy_core_recursion recursion, size_t id, struct dy_core_expr sub, struct dy_core_recursion *result)
-{
-    if (id == recursion.id) {
-        return false;
-    }
-
-    if (dy_core_expr_contains_this_variable(ctx, recursion.id, sub)) {
-        size_t new_id = ctx->running_id++;
-
-        dy_array_add(&ctx->equal_variables, &(struct dy_equal_variables){
-            .id1 = recursion.id,
-            .id2 = new_id
-        });
-
-        struct dy_core_expr expr;
-        bool expr_is_new = dy_substitute(ctx, *recursion.expr, id, sub, &expr);
-
-        --ctx->equal_variables.num_elems;
-
-        if (!expr_is_new) {
-            return false;
-        }
-
-        recursion.expr = dy_core_expr_new(expr);
-        recursion.id = new_id;
-
-        *result = recursion;
-        return true;
-    } else {
-        struct dy_core_expr expr;
-        bool expr_is_new = dy_substitute(ctx, *recursion.expr, id, sub, &expr);
-
-        if (!expr_is_new) {
-            return false;
-        }
-
-        recursion.expr = dy_core_expr_new(expr);
-
-        *result = recursion;
-        return true;
-    }
-}
-
-bool dy_substitute_simple(struct dy_core_ctx *ctx, struct dy_core_simple simple, size_t id, struct dy_core_expr sub, struct dy_core_simple *result)
-{
-    struct dy_core_expr out;
-    bool out_is_new = dy_substitute(ctx, *simple.out, id, sub, &out);
-
-    if (simple.tag == DY_CORE_SIMPLE_PROOF) {
-        struct dy_core_expr expr;
-        bool expr_is_new = dy_substitute(ctx, *simple.proof, id, sub, &expr);
-
-        if (!expr_is_new && !out_is_new) {
-            return false;
-        }
-
-        if (expr_is_new) {
-            simple.proof = dy_core_expr_new(expr);
-        } else {
-            dy_core_expr_retain_ptr(ctx, simple.proof);
-        }
-
-        if (out_is_new) {
-            simple.out = dy_core_expr_new(out);
-        } else {
-            dy_core_expr_retain_ptr(ctx, simple.out);
-        }
-
-        *result = simple;
-        return true;
-    } else {
-        if (out_is_new) {
-            simple.out = dy_core_expr_new(out);
-            *result = simple;
-            return true;
-        } else {
-            return false;
-        }
-    }
-}
-
-bool dy_substitute_map_assumption(struct dy_core_ctx *ctx, struct dy_core_map_assumption ass, size_t id, struct dy_core_expr sub, struct dy_core_map_assumption *result)
-{
-    struct dy_core_expr type;
-    bool type_is_new = dy_substitute(ctx, *ass.type, id, sub, &type);
-
-    if (id != ass.id) {
-        if (dy_core_expr_contains_this_variable(ctx, ass.id, sub)) {
-            size_t new_id = ctx->running_id++;
-
-            dy_array_add(&ctx->equal_variables, &(struct dy_equal_variables){
-                .id1 = ass.id,
-                .id2 = new_id
-            });
-
-            struct dy_core_assumption new_ass;
-            bool ass_is_new = dy_substitute_assumption(ctx, ass.assumption, id, sub, &new_ass);
-
-            --ctx->equal_variables.num_elems;
-
-            if (!type_is_new && !ass_is_new) {
-                return false;
-            }
-
-            if (type_is_new) {
-                ass.type = dy_core_expr_new(type);
-            } else {
-                dy_core_expr_retain_ptr(ctx, ass.type);
-            }
-
-            if (ass_is_new) {
-                ass.assumption = new_ass;
-            } else {
-                dy_core_assumption_retain(ctx, ass.assumption);
-            }
-
-            ass.id = new_id;
-
-            *result = ass;
-            return true;
-        } else {
-            struct dy_core_assumption new_ass;
-            bool ass_is_new = dy_substitute_assumption(ctx, ass.assumption, id, sub, &new_ass);
-
-            if (!type_is_new && !ass_is_new) {
-                return false;
-            }
-
-            if (type_is_new) {
-                ass.type = dy_core_expr_new(type);
-            } else {
-                dy_core_expr_retain_ptr(ctx, ass.type);
-            }
-
-            if (ass_is_new) {
-                ass.assumption = new_ass;
-            } else {
-                dy_core_assumption_retain(ctx, ass.assumption);
-            }
-
-            *result = ass;
-            return true;
-        }
-    } else {
-        if (!type_is_new) {
-            return false;
-        }
-
-        if (type_is_new) {
-            ass.type = dy_core_expr_new(type);
-        } else {
-            dy_core_expr_retain_ptr(ctx, ass.type);
-        }
-
-        ass.assumption = dy_core_assumption_retain(ctx, ass.assumption);
-
-        *result = ass;
-        return true;
-    }
-}
-
-bool dy_substitute_map_choice(struct dy_core_ctx *ctx, struct dy_core_map_choice choice, size_t id, struct dy_core_expr sub, struct dy_core_map_choice *result)
-{
-    struct dy_core_assumption new_ass_left;
-    bool ass_left_is_new = dy_substitute_assumption(ctx, choice.assumption_left, id, sub, &new_ass_left);
-
-    struct dy_core_assumption new_ass_right;
-    bool ass_right_is_new = dy_substitute_assumption(ctx, choice.assumption_right, id, sub, &new_ass_right);
-
-    if (!ass_left_is_new && !ass_right_is_new) {
-        return false;
-    }
-
-    if (ass_left_is_new) {
-        choice.assumption_left = new_ass_left;
-    } else {
-        dy_core_assumption_retain(ctx, choice.assumption_left);
-    }
-
-    if (ass_right_is_new) {
-        choice.assumption_right = new_ass_right;
-    } else {
-        dy_core_assumption_retain(ctx, choice.assumption_right);
-    }
-
-    *result = choice;
-    return true;
-}
-
-bool dy_substitute_map_recursion(struct dy_core_ctx *ctx, struct dy_core_map_recursion rec, size_t id, struct dy_core_expr sub, struct dy_core_map_recursion *result)
-{
-    if (id == rec.id) {
-        return false;
-    }
-
-    if (dy_core_expr_contains_this_variable(ctx, rec.id, sub)) {
-        size_t new_id = ctx->running_id++;
-
-        dy_array_add(&ctx->equal_variables, &(struct dy_equal_variables){
-            .id1 = rec.id,
-            .id2 = new_id
-        });
-
-        struct dy_core_assumption new_ass;
-        bool ass_is_new = dy_substitute_assumption(ctx, rec.assumption, id, sub, &new_ass);
-
-        --ctx->equal_variables.num_elems;
-
-        if (!ass_is_new) {
-            return false;
-        }
-
-        rec.assumption = new_ass;
-        rec.id = new_id;
-
-        *result = rec;
-        return true;
-    } else {
-        struct dy_core_assumption new_ass;
-        bool ass_is_new = dy_substitute_assumption(ctx, rec.assumption, id, sub, &new_ass);
-
-        if (!ass_is_new) {
-            return false;
-        }
-
-        rec.assumption = new_ass;
-
-        *result = rec;
-        return true;
-    }
-}
+/*
+ * Copyright 2017-2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "core.h"
+
+#include "../support/util.h"
+
+#include <limits.h>
+
+/**
+ * This file implements substitution for every object of Core.
+ */
+
+static inline bool dy_substitute(struct dy_core_ctx *ctx, struct dy_core_expr expr, size_t id, struct dy_core_expr sub, struct dy_core_expr *result);
+
+/**
+ * Like dy_substitute, but skips 'expr' entirely if 'id' can't occur in it.
+ *
+ * That's only valid while no variables are being renamed, see ctx->equal_variables.
+ */
+static inline bool dy_substitute_ptr(struct dy_core_ctx *ctx, const struct dy_core_expr *expr, size_t id, struct dy_core_expr sub, struct dy_core_expr *result);
+
+static inline bool dy_substitute_ptr(struct dy_core_ctx *ctx, const struct dy_core_expr *expr, size_t id, struct dy_core_expr sub, struct dy_core_expr *result)
+{
+    if (ctx->equal_variables.num_elems == 0 && !dy_core_expr_may_contain(expr, id)) {
+        return false;
+    }
+
+    return dy_substitute(ctx, *expr, id, sub, result);
+}
+
+/** Like dy_substitute(), for the assumption of a function. */
+static inline bool dy_substitute_assumption(struct dy_core_ctx *ctx, struct dy_core_assumption function, size_t id, struct dy_core_expr sub, struct dy_core_assumption *result);
+
+/**
+ * Substitution works off an explicit stack of frames instead of recursing,
+ * since the depth of Core grows with the length of a program.
+ *
+ * A frame holds a copy of the node being substituted in, plus the steps to do on it
+ * in order: Substituting in a child, or entering/leaving the scope of a binder.
+ * Children are substituted in the order the node lists them, so variables get renamed
+ * (see ctx->equal_variables) exactly as a recursive traversal would rename them.
+ */
+
+enum dy_substitute_step_tag {
+    DY_SUBSTITUTE_STEP_CHILD,
+    DY_SUBSTITUTE_STEP_BIND,
+    DY_SUBSTITUTE_STEP_UNBIND
+};
+
+struct dy_substitute_step {
+    unsigned char tag;
+
+    /** Where the child pointer (or the binder id) is in the node. */
+    unsigned char offset;
+
+    /**
+     * For binders, the first child of the assumption or recursion the binder belongs to.
+     * If that or any later child in scope changes, the binder takes on its new id.
+     */
+    unsigned char first_child;
+};
+
+struct dy_substitute_binder {
+    size_t offset;
+    size_t first_child;
+    size_t new_id;
+    bool is_renamed;
+};
+
+#define DY_SUBSTITUTE_MAX_STEPS 8
+#define DY_SUBSTITUTE_MAX_CHILDREN 4
+#define DY_SUBSTITUTE_MAX_BINDERS 2
+
+struct dy_substitute_frame {
+    struct dy_core_expr expr;
+
+    struct dy_substitute_step steps[DY_SUBSTITUTE_MAX_STEPS];
+    size_t num_steps;
+    size_t next_step;
+
+    size_t num_children;
+    size_t num_visited_children;
+    bool child_is_new[DY_SUBSTITUTE_MAX_CHILDREN];
+
+    struct dy_substitute_binder binders[DY_SUBSTITUTE_MAX_BINDERS];
+    size_t num_binders;
+
+    /** Non-zero while inside the scope of a binder that shadows the substituted variable. */
+    size_t num_shadowing_scopes;
+};
+
+/** Sets up 'frame' for 'expr'. Returns false if there are no children to descend into. */
+static inline bool dy_substitute_frame_init(struct dy_substitute_frame *frame, struct dy_core_expr expr, size_t id);
+
+static inline void dy_substitute_frame_add_child(struct dy_substitute_frame *frame, struct dy_core_expr **child);
+
+static inline void dy_substitute_frame_add_binder(struct dy_substitute_frame *frame, size_t *binder, size_t first_child);
+
+static inline void dy_substitute_frame_add_assumption(struct dy_substitute_frame *frame, struct dy_core_assumption *assumption);
+
+static inline void dy_substitute_frame_add_simple(struct dy_substitute_frame *frame, struct dy_core_simple *simple);
+
+static inline struct dy_core_expr **dy_substitute_frame_child(struct dy_substitute_frame *frame, size_t offset);
+
+static inline void dy_substitute_frame_set_child(struct dy_substitute_frame *frame, size_t offset, bool is_new, struct dy_core_expr new_child);
+
+static inline void dy_substitute_frame_bind(struct dy_core_ctx *ctx, struct dy_substitute_frame *frame, struct dy_substitute_step step, size_t id, struct dy_core_expr sub);
+
+static inline void dy_substitute_frame_unbind(struct dy_core_ctx *ctx, struct dy_substitute_frame *frame);
+
+/** Puts together the node once all steps are done. Returns false if nothing changed. */
+static inline bool dy_substitute_frame_finish(struct dy_core_ctx *ctx, struct dy_substitute_frame *frame, struct dy_core_expr *result);
+
+/** Substitutes in 'expr', which must not have children, see dy_substitute_frame_init(). */
+static inline bool dy_substitute_leaf(struct dy_core_ctx *ctx, struct dy_core_expr expr, size_t id, struct dy_core_expr sub, struct dy_core_expr *result);
+
+bool dy_substitute(struct dy_core_ctx *ctx, struct dy_core_expr expr, size_t id, struct dy_core_expr sub, struct dy_core_expr *result)
+{
+    DY_STATS_COUNT(DY_STAT_SUBSTITUTE);
+
+    struct dy_substitute_frame frame;
+    if (!dy_substitute_frame_init(&frame, expr, id)) {
+        return dy_substitute_leaf(ctx, expr, id, sub, result);
+    }
+
+    struct dy_substitute_frame storage[8];
+    dy_array_t frames = dy_array_create_small(storage, sizeof(struct dy_substitute_frame), DY_ALIGNOF(struct dy_substitute_frame), 8);
+
+    DY_ARRAY_PUSH(&frames, struct dy_substitute_frame, frame);
+
+    struct dy_core_expr new_expr;
+    bool is_new;
+
+    for (;;) {
+        struct dy_substitute_frame *top = dy_array_last(&frames);
+
+        if (top->next_step < top->num_steps) {
+            struct dy_substitute_step step = top->steps[top->next_step++];
+
+            switch ((enum dy_substitute_step_tag)step.tag) {
+            case DY_SUBSTITUTE_STEP_CHILD: {
+                const struct dy_core_expr *child = *dy_substitute_frame_child(top, step.offset);
+
+                if (top->num_shadowing_scopes != 0 || (ctx->equal_variables.num_elems == 0 && !dy_core_expr_may_contain(child, id))) {
+                    top->child_is_new[top->num_visited_children++] = false;
+                    continue;
+                }
+
+                if (dy_substitute_frame_init(&frame, *child, id)) {
+                    DY_ARRAY_PUSH(&frames, struct dy_substitute_frame, frame);
+                    continue;
+                }
+
+                is_new = dy_substitute_leaf(ctx, *child, id, sub, &new_expr);
+                dy_substitute_frame_set_child(top, step.offset, is_new, new_expr);
+                continue;
+            }
+            case DY_SUBSTITUTE_STEP_BIND:
+                dy_substitute_frame_bind(ctx, top, step, id, sub);
+                continue;
+            case DY_SUBSTITUTE_STEP_UNBIND:
+                dy_substitute_frame_unbind(ctx, top);
+                continue;
+            }
+
+            dy_bail("impossible");
+        }
+
+        is_new = dy_substitute_frame_finish(ctx, top, &new_expr);
+
+        if (--frames.num_elems == 0) {
+            break;
+        }
+
+        // The child step that pushed the finished frame was the last one of its parent.
+        top = dy_array_last(&frames);
+        dy_substitute_frame_set_child(top, top->steps[top->next_step - 1].offset, is_new, new_expr);
+    }
+
+    dy_array_release(&frames);
+
+    if (is_new) {
+        *result = new_expr;
+    }
+
+    return is_new;
+}
+
+bool dy_substitute_assumption(struct dy_core_ctx *ctx, struct dy_core_assumption function, size_t id, struct dy_core_expr sub, struct dy_core_assumption *result)
+{
+    struct dy_core_expr expr = {
+        .tag = DY_CORE_EXPR_INTRO,
+        .intro = {
+            .tag = DY_CORE_INTRO_COMPLEX,
+            .complex = {
+                .tag = DY_CORE_COMPLEX_ASSUMPTION,
+                .assumption = function,
+            },
+        }
+    };
+
+    if (!dy_substitute(ctx, expr, id, sub, &expr)) {
+        return false;
+    }
+
+    *result = expr.intro.complex.assumption;
+    return true;
+}
+
+bool dy_substitute_frame_init(struct dy_substitute_frame *frame, struct dy_core_expr expr, size_t id)
+{
+    // Every node that substitution descends into passes through here exactly once.
+    DY_STATS_COUNT(DY_STAT_SUBSTITUTE_NODES);
+
+    frame->expr = expr;
+    frame->num_steps = 0;
+    frame->next_step = 0;
+    frame->num_children = 0;
+    frame->num_visited_children = 0;
+    frame->num_binders = 0;
+    frame->num_shadowing_scopes = 0;
+
+    switch (expr.tag) {
+    case DY_CORE_EXPR_INTRO:
+        switch (expr.intro.tag) {
+        case DY_CORE_INTRO_COMPLEX:
+            switch (expr.intro.complex.tag) {
+            case DY_CORE_COMPLEX_ASSUMPTION:
+                dy_substitute_frame_add_assumption(frame, &frame->expr.intro.complex.assumption);
+                return true;
+            case DY_CORE_COMPLEX_CHOICE:
+                dy_substitute_frame_add_child(frame, &frame->expr.intro.complex.choice.left);
+                dy_substitute_frame_add_child(frame, &frame->expr.intro.complex.choice.right);
+                return true;
+            case DY_CORE_COMPLEX_RECURSION:
+                dy_substitute_frame_add_binder(frame, &frame->expr.intro.complex.recursion.id, 0);
+                dy_substitute_frame_add_child(frame, &frame->expr.intro.complex.recursion.expr);
+                frame->steps[frame->num_steps++].tag = DY_SUBSTITUTE_STEP_UNBIND;
+                return true;
+            }
+
+            dy_bail("Impossible");
+        case DY_CORE_INTRO_SIMPLE:
+            dy_substitute_frame_add_simple(frame, &frame->expr.intro.simple);
+            return true;
+        }
+
+        dy_bail("impossible");
+    case DY_CORE_EXPR_ELIM:
+        dy_substitute_frame_add_child(frame, &frame->expr.elim.expr);
+        dy_substitute_frame_add_simple(frame, &frame->expr.elim.simple);
+        return true;
+    case DY_CORE_EXPR_MAP:
+        switch (expr.map.tag) {
+        case DY_CORE_MAP_ASSUMPTION:
+            dy_substitute_frame_add_child(frame, &frame->expr.map.assumption.type);
+            dy_substitute_frame_add_binder(frame, &frame->expr.map.assumption.id, 0);
+            dy_substitute_frame_add_assumption(frame, &frame->expr.map.assumption.assumption);
+            frame->steps[frame->num_steps++].tag = DY_SUBSTITUTE_STEP_UNBIND;
+            return true;
+        case DY_CORE_MAP_CHOICE:
+            dy_substitute_frame_add_assumption(frame, &frame->expr.map.choice.assumption_left);
+            dy_substitute_frame_add_assumption(frame, &frame->expr.map.choice.assumption_right);
+            return true;
+        case DY_CORE_MAP_RECURSION:
+            dy_substitute_frame_add_binder(frame, &frame->expr.map.recursion.id, 0);
+            dy_substitute_frame_add_assumption(frame, &frame->expr.map.recursion.assumption);
+            frame->steps[frame->num_steps++].tag = DY_SUBSTITUTE_STEP_UNBIND;
+            return true;
+        }
+
+        dy_bail("impossible");
+    case DY_CORE_EXPR_INFERENCE_CTX:
+        if (id == expr.inference_ctx.id) {
+            return false;
+        }
+
+        dy_substitute_frame_add_child(frame, &frame->expr.inference_ctx.expr);
+        return true;
+    case DY_CORE_EXPR_VARIABLE:
+    case DY_CORE_EXPR_INFERENCE_VAR:
+    case DY_CORE_EXPR_ANY:
+    case DY_CORE_EXPR_VOID:
+    case DY_CORE_EXPR_CUSTOM:
+        return false;
+    }
+
+    dy_bail("Impossible object type.");
+}
+
+void dy_substitute_frame_add_child(struct dy_substitute_frame *frame, struct dy_core_expr **child)
+{
+    size_t offset = (size_t)((char *)child - (char *)&frame->expr);
+    assert(offset <= UCHAR_MAX);
+
+    frame->steps[frame->num_steps++] = (struct dy_substitute_step){
+        .tag = DY_SUBSTITUTE_STEP_CHILD,
+        .offset = (unsigned char)offset
+    };
+
+    ++frame->num_children;
+}
+
+void dy_substitute_frame_add_binder(struct dy_substitute_frame *frame, size_t *binder, size_t first_child)
+{
+    size_t offset = (size_t)((char *)binder - (char *)&frame->expr);
+    assert(offset <= UCHAR_MAX);
+
+    frame->steps[frame->num_steps++] = (struct dy_substitute_step){
+        .tag = DY_SUBSTITUTE_STEP_BIND,
+        .offset = (unsigned char)offset,
+        .first_child = (unsigned char)first_child
+    };
+}
+
+void dy_substitute_frame_add_assumption(struct dy_substitute_frame *frame, struct dy_core_assumption *assumption)
+{
+    size_t first_child = frame->num_children;
+
+    dy_substitute_frame_add_child(frame, &assumption->type);
+    dy_substitute_frame_add_binder(frame, &assumption->id, first_child);
+    dy_substitute_frame_add_child(frame, &assumption->expr);
+    frame->steps[frame->num_steps++].tag = DY_SUBSTITUTE_STEP_UNBIND;
+}
+
+void dy_substitute_frame_add_simple(struct dy_substitute_frame *frame, struct dy_core_simple *simple)
+{
+    dy_substitute_frame_add_child(frame, &simple->out);
+
+    if (simple->tag == DY_CORE_SIMPLE_PROOF) {
+        dy_substitute_frame_add_child(frame, &simple->proof);
+    }
+}
+
+struct dy_core_expr **dy_substitute_frame_child(struct dy_substitute_frame *frame, size_t offset)
+{
+    return (struct dy_core_expr **)((char *)&frame->expr + offset);
+}
+
+void dy_substitute_frame_set_child(struct dy_substitute_frame *frame, size_t offset, bool is_new, struct dy_core_expr new_child)
+{
+    frame->child_is_new[frame->num_visited_children++] = is_new;
+
+    if (is_new) {
+        *dy_substitute_frame_child(frame, offset) = dy_core_expr_new(new_child);
+    }
+}
+
+void dy_substitute_frame_bind(struct dy_core_ctx *ctx, struct dy_substitute_frame *frame, struct dy_substitute_step step, size_t id, struct dy_core_expr sub)
+{
+    if (frame->num_shadowing_scopes != 0) {
+        ++frame->num_shadowing_scopes;
+        return;
+    }
+
+    size_t binder = *(size_t *)((char *)&frame->expr + step.offset);
+
+    if (binder == id) {
+        frame->num_shadowing_scopes = 1;
+        return;
+    }
+
+    struct dy_substitute_binder *b = &frame->binders[frame->num_binders++];
+    b->offset = step.offset;
+    b->first_child = step.first_child;
+    b->is_renamed = dy_core_expr_contains_this_variable(ctx, binder, sub);
+
+    if (b->is_renamed) {
+        // Otherwise, occurrences of 'binder' in 'sub' would get captured.
+        b->new_id = ctx->running_id++;
+        dy_equal_variables_push(ctx, binder, b->new_id);
+    }
+}
+
+void dy_substitute_frame_unbind(struct dy_core_ctx *ctx, struct dy_substitute_frame *frame)
+{
+    if (frame->num_shadowing_scopes != 0) {
+        --frame->num_shadowing_scopes;
+        return;
+    }
+
+    struct dy_substitute_binder b = frame->binders[--frame->num_binders];
+    if (!b.is_renamed) {
+        return;
+    }
+
+    dy_equal_variables_pop(ctx);
+
+    for (size_t i = b.first_child; i < frame->num_visited_children; ++i) {
+        if (frame->child_is_new[i]) {
+            *(size_t *)((char *)&frame->expr + b.offset) = b.new_id;
+            return;
+        }
+    }
+}
+
+bool dy_substitute_frame_finish(struct dy_core_ctx *ctx, struct dy_substitute_frame *frame, struct dy_core_expr *result)
+{
+    bool is_new = false;
+    for (size_t i = 0; i < frame->num_children; ++i) {
+        is_new = is_new || frame->child_is_new[i];
+    }
+
+    if (!is_new) {
+        return false;
+    }
+
+    // The unchanged children are shared with the old node.
+    for (size_t i = 0, child = 0; i < frame->num_steps; ++i) {
+        if (frame->steps[i].tag != DY_SUBSTITUTE_STEP_CHILD) {
+            continue;
+        }
+
+        if (!frame->child_is_new[child++]) {
+            dy_core_expr_retain_ptr(ctx, *dy_substitute_frame_child(frame, frame->steps[i].offset));
+        }
+    }
+
+    *result = frame->expr;
+    return true;
+}
+
+bool dy_substitute_leaf(struct dy_core_ctx *ctx, struct dy_core_expr expr, size_t id, struct dy_core_expr sub, struct dy_core_expr *result)
+{
+    switch (expr.tag) {
+    case DY_CORE_EXPR_VARIABLE: {
+        if (expr.variable_id == id) {
+            *result = dy_core_expr_retain(ctx, sub);
+            return true;
+        }
+
+        const struct dy_equal_variables *v = dy_equal_variables_find(ctx, expr.variable_id);
+        if (v != NULL && v->id1 == expr.variable_id) {
+            expr.variable_id = v->id2;
+            *result = expr;
+            return true;
+        }
+
+        return false;
+    }
+    case DY_CORE_EXPR_INFERENCE_VAR: {
+        if (expr.inference_var_id == id) {
+            *result = dy_core_expr_retain(ctx, sub);
+            return true;
+        }
+
+        const struct dy_equal_variables *v = dy_equal_variables_find(ctx, expr.inference_var_id);
+        if (v != NULL && v->id1 == expr.inference_var_id) {
+            expr.inference_var_id = v->id2;
+            *result = expr;
+            return true;
+        }
+
+        return false;
+    }
+    case DY_CORE_EXPR_ANY:
+    case DY_CORE_EXPR_VOID:
+    case DY_CORE_EXPR_INFERENCE_CTX:
+        return false;
+    case DY_CORE_EXPR_CUSTOM: {
+        if (ctx->equal_variables.num_elems == 0 && !dy_core_custom_may_contain(expr.custom, id)) {
+            return false;
+        }
+
+        const struct dy_core_custom_shared *s = dy_array_pos(&ctx->custom_shared, expr.custom.id);
+        return s->substitute(ctx, expr.custom.data, id, sub, result);
+    }
+    case DY_CORE_EXPR_INTRO:
+    case DY_CORE_EXPR_ELIM:
+    case DY_CORE_EXPR_MAP:
+        break;
+    }
+
+    dy_bail("Not a leaf.");
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "core.h"
+#include "constraint.h"
+#include "hash_cons.h"
+
+/**
+ * Memoization of subtype checks.
+ *
+ * Finished checks are kept in ctx->past_subtype_checks, an open-addressed table
+ * (power-of-two capacity) keyed on the hashes of subtype and supertype.
+ * A hit yields the cached result and re-adds the constraints the check produced.
+ *
+ * The result of a check also depends on the variables currently in scope,
+ * so every entry records a hash of ctx->equal_variables and ctx->free_variables,
+ * including the types of the latter, which change as inference resolves them;
+ * entries from a different scope never match. Each variable stores the hash of
+ * the scope up to and including itself, so only newly pushed ones need hashing.
+ *
+ * Only checks that didn't transform the subtype expression and didn't
+ * recover inference variables are memoized, since those outputs can't be replayed.
+ *
+ * Checks involving recursive types are additionally treated co-inductively:
+ * Encountering the same check again while it's still in progress assumes it succeeds.
+ * Checks that relied on such an assumption are not memoized.
+ */
+
+struct dy_core_subtype_check_frame {
+    size_t hash;
+    size_t scope_hash;
+    struct dy_core_expr subtype;
+    struct dy_core_expr supertype;
+    bool is_coinductive;
+    bool relied_on_assumption;
+    struct dy_core_subtype_check_frame *next;
+};
+
+/** Above this capacity, the table is cleared instead of grown. */
+static const size_t dy_subtype_memo_max_capacity = 1 << 14;
+
+/** Whether checking 'subtype' against 'supertype' is worth memoizing. */
+static inline bool dy_subtype_memo_applies(struct dy_core_ctx *ctx, struct dy_core_expr subtype, struct dy_core_expr supertype);
+
+/**
+ * Looks up the check described by 'frame', either among finished checks
+ * or among the co-inductive checks in progress.
+ */
+static inline bool dy_subtype_memo_lookup(struct dy_core_ctx *ctx, const struct dy_core_subtype_check_frame *frame, dy_ternary_t *result);
+
+/** Records the result of a finished check, together with the constraints in [constraints_start, end). */
+static inline void dy_subtype_memo_insert(struct dy_core_ctx *ctx, const struct dy_core_subtype_check_frame *frame, dy_ternary_t result, size_t constraints_start);
+
+/** Releases all memoized checks. */
+static inline void dy_subtype_memo_clear(struct dy_core_ctx *ctx);
+
+static inline size_t dy_subtype_memo_scope_hash(struct dy_core_ctx *ctx);
+
+static inline bool dy_subtype_memo_matches(struct dy_core_ctx *ctx, const struct dy_core_subtype_check_frame *frame, size_t hash, size_t scope_hash, struct dy_core_expr subtype, struct dy_core_expr supertype);
+
+static inline void dy_subtype_memo_put(dy_array_t *table, struct dy_core_past_subtype_check entry);
+
+static inline bool dy_subtype_memo_is_recursion(struct dy_core_expr expr);
+
+bool dy_subtype_memo_applies(struct dy_core_ctx *ctx, struct dy_core_expr subtype, struct dy_core_expr supertype)
+{
+    if (ctx->past_subtype_checks.capacity == 0) {
+        return false;
+    }
+
+    // Everything else is either cheap or dispatches to custom code.
+    return subtype.tag == DY_CORE_EXPR_INTRO
+        && supertype.tag == DY_CORE_EXPR_INTRO
+        && (subtype.intro.tag == DY_CORE_INTRO_COMPLEX || supertype.intro.tag == DY_CORE_INTRO_COMPLEX);
+}
+
+bool dy_subtype_memo_lookup(struct dy_core_ctx *ctx, const struct dy_core_subtype_check_frame *frame, dy_ternary_t *result)
+{
+    for (struct dy_core_subtype_check_frame *f = ctx->subtype_check_frames; f != NULL; f = f->next) {
+        if (!f->is_coinductive || !dy_subtype_memo_matches(ctx, frame, f->hash, f->scope_hash, f->subtype, f->supertype)) {
+            continue;
+        }
+
+        // Everything between here and 'f' now depends on an unproven assumption.
+        for (struct dy_core_subtype_check_frame *g = ctx->subtype_check_frames; g != f; g = g->next) {
+            g->relied_on_assumption = true;
+        }
+
+        *result = DY_YES;
+        return true;
+    }
+
+    size_t mask = ctx->past_subtype_checks.capacity - 1;
+
+    for (size_t i = frame->hash & mask;; i = (i + 1) & mask) {
+        const struct dy_core_past_subtype_check *entry = dy_array_pos_uninit(&ctx->past_subtype_checks, i);
+        if (!entry->is_occupied) {
+            return false;
+        }
+
+        if (!dy_subtype_memo_matches(ctx, frame, entry->hash, entry->scope_hash, entry->subtype, entry->supertype)) {
+            continue;
+        }
+
+        dy_constraints_replay(ctx, &entry->constraints);
+
+        *result = entry->result;
+        return true;
+    }
+}
+
+void dy_subtype_memo_insert(struct dy_core_ctx *ctx, const struct dy_core_subtype_check_frame *frame, dy_ternary_t result, size_t constraints_start)
+{
+    dy_array_t *table = &ctx->past_subtype_checks;
+
+    if (4 * (table->num_elems + 1) > 3 * table->capacity) {
+        if (table->capacity >= dy_subtype_memo_max_capacity) {
+            dy_subtype_memo_clear(ctx);
+        } else {
+            dy_array_t old = *table;
+
+            *table = dy_array_create(old.elem_size, old.elem_alignment, old.capacity * 2);
+            memset(table->buffer, 0, table->elem_size * table->capacity);
+
+            for (size_t i = 0; i < old.capacity; ++i) {
+                const struct dy_core_past_subtype_check *entry = dy_array_pos_uninit(&old, i);
+                if (entry->is_occupied) {
+                    dy_subtype_memo_put(table, *entry);
+                }
+            }
+
+            dy_array_release(&old);
+        }
+    }
+
+    struct dy_core_past_subtype_check entry = {
+        .hash = frame->hash,
+        .scope_hash = frame->scope_hash,
+        .subtype = dy_core_expr_retain(ctx, frame->subtype),
+        .supertype = dy_core_expr_retain(ctx, frame->supertype),
+        .result = result,
+        .is_occupied = true
+    };
+
+    dy_constraints_save(ctx, constraints_start, &entry.constraints);
+
+    dy_subtype_memo_put(table, entry);
+}
+
+void dy_subtype_memo_clear(struct dy_core_ctx *ctx)
+{
+    for (size_t i = 0, size = ctx->past_subtype_checks.capacity; i < size; ++i) {
+        struct dy_core_past_subtype_check *entry = dy_array_pos_uninit(&ctx->past_subtype_checks, i);
+        if (!entry->is_occupied) {
+            continue;
+        }
+
+        dy_core_expr_release(ctx, entry->subtype);
+        dy_core_expr_release(ctx, entry->supertype);
+
+        dy_constraints_release_saved(ctx, &entry->constraints);
+
+        *entry = (struct dy_core_past_subtype_check){ 0 };
+    }
+
+    ctx->past_subtype_checks.num_elems = 0;
+}
+
+size_t dy_subtype_memo_scope_hash(struct dy_core_ctx *ctx)
+{
+    // Find the innermost variables whose hashes are still valid, then hash outwards from there.
+    size_t i = ctx->equal_variables.num_elems;
+    while (i > 0 && DY_ARRAY_AT(&ctx->equal_variables, struct dy_equal_variables, i - 1).scope_hash == 0) {
+        --i;
+    }
+
+    size_t h_equal = i == 0 ? 0 : DY_ARRAY_AT(&ctx->equal_variables, struct dy_equal_variables, i - 1).scope_hash;
+    for (size_t size = ctx->equal_variables.num_elems; i < size; ++i) {
+        struct dy_equal_variables *v = dy_array_pos(&ctx->equal_variables, i);
+        h_equal = dy_hash_combine(dy_hash_combine(h_equal, v->id1), v->id2);
+        v->scope_hash = h_equal;
+    }
+
+    i = ctx->free_variables.num_elems;
+    while (i > 0 && DY_ARRAY_AT(&ctx->free_variables, struct dy_free_var, i - 1).scope_hash == 0) {
+        --i;
+    }
+
+    size_t h_free = i == 0 ? 0 : DY_ARRAY_AT(&ctx->free_variables, struct dy_free_var, i - 1).scope_hash;
+    for (size_t size = ctx->free_variables.num_elems; i < size; ++i) {
+        struct dy_free_var *v = dy_array_pos(&ctx->free_variables, i);
+        h_free = dy_hash_combine(dy_hash_combine(h_free, v->id), dy_hash_cons_hash(ctx, v->type));
+        v->scope_hash = h_free;
+    }
+
+    return dy_hash_combine(dy_hash_combine(0, h_equal), h_free);
+}
+
+bool dy_subtype_memo_matches(struct dy_core_ctx *ctx, const struct dy_core_subtype_check_frame *frame, size_t hash, size_t scope_hash, struct dy_core_expr subtype, struct dy_core_expr supertype)
+{
+    return frame->hash == hash
+        && frame->scope_hash == scope_hash
+        && dy_hash_cons_exprs_are_identical(ctx, frame->subtype, subtype)
+        && dy_hash_cons_exprs_are_identical(ctx, frame->supertype, supertype);
+}
+
+void dy_subtype_memo_put(dy_array_t *table, struct dy_core_past_subtype_check entry)
+{
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = entry.hash & mask;; i = (i + 1) & mask) {
+        struct dy_core_past_subtype_check *slot = dy_array_pos_uninit(table, i);
+        if (!slot->is_occupied) {
+            *slot = entry;
+            ++table->num_elems;
+            return;
+        }
+    }
+}
+
+bool dy_subtype_memo_is_recursion(struct dy_core_expr expr)
+{
+    return expr.tag == DY_CORE_EXPR_INTRO
+        && expr.intro.tag == DY_CORE_INTRO_COMPLEX
+        && expr.intro.complex.tag == DY_CORE_COMPLEX_RECURSION;
+}
@@ -13,12 +13,24 @@
  */
 static inline struct dy_core_expr dy_type_of(struct dy_core_ctx *ctx, struct dy_core_expr expr);
 
+/**
+ * Like dy_type_of(), for an expression allocated by dy_core_expr_new().
+ * The type is cached in the node if possible (see struct dy_core_node),
+ * so asking again is O(1).
+ */
+static inline struct dy_core_expr dy_type_of_ptr(struct dy_core_ctx *ctx, const struct dy_core_expr *expr);
+
+/** Whether none of the variables in scope occur in 'node', so that its type is the same in any scope. */
+static inline bool dy_type_of_is_scope_independent(struct dy_core_ctx *ctx, const struct dy_core_node *node);
+
 static inline struct dy_core_expr dy_type_of_map_assumption(struct dy_core_ctx *ctx, struct dy_core_map_assumption ass, bool is_implicit);
 static inline struct dy_core_expr dy_type_of_map_choice(struct dy_core_ctx *ctx, struct dy_core_map_choice choice, bool is_implicit);
 static inline struct dy_core_expr dy_type_of_map_recursion(struct dy_core_ctx *ctx, struct dy_core_map_recursion rec, bool is_implicit);
 
 struct dy_core_expr dy_type_of(struct dy_core_ctx *ctx, struct dy_core_expr expr)
 {
+    DY_STATS_COUNT(DY_STAT_TYPE_OF);
+
     switch (expr.tag) {
     case DY_CORE_EXPR_INTRO:
         expr.intro.polarity = DY_POLARITY_POSITIVE;
@@ -34,14 +46,14 @@ struct dy_core_expr dy_type_of(struct dy_core_ctx *ctx, struct dy_core_expr expr
                     .type = *expr.intro.complex.assumption.type
                 });
 
-                expr.intro.complex.assumption.expr = dy_core_expr_new(dy_type_of(ctx, *expr.intro.complex.assumption.expr));
+                expr.intro.complex.assumption.expr = dy_core_expr_new(dy_type_of_ptr(ctx, expr.intro.complex.assumption.expr));
 
                 ctx->free_variables.num_elems--;
 
                 return expr;
             case DY_CORE_COMPLEX_CHOICE:
-                expr.intro.complex.choice.left = dy_core_expr_new(dy_type_of(ctx, *expr.intro.complex.choice.left));
-                expr.intro.complex.choice.right = dy_core_expr_new(dy_type_of(ctx, *expr.intro.complex.choice.right));
+                expr.intro.complex.choice.left = dy_core_expr_new(dy_type_of_ptr(ctx, expr.intro.complex.choice.left));
+                expr.intro.complex.choice.right = dy_core_expr_new(dy_type_of_ptr(ctx, expr.intro.complex.choice.right));
                 return expr;
             case DY_CORE_COMPLEX_RECURSION:
                 dy_array_add(&ctx->free_variables, &(struct dy_free_var){
@@ -52,7 +64,7 @@ struct dy_core_expr dy_type_of(struct dy_core_ctx *ctx, struct dy_core_expr expr
                     }
                 });
 
-                expr.intro.complex.recursion.expr = dy_core_expr_new(dy_type_of(ctx, *expr.intro.complex.recursion.expr));
+                expr.intro.complex.recursion.expr = dy_core_expr_new(dy_type_of_ptr(ctx, expr.intro.complex.recursion.expr));
 
                 ctx->free_variables.num_elems--;
 
@@ -65,7 +77,7 @@ struct dy_core_expr dy_type_of(struct dy_core_ctx *ctx, struct dy_core_expr expr
                 dy_core_expr_retain_ptr(ctx, expr.intro.simple.proof);
             }
 
-            expr.intro.simple.out = dy_core_expr_new(dy_type_of(ctx, *expr.intro.simple.out));
+            expr.intro.simple.out = dy_core_expr_new(dy_type_of_ptr(ctx, expr.intro.simple.out));
             return expr;
         }
 
@@ -85,7 +97,7 @@ struct dy_core_expr dy_type_of(struct dy_core_ctx *ctx, struct dy_core_expr expr
         dy_bail("impossible");
     case DY_CORE_EXPR_VARIABLE:
         for (size_t i = ctx->free_variables.num_elems; i-- > 0;) {
-            const struct dy_free_var *free_var = dy_array_pos(&ctx->free_variables, i);
+            const struct dy_free_var *free_var = &DY_ARRAY_AT(&ctx->free_variables, struct dy_free_var, i);
             if (free_var->id == expr.variable_id) {
                 return dy_core_expr_retain(ctx, free_var->type);
             }
@@ -112,6 +124,43 @@ struct dy_core_expr dy_type_of(struct dy_core_ctx *ctx, struct dy_core_expr expr
     dy_bail("Impossible object type.");
 }
 
+struct dy_core_expr dy_type_of_ptr(struct dy_core_ctx *ctx, const struct dy_core_expr *expr)
+{
+    // The cache is not part of the value of the node, so filling it in doesn't count as mutating it.
+    struct dy_core_node *node = (struct dy_core_node *)expr;
+
+    if (node->type != NULL) {
+        DY_STATS_COUNT(DY_STAT_TYPE_OF_CACHED);
+        return dy_core_expr_retain(ctx, *node->type);
+    }
+
+    struct dy_core_expr type = dy_type_of(ctx, *expr);
+
+    if (dy_type_of_is_scope_independent(ctx, node)) {
+        node->type = dy_core_expr_new(dy_core_expr_retain(ctx, type));
+    }
+
+    return type;
+}
+
+bool dy_type_of_is_scope_independent(struct dy_core_ctx *ctx, const struct dy_core_node *node)
+{
+    if (node->min_id > node->max_id) {
+        return true;
+    }
+
+    // Any variable occurring in the node but not bound inside it must be in scope,
+    // since looking up its type would fail otherwise.
+    for (size_t i = 0, size = ctx->free_variables.num_elems; i < size; ++i) {
+        size_t id = DY_ARRAY_AT(&ctx->free_variables, struct dy_free_var, i).id;
+        if (node->min_id <= id && id <= node->max_id) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 struct dy_core_expr dy_type_of_map_assumption(struct dy_core_ctx *ctx, struct dy_core_map_assumption ass, bool is_implicit)
 {
     if (ass.dependence == DY_CORE_MAP_DEPENDENCE_DEPENDENT) {
@@ -130,7 +179,7 @@ struct dy_core_expr dy_type_of_map_assumption(struct dy_core_ctx *ctx, struct dy
         .type = *ass.assumption.type
     });
 
-    struct dy_core_expr type = dy_type_of(ctx, *ass.assumption.expr);
+    struct dy_core_expr type = dy_type_of_ptr(ctx, ass.assumption.expr);
 
     ctx->free_variables.num_elems--;
     ctx->free_variables.num_elems--;
@@ -200,7 +249,7 @@ struct dy_core_expr dy_type_of_map_choice(struct dy_core_ctx *ctx, struct dy_cor
         .type = *choice.assumption_left.type
     });
 
-    struct dy_core_expr type_left = dy_type_of(ctx, *choice.assumption_left.expr);
+    struct dy_core_expr type_left = dy_type_of_ptr(ctx, choice.assumption_left.expr);
 
     ctx->free_variables.num_elems--;
 
@@ -209,7 +258,7 @@ struct dy_core_expr dy_type_of_map_choice(struct dy_core_ctx *ctx, struct dy_cor
         .type = *choice.assumption_right.type
     });
 
-    struct dy_core_expr type_right = dy_type_of(ctx, *choice.assumption_right.expr);
+    struct dy_core_expr type_right = dy_type_of_ptr(ctx, choice.assumption_right.expr);
 
     ctx->free_variables.num_elems--;
 
@@ -284,7 +333,7 @@ struct dy_core_expr dy_type_of_map_recursion(struct dy_core_ctx *ctx, struct dy_
         .type = *rec.assumption.type
     });
 
-    struct dy_core_expr type = dy_type_of(ctx, *rec.assumption.expr);
+    struct dy_core_expr type = dy_type_of_ptr(ctx, rec.assumption.expr);
 
     ctx->free_variables.num_elems--;
     ctx->free_variables.num_elems--;
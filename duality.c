@@ -9,6 +9,7 @@
 
 #include "core/check.h"
 #include "core/eval.h"
+#include "core/serialize.h"
 
 #include "lsp/server.h"
 
@@ -16,17 +17,97 @@ static void read_chunk(dy_array_t *buffer, void *env);
 
 static const size_t CHUNK_SIZE = 1024;
 
-static void print_core_expr(struct dy_core_ctx *ctx, FILE *file, struct dy_core_expr expr);
+/** Prints 'expr', elided according to the limits of a dy_writer (0 for none). */
+static void print_core_expr(struct dy_core_ctx *ctx, FILE *file, struct dy_core_expr expr, size_t max_depth, size_t max_size);
 
 static bool core_has_error(struct dy_core_expr expr);
 
+/** Prints the 1-based line and column of the byte at 'index' in 'text'. */
+static void print_position(FILE *file, dy_string_t text, size_t index);
+
+/**
+ * Checked programs can be cached in a file next to their source, see --cache.
+ * The cache holds the Core before and after checking, keyed by the size and hash of the source.
+ */
+static const dy_string_t core_cache_magic = DY_STR_LIT_INIT("DYC1");
+
+/**
+ * Caches of any other version are ignored. Bump this whenever the serialized
+ * format, checking, or the meaning of Core changes, since a stale cache could
+ * otherwise still deserialize just fine.
+ */
+static const size_t core_cache_version = 1;
+
+/** Returns false if there is no usable cache at 'path' for 'source'. */
+static bool load_core_cache(struct dy_core_ctx *ctx, const char *path, dy_string_t source, struct dy_core_expr *pre_checked, struct dy_core_expr *checked);
+
+static void store_core_cache(struct dy_core_ctx *ctx, const char *path, dy_string_t source, struct dy_core_expr pre_checked, struct dy_core_expr checked);
+
 static bool print_core_errors(dy_array_t text_sources, FILE *file, struct dy_core_expr expr, const char *text, size_t text_size);
 
 static void print_error_fragment(FILE *file, struct dy_range range, const char *text, size_t text_size);
 
+#ifdef DY_STATS
+
+/** Set by --stats, see support/stats.h. */
+static bool print_stats = false;
+
+/** Runs at exit, so that failed runs are covered too. */
+static void finish_stats(void);
+
+#endif
+
 int main(int argc, const char *argv[])
 {
+    // Select the environment-based evaluator or the bytecode VM, mainly to cross-check them against the default one.
+    bool eval_with_environments = false;
+    bool eval_with_bytecode = false;
+    // Keep the Core dumps of big programs manageable.
+    size_t max_print_depth = 0;
+    size_t max_print_size = 0;
+    // Skip parsing and checking if the source didn't change since the last run.
+    bool use_cache = false;
+    for (; argc > 1; ++argv, --argc) {
+        if (strcmp(argv[1], "--eval-env") == 0) {
+            eval_with_environments = true;
+        } else if (strcmp(argv[1], "--eval-vm") == 0) {
+            eval_with_bytecode = true;
+        } else if (strcmp(argv[1], "--max-print-depth") == 0 && argc > 2) {
+            max_print_depth = (size_t)strtoul(argv[2], NULL, 10);
+            ++argv, --argc;
+        } else if (strcmp(argv[1], "--max-print-size") == 0 && argc > 2) {
+            max_print_size = (size_t)strtoul(argv[2], NULL, 10);
+            ++argv, --argc;
+        } else if (strcmp(argv[1], "--cache") == 0) {
+            use_cache = true;
+        } else if (strcmp(argv[1], "--stats") == 0 || strncmp(argv[1], "--trace=", strlen("--trace=")) == 0) {
+#ifdef DY_STATS
+            if (strcmp(argv[1], "--stats") == 0) {
+                print_stats = true;
+            } else if (dy_stats.trace == NULL) {
+                FILE *trace = fopen(argv[1] + strlen("--trace="), "w");
+                if (trace == NULL) {
+                    perror("Error opening trace file");
+                    return -1;
+                }
+
+                dy_stats_trace_start(trace);
+            }
+#else
+            fprintf(stderr, "%s needs a build with DY_STATS defined.\n", argv[1]);
+            return -1;
+#endif
+        } else {
+            break;
+        }
+    }
+
+#ifdef DY_STATS
+    atexit(finish_stats);
+#endif
+
     FILE *stream;
+    char *cache_path = NULL;
     if (argc > 1) {
         if (strcmp(argv[1], "--server") == 0) {
             return dy_lsp_run_server(stdin, stdout);
@@ -42,6 +123,15 @@ int main(int argc, const char *argv[])
             perror("Error reading file");
             return -1;
         }
+
+        if (use_cache) {
+            // Without memory for the path, just run without the cache.
+            size_t size = strlen(argv[1]) + sizeof ".dyc";
+            cache_path = malloc(size);
+            if (cache_path != NULL) {
+                snprintf(cache_path, size, "%s.dyc", argv[1]);
+            }
+        }
     } else {
         stream = stdin;
     }
@@ -55,67 +145,161 @@ int main(int argc, const char *argv[])
         }
     };
 
-    struct dy_ast_do_block ast;
-    if (!dy_utf8_to_ast_file(&utf8_to_ast_ctx, &ast)) {
-        fprintf(stderr, "Failed to parse program.\n");
-        return -1;
+    if (cache_path != NULL) {
+        // The cache is keyed by the whole source, so read all of it upfront.
+        while (!feof(stream) && !ferror(stream)) {
+            read_chunk(&utf8_to_ast_ctx.stream.buffer, stream);
+        }
     }
 
+    dy_string_t source = dy_array_view(&utf8_to_ast_ctx.stream.buffer);
+
     dy_array_t custom_shared = dy_array_create(sizeof(struct dy_core_custom_shared), DY_ALIGNOF(struct dy_core_custom_shared), 3);
 
     dy_uv_register(&custom_shared);
     dy_def_register(&custom_shared);
     dy_string_register(&custom_shared);
     dy_string_type_register(&custom_shared);
+    dy_int_register(&custom_shared);
+    dy_int_type_register(&custom_shared);
+    dy_int_op_register(&custom_shared);
+    dy_string_op_register(&custom_shared);
     dy_print_register(&custom_shared);
 
-    struct dy_ast_to_core_ctx ast_to_core_ctx = {
-        .running_id = 0,
-        .variable_replacements = dy_array_create(sizeof(struct dy_variable_replacement), DY_ALIGNOF(struct dy_variable_replacement), 128)
-    };
-
-    struct dy_core_expr core = dy_ast_do_block_to_core(&ast_to_core_ctx, ast);
-
-    dy_ast_do_block_release(ast);
-
     struct dy_core_ctx core_ctx = {
-        .running_id = ast_to_core_ctx.running_id,
+        .running_id = 0,
         .free_variables = dy_array_create(sizeof(struct dy_free_var), DY_ALIGNOF(struct dy_free_var), 64),
         .captured_inference_vars = dy_array_create(sizeof(struct dy_captured_inference_var), DY_ALIGNOF(struct dy_captured_inference_var), 64),
         .recovered_negative_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
         .recovered_positive_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
         .past_subtype_checks = dy_array_create(sizeof(struct dy_core_past_subtype_check), DY_ALIGNOF(struct dy_core_past_subtype_check), 64),
+        .past_checks = dy_array_create(sizeof(struct dy_core_past_check), DY_ALIGNOF(struct dy_core_past_check), 0),
         .equal_variables = dy_array_create(sizeof(struct dy_equal_variables), DY_ALIGNOF(struct dy_equal_variables), 64),
+        .equal_variable_levels = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 256),
         .free_ids_arrays = dy_array_create(sizeof(dy_array_t), DY_ALIGNOF(dy_array_t), 8),
         .constraints = dy_array_create(sizeof(struct dy_constraint), DY_ALIGNOF(struct dy_constraint), 64),
+        .constraint_index = dy_array_create(sizeof(struct dy_constraint_index_entry), DY_ALIGNOF(struct dy_constraint_index_entry), 0),
+        .dead_nodes = dy_array_create(sizeof(struct dy_core_expr *), DY_ALIGNOF(struct dy_core_expr *), 4096),
+        .hash_consed_exprs = dy_array_create(sizeof(struct dy_hash_consed_expr), DY_ALIGNOF(struct dy_hash_consed_expr), 1024),
+        .eval_with_environments = eval_with_environments,
         .custom_shared = custom_shared
     };
 
+    struct dy_bytecode bytecode;
+    if (eval_with_bytecode) {
+        bytecode = dy_bytecode_create();
+        core_ctx.bytecode = &bytecode;
+    }
+
+    struct dy_core_expr core;
+    struct dy_core_expr cached_checked_core;
+    bool is_cached = cache_path != NULL && load_core_cache(&core_ctx, cache_path, source, &core, &cached_checked_core);
+
+    if (!is_cached) {
+        DY_STATS_PHASE_BEGIN(DY_STATS_PHASE_PARSE);
+
+        struct dy_ast_do_block ast;
+        bool parsed = dy_utf8_to_ast_file(&utf8_to_ast_ctx, &ast);
+
+        DY_STATS_PHASE_END(DY_STATS_PHASE_PARSE);
+
+        if (!parsed) {
+            if (utf8_to_ast_ctx.has_out_of_range_int) {
+                fprintf(stderr, "Integer literal out of range at ");
+                print_position(stderr, dy_array_view(&utf8_to_ast_ctx.stream.buffer), utf8_to_ast_ctx.out_of_range_int_index);
+                fprintf(stderr, ".\n");
+            } else {
+                fprintf(stderr, "Failed to parse program.\n");
+            }
+
+            free(cache_path);
+
+            if (core_ctx.bytecode != NULL) {
+                dy_bytecode_release(&core_ctx, core_ctx.bytecode);
+            }
+
+            return -1;
+        }
+
+        dy_interner_release(&utf8_to_ast_ctx.symbols);
+
+        struct dy_ast_to_core_ctx ast_to_core_ctx = {
+            .running_id = 0,
+            .variable_replacements = dy_array_create(sizeof(struct dy_variable_replacement), DY_ALIGNOF(struct dy_variable_replacement), 128),
+            .innermost_replacements = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 128),
+            .num_lookups_per_level = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 16)
+        };
+
+        DY_STATS_PHASE_BEGIN(DY_STATS_PHASE_LOWER);
+
+        core = dy_ast_do_block_to_core(&ast_to_core_ctx, ast);
+
+        DY_STATS_PHASE_END(DY_STATS_PHASE_LOWER);
+
+        dy_ast_do_block_release(ast);
+
+        core_ctx.running_id = ast_to_core_ctx.running_id;
+    }
+
+    core = dy_hash_cons(&core_ctx, core);
+
     printf("=== Pre-checked Core ====\n\n");
-    print_core_expr(&core_ctx, stdout, core);
+    print_core_expr(&core_ctx, stdout, core, max_print_depth, max_print_size);
     printf("\n\n");
 
-    struct dy_core_expr checked_core;
-    if (dy_check_expr(&core_ctx, core, &checked_core)) {
+    if (is_cached) {
         dy_core_expr_release(&core_ctx, core);
-        core = checked_core;
+        core = dy_hash_cons(&core_ctx, cached_checked_core);
+    } else {
+        struct dy_core_expr pre_checked_core = dy_core_expr_retain(&core_ctx, core);
+
+        DY_STATS_PHASE_BEGIN(DY_STATS_PHASE_CHECK);
+
+        struct dy_core_expr checked_core;
+        if (dy_check_expr(&core_ctx, core, &checked_core)) {
+            dy_core_expr_release(&core_ctx, core);
+            core = dy_hash_cons(&core_ctx, checked_core);
+        }
+
+        DY_STATS_PHASE_END(DY_STATS_PHASE_CHECK);
+
+        if (cache_path != NULL) {
+            store_core_cache(&core_ctx, cache_path, source, pre_checked_core, core);
+        }
+
+        dy_core_expr_release(&core_ctx, pre_checked_core);
     }
 
+    free(cache_path);
+
     printf("=== Checked Core ====\n\n");
-    print_core_expr(&core_ctx, stdout, core);
+    print_core_expr(&core_ctx, stdout, core, max_print_depth, max_print_size);
     printf("\n\n");
 
     if (core_has_error(core)) {
         fprintf(stderr, "*** Encountered errors. Aborting. ***\n");
+
+        if (core_ctx.bytecode != NULL) {
+            dy_bytecode_release(&core_ctx, core_ctx.bytecode);
+        }
+
         return -1;
     }
 
+    // Don't leave the garbage of checking to evaluation.
+    dy_core_free_dead_nodes(&core_ctx);
+
     bool is_value = false;
     struct dy_core_expr result = core;
+
+    DY_STATS_PHASE_BEGIN(DY_STATS_PHASE_EVAL);
+
     dy_eval_expr(&core_ctx, core, &is_value, &result);
 
+    DY_STATS_PHASE_END(DY_STATS_PHASE_EVAL);
+
     printf("=== Evaluated Core ====\n\n");
-    print_core_expr(&core_ctx, stdout, result);
+    print_core_expr(&core_ctx, stdout, result, max_print_depth, max_print_size);
     printf("\n");
 
     if (!is_value) {
@@ -125,23 +309,46 @@ int main(int argc, const char *argv[])
             fprintf(stderr, "*** Unable to continue evaluating. ***\n");
         }
 
+        if (core_ctx.bytecode != NULL) {
+            dy_bytecode_release(&core_ctx, core_ctx.bytecode);
+        }
+
         return -1;
     }
 
+    if (core_ctx.bytecode != NULL) {
+        dy_bytecode_release(&core_ctx, core_ctx.bytecode);
+    }
+
     return 0;
 }
 
-void print_core_expr(struct dy_core_ctx *ctx, FILE *file, struct dy_core_expr expr)
+#ifdef DY_STATS
+
+void finish_stats(void)
 {
-    dy_array_t s = dy_array_create(sizeof(char), DY_ALIGNOF(char), 64);
-    dy_core_expr_to_string(ctx, expr, &s);
+    if (dy_stats.trace != NULL) {
+        FILE *trace = dy_stats.trace;
+        dy_stats_trace_finish();
+        fclose(trace);
+    }
 
-    for (size_t i = 0; i < s.num_elems; ++i) {
-        char c = *(char *)dy_array_pos(&s, i);
-        fprintf(file, "%c", c);
+    if (print_stats) {
+        dy_stats_print(stderr);
     }
+}
+
+#endif
+
+void print_core_expr(struct dy_core_ctx *ctx, FILE *file, struct dy_core_expr expr, size_t max_depth, size_t max_size)
+{
+    struct dy_writer writer = dy_writer_to_file(file);
+    writer.max_depth = max_depth;
+    writer.max_size = max_size;
+
+    dy_core_expr_to_string(ctx, expr, &writer);
 
-    dy_array_release(&s);
+    dy_writer_release(&writer);
 }
 
 void read_chunk(dy_array_t *buffer, void *env)
@@ -152,13 +359,30 @@ void read_chunk(dy_array_t *buffer, void *env)
         return;
     }
 
-    dy_array_set_excess_capacity(buffer, CHUNK_SIZE);
+    // The parser wants the whole source in one buffer, so grow geometrically
+    // instead of reallocating for every chunk.
+    size_t chunk_size = buffer->num_elems > CHUNK_SIZE ? buffer->num_elems : CHUNK_SIZE;
 
-    size_t num_bytes_read = fread(dy_array_excess_buffer(buffer), sizeof(char), CHUNK_SIZE, stream);
+    dy_array_set_excess_capacity(buffer, chunk_size);
+
+    size_t num_bytes_read = fread(dy_array_excess_buffer(buffer), sizeof(char), chunk_size, stream);
 
     dy_array_add_to_size(buffer, num_bytes_read);
 }
 
+void print_position(FILE *file, dy_string_t text, size_t index)
+{
+    size_t line = 1, line_start = 0;
+    for (size_t i = 0; i < index; ++i) {
+        if (text.ptr[i] == '\n') {
+            ++line;
+            line_start = i + 1;
+        }
+    }
+
+    fprintf(file, "%zu:%zu", line, index - line_start + 1);
+}
+
 bool core_has_error(struct dy_core_expr expr)
 {
     switch (expr.tag) {
@@ -312,3 +536,112 @@ void print_error_fragment(FILE *file, struct dy_range range, const char *text, s
     fprintf(file, "\n");
 }
 */
+
+bool load_core_cache(struct dy_core_ctx *ctx, const char *path, dy_string_t source, struct dy_core_expr *pre_checked, struct dy_core_expr *checked)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    dy_array_t buffer = dy_array_create(sizeof(char), DY_ALIGNOF(char), CHUNK_SIZE);
+    while (!feof(file) && !ferror(file)) {
+        read_chunk(&buffer, file);
+    }
+
+    bool is_valid = !ferror(file);
+
+    fclose(file);
+
+    struct dy_core_deserializer d = dy_core_deserializer_create(dy_array_view(&buffer));
+
+    is_valid = is_valid
+        && d.bytes.size >= core_cache_magic.size
+        && memcmp(d.bytes.ptr, core_cache_magic.ptr, core_cache_magic.size) == 0;
+
+    // A cache is only valid for the same version, the exact same source, and the same set of customs.
+    size_t version, source_size, source_hash, num_customs, running_id;
+    if (is_valid) {
+        d.pos = core_cache_magic.size;
+
+        is_valid = dy_deserialize_size_t(&d, &version)
+            && version == core_cache_version
+            && dy_deserialize_size_t(&d, &source_size)
+            && source_size == source.size
+            && dy_deserialize_size_t(&d, &source_hash)
+            && source_hash == dy_intern_hash(source)
+            && dy_deserialize_size_t(&d, &num_customs)
+            && num_customs == ctx->custom_shared.num_elems
+            && dy_deserialize_size_t(&d, &running_id);
+    }
+
+    if (is_valid && dy_deserialize_expr(ctx, &d, pre_checked)) {
+        if (dy_deserialize_expr(ctx, &d, checked)) {
+            dy_string_t payload = {
+                .ptr = d.bytes.ptr + core_cache_magic.size,
+                .size = d.pos - core_cache_magic.size
+            };
+
+            // Catches damage that still happens to deserialize.
+            size_t checksum;
+            is_valid = dy_deserialize_size_t(&d, &checksum)
+                && checksum == dy_intern_hash(payload)
+                && d.pos == d.bytes.size;
+
+            if (!is_valid) {
+                dy_core_expr_release(ctx, *checked);
+            }
+        } else {
+            is_valid = false;
+        }
+
+        if (is_valid) {
+            ctx->running_id = running_id;
+        } else {
+            dy_core_expr_release(ctx, *pre_checked);
+        }
+    } else {
+        is_valid = false;
+    }
+
+    dy_core_deserializer_release(ctx, &d);
+    dy_array_release(&buffer);
+
+    return is_valid;
+}
+
+void store_core_cache(struct dy_core_ctx *ctx, const char *path, dy_string_t source, struct dy_core_expr pre_checked, struct dy_core_expr checked)
+{
+    // Built up in memory first, so that the checksum can go at the end.
+    struct dy_writer writer = dy_writer_to_buffer(CHUNK_SIZE);
+    struct dy_core_serializer s = dy_core_serializer_create(&writer);
+
+    dy_write(&writer, core_cache_magic);
+    dy_serialize_size_t(&s, core_cache_version);
+    dy_serialize_size_t(&s, source.size);
+    dy_serialize_size_t(&s, dy_intern_hash(source));
+    dy_serialize_size_t(&s, ctx->custom_shared.num_elems);
+    dy_serialize_size_t(&s, ctx->running_id);
+    dy_serialize_expr(ctx, &s, pre_checked);
+    dy_serialize_expr(ctx, &s, checked);
+
+    dy_string_t payload = dy_array_view(&writer.buffer);
+    payload.ptr += core_cache_magic.size;
+    payload.size -= core_cache_magic.size;
+    dy_serialize_size_t(&s, dy_intern_hash(payload));
+
+    dy_core_serializer_release(ctx, &s);
+
+    FILE *file = s.failed ? NULL : fopen(path, "wb");
+    if (file != NULL) {
+        bool failed = fwrite(writer.buffer.buffer, sizeof(char), writer.buffer.num_elems, file) != writer.buffer.num_elems;
+        failed = fclose(file) != 0 || failed;
+
+        if (failed) {
+            // Just slower next time.
+            remove(path);
+        }
+    }
+
+    dy_writer_release(&writer);
+}
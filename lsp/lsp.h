@@ -22,10 +22,32 @@ typedef struct dy_lsp_ctx dy_lsp_ctx_t;
 
 typedef void (*dy_lsp_send_fn)(const uint8_t *message, void *env);
 
-static inline dy_lsp_ctx_t *dy_lsp_create(dy_lsp_send_fn send, void *env);
+typedef bool (*dy_lsp_input_is_pending_fn)(void *env);
+
+/**
+ * 'input_is_pending' tells whether more messages arrived. It may be NULL,
+ * in which case checking a document is never cancelled, see dy_lsp_idle().
+ */
+static inline dy_lsp_ctx_t *dy_lsp_create(dy_lsp_send_fn send, void *env, dy_lsp_input_is_pending_fn input_is_pending, void *input_env);
 
 static inline bool dy_lsp_handle_message(dy_lsp_ctx_t *ctx, const uint8_t *message);
 
+/**
+ * Lets the server see 'message' as soon as it's read, before the messages preceding it are handled.
+ * That way, requests cancelled via $/cancelRequest can be answered right away instead of being worked on.
+ */
+static inline void dy_lsp_note_message(dy_lsp_ctx_t *ctx, const uint8_t *message);
+
+/**
+ * Should be called whenever there are no more messages to handle.
+ *
+ * Documents are only checked here, so a burst of edits is checked once, as a whole.
+ * Checking is cancelled as soon as more messages arrive, so that they're handled first.
+ * The document is checked again with the next call, which is cheap up to where
+ * the cancelled check got, since checked definitions are memoized (see check_memo.h).
+ */
+static inline void dy_lsp_idle(dy_lsp_ctx_t *ctx);
+
 static inline void dy_lsp_initialize(const uint8_t *id, dy_lsp_ctx_t *ctx, dy_array_t *json);
 
 static inline void dy_lsp_initialized(dy_lsp_ctx_t *ctx);
@@ -55,6 +77,7 @@ struct document {
     struct dy_core_ctx core_ctx;
     struct dy_core_expr core;
     bool core_is_present;
+    bool needs_processing; /** The text changed since the last check, see dy_lsp_idle(). */
 };
 
 struct dy_lsp_ctx {
@@ -63,10 +86,14 @@ struct dy_lsp_ctx {
     dy_lsp_send_fn send;
     void *env;
 
+    dy_lsp_input_is_pending_fn input_is_pending;
+    void *input_env;
+
     bool is_initialized;
     bool received_shutdown_request;
     int exit_code;
     dy_array_t documents;
+    dy_array_t cancelled_request_ids; /** Copies of the JSON ids, see dy_lsp_note_message(). */
 };
 
 static inline void dy_lsp_send(dy_lsp_ctx_t *ctx);
@@ -77,6 +104,8 @@ static inline void server_info(dy_array_t *json);
 static inline void text_document_sync_options(dy_array_t *json);
 static inline void initialize_response(const uint8_t *id, dy_array_t *json);
 static inline void method_not_found(const uint8_t *id, dy_string_t message, dy_array_t *json);
+static inline void request_cancelled(const uint8_t *id, dy_array_t *json);
+static inline bool take_cancelled_request(dy_lsp_ctx_t *ctx, const uint8_t *id);
 static inline void response_error(long code, dy_string_t message, dy_array_t *json);
 static inline void null_success_response(const uint8_t *id, dy_array_t *json);
 static inline void hover_result(dy_string_t contents, dy_array_t *json);
@@ -85,9 +114,12 @@ static inline void make_range(long start_line, long start_character, long end_li
 static inline void publish_diagnostics(struct dy_core_ctx *ctx, dy_string_t uri, const dy_array_t *text_sources, struct dy_core_expr expr, dy_string_t text, dy_array_t *json);
 static inline void compute_lsp_range(dy_string_t text, struct dy_range range, dy_array_t *json);
 
-static inline void process_document(struct dy_lsp_ctx *ctx, struct document *doc);
+/** Returns false if checking was cancelled, in which case the document is left as it was. */
+static inline bool process_document(struct dy_lsp_ctx *ctx, struct document *doc);
 static inline void null_stream(dy_array_t *buffer, void *env);
 static inline bool compute_byte_offset(dy_string_t text, long line_offset, long utf16_offset, size_t *byte_offset);
+static inline bool get_position_byte_offset(dy_string_t text, const uint8_t *position, size_t *byte_offset);
+static inline bool get_range_byte_offsets(dy_string_t text, const uint8_t *range, size_t *start, size_t *end);
 static inline bool produce_diagnostics(struct dy_core_ctx *ctx, const dy_array_t *text_sources, struct dy_core_expr expr, dy_string_t text, dy_array_t *json);
 static inline bool produce_solution_diagnostics(struct dy_core_ctx *ctx, const dy_array_t *text_sources, struct dy_core_simple simple, dy_string_t text, dy_array_t *json);
 static inline void compute_lsp_range(dy_string_t text, struct dy_range range, dy_array_t *json);
@@ -100,6 +132,7 @@ static inline void put_string_literal(dy_string_t s, dy_array_t *json);
 static inline const uint8_t *copy_json_value(const uint8_t *src, dy_array_t *dst);
 static inline const uint8_t *copy_json_string(const uint8_t *src, dy_array_t *dst);
 static inline const uint8_t *skip_json_value(const uint8_t *json);
+static inline bool json_values_are_equal(const uint8_t *a, const uint8_t *b);
 static inline void put_number(long x, dy_array_t *json);
 static inline const uint8_t *skip_json_string(const uint8_t *p);
 static inline const uint8_t *json_get_member(const uint8_t *p, dy_string_t member);
@@ -108,17 +141,23 @@ static inline dy_string_t array_view(const dy_array_t *x);
 static inline dy_array_t view_to_array(dy_string_t s);
 static inline void replace_storage_with_view(dy_array_t *x, dy_string_t s);
 
-dy_lsp_ctx_t *dy_lsp_create(dy_lsp_send_fn send, void *env)
+/** Replaces the bytes in [start, end) of 'x' with 's'. */
+static inline void replace_range_with_view(dy_array_t *x, size_t start, size_t end, dy_string_t s);
+
+dy_lsp_ctx_t *dy_lsp_create(dy_lsp_send_fn send, void *env, dy_lsp_input_is_pending_fn input_is_pending, void *input_env)
 {
     dy_lsp_ctx_t *ctx = dy_rc_alloc(sizeof *ctx, DY_ALIGNOF(struct dy_lsp_ctx));
     *ctx = (dy_lsp_ctx_t){
         .output_buffer = dy_array_create(1, 1, 128),
         .send = send,
         .env = env,
+        .input_is_pending = input_is_pending,
+        .input_env = input_env,
         .is_initialized = false,
         .received_shutdown_request = false,
         .exit_code = 1, // Error by default.
-        .documents = dy_array_create(sizeof(struct document), DY_ALIGNOF(struct document), 8)
+        .documents = dy_array_create(sizeof(struct document), DY_ALIGNOF(struct document), 8),
+        .cancelled_request_ids = dy_array_create(sizeof(dy_array_t), DY_ALIGNOF(dy_array_t), 4)
     };
 
     return ctx;
@@ -126,6 +165,11 @@ dy_lsp_ctx_t *dy_lsp_create(dy_lsp_send_fn send, void *env)
 
 void dy_lsp_destroy(dy_lsp_ctx_t *ctx)
 {
+    for (size_t i = 0, size = ctx->cancelled_request_ids.num_elems; i < size; ++i) {
+        dy_array_release(dy_array_pos(&ctx->cancelled_request_ids, i));
+    }
+
+    dy_array_release(&ctx->cancelled_request_ids);
     dy_array_release(&ctx->documents);
     dy_array_release(&ctx->output_buffer);
     dy_rc_release(ctx, DY_ALIGNOF(dy_lsp_ctx_t));
@@ -171,6 +215,17 @@ bool dy_lsp_handle_message(dy_lsp_ctx_t *ctx, const uint8_t *message)
         return false;
     }
 
+    if (dy_string_are_equal(method_string, DY_STR_LIT("$/cancelRequest"))) {
+        // Already taken care of by dy_lsp_note_message().
+        return true;
+    }
+
+    if (id != NULL && take_cancelled_request(ctx, id)) {
+        request_cancelled(id, &ctx->output_buffer);
+        dy_lsp_send(ctx);
+        return true;
+    }
+
     if (ctx->received_shutdown_request) {
         if (id != NULL) {
             invalid_request(id, DY_STR_LIT("Non-exit request after shutdown."), &ctx->output_buffer);
@@ -460,6 +515,62 @@ bool dy_lsp_handle_message(dy_lsp_ctx_t *ctx, const uint8_t *message)
     return true;
 }
 
+void dy_lsp_note_message(dy_lsp_ctx_t *ctx, const uint8_t *message)
+{
+    if (*message != DY_JSON_OBJECT) {
+        return;
+    }
+    message++;
+
+    const uint8_t *method = json_get_member(message, DY_STR_LIT("method"));
+    if (method == NULL || *method != DY_JSON_STRING) {
+        return;
+    }
+    method++;
+
+    if (!dy_string_are_equal(convert_json_string(method), DY_STR_LIT("$/cancelRequest"))) {
+        return;
+    }
+
+    const uint8_t *params = json_get_member(message, DY_STR_LIT("params"));
+    if (params == NULL || *params != DY_JSON_OBJECT) {
+        return;
+    }
+    params++;
+
+    const uint8_t *id = json_get_member(params, DY_STR_LIT("id"));
+    if (id == NULL) {
+        return;
+    }
+
+    dy_array_t id_copy = dy_array_create(1, 1, 16);
+    copy_json_value(id, &id_copy);
+
+    dy_array_add(&ctx->cancelled_request_ids, &id_copy);
+}
+
+void dy_lsp_idle(dy_lsp_ctx_t *ctx)
+{
+    for (size_t i = 0, size = ctx->documents.num_elems; i < size; ++i) {
+        struct document *doc = dy_array_pos(&ctx->documents, i);
+
+        if (doc->needs_processing) {
+            if (!process_document(ctx, doc)) {
+                break;
+            }
+
+            doc->needs_processing = false;
+        }
+    }
+
+    // Everything noted so far has been handled, so remaining cancellations refer to finished requests.
+    for (size_t i = 0, size = ctx->cancelled_request_ids.num_elems; i < size; ++i) {
+        dy_array_release(dy_array_pos(&ctx->cancelled_request_ids, i));
+    }
+
+    ctx->cancelled_request_ids.num_elems = 0;
+}
+
 void dy_lsp_initialize(const uint8_t *id, dy_lsp_ctx_t *ctx, dy_array_t *json)
 {
     if (ctx->is_initialized) {
@@ -492,22 +603,36 @@ void dy_lsp_did_open(dy_lsp_ctx_t *ctx, dy_string_t uri, dy_string_t text)
             .recovered_negative_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
             .recovered_positive_inference_ids = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 8),
             .past_subtype_checks = dy_array_create(sizeof(struct dy_core_past_subtype_check), DY_ALIGNOF(struct dy_core_past_subtype_check), 64),
+            // Lets re-processing after an edit reuse the definitions that didn't change.
+            .past_checks = dy_array_create(sizeof(struct dy_core_past_check), DY_ALIGNOF(struct dy_core_past_check), 64),
+            // Messages arriving while a document is checked shouldn't have to wait, see dy_lsp_idle().
+            .should_cancel_check = ctx->input_is_pending,
+            .should_cancel_check_env = ctx->input_env,
             .free_variables = dy_array_create(sizeof(struct dy_free_var), DY_ALIGNOF(struct dy_free_var), 64),
             .equal_variables = dy_array_create(sizeof(struct dy_equal_variables), DY_ALIGNOF(struct dy_equal_variables), 64),
+            .equal_variable_levels = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 256),
             .free_ids_arrays = dy_array_create(sizeof(dy_array_t), DY_ALIGNOF(dy_array_t), 8),
             .constraints = dy_array_create(sizeof(struct dy_constraint), DY_ALIGNOF(struct dy_constraint), 64),
+            .constraint_index = dy_array_create(sizeof(struct dy_constraint_index_entry), DY_ALIGNOF(struct dy_constraint_index_entry), 0),
+            // Stale nodes of a document should go right away, rather than with the next batch.
+            .dead_nodes = dy_array_create(sizeof(struct dy_core_expr *), DY_ALIGNOF(struct dy_core_expr *), 0),
+            // Documents are re-processed over and over, so interning would just pin stale nodes.
+            .hash_consed_exprs = dy_array_create(sizeof(struct dy_hash_consed_expr), DY_ALIGNOF(struct dy_hash_consed_expr), 0),
             .custom_shared = dy_array_create(sizeof(struct dy_core_custom_shared), DY_ALIGNOF(struct dy_core_custom_shared), 3)
         },
-        .core_is_present = false
+        .core_is_present = false,
+        .needs_processing = true
     };
 
     dy_uv_register(&doc.core_ctx.custom_shared);
     dy_def_register(&doc.core_ctx.custom_shared);
     dy_string_register(&doc.core_ctx.custom_shared);
     dy_string_type_register(&doc.core_ctx.custom_shared);
-    dy_print_register(&doc.core_ctx.constraints);
-
-    process_document(ctx, &doc);
+    dy_int_register(&doc.core_ctx.custom_shared);
+    dy_int_type_register(&doc.core_ctx.custom_shared);
+    dy_int_op_register(&doc.core_ctx.custom_shared);
+    dy_string_op_register(&doc.core_ctx.custom_shared);
+    dy_print_register(&doc.core_ctx.custom_shared);
 
     dy_array_add(&ctx->documents, &doc);
 }
@@ -537,28 +662,37 @@ void dy_lsp_did_change(dy_lsp_ctx_t *ctx, dy_string_t uri, const uint8_t *conten
             const uint8_t *change = content_changes;
 
             if (*change != DY_JSON_OBJECT) {
-                return;
+                break;
             }
             change++;
 
             const uint8_t *text = json_get_member(change, DY_STR_LIT("text"));
-            if (text == NULL) {
-                return;
-            }
-            if (*text != DY_JSON_STRING) {
-                return;
+            if (text == NULL || *text != DY_JSON_STRING) {
+                break;
             }
             ++text;
 
             dy_string_t text_string = convert_json_string(text);
 
-            replace_storage_with_view(&doc->text, text_string);
+            const uint8_t *range = json_get_member(change, DY_STR_LIT("range"));
+            if (range == NULL) {
+                replace_storage_with_view(&doc->text, text_string);
+            } else {
+                size_t start, end;
+                if (!get_range_byte_offsets(array_view(&doc->text), range, &start, &end)) {
+                    break;
+                }
 
-            process_document(ctx, doc);
+                replace_range_with_view(&doc->text, start, end, text_string);
+            }
 
             content_changes = skip_json_value(content_changes);
         }
 
+        // Changes are applied right away, but checking waits for dy_lsp_idle().
+        // A malformed change drops the ones after it, but those before it still need checking.
+        doc->needs_processing = true;
+
         break;
     }
 }
@@ -649,6 +783,37 @@ void method_not_found(const uint8_t *id, dy_string_t message, dy_array_t *json)
     dy_array_add(json, &(uint8_t){ DY_JSON_END });
 }
 
+void request_cancelled(const uint8_t *id, dy_array_t *json)
+{
+    dy_array_add(json, &(uint8_t){ DY_JSON_OBJECT });
+
+    put_string_literal(DY_STR_LIT("jsonrpc"), json);
+    put_string_literal(DY_STR_LIT("2.0"), json);
+
+    put_string_literal(DY_STR_LIT("id"), json);
+    copy_json_value(id, json);
+
+    put_string_literal(DY_STR_LIT("error"), json);
+    response_error(-32800, DY_STR_LIT("Request cancelled."), json);
+
+    dy_array_add(json, &(uint8_t){ DY_JSON_END });
+}
+
+bool take_cancelled_request(dy_lsp_ctx_t *ctx, const uint8_t *id)
+{
+    for (size_t i = 0, size = ctx->cancelled_request_ids.num_elems; i < size; ++i) {
+        dy_array_t *cancelled_id = dy_array_pos(&ctx->cancelled_request_ids, i);
+
+        if (json_values_are_equal(cancelled_id->buffer, id)) {
+            dy_array_release(cancelled_id);
+            dy_array_remove(&ctx->cancelled_request_ids, i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void response_error(long code, dy_string_t message, dy_array_t *json)
 {
     dy_array_add(json, &(uint8_t){ DY_JSON_OBJECT });
@@ -695,8 +860,9 @@ void text_document_sync_options(dy_array_t *json)
     put_string_literal(DY_STR_LIT("openClose"), json);
     dy_array_add(json, &(uint8_t){ DY_JSON_TRUE });
 
+    // Incremental, see dy_lsp_did_change().
     put_string_literal(DY_STR_LIT("change"), json);
-    put_number(1, json);
+    put_number(2, json);
 
     dy_array_add(json, &(uint8_t){ DY_JSON_END });
 }
@@ -743,48 +909,78 @@ void publish_diagnostics(struct dy_core_ctx *ctx, dy_string_t uri, const dy_arra
     dy_array_add(json, &(uint8_t){ DY_JSON_END });
 }
 
-void process_document(struct dy_lsp_ctx *ctx, struct document *doc)
+bool process_document(struct dy_lsp_ctx *ctx, struct document *doc)
 {
-    if (doc->core_is_present) {
-        dy_core_expr_release(&doc->core_ctx, doc->core);
-        doc->core_is_present = false;
-    }
-
     struct dy_utf8_to_ast_ctx utf8_to_ast_ctx = {
         .stream = {
             .get_chars = null_stream,
             .buffer = doc->text,
             .env = NULL,
             .current_index = 0
-        }
+        },
+        // Half-typed documents are what makes the parser backtrack the most.
+        .memo = dy_array_create(sizeof(struct dy_utf8_memo_entry), DY_ALIGNOF(struct dy_utf8_memo_entry), 64)
     };
 
     struct dy_ast_do_block ast;
-    if (!dy_utf8_to_ast_file(&utf8_to_ast_ctx, &ast)) {
-        return;
+    bool parsed = dy_utf8_to_ast_file(&utf8_to_ast_ctx, &ast);
+
+    dy_array_release(&utf8_to_ast_ctx.memo);
+    dy_interner_release(&utf8_to_ast_ctx.symbols);
+
+    if (!parsed) {
+        if (doc->core_is_present) {
+            dy_core_expr_release(&doc->core_ctx, doc->core);
+            doc->core_is_present = false;
+        }
+
+        return true;
     }
 
     struct dy_ast_to_core_ctx ast_to_core_ctx = {
         .running_id = doc->core_ctx.running_id,
-        .variable_replacements = dy_array_create(sizeof(struct dy_variable_replacement), DY_ALIGNOF(struct dy_variable_replacement), 128)
+        .variable_replacements = dy_array_create(sizeof(struct dy_variable_replacement), DY_ALIGNOF(struct dy_variable_replacement), 128),
+        .innermost_replacements = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 128),
+        .num_lookups_per_level = dy_array_create(sizeof(size_t), DY_ALIGNOF(size_t), 16)
     };
 
     struct dy_core_expr core = dy_ast_do_block_to_core(&ast_to_core_ctx, ast);
 
     doc->core_ctx.running_id = ast_to_core_ctx.running_id;
 
+    dy_array_release(&ast_to_core_ctx.variable_replacements);
+    dy_array_release(&ast_to_core_ctx.innermost_replacements);
+    dy_array_release(&ast_to_core_ctx.num_lookups_per_level);
+
+    doc->core_ctx.check_is_cancelled = false;
+
     struct dy_core_expr checked_core;
     if (dy_check_expr(&doc->core_ctx, core, &checked_core)) {
         dy_core_expr_release(&doc->core_ctx, core);
         core = checked_core;
     }
 
+    if (doc->core_ctx.check_is_cancelled) {
+        // Stale by the time it'd be done, so the previous result stays until the next check.
+        dy_core_expr_release(&doc->core_ctx, core);
+        return false;
+    }
+
+    if (doc->core_is_present) {
+        dy_core_expr_release(&doc->core_ctx, doc->core);
+    }
+
     doc->core_is_present = true;
     doc->core = core;
 
+    // Whatever wasn't reused by this run is unlikely to be reused by the next one.
+    dy_check_memo_sweep(&doc->core_ctx);
+
     //publish_diagnostics(&doc->core_ctx, array_view(&doc->uri), &parser_ctx.text_sources, doc->core, array_view(&doc->text), &ctx->output_buffer);
 
     //dy_lsp_send(ctx);
+
+    return true;
 }
 
 void null_stream(dy_array_t *buffer, void *env)
@@ -802,32 +998,44 @@ bool compute_byte_offset(dy_string_t text, long line_offset, long utf16_offset,
 
     size_t cnt = 0;
     for (long i = 0; i < line_offset; ++i) {
-        if (cnt >= text.size) {
-            return false;
-        }
-
-        for (;;) {
-            if (text.ptr[cnt] == '\n') {
-                ++cnt;
-                break;
-            }
-
+        while (cnt < text.size && text.ptr[cnt] != '\n') {
             ++cnt;
         }
-    }
 
-    for (long i = 0; i < utf16_offset; ++i) {
-        if (cnt >= text.size) {
+        if (cnt == text.size) {
             return false;
         }
 
-        if (text.ptr[cnt] == '\n') {
-            --cnt;
+        ++cnt;
+    }
+
+    // The offset counts UTF-16 code units, so walk the line's UTF-8 codepoints.
+    // Codepoints of four bytes are surrogate pairs in UTF-16, everything else is a single unit.
+    for (long i = 0; i < utf16_offset;) {
+        // Offsets past the end of a line refer to the end of the line.
+        if (cnt == text.size || text.ptr[cnt] == '\n') {
             break;
         }
 
-        // TODO: Breaks if the text is anything but 1-byte UTF-8 codepoints. Sadly we only get UTF-16 offsets :/
-        ++cnt;
+        unsigned char lead = (unsigned char)text.ptr[cnt];
+
+        size_t num_bytes;
+        if (lead >= 0xF0) {
+            num_bytes = 4;
+            i += 2;
+        } else if (lead >= 0xE0) {
+            num_bytes = 3;
+            ++i;
+        } else if (lead >= 0xC0) {
+            num_bytes = 2;
+            ++i;
+        } else {
+            num_bytes = 1;
+            ++i;
+        }
+
+        // Don't run past a truncated sequence at the end of the text.
+        cnt += DY_MIN(num_bytes, text.size - cnt);
     }
 
     *byte_offset = cnt;
@@ -835,6 +1043,54 @@ bool compute_byte_offset(dy_string_t text, long line_offset, long utf16_offset,
     return true;
 }
 
+bool get_position_byte_offset(dy_string_t text, const uint8_t *position, size_t *byte_offset)
+{
+    if (*position != DY_JSON_OBJECT) {
+        return false;
+    }
+    ++position;
+
+    const uint8_t *line = json_get_member(position, DY_STR_LIT("line"));
+    if (line == NULL || *line != DY_JSON_NUMBER) {
+        return false;
+    }
+    ++line;
+
+    long line_number;
+    memcpy(&line_number, line, sizeof(line_number));
+
+    const uint8_t *character = json_get_member(position, DY_STR_LIT("character"));
+    if (character == NULL || *character != DY_JSON_NUMBER) {
+        return false;
+    }
+    ++character;
+
+    long character_number;
+    memcpy(&character_number, character, sizeof(character_number));
+
+    return compute_byte_offset(text, line_number, character_number, byte_offset);
+}
+
+bool get_range_byte_offsets(dy_string_t text, const uint8_t *range, size_t *start, size_t *end)
+{
+    if (*range != DY_JSON_OBJECT) {
+        return false;
+    }
+    ++range;
+
+    const uint8_t *start_position = json_get_member(range, DY_STR_LIT("start"));
+    if (start_position == NULL || !get_position_byte_offset(text, start_position, start)) {
+        return false;
+    }
+
+    const uint8_t *end_position = json_get_member(range, DY_STR_LIT("end"));
+    if (end_position == NULL || !get_position_byte_offset(text, end_position, end)) {
+        return false;
+    }
+
+    return *start <= *end;
+}
+
 bool produce_diagnostics(struct dy_core_ctx *ctx, const dy_array_t *text_sources, struct dy_core_expr expr, dy_string_t text, dy_array_t *json)
 {
     switch (expr.tag) {
@@ -1093,6 +1349,13 @@ const uint8_t *copy_json_string(const uint8_t *src, dy_array_t *dst)
     return src + 1;
 }
 
+bool json_values_are_equal(const uint8_t *a, const uint8_t *b)
+{
+    size_t size = (size_t)(skip_json_value(a) - a);
+
+    return size == (size_t)(skip_json_value(b) - b) && memcmp(a, b, size) == 0;
+}
+
 const uint8_t *skip_json_value(const uint8_t *p)
 {
     switch (*p) {
@@ -1169,6 +1432,21 @@ void replace_storage_with_view(dy_array_t *x, dy_string_t s)
     }
 }
 
+void replace_range_with_view(dy_array_t *x, size_t start, size_t end, dy_string_t s)
+{
+    size_t tail_size = x->num_elems - end;
+
+    if (s.size > end - start) {
+        dy_array_set_excess_capacity(x, s.size - (end - start));
+    }
+
+    char *buffer = x->buffer;
+    memmove(buffer + start + s.size, buffer + end, tail_size);
+    memcpy(buffer + start, s.ptr, s.size);
+
+    x->num_elems = start + s.size + tail_size;
+}
+
 void dy_lsp_send(dy_lsp_ctx_t *ctx)
 {
     ctx->send(ctx->output_buffer.buffer, ctx->env);
@@ -11,6 +11,7 @@
 #include "../support/stream.h"
 #include "../support/json_to_utf8.h"
 #include "../support/utf8_to_json.h"
+#include "../support/writer.h"
 
 #include <stdio.h>
 #include <assert.h>
@@ -20,27 +21,68 @@
 #    include <fcntl.h>
 #endif
 
+#if defined(__unix__) || defined(__APPLE__)
+#    include <poll.h>
+#    include <unistd.h>
+#    include <errno.h>
+#    define DY_LSP_HAVE_POLL
+#endif
+
+/**
+ * The server reads ahead as long as input is available, so that every message is noted
+ * (see dy_lsp_note_message()) before those preceding it are handled.
+ * Once all messages are handled and no new ones arrived, the server idles (see dy_lsp_idle()),
+ * which is when documents are checked.
+ *
+ * Checking is what takes time, so this way a burst of edits is checked only once,
+ * and requests cancelled in the meantime aren't worked on. Messages arriving
+ * during a check cancel it (see dy_lsp_idle()), so they needn't wait for it either.
+ */
+
 struct dy_lsp_stream_env {
     FILE *file;
     bool is_bounded;
     size_t bound_size_in_bytes;
+
+    /**
+     * Input read from stdin but not yet handed to the stream, see read_input().
+     * Reading in large chunks keeps the syscalls down, while the stream still
+     * gets its input in pieces that don't reach past the current message.
+     */
+    dy_array_t read_ahead;
+    size_t read_ahead_index;
+    bool input_ended;
 };
 
+/**
+ * Serves requests from 'in' and responds on 'out' until the client exits.
+ *
+ * Reading ahead (see above) needs to know whether input is pending, which is only
+ * possible for stdin, and only on platforms with poll(). Otherwise, every message
+ * is handled as if it was the last one before idling.
+ */
 static inline int dy_lsp_run_server(FILE *in, FILE *out);
 
-static inline bool dy_lsp_process_message(dy_lsp_ctx_t *ctx, struct dy_stream *stream, dy_array_t *json_buffer);
+static inline bool dy_lsp_read_message(struct dy_stream *stream, dy_array_t *json_buffer);
 
 static inline bool dy_lsp_read_content_length(struct dy_stream *stream, size_t *content_length_in_bytes);
 
 struct send_env {
     dy_array_t buffer;
+    struct dy_writer writer;
     FILE *file;
 };
 
 static void send_callback(const uint8_t *message, void *env);
 static void stream_callback(dy_array_t *buffer, void *env);
-static void write_size_t(FILE *file, size_t x);
 static void set_file_to_binary(FILE *file);
+static bool input_is_pending(void *env);
+
+/** Reads up to 'max' bytes of input into 'dst'. Returns 0 only at the end of input. */
+static size_t read_input(struct dy_lsp_stream_env *env, void *dst, size_t max);
+
+/** Upper bound on messages read ahead before handling them. */
+static const size_t dy_lsp_max_read_ahead = 256;
 
 int dy_lsp_run_server(FILE *in, FILE *out)
 {
@@ -49,11 +91,15 @@ int dy_lsp_run_server(FILE *in, FILE *out)
 
     struct dy_lsp_stream_env recv_env = {
         .file = in,
-        .is_bounded = false
+        .is_bounded = false,
+        .read_ahead = dy_array_create(sizeof(char), DY_ALIGNOF(char), 4096),
+        .read_ahead_index = 0,
+        .input_ended = false
     };
 
     struct send_env send_env = {
         .buffer = dy_array_create(sizeof(char), DY_ALIGNOF(char), 1024),
+        .writer = dy_writer_to_file(out),
         .file = out
     };
 
@@ -64,23 +110,62 @@ int dy_lsp_run_server(FILE *in, FILE *out)
         .current_index = 0
     };
 
-    dy_lsp_ctx_t *ctx = dy_lsp_create(send_callback, &send_env);
+    dy_lsp_ctx_t *ctx = dy_lsp_create(send_callback, &send_env, input_is_pending, &recv_env);
+
+    dy_array_t queue = dy_array_create(sizeof(dy_array_t), DY_ALIGNOF(dy_array_t), 16);
+
+    bool input_ended = false;
+    bool is_running = true;
 
-    dy_array_t json_buffer = dy_array_create(1, 1, 128);
+    while (is_running) {
+        do {
+            dy_array_t json_buffer = dy_array_create(1, 1, 128);
 
-    for (;;) {
-        if (!dy_lsp_process_message(ctx, &stream, &json_buffer)) {
-            int ret = dy_lsp_exit_code(ctx);
-            dy_lsp_destroy(ctx);
-            dy_array_release(&json_buffer);
-            return ret;
+            if (!dy_lsp_read_message(&stream, &json_buffer)) {
+                dy_array_release(&json_buffer);
+                input_ended = true;
+                break;
+            }
+
+            dy_lsp_note_message(ctx, json_buffer.buffer);
+
+            dy_array_add(&queue, &json_buffer);
+        } while (queue.num_elems < dy_lsp_max_read_ahead && input_is_pending(&recv_env));
+
+        for (size_t i = 0; i < queue.num_elems; ++i) {
+            dy_array_t *json_buffer = dy_array_pos(&queue, i);
+
+            if (is_running && !dy_lsp_handle_message(ctx, json_buffer->buffer)) {
+                is_running = false;
+            }
+
+            dy_array_release(json_buffer);
+        }
+
+        queue.num_elems = 0;
+
+        if (input_ended) {
+            is_running = false;
         }
 
-        json_buffer.num_elems = 0;
+        if (is_running && !input_is_pending(&recv_env)) {
+            dy_lsp_idle(ctx);
+        }
     }
+
+    int ret = dy_lsp_exit_code(ctx);
+
+    dy_lsp_destroy(ctx);
+    dy_array_release(&queue);
+    dy_array_release(&stream.buffer);
+    dy_array_release(&recv_env.read_ahead);
+    dy_array_release(&send_env.buffer);
+    dy_writer_release(&send_env.writer);
+
+    return ret;
 }
 
-bool dy_lsp_process_message(dy_lsp_ctx_t *ctx, struct dy_stream *stream, dy_array_t *json_buffer)
+bool dy_lsp_read_message(struct dy_stream *stream, dy_array_t *json_buffer)
 {
     struct dy_lsp_stream_env *env = stream->env;
 
@@ -104,7 +189,7 @@ bool dy_lsp_process_message(dy_lsp_ctx_t *ctx, struct dy_stream *stream, dy_arra
 
     dy_stream_reset(stream);
 
-    return dy_lsp_handle_message(ctx, json_buffer->buffer);
+    return true;
 }
 
 bool dy_lsp_read_content_length(struct dy_stream *stream, size_t *content_length_in_bytes)
@@ -136,29 +221,28 @@ void send_callback(const uint8_t *message, void *env)
 {
     struct send_env *send_env = env;
 
-    size_t size = send_env->buffer.num_elems;
-
     dy_json_to_utf8(message, &send_env->buffer);
 
-    fprintf(send_env->file, "Content-Length:");
-    write_size_t(send_env->file, send_env->buffer.num_elems - size);
-    fprintf(send_env->file, "\r\n\r\n");
+    dy_string_t content = {
+        .ptr = send_env->buffer.buffer,
+        .size = send_env->buffer.num_elems
+    };
 
-    fwrite((char *)send_env->buffer.buffer + size, sizeof(char), send_env->buffer.num_elems - size, send_env->file);
+    dy_write(&send_env->writer, DY_STR_LIT("Content-Length:"));
+    dy_write_size_t_decimal(&send_env->writer, content.size);
+    dy_write(&send_env->writer, DY_STR_LIT("\r\n\r\n"));
+    dy_write(&send_env->writer, content);
 
+    dy_writer_flush(&send_env->writer);
     fflush(send_env->file);
 
-    send_env->buffer.num_elems = size;
+    send_env->buffer.num_elems = 0;
 }
 
 void stream_callback(dy_array_t *buffer, void *env)
 {
     struct dy_lsp_stream_env *state = env;
 
-    if (feof(state->file) || ferror(state->file)) {
-        return;
-    }
-
     if (state->is_bounded) {
         if (state->bound_size_in_bytes == 0) {
             return;
@@ -166,41 +250,89 @@ void stream_callback(dy_array_t *buffer, void *env)
 
         dy_array_set_excess_capacity(buffer, state->bound_size_in_bytes);
 
-        size_t num_bytes_read = fread(dy_array_excess_buffer(buffer), sizeof(char), state->bound_size_in_bytes, state->file);
+        size_t num_bytes_read = read_input(state, dy_array_excess_buffer(buffer), state->bound_size_in_bytes);
 
         dy_array_add_to_size(buffer, num_bytes_read);
 
         state->bound_size_in_bytes -= num_bytes_read;
     } else {
+        // Headers are read byte by byte, so that nothing past them ends up in the stream.
         dy_array_set_excess_capacity(buffer, 1);
 
-        size_t num_bytes_read = fread(dy_array_excess_buffer(buffer), sizeof(char), 1, state->file);
+        size_t num_bytes_read = read_input(state, dy_array_excess_buffer(buffer), 1);
 
         dy_array_add_to_size(buffer, num_bytes_read);
     }
 }
 
-void write_size_t(FILE *file, size_t x)
+size_t read_input(struct dy_lsp_stream_env *env, void *dst, size_t max)
 {
-    dy_array_t buffer = dy_array_create(sizeof(char), DY_ALIGNOF(char), 4);
+    if (env->input_ended) {
+        return 0;
+    }
 
-    for (;;) {
-        char digit = (x % 10) + '0';
+#ifdef DY_LSP_HAVE_POLL
+    // Bypasses the FILE, whose buffer input_is_pending() couldn't look into.
+    if (env->file == stdin) {
+        if (env->read_ahead_index == env->read_ahead.num_elems) {
+            ssize_t num_bytes_read;
+            do {
+                num_bytes_read = read(STDIN_FILENO, env->read_ahead.buffer, env->read_ahead.capacity);
+            } while (num_bytes_read < 0 && errno == EINTR);
+
+            if (num_bytes_read <= 0) {
+                env->input_ended = true;
+                return 0;
+            }
+
+            env->read_ahead.num_elems = (size_t)num_bytes_read;
+            env->read_ahead_index = 0;
+        }
 
-        dy_array_add(&buffer, &digit);
+        size_t num_bytes = DY_MIN(max, env->read_ahead.num_elems - env->read_ahead_index);
 
-        x = x / 10;
+        memcpy(dst, (const char *)env->read_ahead.buffer + env->read_ahead_index, num_bytes);
 
-        if (x == 0) {
-            break;
-        }
+        env->read_ahead_index += num_bytes;
+
+        return num_bytes;
     }
+#endif
 
-    for (size_t i = buffer.num_elems; i-- > 0;) {
-        fprintf(file, "%c", *(char *)dy_array_pos(&buffer, i));
+    size_t num_bytes_read = fread(dst, sizeof(char), max, env->file);
+    if (num_bytes_read == 0) {
+        env->input_ended = true;
     }
 
-    dy_array_release(&buffer);
+    return num_bytes_read;
+}
+
+bool input_is_pending(void *env)
+{
+#ifdef DY_LSP_HAVE_POLL
+    const struct dy_lsp_stream_env *state = env;
+
+    // poll() needs a file descriptor, and fileno() isn't available in strict C99 mode,
+    // so only stdin, whose descriptor is known, can be checked.
+    if (state->file != stdin || state->input_ended) {
+        return false;
+    }
+
+    if (state->read_ahead_index != state->read_ahead.num_elems) {
+        return true;
+    }
+
+    struct pollfd pfd = {
+        .fd = STDIN_FILENO,
+        .events = POLLIN
+    };
+
+    return poll(&pfd, 1, 0) > 0;
+#else
+    // Without a portable way to peek, assume every message is the last one for now.
+    (void)env;
+    return false;
+#endif
 }
 
 void set_file_to_binary(FILE *file)
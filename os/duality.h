@@ -64,6 +64,23 @@ size_t dy_rc_release(void *ptr, size_t alignment)
     return mem_release(ptr, alignment);
 }
 
+size_t dy_rc_decrement(void *ptr, size_t alignment)
+{
+    struct mem_slot *slot = (void *)((char *)ptr - MEM_SLOT_PRE_PADDING(alignment) - sizeof *slot);
+
+    // A slot with a count of 0 is free for reuse, so the last reference stays until dy_rc_free().
+    if (slot->ref_cnt == 1) {
+        return 0;
+    }
+
+    return mem_release(ptr, alignment);
+}
+
+void dy_rc_free(void *ptr, size_t alignment)
+{
+    mem_release(ptr, alignment);
+}
+
 void *dy_rc_realloc(void *ptr, size_t new_size, size_t alignment)
 {
     size_t pre_padding = MEM_SLOT_PRE_PADDING(alignment);
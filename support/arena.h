@@ -0,0 +1,247 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "rc.h"
+
+/**
+ * Implements an arena backend for the reference-counting functions.
+ *
+ * Small blocks are carved out of large chunks with a bump pointer and,
+ * once released, are kept in per-size-class free lists for reuse.
+ * Blocks above the largest size class get their own allocation.
+ *
+ * Destroying the arena frees everything at once, which makes it a good fit
+ * for memory that only lives as long as one check/eval run.
+ */
+
+#ifndef DY_FREESTANDING
+
+#    include <stdlib.h>
+#    include <string.h>
+#    include <assert.h>
+
+#    include "util.h"
+
+/** Size classes are multiples of this; it's also the alignment of every block. */
+#    define DY_ARENA_GRANULARITY 16
+
+#    define DY_ARENA_NUM_SIZE_CLASSES 32
+
+#    define DY_ARENA_CHUNK_SIZE (256 * 1024)
+
+struct dy_arena_chunk {
+    struct dy_arena_chunk *next;
+};
+
+struct dy_arena_large_block {
+    struct dy_arena_large_block *prev;
+    struct dy_arena_large_block *next;
+};
+
+struct dy_arena_free_block {
+    struct dy_arena_free_block *next;
+};
+
+struct dy_arena {
+    struct dy_arena_chunk *chunks;
+    char *current;
+    char *end;
+    struct dy_arena_free_block *free_lists[DY_ARENA_NUM_SIZE_CLASSES];
+    struct dy_arena_large_block *large_blocks;
+};
+
+static const size_t dy_arena_chunk_header_size = sizeof(struct dy_arena_chunk) + DY_COMPUTE_PADDING(sizeof(struct dy_arena_chunk), DY_ARENA_GRANULARITY);
+
+static const size_t dy_arena_large_header_size = sizeof(struct dy_arena_large_block) + DY_COMPUTE_PADDING(sizeof(struct dy_arena_large_block), DY_ARENA_GRANULARITY);
+
+static inline struct dy_arena dy_arena_create(void);
+
+/** Returns a backend that allocates from 'arena', suitable for dy_rc_set_allocator(). */
+static inline struct dy_rc_allocator dy_arena_allocator(struct dy_arena *arena);
+
+/** Frees all memory of the arena, regardless of whether it has been released. */
+static inline void dy_arena_destroy(struct dy_arena *arena);
+
+static inline void *dy_arena_alloc(size_t size, void *env);
+
+static inline void *dy_arena_realloc(void *ptr, size_t old_size, size_t new_size, void *env);
+
+static inline void dy_arena_free(void *ptr, size_t size, void *env);
+
+static inline size_t dy_arena_size_class(size_t size);
+
+static inline void *dy_arena_bump(struct dy_arena *arena, size_t size);
+
+struct dy_arena dy_arena_create(void)
+{
+    return (struct dy_arena){
+        .chunks = NULL,
+        .current = NULL,
+        .end = NULL,
+        .large_blocks = NULL
+    };
+}
+
+struct dy_rc_allocator dy_arena_allocator(struct dy_arena *arena)
+{
+    return (struct dy_rc_allocator){
+        .alloc = dy_arena_alloc,
+        .realloc = dy_arena_realloc,
+        .free = dy_arena_free,
+        .env = arena
+    };
+}
+
+void dy_arena_destroy(struct dy_arena *arena)
+{
+    for (struct dy_arena_chunk *c = arena->chunks; c != NULL;) {
+        struct dy_arena_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+
+    for (struct dy_arena_large_block *b = arena->large_blocks; b != NULL;) {
+        struct dy_arena_large_block *next = b->next;
+        free(b);
+        b = next;
+    }
+
+    *arena = dy_arena_create();
+}
+
+void *dy_arena_alloc(size_t size, void *env)
+{
+    struct dy_arena *arena = env;
+
+    size_t size_class = dy_arena_size_class(size);
+
+    if (size_class == DY_ARENA_NUM_SIZE_CLASSES) {
+        struct dy_arena_large_block *b = calloc(1, dy_arena_large_header_size + size);
+        assert(b);
+
+        b->prev = NULL;
+        b->next = arena->large_blocks;
+        if (b->next != NULL) {
+            b->next->prev = b;
+        }
+        arena->large_blocks = b;
+
+        return (char *)b + dy_arena_large_header_size;
+    }
+
+    size_t class_size = (size_class + 1) * DY_ARENA_GRANULARITY;
+
+    struct dy_arena_free_block *f = arena->free_lists[size_class];
+    if (f != NULL) {
+        arena->free_lists[size_class] = f->next;
+        memset(f, 0, class_size);
+        return f;
+    }
+
+    return dy_arena_bump(arena, class_size);
+}
+
+void *dy_arena_realloc(void *ptr, size_t old_size, size_t new_size, void *env)
+{
+    struct dy_arena *arena = env;
+
+    size_t old_class = dy_arena_size_class(old_size);
+    size_t new_class = dy_arena_size_class(new_size);
+
+    if (old_class == new_class && old_class != DY_ARENA_NUM_SIZE_CLASSES) {
+        return ptr;
+    }
+
+    if (old_class == DY_ARENA_NUM_SIZE_CLASSES && new_class == DY_ARENA_NUM_SIZE_CLASSES) {
+        struct dy_arena_large_block *b = realloc((char *)ptr - dy_arena_large_header_size, dy_arena_large_header_size + new_size);
+        assert(b);
+
+        if (b->prev != NULL) {
+            b->prev->next = b;
+        } else {
+            arena->large_blocks = b;
+        }
+
+        if (b->next != NULL) {
+            b->next->prev = b;
+        }
+
+        return (char *)b + dy_arena_large_header_size;
+    }
+
+    void *p = dy_arena_alloc(new_size, env);
+
+    memcpy(p, ptr, DY_MIN(old_size, new_size));
+
+    dy_arena_free(ptr, old_size, env);
+
+    return p;
+}
+
+void dy_arena_free(void *ptr, size_t size, void *env)
+{
+    struct dy_arena *arena = env;
+
+    size_t size_class = dy_arena_size_class(size);
+
+    if (size_class == DY_ARENA_NUM_SIZE_CLASSES) {
+        struct dy_arena_large_block *b = (void *)((char *)ptr - dy_arena_large_header_size);
+
+        if (b->prev != NULL) {
+            b->prev->next = b->next;
+        } else {
+            arena->large_blocks = b->next;
+        }
+
+        if (b->next != NULL) {
+            b->next->prev = b->prev;
+        }
+
+        free(b);
+        return;
+    }
+
+    struct dy_arena_free_block *f = ptr;
+    f->next = arena->free_lists[size_class];
+    arena->free_lists[size_class] = f;
+}
+
+size_t dy_arena_size_class(size_t size)
+{
+    size_t size_class = (size + DY_ARENA_GRANULARITY - 1) / DY_ARENA_GRANULARITY;
+    if (size_class == 0) {
+        return 0;
+    }
+
+    return DY_MIN(size_class - 1, DY_ARENA_NUM_SIZE_CLASSES);
+}
+
+void *dy_arena_bump(struct dy_arena *arena, size_t size)
+{
+    if ((size_t)(arena->end - arena->current) < size) {
+        // Whatever is left in the current chunk is simply abandoned.
+        struct dy_arena_chunk *c = malloc(DY_ARENA_CHUNK_SIZE);
+        assert(c);
+
+        c->next = arena->chunks;
+        arena->chunks = c;
+
+        arena->current = (char *)c + dy_arena_chunk_header_size;
+        arena->end = (char *)c + DY_ARENA_CHUNK_SIZE;
+    }
+
+    void *p = arena->current;
+    arena->current += size;
+
+    // Fresh chunks come from malloc, so they need to be zeroed like the free list blocks.
+    memset(p, 0, size);
+
+    return p;
+}
+
+#endif // !DY_FREESTANDING
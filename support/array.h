@@ -12,6 +12,12 @@
 
 /**
  * This file implements dynamically growable arrays.
+ *
+ * Short-lived arrays can start out on storage provided by the caller, typically
+ * a local array, and only move to the heap once they outgrow it (see dy_array_create_small()).
+ *
+ * The DY_ARRAY_* macros are typed and unchecked shorthands for the functions,
+ * for loops where computing positions from 'elem_size' shows up.
  */
 
 typedef struct dy_array {
@@ -20,10 +26,30 @@ typedef struct dy_array {
     size_t elem_alignment;
     size_t num_elems;
     size_t capacity;
+    bool is_small; // 'buffer' is storage of the caller, not reference-counted.
 } dy_array_t;
 
+/** The 'i'-th element of 'array', which holds objects of type 'type'. */
+#define DY_ARRAY_AT(array, type, i) (((type *)(array)->buffer)[i])
+
+/** Appends 'value' to 'array', which holds objects of type 'type'. Evaluates 'array' multiple times. */
+#define DY_ARRAY_PUSH(array, type, value)                          \
+    do {                                                           \
+        if ((array)->num_elems == (array)->capacity) {             \
+            dy_array_reserve((array), (array)->num_elems + 1);     \
+        }                                                          \
+        ((type *)(array)->buffer)[(array)->num_elems++] = (value); \
+    } while (0)
+
 static inline dy_array_t dy_array_create(size_t elem_size, size_t alignment, size_t capacity);
 
+/**
+ * Creates an empty array that stores its first 'capacity' elements in 'storage'.
+ * Growing beyond that moves them to the heap. 'storage' has to outlive the array,
+ * so such arrays can't be retained. Releasing them works as usual.
+ */
+static inline dy_array_t dy_array_create_small(void *storage, size_t elem_size, size_t alignment, size_t capacity);
+
 static inline void dy_array_retain(const dy_array_t *array);
 
 static inline void dy_array_release(dy_array_t *array);
@@ -40,6 +66,15 @@ static inline void dy_array_insert_keep_order(dy_array_t *array, size_t index, c
 
 static inline void dy_array_set_excess_capacity(dy_array_t *array, size_t excess_capacity);
 
+/** Makes room for at least 'capacity' elements, growing geometrically so that repeated calls amortize. */
+static inline void dy_array_reserve(dy_array_t *array, size_t capacity);
+
+/** Appends the 'n' elements at 'values'. */
+static inline void dy_array_append_n(dy_array_t *array, const void *values, size_t n);
+
+/** Moves the elements to a buffer of exactly 'capacity' elements. */
+static inline void dy_array_set_capacity(dy_array_t *array, size_t capacity);
+
 static inline void *dy_array_excess_buffer(const dy_array_t *array);
 
 static inline void dy_array_add_to_size(dy_array_t *array, size_t added_size);
@@ -52,6 +87,9 @@ static inline void *dy_array_last(const dy_array_t *array);
 
 static inline dy_string_t dy_array_view(const dy_array_t *array);
 
+/** Creates a char array holding a copy of 's'. */
+static inline dy_array_t dy_array_from_view(dy_string_t s);
+
 dy_array_t dy_array_create(size_t elem_size, size_t alignment, size_t capacity)
 {
     assert(elem_size != 0);
@@ -68,11 +106,32 @@ dy_array_t dy_array_create(size_t elem_size, size_t alignment, size_t capacity)
     };
 }
 
+dy_array_t dy_array_create_small(void *storage, size_t elem_size, size_t alignment, size_t capacity)
+{
+    assert(elem_size != 0);
+
+    return (dy_array_t){
+        .buffer = storage,
+        .elem_size = elem_size,
+        .elem_alignment = alignment,
+        .num_elems = 0,
+        .capacity = capacity,
+        .is_small = true
+    };
+}
+
 size_t dy_array_add(dy_array_t *array, const void *value)
 {
-    size_t size = array->num_elems;
-    dy_array_insert_keep_order(array, size, value);
-    return size;
+    size_t index = array->num_elems;
+
+    if (index == array->capacity) {
+        dy_array_reserve(array, index + 1);
+    }
+
+    memcpy(dy_array_pos_uninit(array, index), value, array->elem_size);
+    ++array->num_elems;
+
+    return index;
 }
 
 void dy_array_prepend_keep_order(dy_array_t *array, const void *value)
@@ -97,16 +156,7 @@ void dy_array_insert_keep_order(dy_array_t *array, size_t index, const void *val
     assert(index <= array->num_elems);
 
     if (array->num_elems == array->capacity) {
-        if (array->capacity == 0) {
-            array->capacity = 8;
-        } else {
-            assert(!dy_size_t_mul_overflow(array->capacity, 2, &array->capacity));
-        }
-
-        size_t capacity_in_bytes;
-        assert(!dy_size_t_mul_overflow(array->elem_size, array->capacity, &capacity_in_bytes));
-
-        array->buffer = dy_rc_realloc(array->buffer, capacity_in_bytes, array->elem_alignment);
+        dy_array_reserve(array, array->num_elems + 1);
     }
 
     memmove(dy_array_pos_uninit(array, index + 1), dy_array_pos_uninit(array, index), array->elem_size * (array->num_elems - index));
@@ -122,14 +172,63 @@ void dy_array_set_excess_capacity(dy_array_t *array, size_t excess_capacity)
         return;
     }
 
-    size_t added_capacity = excess_capacity - current_excess_capacity;
+    size_t capacity;
+    assert(!dy_size_t_add_overflow(array->num_elems, excess_capacity, &capacity));
 
-    assert(!dy_size_t_add_overflow(array->capacity, added_capacity, &array->capacity));
+    dy_array_set_capacity(array, capacity);
+}
+
+void dy_array_reserve(dy_array_t *array, size_t capacity)
+{
+    if (capacity <= array->capacity) {
+        return;
+    }
+
+    size_t new_capacity = 8;
+    if (array->capacity != 0) {
+        assert(!dy_size_t_mul_overflow(array->capacity, 2, &new_capacity));
+    }
+
+    if (new_capacity < capacity) {
+        new_capacity = capacity;
+    }
+
+    dy_array_set_capacity(array, new_capacity);
+}
+
+void dy_array_append_n(dy_array_t *array, const void *values, size_t n)
+{
+    if (n == 0) {
+        return;
+    }
+
+    size_t num_elems;
+    assert(!dy_size_t_add_overflow(array->num_elems, n, &num_elems));
+
+    dy_array_reserve(array, num_elems);
+
+    memcpy(dy_array_excess_buffer(array), values, array->elem_size * n);
+    array->num_elems = num_elems;
+}
+
+void dy_array_set_capacity(dy_array_t *array, size_t capacity)
+{
+    assert(capacity >= array->num_elems);
 
     size_t capacity_in_bytes;
-    assert(!dy_size_t_mul_overflow(array->elem_size, array->capacity, &capacity_in_bytes));
+    assert(!dy_size_t_mul_overflow(array->elem_size, capacity, &capacity_in_bytes));
+
+    if (array->is_small) {
+        void *buffer = dy_rc_alloc(capacity_in_bytes, array->elem_alignment);
+        memcpy(buffer, array->buffer, array->elem_size * array->num_elems);
 
-    array->buffer = dy_rc_realloc(array->buffer, capacity_in_bytes, array->elem_alignment);
+        array->buffer = buffer;
+        array->is_small = false;
+    } else {
+        array->buffer = dy_rc_realloc(array->buffer, capacity_in_bytes, array->elem_alignment);
+    }
+
+    array->capacity = capacity;
 }
 
 void dy_array_add_to_size(dy_array_t *array, size_t added_size)
@@ -168,12 +267,16 @@ void *dy_array_last(const dy_array_t *array)
 
 void dy_array_retain(const dy_array_t *array)
 {
+    assert(!array->is_small);
+
     dy_rc_retain(array->buffer, array->elem_alignment);
 }
 
 void dy_array_release(dy_array_t *array)
 {
-    dy_rc_release(array->buffer, array->elem_alignment);
+    if (!array->is_small) {
+        dy_rc_release(array->buffer, array->elem_alignment);
+    }
 }
 
 dy_string_t dy_array_view(const dy_array_t *array)
@@ -183,3 +286,16 @@ dy_string_t dy_array_view(const dy_array_t *array)
         .size = array->num_elems
     };
 }
+
+dy_array_t dy_array_from_view(dy_string_t s)
+{
+    dy_array_t array = dy_array_create(sizeof(char), DY_ALIGNOF(char), s.size);
+
+    if (s.size != 0) {
+        memcpy(array.buffer, s.ptr, s.size);
+    }
+
+    array.num_elems = s.size;
+
+    return array;
+}
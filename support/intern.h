@@ -0,0 +1,138 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "array.h"
+#include "string.h"
+#include "util.h"
+
+#include <string.h>
+
+/**
+ * Maps strings to small integers (symbols), numbered consecutively from 0 in
+ * the order they were first interned. Equal strings always get the same symbol,
+ * so afterwards they can be compared and used as array indices in O(1).
+ *
+ * The strings themselves are not copied and must outlive the interner.
+ *
+ * Open-addressed with a power-of-two capacity. A zero-initialized interner is empty and ready to use.
+ */
+
+struct dy_interned_string {
+    dy_string_t string;
+    size_t hash;
+    size_t symbol;
+    bool is_occupied;
+};
+
+struct dy_interner {
+    dy_array_t table;
+    size_t num_symbols;
+};
+
+/** Returns the symbol of 's', assigning the next free one if 's' wasn't interned before. */
+static inline size_t dy_intern(struct dy_interner *interner, dy_string_t s);
+
+static inline void dy_interner_release(struct dy_interner *interner);
+
+static inline size_t dy_intern_hash(dy_string_t s);
+
+static inline void dy_intern_rehash(dy_array_t *table, size_t capacity);
+
+static inline void dy_intern_put(dy_array_t *table, struct dy_interned_string entry);
+
+size_t dy_intern(struct dy_interner *interner, dy_string_t s)
+{
+    dy_array_t *table = &interner->table;
+
+    if (table->capacity == 0) {
+        *table = dy_array_create(sizeof(struct dy_interned_string), DY_ALIGNOF(struct dy_interned_string), 64);
+        memset(table->buffer, 0, table->elem_size * table->capacity);
+    }
+
+    size_t hash = dy_intern_hash(s);
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const struct dy_interned_string *entry = dy_array_pos_uninit(table, i);
+        if (!entry->is_occupied) {
+            break;
+        }
+
+        if (entry->hash == hash && dy_string_are_equal(entry->string, s)) {
+            return entry->symbol;
+        }
+    }
+
+    if (4 * (table->num_elems + 1) > 3 * table->capacity) {
+        dy_intern_rehash(table, table->capacity * 2);
+    }
+
+    size_t symbol = interner->num_symbols++;
+
+    dy_intern_put(table, (struct dy_interned_string){
+        .string = s,
+        .hash = hash,
+        .symbol = symbol,
+        .is_occupied = true
+    });
+
+    return symbol;
+}
+
+void dy_interner_release(struct dy_interner *interner)
+{
+    if (interner->table.capacity != 0) {
+        dy_array_release(&interner->table);
+    }
+
+    *interner = (struct dy_interner){ 0 };
+}
+
+size_t dy_intern_hash(dy_string_t s)
+{
+    // FNV-1a.
+    size_t hash = (size_t)0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < s.size; ++i) {
+        hash ^= (unsigned char)s.ptr[i];
+        hash *= (size_t)0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+void dy_intern_rehash(dy_array_t *table, size_t capacity)
+{
+    dy_array_t old = *table;
+
+    *table = dy_array_create(old.elem_size, old.elem_alignment, capacity);
+    memset(table->buffer, 0, table->elem_size * table->capacity);
+
+    for (size_t i = 0; i < old.capacity; ++i) {
+        const struct dy_interned_string *entry = dy_array_pos_uninit(&old, i);
+        if (entry->is_occupied) {
+            dy_intern_put(table, *entry);
+        }
+    }
+
+    dy_array_release(&old);
+}
+
+void dy_intern_put(dy_array_t *table, struct dy_interned_string entry)
+{
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = entry.hash & mask;; i = (i + 1) & mask) {
+        struct dy_interned_string *slot = dy_array_pos_uninit(table, i);
+        if (!slot->is_occupied) {
+            *slot = entry;
+            ++table->num_elems;
+            return;
+        }
+    }
+}
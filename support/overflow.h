@@ -12,7 +12,7 @@
 #include <limits.h>
 
 /**
- * Signed/unsigned integer add/mul operations with overflow detection.
+ * Signed/unsigned integer add/sub/mul operations with overflow detection.
  *
  * TODO: Replace with compiler builtins where available.
  */
@@ -28,6 +28,8 @@ static inline bool dy_size_t_add_overflow(size_t a, size_t b, size_t *c);
 
 static inline bool dy_intmax_t_add_overflow(intmax_t a, intmax_t b, intmax_t *c);
 
+static inline bool dy_intmax_t_sub_overflow(intmax_t a, intmax_t b, intmax_t *c);
+
 static inline bool dy_smul_overflow(int a, int b, int *c);
 static inline bool dy_smull_overflow(long a, long b, long *c);
 static inline bool dy_smulll_overflow(long long a, long long b, long long *c);
@@ -79,6 +81,16 @@ bool dy_intmax_t_add_overflow(intmax_t a, intmax_t b, intmax_t *c)
     }
 }
 
+bool dy_intmax_t_sub_overflow(intmax_t a, intmax_t b, intmax_t *c)
+{
+    if (((b < 0) && (a > (INTMAX_MAX + b))) || ((b > 0) && (a < (INTMAX_MIN + b)))) {
+        return true;
+    } else {
+        *c = a - b;
+        return false;
+    }
+}
+
 bool dy_uadd_overflow(unsigned a, unsigned b, unsigned *c)
 {
     unsigned ret = a + b;
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include "stats.h"
+
 #include <stddef.h>
 
 /**
@@ -33,6 +35,15 @@ static inline void *dy_rc_retain(void *ptr, size_t alignment);
  */
 static inline size_t dy_rc_release(void *ptr, size_t alignment);
 
+/**
+ * Like dy_rc_release(), but never frees the object.
+ * If the new reference count is 0, the object must be passed to dy_rc_free() later on.
+ */
+static inline size_t dy_rc_decrement(void *ptr, size_t alignment);
+
+/** Frees an object whose reference count dy_rc_decrement() brought to 0. */
+static inline void dy_rc_free(void *ptr, size_t alignment);
+
 /**
  * Tries to resize the allocation pointed to by 'ptr' in place.
  * If that fails, allocates new space of size 'new_size' and copies over the old content.
@@ -41,22 +52,90 @@ static inline void *dy_rc_realloc(void *ptr, size_t new_size, size_t alignment);
 
 #ifndef DY_FREESTANDING
 
+/**
+ * The backend that the functions above obtain their memory from.
+ *
+ * 'alloc' must return zeroed memory. 'realloc' and 'free' are passed
+ * the size the block was last allocated with, so that backends don't
+ * need to keep track of it themselves.
+ */
+struct dy_rc_allocator {
+    void *(*alloc)(size_t size, void *env);
+    void *(*realloc)(void *ptr, size_t old_size, size_t new_size, void *env);
+    void (*free)(void *ptr, size_t size, void *env);
+    void *env;
+};
+
+/**
+ * Makes 'allocator' the backend of all subsequent allocations and returns the previous one.
+ *
+ * An object must be released through the backend it was allocated with,
+ * so objects must not outlive the backend being switched back.
+ */
+static inline struct dy_rc_allocator dy_rc_set_allocator(struct dy_rc_allocator allocator);
+
+/** The default backend, which simply forwards to calloc/realloc/free. */
+static inline struct dy_rc_allocator dy_rc_malloc_allocator(void);
+
 #    include <stdlib.h>
 #    include <string.h>
 #    include <assert.h>
 
 #    include "util.h"
 
+/**
+ * Precedes every allocation. The size is the one passed to the backend.
+ */
+struct dy_rc_slot {
+    size_t size;
+    size_t ref_cnt;
+};
+
+static inline void *dy_rc_malloc_alloc(size_t size, void *env);
+static inline void *dy_rc_malloc_realloc(void *ptr, size_t old_size, size_t new_size, void *env);
+static inline void dy_rc_malloc_free(void *ptr, size_t size, void *env);
+
+static inline struct dy_rc_slot *dy_rc_slot(const void *ptr, size_t alignment);
+
+static struct dy_rc_allocator dy_rc_current_allocator = {
+    .alloc = dy_rc_malloc_alloc,
+    .realloc = dy_rc_malloc_realloc,
+    .free = dy_rc_malloc_free,
+    .env = NULL
+};
+
+struct dy_rc_allocator dy_rc_set_allocator(struct dy_rc_allocator allocator)
+{
+    struct dy_rc_allocator old = dy_rc_current_allocator;
+    dy_rc_current_allocator = allocator;
+    return old;
+}
+
+struct dy_rc_allocator dy_rc_malloc_allocator(void)
+{
+    return (struct dy_rc_allocator){
+        .alloc = dy_rc_malloc_alloc,
+        .realloc = dy_rc_malloc_realloc,
+        .free = dy_rc_malloc_free,
+        .env = NULL
+    };
+}
+
 void *dy_rc_alloc(size_t size, size_t alignment)
 {
-    const size_t pre_padding = DY_COMPUTE_PADDING(sizeof(size_t), alignment);
+    const size_t pre_padding = DY_COMPUTE_PADDING(sizeof(struct dy_rc_slot), alignment);
+    const size_t total_size = sizeof(struct dy_rc_slot) + pre_padding + size;
 
-    size_t *rc = calloc(1, sizeof *rc + pre_padding + size);
-    assert(rc);
+    DY_STATS_COUNT(DY_STAT_RC_ALLOC);
+    DY_STATS_ADD(DY_STAT_RC_ALLOC_BYTES, total_size);
 
-    *rc = 1;
+    struct dy_rc_slot *slot = dy_rc_current_allocator.alloc(total_size, dy_rc_current_allocator.env);
+    assert(slot);
 
-    return (char *)(rc + 1) + pre_padding;
+    slot->size = total_size;
+    slot->ref_cnt = 1;
+
+    return (char *)(slot + 1) + pre_padding;
 }
 
 void *dy_rc_new(void *ptr, size_t size, size_t alignment)
@@ -70,40 +149,73 @@ void *dy_rc_new(void *ptr, size_t size, size_t alignment)
 
 void *dy_rc_retain(void *ptr, size_t alignment)
 {
-    const size_t pre_padding = DY_COMPUTE_PADDING(sizeof(size_t), alignment);
-
-    size_t *rc = (void *)((char *)ptr - pre_padding - sizeof *rc);
-
-    ++*rc;
+    ++dy_rc_slot(ptr, alignment)->ref_cnt;
 
     return ptr;
 }
 
 size_t dy_rc_release(void *ptr, size_t alignment)
 {
-    const size_t pre_padding = DY_COMPUTE_PADDING(sizeof(size_t), alignment);
-
-    size_t *rc = (void *)((char *)ptr - pre_padding - sizeof *rc);
+    struct dy_rc_slot *slot = dy_rc_slot(ptr, alignment);
 
-    size_t new_ref_cnt = --*rc;
+    size_t new_ref_cnt = --slot->ref_cnt;
 
     if (new_ref_cnt == 0) {
-        free(rc);
+        dy_rc_current_allocator.free(slot, slot->size, dy_rc_current_allocator.env);
     }
 
     return new_ref_cnt;
 }
 
+size_t dy_rc_decrement(void *ptr, size_t alignment)
+{
+    return --dy_rc_slot(ptr, alignment)->ref_cnt;
+}
+
+void dy_rc_free(void *ptr, size_t alignment)
+{
+    struct dy_rc_slot *slot = dy_rc_slot(ptr, alignment);
+
+    assert(slot->ref_cnt == 0);
+
+    dy_rc_current_allocator.free(slot, slot->size, dy_rc_current_allocator.env);
+}
+
 void *dy_rc_realloc(void *ptr, size_t new_size, size_t alignment)
 {
-    const size_t pre_padding = DY_COMPUTE_PADDING(sizeof(size_t), alignment);
+    const size_t pre_padding = DY_COMPUTE_PADDING(sizeof(struct dy_rc_slot), alignment);
+    const size_t total_size = sizeof(struct dy_rc_slot) + pre_padding + new_size;
 
-    size_t *old = (void *)((char *)ptr - pre_padding - sizeof *old);
+    struct dy_rc_slot *old = dy_rc_slot(ptr, alignment);
 
-    size_t *new = realloc(old, sizeof *new + pre_padding + new_size);
+    struct dy_rc_slot *new = dy_rc_current_allocator.realloc(old, old->size, total_size, dy_rc_current_allocator.env);
     assert(new);
 
+    new->size = total_size;
+
     return (char *)(new + 1) + pre_padding;
 }
 
+struct dy_rc_slot *dy_rc_slot(const void *ptr, size_t alignment)
+{
+    const size_t pre_padding = DY_COMPUTE_PADDING(sizeof(struct dy_rc_slot), alignment);
+
+    return (void *)((const char *)ptr - pre_padding - sizeof(struct dy_rc_slot));
+}
+
+void *dy_rc_malloc_alloc(size_t size, void *env)
+{
+    return calloc(1, size);
+}
+
+void *dy_rc_malloc_realloc(void *ptr, size_t old_size, size_t new_size, void *env)
+{
+    return realloc(ptr, new_size);
+}
+
+void dy_rc_malloc_free(void *ptr, size_t size, void *env)
+{
+    free(ptr);
+}
+
 #endif // !DY_FREESTANDING
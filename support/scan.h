@@ -0,0 +1,221 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Scanning primitives over a contiguous range of bytes [ptr, end).
+ *
+ * Each function returns the first position at which its run ends, or 'end'.
+ * Everything looked for is ASCII, so these work on UTF-8 unchanged.
+ *
+ * With SSE2 (always available on x86-64), runs are classified 16 bytes at a time.
+ * Most runs in source text are only a few bytes long though, and setting up the vectors
+ * costs more than it saves for those, so the first dy_scan_short_run bytes are always
+ * looked at one by one. The scalar versions are also used for the remainder and everywhere else.
+ * Define DY_SCAN_NO_SIMD to always use the scalar versions.
+ */
+
+#if !defined(DY_SCAN_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#    define DY_SCAN_SSE2 1
+#    include <emmintrin.h>
+#    ifdef _MSC_VER
+#        include <intrin.h>
+#    endif
+#endif
+
+/** Skips ' ' and '\t', and also '\r' and '\n' if 'newlines' is true. */
+static inline const char *dy_scan_blanks(const char *ptr, const char *end, bool newlines);
+
+/** Skips the characters that can follow the first letter of an identifier: [a-zA-Z0-9?-]. */
+static inline const char *dy_scan_identifier_tail(const char *ptr, const char *end);
+
+/** Finds the first occurrence of 'c'. */
+static inline const char *dy_scan_byte(const char *ptr, const char *end, char c);
+
+static inline const char *dy_scan_blanks_scalar(const char *ptr, const char *end, bool newlines);
+
+static inline const char *dy_scan_identifier_tail_scalar(const char *ptr, const char *end);
+
+static inline const char *dy_scan_byte_scalar(const char *ptr, const char *end, char c);
+
+static inline bool dy_scan_is_blank(char c, bool newlines);
+
+static inline bool dy_scan_is_identifier_char(char c);
+
+static const size_t dy_scan_short_run = 16;
+
+/** The end of the prefix of [ptr, end) that is scanned one by one. */
+static inline const char *dy_scan_short_run_end(const char *ptr, const char *end);
+
+#ifdef DY_SCAN_SSE2
+/** Index of the lowest set bit of a non-zero mask. */
+static inline unsigned dy_scan_first_set(unsigned mask);
+#endif
+
+const char *dy_scan_blanks(const char *ptr, const char *end, bool newlines)
+{
+    const char *short_run_end = dy_scan_short_run_end(ptr, end);
+
+    ptr = dy_scan_blanks_scalar(ptr, short_run_end, newlines);
+    if (ptr != short_run_end || ptr == end) {
+        return ptr;
+    }
+
+#ifdef DY_SCAN_SSE2
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8(newlines ? '\r' : ' ');
+    const __m128i lf = _mm_set1_epi8(newlines ? '\n' : ' ');
+
+    while (end - ptr >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)ptr);
+
+        __m128i blank = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)));
+
+        unsigned non_blank = ~(unsigned)_mm_movemask_epi8(blank) & 0xFFFF;
+        if (non_blank != 0) {
+            return ptr + dy_scan_first_set(non_blank);
+        }
+
+        ptr += 16;
+    }
+#endif
+
+    return dy_scan_blanks_scalar(ptr, end, newlines);
+}
+
+const char *dy_scan_identifier_tail(const char *ptr, const char *end)
+{
+    const char *short_run_end = dy_scan_short_run_end(ptr, end);
+
+    ptr = dy_scan_identifier_tail_scalar(ptr, short_run_end);
+    if (ptr != short_run_end || ptr == end) {
+        return ptr;
+    }
+
+#ifdef DY_SCAN_SSE2
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i before_a = _mm_set1_epi8('a' - 1);
+    const __m128i after_z = _mm_set1_epi8('z' + 1);
+    const __m128i before_0 = _mm_set1_epi8('0' - 1);
+    const __m128i after_9 = _mm_set1_epi8('9' + 1);
+    const __m128i dash = _mm_set1_epi8('-');
+    const __m128i question_mark = _mm_set1_epi8('?');
+
+    while (end - ptr >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)ptr);
+
+        // Bytes >= 0x80 are negative as signed chars, so they fail both range checks.
+        __m128i lower = _mm_or_si128(chunk, case_bit);
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, before_a), _mm_cmplt_epi8(lower, after_z));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, before_0), _mm_cmplt_epi8(chunk, after_9));
+        __m128i other = _mm_or_si128(_mm_cmpeq_epi8(chunk, dash), _mm_cmpeq_epi8(chunk, question_mark));
+
+        __m128i ok = _mm_or_si128(_mm_or_si128(letter, digit), other);
+
+        unsigned not_ok = ~(unsigned)_mm_movemask_epi8(ok) & 0xFFFF;
+        if (not_ok != 0) {
+            return ptr + dy_scan_first_set(not_ok);
+        }
+
+        ptr += 16;
+    }
+#endif
+
+    return dy_scan_identifier_tail_scalar(ptr, end);
+}
+
+const char *dy_scan_byte(const char *ptr, const char *end, char c)
+{
+    if (ptr == end) {
+        return end;
+    }
+
+    // The C library's memchr() is vectorized about everywhere.
+    const char *found = memchr(ptr, c, (size_t)(end - ptr));
+    if (found == NULL) {
+        return end;
+    }
+
+    return found;
+}
+
+const char *dy_scan_blanks_scalar(const char *ptr, const char *end, bool newlines)
+{
+    while (ptr != end && dy_scan_is_blank(*ptr, newlines)) {
+        ++ptr;
+    }
+
+    return ptr;
+}
+
+const char *dy_scan_identifier_tail_scalar(const char *ptr, const char *end)
+{
+    while (ptr != end && dy_scan_is_identifier_char(*ptr)) {
+        ++ptr;
+    }
+
+    return ptr;
+}
+
+const char *dy_scan_byte_scalar(const char *ptr, const char *end, char c)
+{
+    while (ptr != end && *ptr != c) {
+        ++ptr;
+    }
+
+    return ptr;
+}
+
+bool dy_scan_is_blank(char c, bool newlines)
+{
+    return c == ' ' || c == '\t' || (newlines && (c == '\r' || c == '\n'));
+}
+
+bool dy_scan_is_identifier_char(char c)
+{
+    return ('a' <= c && c <= 'z')
+           || ('A' <= c && c <= 'Z')
+           || ('0' <= c && c <= '9')
+           || c == '-'
+           || c == '?';
+}
+
+const char *dy_scan_short_run_end(const char *ptr, const char *end)
+{
+    if ((size_t)(end - ptr) > dy_scan_short_run) {
+        return ptr + dy_scan_short_run;
+    } else {
+        return end;
+    }
+}
+
+#ifdef DY_SCAN_SSE2
+unsigned dy_scan_first_set(unsigned mask)
+{
+#    if defined(__GNUC__)
+    return (unsigned)__builtin_ctz(mask);
+#    elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#    else
+    unsigned index = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        ++index;
+    }
+    return index;
+#    endif
+}
+#endif
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+/**
+ * Optional instrumentation: Counters for the hot spots of checking and evaluation,
+ * timers for the phases of a run, and spans that can be written out in the
+ * Chrome trace event format (load the file in chrome://tracing or ui.perfetto.dev).
+ *
+ * Everything is compiled in only if DY_STATS is defined. Otherwise, the macros
+ * below expand to nothing and none of the functions exist.
+ *
+ * Times are taken with clock(), which is portable and has microsecond resolution
+ * on common platforms. Since a run is single-threaded and bound by CPU,
+ * processor time is close to wall-clock time.
+ */
+
+#ifdef DY_STATS
+
+#    ifdef DY_FREESTANDING
+#        error "DY_STATS needs a hosted environment."
+#    endif
+
+#    include "bail.h"
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdint.h>
+#    include <stdio.h>
+#    include <time.h>
+
+enum dy_stat {
+    DY_STAT_IS_SUBTYPE,
+    DY_STAT_ARE_EQUAL,
+    DY_STAT_TYPE_OF,
+    DY_STAT_TYPE_OF_CACHED,
+    DY_STAT_SUBSTITUTE,
+    DY_STAT_SUBSTITUTE_NODES,
+    DY_STAT_EVAL_ELIM_STEP,
+    DY_STAT_RC_ALLOC,
+    DY_STAT_RC_ALLOC_BYTES,
+    DY_NUM_STATS
+};
+
+enum dy_stats_phase {
+    DY_STATS_PHASE_PARSE,
+    DY_STATS_PHASE_LOWER,
+    DY_STATS_PHASE_CHECK,
+    DY_STATS_PHASE_EVAL,
+    DY_STATS_NUM_PHASES
+};
+
+struct dy_stats {
+    size_t counts[DY_NUM_STATS];
+
+    clock_t phase_start[DY_STATS_NUM_PHASES];
+    clock_t phase_time[DY_STATS_NUM_PHASES];
+
+    /** Where trace events go, or NULL. */
+    FILE *trace;
+    bool has_trace_events;
+};
+
+static struct dy_stats dy_stats;
+
+#    define DY_STATS_COUNT(stat) ((void)++dy_stats.counts[(stat)])
+#    define DY_STATS_ADD(stat, n) ((void)(dy_stats.counts[(stat)] += (n)))
+#    define DY_STATS_PHASE_BEGIN(phase) dy_stats_phase_begin((phase))
+#    define DY_STATS_PHASE_END(phase) dy_stats_phase_end((phase))
+#    define DY_STATS_SPAN_BEGIN(name, id) dy_stats_trace_event((name), (id), 'B')
+#    define DY_STATS_SPAN_END(name, id) dy_stats_trace_event((name), (id), 'E')
+
+static inline void dy_stats_phase_begin(enum dy_stats_phase phase);
+
+static inline void dy_stats_phase_end(enum dy_stats_phase phase);
+
+/**
+ * Writes a trace event of type 'phase' ('B' for begin, 'E' for end) if tracing.
+ * 'id' distinguishes spans of the same name, like the definitions of a program;
+ * SIZE_MAX if there is no need for that.
+ */
+static inline void dy_stats_trace_event(const char *name, size_t id, char phase);
+
+/** Starts writing trace events to 'file'. */
+static inline void dy_stats_trace_start(FILE *file);
+
+/** Finishes the trace, leaving 'file' open. */
+static inline void dy_stats_trace_finish(void);
+
+/** Prints all counters and phase times in a human-readable table. */
+static inline void dy_stats_print(FILE *file);
+
+static inline const char *dy_stat_name(enum dy_stat stat);
+
+static inline const char *dy_stats_phase_name(enum dy_stats_phase phase);
+
+static inline double dy_stats_clock_to_us(clock_t c);
+
+void dy_stats_phase_begin(enum dy_stats_phase phase)
+{
+    dy_stats.phase_start[phase] = clock();
+    dy_stats_trace_event(dy_stats_phase_name(phase), SIZE_MAX, 'B');
+}
+
+void dy_stats_phase_end(enum dy_stats_phase phase)
+{
+    dy_stats.phase_time[phase] += clock() - dy_stats.phase_start[phase];
+    dy_stats_trace_event(dy_stats_phase_name(phase), SIZE_MAX, 'E');
+}
+
+void dy_stats_trace_event(const char *name, size_t id, char phase)
+{
+    if (dy_stats.trace == NULL) {
+        return;
+    }
+
+    fprintf(dy_stats.trace, "%s\n{\"name\":\"%s", dy_stats.has_trace_events ? "," : "", name);
+    if (id != SIZE_MAX) {
+        fprintf(dy_stats.trace, " %zu", id);
+    }
+    fprintf(dy_stats.trace, "\",\"ph\":\"%c\",\"ts\":%.0f,\"pid\":1,\"tid\":1}", phase, dy_stats_clock_to_us(clock()));
+
+    dy_stats.has_trace_events = true;
+}
+
+void dy_stats_trace_start(FILE *file)
+{
+    dy_stats.trace = file;
+    dy_stats.has_trace_events = false;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+}
+
+void dy_stats_trace_finish(void)
+{
+    fprintf(dy_stats.trace, "\n]}\n");
+
+    dy_stats.trace = NULL;
+}
+
+void dy_stats_print(FILE *file)
+{
+    fprintf(file, "=== Stats ====\n\n");
+
+    for (size_t i = 0; i < DY_STATS_NUM_PHASES; ++i) {
+        fprintf(file, "%-24s %12.3f ms\n", dy_stats_phase_name(i), dy_stats_clock_to_us(dy_stats.phase_time[i]) / 1000);
+    }
+
+    fprintf(file, "\n");
+
+    for (size_t i = 0; i < DY_NUM_STATS; ++i) {
+        fprintf(file, "%-24s %12zu\n", dy_stat_name(i), dy_stats.counts[i]);
+    }
+}
+
+const char *dy_stat_name(enum dy_stat stat)
+{
+    switch (stat) {
+    case DY_STAT_IS_SUBTYPE:
+        return "dy_is_subtype";
+    case DY_STAT_ARE_EQUAL:
+        return "dy_are_equal";
+    case DY_STAT_TYPE_OF:
+        return "dy_type_of";
+    case DY_STAT_TYPE_OF_CACHED:
+        return "  cached";
+    case DY_STAT_SUBSTITUTE:
+        return "dy_substitute";
+    case DY_STAT_SUBSTITUTE_NODES:
+        return "  nodes visited";
+    case DY_STAT_EVAL_ELIM_STEP:
+        return "dy_eval_elim_single_step";
+    case DY_STAT_RC_ALLOC:
+        return "dy_rc_alloc";
+    case DY_STAT_RC_ALLOC_BYTES:
+        return "  bytes";
+    case DY_NUM_STATS:
+        break;
+    }
+
+    dy_bail("impossible");
+}
+
+const char *dy_stats_phase_name(enum dy_stats_phase phase)
+{
+    switch (phase) {
+    case DY_STATS_PHASE_PARSE:
+        return "parse";
+    case DY_STATS_PHASE_LOWER:
+        return "lower";
+    case DY_STATS_PHASE_CHECK:
+        return "check";
+    case DY_STATS_PHASE_EVAL:
+        return "eval";
+    case DY_STATS_NUM_PHASES:
+        break;
+    }
+
+    dy_bail("impossible");
+}
+
+double dy_stats_clock_to_us(clock_t c)
+{
+    return (double)c * 1e6 / CLOCKS_PER_SEC;
+}
+
+#else
+
+#    define DY_STATS_COUNT(stat) ((void)0)
+#    define DY_STATS_ADD(stat, n) ((void)0)
+#    define DY_STATS_PHASE_BEGIN(phase) ((void)0)
+#    define DY_STATS_PHASE_END(phase) ((void)0)
+#    define DY_STATS_SPAN_BEGIN(name, id) ((void)0)
+#    define DY_STATS_SPAN_END(name, id) ((void)0)
+
+#endif // DY_STATS
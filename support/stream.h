@@ -27,6 +27,15 @@ struct dy_stream {
 
 static inline bool dy_stream_get_char(struct dy_stream *stream, char *c);
 
+/**
+ * Pulls in everything get_chars() has to offer, so that the buffer holds the complete
+ * input and doesn't move anymore. Afterwards, get_chars() isn't called again.
+ */
+static inline void dy_stream_read_all(struct dy_stream *stream);
+
+/** A get_chars() for streams whose buffer already holds everything. */
+static inline void dy_stream_no_more_chars(dy_array_t *buffer, void *env);
+
 static inline void dy_stream_put_last_char_back(struct dy_stream *stream);
 
 static inline void dy_stream_reset(struct dy_stream *stream);
@@ -45,11 +54,32 @@ bool dy_stream_get_char(struct dy_stream *stream, char *c)
         }
     }
 
-    memcpy(c, dy_array_pos(&stream->buffer, stream->current_index), 1);
+    *c = ((const char *)stream->buffer.buffer)[stream->current_index];
     ++stream->current_index;
     return true;
 }
 
+void dy_stream_read_all(struct dy_stream *stream)
+{
+    for (;;) {
+        size_t size = stream->buffer.num_elems;
+
+        stream->get_chars(&stream->buffer, stream->env);
+
+        if (stream->buffer.num_elems == size) {
+            break;
+        }
+    }
+
+    stream->get_chars = dy_stream_no_more_chars;
+}
+
+void dy_stream_no_more_chars(dy_array_t *buffer, void *env)
+{
+    (void)buffer;
+    (void)env;
+}
+
 void dy_stream_put_last_char_back(struct dy_stream *stream)
 {
     --stream->current_index;
@@ -0,0 +1,213 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "array.h"
+#include "string.h"
+#include "util.h"
+
+#include <string.h>
+
+/**
+ * A buffered sink for text.
+ *
+ * Bytes are collected in 'buffer' and handed to 'flush' in bulk, once
+ * dy_writer_chunk_size of them have piled up or when dy_writer_flush() is called.
+ * Without a 'flush' callback, nothing is ever handed on and the writer just
+ * builds up the text in 'buffer'.
+ *
+ * Output can be limited: After 'max_size' bytes, the rest is dropped and
+ * replaced with "...". Nested structures written through dy_writer_enter()
+ * and dy_writer_leave() are likewise elided below 'max_depth' levels.
+ * A limit of 0 means no limit.
+ */
+
+struct dy_writer {
+    dy_array_t buffer;
+    void (*flush)(dy_string_t bytes, void *env);
+    void *env;
+
+    size_t max_size;
+    size_t max_depth;
+
+    size_t num_written;
+    size_t depth;
+    bool is_truncated;
+};
+
+static const size_t dy_writer_chunk_size = 4096;
+
+static const dy_string_t dy_writer_ellipsis = DY_STR_LIT_INIT("...");
+
+/** A writer that collects everything in its buffer. */
+static inline struct dy_writer dy_writer_to_buffer(size_t initial_capacity);
+
+/** A writer that hands its output to 'flush' in chunks. */
+static inline struct dy_writer dy_writer_to_callback(void (*flush)(dy_string_t bytes, void *env), void *env);
+
+static inline void dy_write(struct dy_writer *writer, dy_string_t s);
+
+static inline void dy_write_char(struct dy_writer *writer, char c);
+
+static inline void dy_write_size_t_decimal(struct dy_writer *writer, size_t x);
+
+/**
+ * Enters a nested level of output. If that is too deep (or the output is
+ * already cut off), writes "..." instead and returns false, in which case
+ * the level must be skipped without calling dy_writer_leave().
+ */
+static inline bool dy_writer_enter(struct dy_writer *writer);
+
+static inline void dy_writer_leave(struct dy_writer *writer);
+
+/** Hands all buffered bytes to the callback, if there is one. */
+static inline void dy_writer_flush(struct dy_writer *writer);
+
+/** Flushes 'writer' and frees its buffer. */
+static inline void dy_writer_release(struct dy_writer *writer);
+
+#ifndef DY_FREESTANDING
+
+#    include <stdio.h>
+
+/** A writer that writes to 'file' in chunks. */
+static inline struct dy_writer dy_writer_to_file(FILE *file);
+
+static inline void dy_writer_file_flush(dy_string_t bytes, void *env);
+
+struct dy_writer dy_writer_to_file(FILE *file)
+{
+    return dy_writer_to_callback(dy_writer_file_flush, file);
+}
+
+void dy_writer_file_flush(dy_string_t bytes, void *env)
+{
+    fwrite(bytes.ptr, sizeof(char), bytes.size, env);
+}
+
+#endif // !DY_FREESTANDING
+
+struct dy_writer dy_writer_to_buffer(size_t initial_capacity)
+{
+    return (struct dy_writer){
+        .buffer = dy_array_create(sizeof(char), DY_ALIGNOF(char), initial_capacity)
+    };
+}
+
+struct dy_writer dy_writer_to_callback(void (*flush)(dy_string_t bytes, void *env), void *env)
+{
+    return (struct dy_writer){
+        .buffer = dy_array_create(sizeof(char), DY_ALIGNOF(char), dy_writer_chunk_size),
+        .flush = flush,
+        .env = env
+    };
+}
+
+void dy_write(struct dy_writer *writer, dy_string_t s)
+{
+    if (writer->is_truncated || s.size == 0) {
+        return;
+    }
+
+    if (writer->max_size != 0 && s.size > writer->max_size - writer->num_written) {
+        s.size = writer->max_size - writer->num_written;
+        writer->is_truncated = true;
+    }
+
+    dy_array_t *buffer = &writer->buffer;
+
+    if (buffer->capacity - buffer->num_elems < s.size) {
+        if (writer->flush != NULL) {
+            dy_writer_flush(writer);
+
+            if (s.size >= dy_writer_chunk_size && !writer->is_truncated) {
+                // Big enough to be handed on right away, without copying it first.
+                writer->flush(s, writer->env);
+                writer->num_written += s.size;
+                return;
+            }
+        }
+
+        if (buffer->capacity - buffer->num_elems < s.size) {
+            // At least double, like adding single elements does.
+            dy_array_set_excess_capacity(buffer, s.size > buffer->capacity ? s.size : buffer->capacity);
+        }
+    }
+
+    memcpy(dy_array_excess_buffer(buffer), s.ptr, s.size);
+    dy_array_add_to_size(buffer, s.size);
+
+    writer->num_written += s.size;
+
+    if (writer->is_truncated) {
+        // Deliberately past 'max_size', so that the cut is visible.
+        dy_array_set_excess_capacity(buffer, dy_writer_ellipsis.size);
+        memcpy(dy_array_excess_buffer(buffer), dy_writer_ellipsis.ptr, dy_writer_ellipsis.size);
+        dy_array_add_to_size(buffer, dy_writer_ellipsis.size);
+    }
+
+    if (writer->flush != NULL && buffer->num_elems >= dy_writer_chunk_size) {
+        dy_writer_flush(writer);
+    }
+}
+
+void dy_write_char(struct dy_writer *writer, char c)
+{
+    dy_write(writer, (dy_string_t){ .ptr = &c, .size = 1 });
+}
+
+void dy_write_size_t_decimal(struct dy_writer *writer, size_t x)
+{
+    // Enough for 64 bits.
+    char digits[20];
+    size_t start = sizeof digits;
+
+    do {
+        digits[--start] = (char)('0' + x % 10);
+        x /= 10;
+    } while (x != 0);
+
+    dy_write(writer, (dy_string_t){ .ptr = digits + start, .size = sizeof digits - start });
+}
+
+bool dy_writer_enter(struct dy_writer *writer)
+{
+    if (writer->is_truncated) {
+        return false;
+    }
+
+    if (writer->max_depth != 0 && writer->depth == writer->max_depth) {
+        dy_write(writer, dy_writer_ellipsis);
+        return false;
+    }
+
+    ++writer->depth;
+
+    return true;
+}
+
+void dy_writer_leave(struct dy_writer *writer)
+{
+    --writer->depth;
+}
+
+void dy_writer_flush(struct dy_writer *writer)
+{
+    if (writer->flush == NULL || writer->buffer.num_elems == 0) {
+        return;
+    }
+
+    writer->flush((dy_string_t){ .ptr = writer->buffer.buffer, .size = writer->buffer.num_elems }, writer->env);
+
+    writer->buffer.num_elems = 0;
+}
+
+void dy_writer_release(struct dy_writer *writer)
+{
+    dy_writer_flush(writer);
+    dy_array_release(&writer->buffer);
+}
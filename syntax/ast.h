@@ -9,6 +9,48 @@
 #include "../support/array.h"
 #include "../support/rc.h"
 #include "../support/bail.h"
+#include "../support/string.h"
+
+#include <stdint.h>
+
+/**
+ * Names and string literals are views into the parsed text (see dy_utf8_to_ast_file()),
+ * so the text has to outlive the AST.
+ */
+
+/**
+ * An identifier, together with its symbol from the interner of the parse that produced it
+ * (see dy_utf8_to_ast_ctx.symbols). Names are equal iff their symbols are.
+ */
+struct dy_ast_name {
+    dy_string_t text;
+    size_t symbol;
+};
+
+/**
+ * The builtin names. Every parse interns them first, in this order,
+ * so their symbols are these values.
+ */
+enum dy_ast_builtin {
+    DY_AST_BUILTIN_PRINT,
+    DY_AST_BUILTIN_ADD,
+    DY_AST_BUILTIN_SUB,
+    DY_AST_BUILTIN_MUL,
+    DY_AST_BUILTIN_COMPARE,
+    DY_AST_BUILTIN_CONCAT,
+    DY_AST_BUILTIN_SUBSTRING,
+    DY_AST_NUM_BUILTINS
+};
+
+static const dy_string_t dy_ast_builtin_names[DY_AST_NUM_BUILTINS] = {
+    DY_STR_LIT_INIT("print"),
+    DY_STR_LIT_INIT("add"),
+    DY_STR_LIT_INIT("sub"),
+    DY_STR_LIT_INIT("mul"),
+    DY_STR_LIT_INIT("compare"),
+    DY_STR_LIT_INIT("concat"),
+    DY_STR_LIT_INIT("substring")
+};
 
 enum dy_ast_argument_tag {
     DY_AST_ARGUMENT_EXPR,
@@ -68,7 +110,7 @@ enum dy_ast_binding_tag {
 };
 
 struct dy_ast_binding {
-    dy_array_t name;
+    struct dy_ast_name name;
     bool have_name;
     union {
         struct dy_ast_expr *type;
@@ -86,7 +128,7 @@ struct dy_ast_function {
 };
 
 struct dy_ast_recursion {
-    dy_array_t name;
+    struct dy_ast_name name;
     struct dy_ast_expr *expr;
     bool is_fin;
     bool is_implicit;
@@ -115,7 +157,7 @@ struct dy_ast_do_block_stmnt_let {
 };
 
 struct dy_ast_do_block_stmnt_def {
-    dy_array_t name;
+    struct dy_ast_name name;
     struct dy_ast_expr *expr;
 };
 
@@ -155,7 +197,7 @@ struct dy_ast_simple {
 };
 
 struct dy_ast_map_some {
-    dy_array_t name;
+    struct dy_ast_name name;
     struct dy_ast_expr *type; // Can be NULL.
     struct dy_ast_binding binding;
     struct dy_ast_expr *expr;
@@ -174,7 +216,7 @@ struct dy_ast_map_either {
 };
 
 struct dy_ast_map_fin {
-    dy_array_t name;
+    struct dy_ast_name name;
     struct dy_ast_binding binding;
     struct dy_ast_expr *expr;
     bool is_implicit;
@@ -188,6 +230,8 @@ enum dy_ast_expr_tag {
     DY_AST_EXPR_DO_BLOCK,
     DY_AST_EXPR_STRING,
     DY_AST_EXPR_STRING_TYPE,
+    DY_AST_EXPR_INT,
+    DY_AST_EXPR_INT_TYPE,
     DY_AST_EXPR_ANY,
     DY_AST_EXPR_VOID,
     DY_AST_EXPR_JUXTAPOSITION,
@@ -199,12 +243,13 @@ enum dy_ast_expr_tag {
 
 struct dy_ast_expr {
     union {
-        dy_array_t variable;
+        struct dy_ast_name variable;
         struct dy_ast_function function;
         struct dy_ast_recursion recursion;
         struct dy_ast_list list;
         struct dy_ast_do_block do_block;
-        dy_array_t string;
+        dy_string_t string;
+        intptr_t int_value;
         struct dy_ast_juxtaposition juxtaposition;
         struct dy_ast_simple simple;
         struct dy_ast_map_some map_some;
@@ -297,14 +342,12 @@ struct dy_ast_expr dy_ast_expr_retain(struct dy_ast_expr expr)
 {
     switch (expr.tag) {
     case DY_AST_EXPR_VARIABLE:
-        dy_array_retain(&expr.variable);
         return expr;
     case DY_AST_EXPR_FUNCTION:
         dy_ast_binding_retain(expr.function.binding);
         dy_ast_expr_retain_ptr(expr.function.expr);
         return expr;
     case DY_AST_EXPR_RECURSION:
-        dy_array_retain(&expr.recursion.name);
         dy_ast_expr_retain_ptr(expr.recursion.expr);
         return expr;
     case DY_AST_EXPR_LIST:
@@ -314,11 +357,12 @@ struct dy_ast_expr dy_ast_expr_retain(struct dy_ast_expr expr)
         dy_ast_do_block_retain(expr.do_block);
         return expr;
     case DY_AST_EXPR_STRING:
-        dy_array_retain(&expr.string);
         return expr;
     case DY_AST_EXPR_ANY:
     case DY_AST_EXPR_VOID:
     case DY_AST_EXPR_STRING_TYPE:
+    case DY_AST_EXPR_INT:
+    case DY_AST_EXPR_INT_TYPE:
         return expr;
     case DY_AST_EXPR_JUXTAPOSITION:
         dy_ast_expr_retain_ptr(expr.juxtaposition.left);
@@ -332,7 +376,6 @@ struct dy_ast_expr dy_ast_expr_retain(struct dy_ast_expr expr)
         dy_ast_expr_retain_ptr(expr.simple.expr);
         return expr;
     case DY_AST_EXPR_MAP_SOME:
-        dy_array_retain(&expr.map_some.name);
         if (expr.map_some.type) {
             dy_ast_expr_retain_ptr(expr.map_some.type);
         }
@@ -343,7 +386,6 @@ struct dy_ast_expr dy_ast_expr_retain(struct dy_ast_expr expr)
         dy_ast_map_either_body_retain(expr.map_either.body);
         return expr;
     case DY_AST_EXPR_MAP_FIN:
-        dy_array_retain(&expr.map_fin.name);
         dy_ast_binding_retain(expr.map_fin.binding);
         dy_ast_expr_retain_ptr(expr.map_fin.expr);
         return expr;
@@ -361,14 +403,12 @@ void dy_ast_expr_release(struct dy_ast_expr expr)
 {
     switch (expr.tag) {
     case DY_AST_EXPR_VARIABLE:
-        dy_array_release(&expr.variable);
         return;
     case DY_AST_EXPR_FUNCTION:
         dy_ast_binding_release(expr.function.binding);
         dy_ast_expr_release_ptr(expr.function.expr);
         return;
     case DY_AST_EXPR_RECURSION:
-        dy_array_release(&expr.recursion.name);
         dy_ast_expr_release_ptr(expr.recursion.expr);
         return;
     case DY_AST_EXPR_LIST:
@@ -378,11 +418,12 @@ void dy_ast_expr_release(struct dy_ast_expr expr)
         dy_ast_do_block_release(expr.do_block);
         return;
     case DY_AST_EXPR_STRING:
-        dy_array_release(&expr.string);
         return;
     case DY_AST_EXPR_ANY:
     case DY_AST_EXPR_VOID:
     case DY_AST_EXPR_STRING_TYPE:
+    case DY_AST_EXPR_INT:
+    case DY_AST_EXPR_INT_TYPE:
         return;
     case DY_AST_EXPR_JUXTAPOSITION:
         dy_ast_expr_release_ptr(expr.juxtaposition.left);
@@ -396,7 +437,6 @@ void dy_ast_expr_release(struct dy_ast_expr expr)
         dy_ast_expr_release_ptr(expr.simple.expr);
         return;
     case DY_AST_EXPR_MAP_SOME:
-        dy_array_release(&expr.map_some.name);
         if (expr.map_some.type) {
             dy_ast_expr_release_ptr(expr.map_some.type);
         }
@@ -407,7 +447,6 @@ void dy_ast_expr_release(struct dy_ast_expr expr)
         dy_ast_map_either_body_release(expr.map_either.body);
         return;
     case DY_AST_EXPR_MAP_FIN:
-        dy_array_release(&expr.map_fin.name);
         dy_ast_binding_release(expr.map_fin.binding);
         dy_ast_expr_release_ptr(expr.map_fin.expr);
         return;
@@ -497,10 +536,19 @@ struct dy_ast_do_block *dy_ast_do_block_retain_ptr(struct dy_ast_do_block *do_bl
 
 void dy_ast_do_block_release(struct dy_ast_do_block do_block)
 {
-    dy_ast_do_block_stmnt_release(do_block.stmnt);
+    // Walks the statements in a loop, since do-blocks can be as long as the whole program.
+    for (;;) {
+        dy_ast_do_block_stmnt_release(do_block.stmnt);
 
-    if (do_block.rest) {
-        dy_ast_do_block_release_ptr(do_block.rest);
+        struct dy_ast_do_block *rest = do_block.rest;
+        if (rest == NULL) {
+            return;
+        }
+
+        do_block = *rest;
+        if (dy_rc_release(rest, DY_ALIGNOF(struct dy_ast_do_block)) != 0) {
+            return;
+        }
     }
 }
 
@@ -523,7 +571,6 @@ struct dy_ast_do_block_stmnt dy_ast_do_block_stmnt_retain(struct dy_ast_do_block
         dy_ast_expr_retain_ptr(stmnt.let.expr);
         return stmnt;
     case DY_AST_DO_BLOCK_STMNT_DEF:
-        dy_array_retain(&stmnt.def.name);
         dy_ast_expr_retain_ptr(stmnt.def.expr);
         return stmnt;
     }
@@ -543,7 +590,6 @@ void dy_ast_do_block_stmnt_release(struct dy_ast_do_block_stmnt stmnt)
         dy_ast_expr_release_ptr(stmnt.let.expr);
         return;
     case DY_AST_DO_BLOCK_STMNT_DEF:
-        dy_array_release(&stmnt.def.name);
         dy_ast_expr_release_ptr(stmnt.def.expr);
         return;
     }
@@ -590,9 +636,18 @@ struct dy_ast_list_body *dy_ast_list_body_retain_ptr(struct dy_ast_list_body *li
 
 void dy_ast_list_body_release(struct dy_ast_list_body list_body)
 {
-    dy_ast_expr_release_ptr(list_body.expr);
-    if (list_body.next) {
-        dy_ast_list_body_release_ptr(list_body.next);
+    for (;;) {
+        dy_ast_expr_release_ptr(list_body.expr);
+
+        struct dy_ast_list_body *next = list_body.next;
+        if (next == NULL) {
+            return;
+        }
+
+        list_body = *next;
+        if (dy_rc_release(next, DY_ALIGNOF(struct dy_ast_list_body)) != 0) {
+            return;
+        }
     }
 }
 
@@ -626,9 +681,18 @@ struct dy_ast_pattern_list_body *dy_ast_pattern_list_body_retain_ptr(struct dy_a
 
 void dy_ast_pattern_list_body_release(struct dy_ast_pattern_list_body list_body)
 {
-    dy_ast_binding_release_ptr(list_body.binding);
-    if (list_body.next) {
-        dy_ast_pattern_list_body_release_ptr(list_body.next);
+    for (;;) {
+        dy_ast_binding_release_ptr(list_body.binding);
+
+        struct dy_ast_pattern_list_body *next = list_body.next;
+        if (next == NULL) {
+            return;
+        }
+
+        list_body = *next;
+        if (dy_rc_release(next, DY_ALIGNOF(struct dy_ast_pattern_list_body)) != 0) {
+            return;
+        }
     }
 }
 
@@ -647,10 +711,6 @@ struct dy_ast_binding *dy_ast_binding_new(struct dy_ast_binding binding)
 
 struct dy_ast_binding dy_ast_binding_retain(struct dy_ast_binding binding)
 {
-    if (binding.have_name) {
-        dy_array_retain(&binding.name);
-    }
-
     switch (binding.tag) {
     case DY_AST_BINDING_TYPE:
         dy_ast_expr_retain_ptr(binding.type);
@@ -672,10 +732,6 @@ struct dy_ast_binding *dy_ast_binding_retain_ptr(struct dy_ast_binding *binding)
 
 void dy_ast_binding_release(struct dy_ast_binding binding)
 {
-    if (binding.have_name) {
-        dy_array_release(&binding.name);
-    }
-
     switch (binding.tag) {
     case DY_AST_BINDING_TYPE:
         dy_ast_expr_release_ptr(binding.type);
@@ -721,10 +777,19 @@ struct dy_ast_map_either_body *dy_ast_map_either_body_retain_ptr(struct dy_ast_m
 
 void dy_ast_map_either_body_release(struct dy_ast_map_either_body map_either_body)
 {
-    dy_ast_binding_release(map_either_body.binding);
-    dy_ast_expr_release_ptr(map_either_body.expr);
-    if (map_either_body.next) {
-        dy_ast_map_either_body_release_ptr(map_either_body.next);
+    for (;;) {
+        dy_ast_binding_release(map_either_body.binding);
+        dy_ast_expr_release_ptr(map_either_body.expr);
+
+        struct dy_ast_map_either_body *next = map_either_body.next;
+        if (next == NULL) {
+            return;
+        }
+
+        map_either_body = *next;
+        if (dy_rc_release(next, DY_ALIGNOF(struct dy_ast_map_either_body)) != 0) {
+            return;
+        }
     }
 }
 
@@ -11,17 +11,45 @@
 #include "def.h"
 #include "unbound_variable.h"
 #include "print.h"
+#include "int_op.h"
+#include "string_op.h"
 
 #include "../core/core.h"
 
 struct dy_ast_to_core_ctx {
     size_t running_id;
+
+    /** The names in scope as a stack of struct dy_variable_replacement, innermost last. */
     dy_array_t variable_replacements;
+
+    /**
+     * Maps every symbol to its innermost binding: One plus its index in variable_replacements,
+     * or 0 if the symbol isn't bound. Grown on demand.
+     *
+     * Together with the 'shadowed' links in variable_replacements, this makes resolving
+     * a name a single array access, however deep the scope and however long the name.
+     */
+    dy_array_t innermost_replacements;
+
+    /**
+     * Number of names that were resolved to the n-th innermost binding in scope, indexed by n.
+     * Grown on demand.
+     */
+    dy_array_t num_lookups_per_level;
+
+    /** Number of names that were resolved to a builtin. */
+    size_t num_builtin_lookups;
+
+    /** Number of names that weren't bound at all. */
+    size_t num_unbound_lookups;
 };
 
 struct dy_variable_replacement {
-    dy_string_t variable;
+    size_t symbol;
     size_t replacement_id;
+
+    /** The previous value of ctx->innermost_replacements[symbol], restored when this goes out of scope. */
+    size_t shadowed;
 };
 
 enum dy_converted_map_either_body_tag {
@@ -52,13 +80,13 @@ static inline struct dy_core_expr dy_ast_juxtaposition_to_core(struct dy_ast_to_
 
 static inline struct dy_core_expr dy_ast_do_block_to_core(struct dy_ast_to_core_ctx *ctx, struct dy_ast_do_block do_block);
 
-static inline struct dy_core_expr dy_ast_variable_to_core(struct dy_ast_to_core_ctx *ctx, const dy_array_t *variable);
+static inline struct dy_core_expr dy_ast_variable_to_core(struct dy_ast_to_core_ctx *ctx, struct dy_ast_name variable);
 
 static inline struct dy_core_expr dy_ast_any_to_core(struct dy_ast_to_core_ctx *ctx);
 
 static inline struct dy_core_expr dy_ast_void_to_core(struct dy_ast_to_core_ctx *ctx);
 
-static inline struct dy_core_expr dy_ast_string_to_core(struct dy_ast_to_core_ctx *ctx, const dy_array_t *string);
+static inline struct dy_core_expr dy_ast_string_to_core(struct dy_ast_to_core_ctx *ctx, dy_string_t string);
 
 static inline struct dy_core_expr dy_ast_map_some_to_core(struct dy_ast_to_core_ctx *ctx, struct dy_ast_map_some map_some);
 
@@ -71,6 +99,12 @@ static inline struct dy_core_expr dy_construct_function(struct dy_ast_to_core_ct
 
 static inline struct dy_core_assumption dy_construct_bare_function(struct dy_ast_to_core_ctx *ctx, struct dy_ast_binding binding, struct dy_ast_expr expr, size_t *inference_id, bool *have_inference_id);
 
+/** Makes 'fun a : Int => fun b : Int => <op: a, b>'. */
+static inline struct dy_core_expr dy_make_int_op_function(struct dy_ast_to_core_ctx *ctx, enum dy_int_op op);
+
+/** Makes a curried function that passes its arguments on to 'op'. The first one is a string, any others are integers. */
+static inline struct dy_core_expr dy_make_string_op_function(struct dy_ast_to_core_ctx *ctx, enum dy_string_op op);
+
 static inline struct dy_core_expr dy_make_function_without_type(struct dy_ast_to_core_ctx *ctx, size_t id, struct dy_core_expr expr, bool is_implicit, enum dy_polarity polarity);
 
 static inline struct dy_core_expr dy_process_pattern(struct dy_ast_to_core_ctx *ctx, struct dy_core_expr pattern_expr, struct dy_ast_pattern pattern, struct dy_ast_expr final_expr);
@@ -103,6 +137,15 @@ static inline struct dy_core_expr dy_convert_list_body(struct dy_ast_to_core_ctx
 
 static inline struct dy_converted_map_either_body dy_convert_map_either_body(struct dy_ast_to_core_ctx *ctx, struct dy_ast_map_either_body body, bool is_implicit, dy_array_t *inference_ids);
 
+/** Brings 'name' into scope as the variable 'id', shadowing any outer binding of it. */
+static inline void dy_ast_to_core_push_name(struct dy_ast_to_core_ctx *ctx, struct dy_ast_name name, size_t id);
+
+/** Takes the innermost name out of scope again. */
+static inline void dy_ast_to_core_pop_name(struct dy_ast_to_core_ctx *ctx);
+
+/** Makes 'array' (of size_t) at least 'num_elems' long, filling it up with zeros. */
+static inline void dy_ast_to_core_grow_zeroed(dy_array_t *array, size_t num_elems);
+
 struct dy_core_expr dy_ast_expr_to_core(struct dy_ast_to_core_ctx *ctx, struct dy_ast_expr expr)
 {
     switch (expr.tag) {
@@ -119,18 +162,28 @@ struct dy_core_expr dy_ast_expr_to_core(struct dy_ast_to_core_ctx *ctx, struct d
     case DY_AST_EXPR_DO_BLOCK:
         return dy_ast_do_block_to_core(ctx, expr.do_block);
     case DY_AST_EXPR_VARIABLE:
-        return dy_ast_variable_to_core(ctx, &expr.variable);
+        return dy_ast_variable_to_core(ctx, expr.variable);
     case DY_AST_EXPR_ANY:
         return dy_ast_any_to_core(ctx);
     case DY_AST_EXPR_VOID:
         return dy_ast_void_to_core(ctx);
     case DY_AST_EXPR_STRING:
-        return dy_ast_string_to_core(ctx, &expr.string);
+        return dy_ast_string_to_core(ctx, expr.string);
     case DY_AST_EXPR_STRING_TYPE:
         return (struct dy_core_expr){
             .tag = DY_CORE_EXPR_CUSTOM,
             .custom = dy_string_type_create()
         };
+    case DY_AST_EXPR_INT:
+        return (struct dy_core_expr){
+            .tag = DY_CORE_EXPR_CUSTOM,
+            .custom = dy_int_create(expr.int_value)
+        };
+    case DY_AST_EXPR_INT_TYPE:
+        return (struct dy_core_expr){
+            .tag = DY_CORE_EXPR_CUSTOM,
+            .custom = dy_int_type_create()
+        };
     case DY_AST_EXPR_MAP_SOME:
         return dy_ast_map_some_to_core(ctx, expr.map_some);
     case DY_AST_EXPR_MAP_EITHER:
@@ -156,14 +209,11 @@ struct dy_core_expr dy_ast_recursion_to_core(struct dy_ast_to_core_ctx *ctx, str
 {
     size_t id = ctx->running_id++;
 
-    dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-        .variable = dy_array_view(&recursion.name),
-        .replacement_id = id
-    });
+    dy_ast_to_core_push_name(ctx, recursion.name, id);
 
     struct dy_core_expr e = dy_ast_expr_to_core(ctx, *recursion.expr);
 
-    ctx->variable_replacements.num_elems--;
+    dy_ast_to_core_pop_name(ctx);
 
     return (struct dy_core_expr){
         .tag = DY_CORE_EXPR_INTRO,
@@ -413,14 +463,11 @@ struct dy_core_expr dy_ast_do_block_to_core(struct dy_ast_to_core_ctx *ctx, stru
 
         size_t id = ctx->running_id++;
 
-        dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-            .variable = dy_array_view(&do_block.stmnt.def.name),
-            .replacement_id = id
-        });
+        dy_ast_to_core_push_name(ctx, do_block.stmnt.def.name, id);
 
         struct dy_core_expr body = dy_ast_do_block_to_core(ctx, *do_block.rest);
 
-        ctx->variable_replacements.num_elems--;
+        dy_ast_to_core_pop_name(ctx);
 
         struct dy_def_data d = {
             .arg = arg,
@@ -438,14 +485,18 @@ struct dy_core_expr dy_ast_do_block_to_core(struct dy_ast_to_core_ctx *ctx, stru
     dy_bail("impossible");
 }
 
-struct dy_core_expr dy_ast_variable_to_core(struct dy_ast_to_core_ctx *ctx, const dy_array_t *variable)
+struct dy_core_expr dy_ast_variable_to_core(struct dy_ast_to_core_ctx *ctx, struct dy_ast_name variable)
 {
-    dy_string_t s = dy_array_view(variable);
+    if (variable.symbol < ctx->innermost_replacements.num_elems) {
+        size_t index_plus_one = *(const size_t *)dy_array_pos(&ctx->innermost_replacements, variable.symbol);
+
+        if (index_plus_one != 0) {
+            const struct dy_variable_replacement *replacement = dy_array_pos(&ctx->variable_replacements, index_plus_one - 1);
 
-    for (size_t i = ctx->variable_replacements.num_elems; i-- > 0;) {
-        const struct dy_variable_replacement *replacement = dy_array_pos(&ctx->variable_replacements, i);
+            size_t level = ctx->variable_replacements.num_elems - index_plus_one;
+            dy_ast_to_core_grow_zeroed(&ctx->num_lookups_per_level, level + 1);
+            ++*(size_t *)dy_array_pos(&ctx->num_lookups_per_level, level);
 
-        if (dy_string_are_equal(replacement->variable, s)) {
             return (struct dy_core_expr){
                 .tag = DY_CORE_EXPR_VARIABLE,
                 .variable_id = replacement->replacement_id
@@ -453,7 +504,10 @@ struct dy_core_expr dy_ast_variable_to_core(struct dy_ast_to_core_ctx *ctx, cons
         }
     }
 
-    if (dy_string_are_equal(s, DY_STR_LIT("print"))) {
+    switch (variable.symbol) {
+    case DY_AST_BUILTIN_PRINT: {
+        ++ctx->num_builtin_lookups;
+
         size_t id = ctx->running_id++;
 
         return (struct dy_core_expr){
@@ -484,11 +538,30 @@ struct dy_core_expr dy_ast_variable_to_core(struct dy_ast_to_core_ctx *ctx, cons
             }
         };
     }
+    case DY_AST_BUILTIN_ADD:
+        ++ctx->num_builtin_lookups;
+        return dy_make_int_op_function(ctx, DY_INT_OP_ADD);
+    case DY_AST_BUILTIN_SUB:
+        ++ctx->num_builtin_lookups;
+        return dy_make_int_op_function(ctx, DY_INT_OP_SUB);
+    case DY_AST_BUILTIN_MUL:
+        ++ctx->num_builtin_lookups;
+        return dy_make_int_op_function(ctx, DY_INT_OP_MUL);
+    case DY_AST_BUILTIN_COMPARE:
+        ++ctx->num_builtin_lookups;
+        return dy_make_int_op_function(ctx, DY_INT_OP_COMPARE);
+    case DY_AST_BUILTIN_CONCAT:
+        ++ctx->num_builtin_lookups;
+        return dy_make_string_op_function(ctx, DY_STRING_OP_CONCAT);
+    case DY_AST_BUILTIN_SUBSTRING:
+        ++ctx->num_builtin_lookups;
+        return dy_make_string_op_function(ctx, DY_STRING_OP_SUBSTRING);
+    }
 
-    dy_array_retain(variable);
+    ++ctx->num_unbound_lookups;
 
     struct dy_uv_data d = {
-        .var = *variable
+        .var = dy_array_from_view(variable.text)
     };
 
     return (struct dy_core_expr){
@@ -511,17 +584,11 @@ struct dy_core_expr dy_ast_void_to_core(struct dy_ast_to_core_ctx *ctx)
     };
 }
 
-struct dy_core_expr dy_ast_string_to_core(struct dy_ast_to_core_ctx *ctx, const dy_array_t *string)
+struct dy_core_expr dy_ast_string_to_core(struct dy_ast_to_core_ctx *ctx, dy_string_t string)
 {
-    dy_array_retain(string);
-
-    struct dy_string_data d = {
-        .value = *string
-    };
-
     return (struct dy_core_expr){
         .tag = DY_CORE_EXPR_CUSTOM,
-        .custom = dy_string_create(d)
+        .custom = dy_string_create_from_view(string)
     };
 }
 
@@ -544,16 +611,13 @@ struct dy_core_expr dy_ast_map_some_to_core(struct dy_ast_to_core_ctx *ctx, stru
 
     size_t replacement_id = ctx->running_id++;
 
-    dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-        .variable = dy_array_view(&map_some.name),
-        .replacement_id = replacement_id
-    });
+    dy_ast_to_core_push_name(ctx, map_some.name, replacement_id);
 
     size_t inference_id2;
     bool have_inference_id2 = false;
     struct dy_core_assumption ass = dy_construct_bare_function(ctx, map_some.binding, *map_some.expr, &inference_id2, &have_inference_id2);
 
-    ctx->variable_replacements.num_elems--;
+    dy_ast_to_core_pop_name(ctx);
 
     struct dy_core_expr map = {
         .tag = DY_CORE_EXPR_MAP,
@@ -649,16 +713,13 @@ struct dy_core_expr dy_ast_map_fin_to_core(struct dy_ast_to_core_ctx *ctx, struc
 {
     size_t replacement_id = ctx->running_id++;
 
-    dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-        .variable = dy_array_view(&map_fin.name),
-        .replacement_id = replacement_id
-    });
+    dy_ast_to_core_push_name(ctx, map_fin.name, replacement_id);
 
     size_t inference_id;
     bool have_inference_id = false;
     struct dy_core_assumption ass = dy_construct_bare_function(ctx, map_fin.binding, *map_fin.expr, &inference_id, &have_inference_id);
 
-    ctx->variable_replacements.num_elems--;
+    dy_ast_to_core_pop_name(ctx);
 
     struct dy_core_expr map = {
         .tag = DY_CORE_EXPR_MAP,
@@ -696,16 +757,13 @@ struct dy_core_expr dy_construct_function(struct dy_ast_to_core_ctx *ctx, struct
         size_t id = ctx->running_id++;
 
         if (binding.have_name) {
-            dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-                .variable = dy_array_view(&binding.name),
-                .replacement_id = id
-            });
+            dy_ast_to_core_push_name(ctx, binding.name, id);
         }
 
         struct dy_core_expr e = dy_ast_expr_to_core(ctx, expr);
 
         if (binding.have_name) {
-            ctx->variable_replacements.num_elems--;
+            dy_ast_to_core_pop_name(ctx);
         }
 
         return dy_make_function_without_type(ctx, id, e, is_implicit, polarity);
@@ -716,16 +774,13 @@ struct dy_core_expr dy_construct_function(struct dy_ast_to_core_ctx *ctx, struct
         size_t id = ctx->running_id++;
 
         if (binding.have_name) {
-            dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-                .variable = dy_array_view(&binding.name),
-                .replacement_id = id
-            });
+            dy_ast_to_core_push_name(ctx, binding.name, id);
         }
 
         struct dy_core_expr e = dy_ast_expr_to_core(ctx, expr);
 
         if (binding.have_name) {
-            ctx->variable_replacements.num_elems--;
+            dy_ast_to_core_pop_name(ctx);
         }
 
         return (struct dy_core_expr){
@@ -749,10 +804,7 @@ struct dy_core_expr dy_construct_function(struct dy_ast_to_core_ctx *ctx, struct
         size_t id = ctx->running_id++;
 
         if (binding.have_name) {
-            dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-                .variable = dy_array_view(&binding.name),
-                .replacement_id = id
-            });
+            dy_ast_to_core_push_name(ctx, binding.name, id);
         }
 
         struct dy_core_expr id_expr = {
@@ -763,7 +815,7 @@ struct dy_core_expr dy_construct_function(struct dy_ast_to_core_ctx *ctx, struct
         struct dy_core_expr e = dy_process_pattern(ctx, id_expr, binding.pattern, expr);
 
         if (binding.have_name) {
-            ctx->variable_replacements.num_elems--;
+            dy_ast_to_core_pop_name(ctx);
         }
 
         return dy_make_function_without_type(ctx, id, e, is_implicit, polarity);
@@ -780,16 +832,13 @@ struct dy_core_assumption dy_construct_bare_function(struct dy_ast_to_core_ctx *
         size_t id = ctx->running_id++;
 
         if (binding.have_name) {
-            dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-                .variable = dy_array_view(&binding.name),
-                .replacement_id = id
-            });
+            dy_ast_to_core_push_name(ctx, binding.name, id);
         }
 
         struct dy_core_expr e = dy_ast_expr_to_core(ctx, expr);
 
         if (binding.have_name) {
-            ctx->variable_replacements.num_elems--;
+            dy_ast_to_core_pop_name(ctx);
         }
 
         *inference_id = ctx->running_id++;
@@ -810,16 +859,13 @@ struct dy_core_assumption dy_construct_bare_function(struct dy_ast_to_core_ctx *
         size_t id = ctx->running_id++;
 
         if (binding.have_name) {
-            dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-                .variable = dy_array_view(&binding.name),
-                .replacement_id = id
-            });
+            dy_ast_to_core_push_name(ctx, binding.name, id);
         }
 
         struct dy_core_expr e = dy_ast_expr_to_core(ctx, expr);
 
         if (binding.have_name) {
-            ctx->variable_replacements.num_elems--;
+            dy_ast_to_core_pop_name(ctx);
         }
 
         *have_inference_id = false;
@@ -834,10 +880,7 @@ struct dy_core_assumption dy_construct_bare_function(struct dy_ast_to_core_ctx *
         size_t id = ctx->running_id++;
 
         if (binding.have_name) {
-            dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
-                .variable = dy_array_view(&binding.name),
-                .replacement_id = id
-            });
+            dy_ast_to_core_push_name(ctx, binding.name, id);
         }
 
         struct dy_core_expr id_expr = {
@@ -848,7 +891,7 @@ struct dy_core_assumption dy_construct_bare_function(struct dy_ast_to_core_ctx *
         struct dy_core_expr e = dy_process_pattern(ctx, id_expr, binding.pattern, expr);
 
         if (binding.have_name) {
-            ctx->variable_replacements.num_elems--;
+            dy_ast_to_core_pop_name(ctx);
         }
 
         *inference_id = ctx->running_id++;
@@ -868,6 +911,120 @@ struct dy_core_assumption dy_construct_bare_function(struct dy_ast_to_core_ctx *
     dy_bail("impossible");
 }
 
+struct dy_core_expr dy_make_int_op_function(struct dy_ast_to_core_ctx *ctx, enum dy_int_op op)
+{
+    size_t left_id = ctx->running_id++;
+    size_t right_id = ctx->running_id++;
+
+    struct dy_core_expr int_type = {
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_int_type_create()
+    };
+
+    struct dy_core_expr body = {
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_int_op_create((struct dy_int_op_data){
+            .op = op,
+            .left = {
+                .tag = DY_CORE_EXPR_VARIABLE,
+                .variable_id = left_id
+            },
+            .right = {
+                .tag = DY_CORE_EXPR_VARIABLE,
+                .variable_id = right_id
+            }
+        })
+    };
+
+    struct dy_core_expr inner = {
+        .tag = DY_CORE_EXPR_INTRO,
+        .intro = {
+            .polarity = DY_POLARITY_POSITIVE,
+            .is_implicit = false,
+            .tag = DY_CORE_INTRO_COMPLEX,
+            .complex = {
+                .tag = DY_CORE_COMPLEX_ASSUMPTION,
+                .assumption = {
+                    .id = right_id,
+                    .type = dy_core_expr_new(int_type),
+                    .expr = dy_core_expr_new(body)
+                }
+            }
+        }
+    };
+
+    return (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_INTRO,
+        .intro = {
+            .polarity = DY_POLARITY_POSITIVE,
+            .is_implicit = false,
+            .tag = DY_CORE_INTRO_COMPLEX,
+            .complex = {
+                .tag = DY_CORE_COMPLEX_ASSUMPTION,
+                .assumption = {
+                    .id = left_id,
+                    .type = dy_core_expr_new(int_type),
+                    .expr = dy_core_expr_new(inner)
+                }
+            }
+        }
+    };
+}
+
+struct dy_core_expr dy_make_string_op_function(struct dy_ast_to_core_ctx *ctx, enum dy_string_op op)
+{
+    size_t arity = dy_string_op_arity(op);
+
+    struct dy_string_op_data data = { .op = op };
+    struct dy_core_expr types[DY_STRING_OP_MAX_ARITY];
+
+    for (size_t i = 0; i < arity; ++i) {
+        data.args[i] = (struct dy_core_expr){
+            .tag = DY_CORE_EXPR_VARIABLE,
+            .variable_id = ctx->running_id++
+        };
+
+        if (i == 0 || op == DY_STRING_OP_CONCAT) {
+            types[i] = (struct dy_core_expr){
+                .tag = DY_CORE_EXPR_CUSTOM,
+                .custom = dy_string_type_create()
+            };
+        } else {
+            types[i] = (struct dy_core_expr){
+                .tag = DY_CORE_EXPR_CUSTOM,
+                .custom = dy_int_type_create()
+            };
+        }
+    }
+
+    struct dy_core_expr fun = {
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_string_op_create(data)
+    };
+
+    // Wrap the operation into one function per argument, innermost first.
+    for (size_t i = arity; i-- > 0;) {
+        fun = (struct dy_core_expr){
+            .tag = DY_CORE_EXPR_INTRO,
+            .intro = {
+                .polarity = DY_POLARITY_POSITIVE,
+                .is_implicit = false,
+                .tag = DY_CORE_INTRO_COMPLEX,
+                .complex = {
+                    .tag = DY_CORE_COMPLEX_ASSUMPTION,
+                    .assumption = {
+                        .id = data.args[i].variable_id,
+                        .type = dy_core_expr_new(types[i]),
+                        .expr = dy_core_expr_new(fun)
+                    }
+                }
+            }
+        };
+    }
+
+    return fun;
+}
+
 struct dy_core_expr dy_make_function_without_type(struct dy_ast_to_core_ctx *ctx, size_t id, struct dy_core_expr expr, bool is_implicit, enum dy_polarity polarity)
 {
     size_t inference_id = ctx->running_id++;
@@ -1339,3 +1496,39 @@ struct dy_converted_map_either_body dy_convert_map_either_body(struct dy_ast_to_
         }
     };
 }
+
+void dy_ast_to_core_push_name(struct dy_ast_to_core_ctx *ctx, struct dy_ast_name name, size_t id)
+{
+    dy_ast_to_core_grow_zeroed(&ctx->innermost_replacements, name.symbol + 1);
+
+    size_t *innermost = dy_array_pos(&ctx->innermost_replacements, name.symbol);
+
+    size_t index = dy_array_add(&ctx->variable_replacements, &(struct dy_variable_replacement){
+        .symbol = name.symbol,
+        .replacement_id = id,
+        .shadowed = *innermost
+    });
+
+    *innermost = index + 1;
+}
+
+void dy_ast_to_core_pop_name(struct dy_ast_to_core_ctx *ctx)
+{
+    struct dy_variable_replacement replacement;
+    dy_array_pop(&ctx->variable_replacements, &replacement);
+
+    *(size_t *)dy_array_pos(&ctx->innermost_replacements, replacement.symbol) = replacement.shadowed;
+}
+
+void dy_ast_to_core_grow_zeroed(dy_array_t *array, size_t num_elems)
+{
+    if (array->num_elems >= num_elems) {
+        return;
+    }
+
+    size_t added = num_elems - array->num_elems;
+
+    dy_array_set_excess_capacity(array, added);
+    memset(dy_array_excess_buffer(array), 0, added * array->elem_size);
+    dy_array_add_to_size(array, added);
+}
@@ -8,6 +8,8 @@
 
 #include "../core/check.h"
 #include "../core/eval.h"
+#include "../core/check_memo.h"
+#include "../core/serialize.h"
 
 static size_t dy_def_id;
 
@@ -41,7 +43,11 @@ static void *dy_def_retain(struct dy_core_ctx *ctx, void *data);
 
 static void dy_def_release(struct dy_core_ctx *ctx, void *data);
 
-static void dy_def_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string);
+static void dy_def_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer);
+
+static void dy_def_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s);
+
+static bool dy_def_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result);
 
 static inline struct dy_core_custom dy_def_create(struct dy_def_data data);
 
@@ -61,7 +67,9 @@ static inline void dy_def_register(dy_array_t *reg)
         .variable_appears_in_polarity = dy_def_variable_appears_in_polarity,
         .retain = dy_def_retain,
         .release = dy_def_release,
-        .to_string = dy_def_to_string
+        .to_string = dy_def_to_string,
+        .serialize = dy_def_serialize,
+        .deserialize = dy_def_deserialize
     };
 
     dy_def_id = dy_array_add(reg, &s);
@@ -74,10 +82,16 @@ struct dy_core_custom dy_def_create(struct dy_def_data data)
 
 struct dy_core_custom dy_def_create_no_alloc(struct dy_def_data *data)
 {
-    return (struct dy_core_custom){
+    struct dy_core_custom custom = {
         .id = dy_def_id,
-        .data = data
+        .data = data,
+        .has_id_range = true
     };
+
+    dy_core_expr_id_range(data->arg, &custom.min_id, &custom.max_id);
+    dy_core_id_range_add(data->body, &custom.min_id, &custom.max_id);
+
+    return custom;
 }
 
 struct dy_core_expr dy_def_type_of(struct dy_core_ctx *ctx, void *data)
@@ -98,26 +112,61 @@ struct dy_core_expr dy_def_type_of(struct dy_core_ctx *ctx, void *data)
 
 dy_ternary_t dy_def_is_equal(struct dy_core_ctx *ctx, void *data1, void *data2)
 {
-    return DY_MAYBE;
+    const struct dy_def_data *def1 = data1;
+    const struct dy_def_data *def2 = data2;
+
+    if (dy_are_equal(ctx, def1->arg, def2->arg) != DY_YES) {
+        return DY_MAYBE;
+    }
+
+    dy_equal_variables_push(ctx, def1->id, def2->id);
+
+    dy_ternary_t result = dy_are_equal(ctx, def1->body, def2->body);
+
+    dy_equal_variables_pop(ctx);
+
+    return result == DY_YES ? DY_YES : DY_MAYBE;
 }
 
 bool dy_def_check(struct dy_core_ctx *ctx, void *data, struct dy_core_expr *result)
 {
     const struct dy_def_data *def = data;
 
-    size_t constraint_start1 = ctx->constraints.num_elems;
-    struct dy_core_expr new_arg;
-    if (!dy_check_expr(ctx, def->arg, &new_arg)) {
-        new_arg = dy_core_expr_retain(ctx, def->arg);
+    // Top-level statements are mostly definitions, so checking can be cancelled between them.
+    if (dy_check_is_cancelled(ctx)) {
+        return false;
     }
 
+    DY_STATS_SPAN_BEGIN("check def", def->id);
+
+    size_t constraint_start1 = ctx->constraints.num_elems;
+
     bool arg_is_value = false;
     struct dy_core_expr evaled_arg;
-    if (!dy_eval_expr(ctx, new_arg, &arg_is_value, &evaled_arg)) {
-        evaled_arg = dy_core_expr_retain(ctx, new_arg);
-    }
+    struct dy_core_check_memo_frame memo_frame = { 0 };
+    if (!dy_check_memo_lookup(ctx, def->arg, &memo_frame, &evaled_arg, &arg_is_value)) {
+        struct dy_core_expr new_arg;
+        if (!dy_check_expr(ctx, def->arg, &new_arg)) {
+            new_arg = dy_core_expr_retain(ctx, def->arg);
+        }
+
+        if (ctx->check_is_cancelled) {
+            // Neither evaluate nor memoize what's only partially checked.
+            dy_core_expr_release(ctx, new_arg);
+
+            DY_STATS_SPAN_END("check def", def->id);
+
+            return false;
+        }
+
+        if (!dy_eval_expr(ctx, new_arg, &arg_is_value, &evaled_arg)) {
+            evaled_arg = dy_core_expr_retain(ctx, new_arg);
+        }
 
-    dy_core_expr_release(ctx, new_arg);
+        dy_core_expr_release(ctx, new_arg);
+
+        dy_check_memo_insert(ctx, &memo_frame, evaled_arg, arg_is_value);
+    }
 
     if (arg_is_value) {
         struct dy_core_expr new_body;
@@ -138,6 +187,8 @@ bool dy_def_check(struct dy_core_ctx *ctx, void *data, struct dy_core_expr *resu
 
         *result = new_body;
 
+        DY_STATS_SPAN_END("check def", def->id);
+
         return true;
     } else {
         struct dy_core_expr type_of_arg = dy_type_of(ctx, evaled_arg);
@@ -170,6 +221,8 @@ bool dy_def_check(struct dy_core_ctx *ctx, void *data, struct dy_core_expr *resu
             .custom = dy_def_create(new_data)
         };
 
+        DY_STATS_SPAN_END("check def", def->id);
+
         return true;
     }
 }
@@ -190,6 +243,8 @@ bool dy_def_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_
 {
     const struct dy_def_data *def = data;
 
+    DY_STATS_SPAN_BEGIN("eval def", def->id);
+
     bool arg_is_value = false;
     struct dy_core_expr evaled_arg;
     if (!dy_eval_expr(ctx, def->arg, &arg_is_value, &evaled_arg)) {
@@ -197,6 +252,9 @@ bool dy_def_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_
     }
 
     if (!arg_is_value) {
+        // Stuck on the argument, so neither is the result a value.
+        *is_value = false;
+
         struct dy_def_data new_data = {
             .id = def->id,
             .arg = evaled_arg,
@@ -208,6 +266,8 @@ bool dy_def_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_
             .custom = dy_def_create(new_data)
         };
 
+        DY_STATS_SPAN_END("eval def", def->id);
+
         return true;
     }
 
@@ -222,6 +282,8 @@ bool dy_def_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_
 
     dy_core_expr_release(ctx, new_body);
 
+    DY_STATS_SPAN_END("eval def", def->id);
+
     return ret;
 }
 
@@ -315,22 +377,47 @@ void *dy_def_retain(struct dy_core_ctx *ctx, void *data)
 
 void dy_def_release(struct dy_core_ctx *ctx, void *data)
 {
-    const struct dy_def_data *d = data;
+    struct dy_def_data d = *(struct dy_def_data *)data;
 
     if (dy_rc_release(data, dy_def_data_align) == 0) {
-        dy_core_expr_release(ctx, d->arg);
-        dy_core_expr_release(ctx, d->body);
+        dy_core_expr_release(ctx, d.arg);
+        dy_core_expr_release(ctx, d.body);
     }
 }
 
-void dy_def_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string)
+void dy_def_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer)
 {
     const struct dy_def_data *d = data;
 
-    add_string(string, DY_STR_LIT("def "));
-    add_size_t_decimal(string, d->id);
-    add_string(string, DY_STR_LIT(" = "));
-    dy_core_expr_to_string(ctx, d->arg, string);
-    add_string(string, DY_STR_LIT("\n"));
-    dy_core_expr_to_string(ctx, d->body, string);
+    dy_write(writer, DY_STR_LIT("def "));
+    dy_write_size_t_decimal(writer, d->id);
+    dy_write(writer, DY_STR_LIT(" = "));
+    dy_core_expr_to_string(ctx, d->arg, writer);
+    dy_write(writer, DY_STR_LIT("\n"));
+    dy_core_expr_to_string(ctx, d->body, writer);
+}
+
+void dy_def_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s)
+{
+    const struct dy_def_data *def = data;
+
+    dy_serialize_size_t(s, def->id);
+    dy_serialize_expr(ctx, s, def->arg);
+    dy_serialize_expr(ctx, s, def->body);
+}
+
+bool dy_def_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result)
+{
+    struct dy_def_data def;
+    if (!dy_deserialize_size_t(d, &def.id) || !dy_deserialize_expr(ctx, d, &def.arg)) {
+        return false;
+    }
+
+    if (!dy_deserialize_expr(ctx, d, &def.body)) {
+        dy_core_expr_release(ctx, def.arg);
+        return false;
+    }
+
+    *result = dy_def_create(def);
+    return true;
 }
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "../core/core.h"
+#include "../core/serialize.h"
+#include "int_type.h"
+
+#include <stdint.h>
+
+/**
+ * Native integers, of the width of a pointer.
+ *
+ * The value is stored unboxed in the data pointer of the custom itself,
+ * so integers don't allocate, retaining and releasing them is free and
+ * hash-consing identifies equal integers. Arithmetic on them is in int_op.h.
+ */
+
+static size_t dy_int_id;
+
+static struct dy_core_expr dy_int_type_of(struct dy_core_ctx *ctx, void *data);
+
+static dy_ternary_t dy_int_is_equal(struct dy_core_ctx *ctx, void *data1, void *data2);
+
+static bool dy_int_check(struct dy_core_ctx *ctx, void *data, struct dy_core_expr *result);
+
+static bool dy_int_remove_mentions_in_type(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, struct dy_core_expr *result);
+
+static bool dy_int_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_core_expr *result);
+
+static bool dy_int_substitute(struct dy_core_ctx *ctx, void *data, size_t id, struct dy_core_expr sub, struct dy_core_expr *result);
+
+static dy_ternary_t dy_int_is_subtype(struct dy_core_ctx *ctx, void *subtype, void *supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr);
+
+static bool dy_int_contains_this_variable(struct dy_core_ctx *ctx, void *data, size_t id);
+
+static void dy_int_variable_appears_in_polarity(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, bool *positive, bool *negative);
+
+static void *dy_int_retain(struct dy_core_ctx *ctx, void *data);
+
+static void dy_int_release(struct dy_core_ctx *ctx, void *data);
+
+static void dy_int_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer);
+
+static void dy_int_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s);
+
+static bool dy_int_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result);
+
+static inline struct dy_core_custom dy_int_create(intptr_t value);
+
+/** Whether 'expr' is an integer, and if so, which. */
+static inline bool dy_int_get(struct dy_core_expr expr, intptr_t *value);
+
+static inline void dy_int_register(dy_array_t *reg)
+{
+    struct dy_core_custom_shared s = {
+        .type_of = dy_int_type_of,
+        .is_equal = dy_int_is_equal,
+        .check = dy_int_check,
+        .remove_mentions_in_type = dy_int_remove_mentions_in_type,
+        .eval = dy_int_eval,
+        .substitute = dy_int_substitute,
+        .is_subtype = dy_int_is_subtype,
+        .contains_this_variable = dy_int_contains_this_variable,
+        .variable_appears_in_polarity = dy_int_variable_appears_in_polarity,
+        .retain = dy_int_retain,
+        .release = dy_int_release,
+        .to_string = dy_int_to_string,
+        .serialize = dy_int_serialize,
+        .deserialize = dy_int_deserialize
+    };
+
+    dy_int_id = dy_array_add(reg, &s);
+}
+
+struct dy_core_custom dy_int_create(intptr_t value)
+{
+    return (struct dy_core_custom){
+        .id = dy_int_id,
+        .data = (void *)value,
+        .min_id = SIZE_MAX,
+        .max_id = 0,
+        .has_id_range = true
+    };
+}
+
+bool dy_int_get(struct dy_core_expr expr, intptr_t *value)
+{
+    if (expr.tag != DY_CORE_EXPR_CUSTOM || expr.custom.id != dy_int_id) {
+        return false;
+    }
+
+    *value = (intptr_t)expr.custom.data;
+    return true;
+}
+
+struct dy_core_expr dy_int_type_of(struct dy_core_ctx *ctx, void *data)
+{
+    return (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_int_type_create()
+    };
+}
+
+dy_ternary_t dy_int_is_equal(struct dy_core_ctx *ctx, void *data1, void *data2)
+{
+    if (data1 == data2) {
+        return DY_YES;
+    } else {
+        return DY_NO;
+    }
+}
+
+bool dy_int_check(struct dy_core_ctx *ctx, void *data, struct dy_core_expr *result)
+{
+    return false;
+}
+
+bool dy_int_remove_mentions_in_type(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, struct dy_core_expr *result)
+{
+    return false;
+}
+
+bool dy_int_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_core_expr *result)
+{
+    *is_value = true;
+    return false;
+}
+
+bool dy_int_substitute(struct dy_core_ctx *ctx, void *data, size_t id, struct dy_core_expr sub, struct dy_core_expr *result)
+{
+    return false;
+}
+
+dy_ternary_t dy_int_is_subtype(struct dy_core_ctx *ctx, void *subtype, void *supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr)
+{
+    return dy_int_is_equal(ctx, subtype, supertype);
+}
+
+bool dy_int_contains_this_variable(struct dy_core_ctx *ctx, void *data, size_t id)
+{
+    return false;
+}
+
+void dy_int_variable_appears_in_polarity(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, bool *positive, bool *negative)
+{
+}
+
+void *dy_int_retain(struct dy_core_ctx *ctx, void *data)
+{
+    return data;
+}
+
+void dy_int_release(struct dy_core_ctx *ctx, void *data)
+{
+}
+
+void dy_int_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer)
+{
+    intptr_t value = (intptr_t)data;
+
+    // Literals always carry a sign, see dy_utf8_to_ast_int().
+    if (value < 0) {
+        dy_write(writer, DY_STR_LIT("-"));
+        // Negating in unsigned arithmetic also works for the most negative value.
+        dy_write_size_t_decimal(writer, (size_t)0 - (size_t)value);
+    } else {
+        dy_write(writer, DY_STR_LIT("+"));
+        dy_write_size_t_decimal(writer, (size_t)value);
+    }
+}
+
+void dy_int_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s)
+{
+    intptr_t value = (intptr_t)data;
+
+    // Zigzag-encoded, so that small negative values stay short.
+    size_t bits = (size_t)value << 1;
+    dy_serialize_size_t(s, value < 0 ? ~bits : bits);
+}
+
+bool dy_int_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result)
+{
+    size_t bits;
+    if (!dy_deserialize_size_t(d, &bits)) {
+        return false;
+    }
+
+    *result = dy_int_create((bits & 1) != 0 ? (intptr_t)~(bits >> 1) : (intptr_t)(bits >> 1));
+    return true;
+}
@@ -0,0 +1,403 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "../core/check.h"
+#include "../core/eval.h"
+#include "../core/serialize.h"
+#include "../support/overflow.h"
+
+#include "int.h"
+
+/**
+ * Primitive arithmetic on native integers (see int.h).
+ *
+ * Once both operands have evaluated to integers, the result is computed directly
+ * on the unboxed values. An operation that would overflow doesn't evaluate any further.
+ *
+ * 'compare' evaluates to -1, 0 or +1, depending on whether the left operand
+ * is less than, equal to or greater than the right one.
+ */
+
+static size_t dy_int_op_id;
+
+enum dy_int_op {
+    DY_INT_OP_ADD,
+    DY_INT_OP_SUB,
+    DY_INT_OP_MUL,
+    DY_INT_OP_COMPARE
+};
+
+struct dy_int_op_data {
+    enum dy_int_op op;
+    struct dy_core_expr left;
+    struct dy_core_expr right;
+};
+
+static const size_t dy_int_op_data_align = DY_ALIGNOF(struct dy_int_op_data);
+
+static struct dy_core_expr dy_int_op_type_of(struct dy_core_ctx *ctx, void *data);
+
+static dy_ternary_t dy_int_op_is_equal(struct dy_core_ctx *ctx, void *data1, void *data2);
+
+static bool dy_int_op_check(struct dy_core_ctx *ctx, void *data, struct dy_core_expr *result);
+
+static bool dy_int_op_remove_mentions_in_type(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, struct dy_core_expr *result);
+
+static bool dy_int_op_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_core_expr *result);
+
+static bool dy_int_op_substitute(struct dy_core_ctx *ctx, void *data, size_t id, struct dy_core_expr sub, struct dy_core_expr *result);
+
+static dy_ternary_t dy_int_op_is_subtype(struct dy_core_ctx *ctx, void *subtype, void *supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr);
+
+static bool dy_int_op_contains_this_variable(struct dy_core_ctx *ctx, void *data, size_t id);
+
+static void dy_int_op_variable_appears_in_polarity(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, bool *positive, bool *negative);
+
+static void *dy_int_op_retain(struct dy_core_ctx *ctx, void *data);
+
+static void dy_int_op_release(struct dy_core_ctx *ctx, void *data);
+
+static void dy_int_op_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer);
+
+static void dy_int_op_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s);
+
+static bool dy_int_op_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result);
+
+static inline struct dy_core_custom dy_int_op_create(struct dy_int_op_data data);
+
+static inline struct dy_core_custom dy_int_op_create_no_alloc(struct dy_int_op_data *data);
+
+/** Returns false if the result doesn't fit into an integer. */
+static inline bool dy_int_op_compute(enum dy_int_op op, intptr_t left, intptr_t right, intptr_t *result);
+
+static inline dy_string_t dy_int_op_name(enum dy_int_op op);
+
+static inline void dy_int_op_register(dy_array_t *reg)
+{
+    struct dy_core_custom_shared s = {
+        .type_of = dy_int_op_type_of,
+        .is_equal = dy_int_op_is_equal,
+        .check = dy_int_op_check,
+        .remove_mentions_in_type = dy_int_op_remove_mentions_in_type,
+        .eval = dy_int_op_eval,
+        .substitute = dy_int_op_substitute,
+        .is_subtype = dy_int_op_is_subtype,
+        .contains_this_variable = dy_int_op_contains_this_variable,
+        .variable_appears_in_polarity = dy_int_op_variable_appears_in_polarity,
+        .retain = dy_int_op_retain,
+        .release = dy_int_op_release,
+        .to_string = dy_int_op_to_string,
+        .serialize = dy_int_op_serialize,
+        .deserialize = dy_int_op_deserialize
+    };
+
+    dy_int_op_id = dy_array_add(reg, &s);
+}
+
+struct dy_core_custom dy_int_op_create(struct dy_int_op_data data)
+{
+    return dy_int_op_create_no_alloc(dy_rc_new(&data, sizeof data, dy_int_op_data_align));
+}
+
+struct dy_core_custom dy_int_op_create_no_alloc(struct dy_int_op_data *data)
+{
+    struct dy_core_custom custom = {
+        .id = dy_int_op_id,
+        .data = data,
+        .has_id_range = true
+    };
+
+    dy_core_expr_id_range(data->left, &custom.min_id, &custom.max_id);
+    dy_core_id_range_add(data->right, &custom.min_id, &custom.max_id);
+
+    return custom;
+}
+
+struct dy_core_expr dy_int_op_type_of(struct dy_core_ctx *ctx, void *data)
+{
+    return (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_int_type_create()
+    };
+}
+
+dy_ternary_t dy_int_op_is_equal(struct dy_core_ctx *ctx, void *data1, void *data2)
+{
+    const struct dy_int_op_data *d1 = data1;
+    const struct dy_int_op_data *d2 = data2;
+
+    if (d1->op != d2->op) {
+        return DY_MAYBE;
+    }
+
+    if (dy_are_equal(ctx, d1->left, d2->left) == DY_YES && dy_are_equal(ctx, d1->right, d2->right) == DY_YES) {
+        return DY_YES;
+    } else {
+        return DY_MAYBE;
+    }
+}
+
+bool dy_int_op_check(struct dy_core_ctx *ctx, void *data, struct dy_core_expr *result)
+{
+    const struct dy_int_op_data *d = data;
+
+    size_t constraint_start1 = ctx->constraints.num_elems;
+
+    struct dy_core_expr left;
+    bool left_is_new = dy_check_expr(ctx, d->left, &left);
+
+    size_t constraint_start2 = ctx->constraints.num_elems;
+
+    struct dy_core_expr right;
+    bool right_is_new = dy_check_expr(ctx, d->right, &right);
+
+    dy_join_constraints(ctx, constraint_start1, constraint_start2);
+
+    if (!left_is_new && !right_is_new) {
+        return false;
+    }
+
+    if (!left_is_new) {
+        left = dy_core_expr_retain(ctx, d->left);
+    }
+
+    if (!right_is_new) {
+        right = dy_core_expr_retain(ctx, d->right);
+    }
+
+    struct dy_int_op_data new_data = {
+        .op = d->op,
+        .left = left,
+        .right = right
+    };
+
+    *result = (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_int_op_create(new_data)
+    };
+
+    return true;
+}
+
+bool dy_int_op_remove_mentions_in_type(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, struct dy_core_expr *result)
+{
+    if (dy_int_op_contains_this_variable(ctx, data, id)) {
+        *result = (struct dy_core_expr){
+            .tag = DY_CORE_EXPR_ANY
+        };
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool dy_int_op_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_core_expr *result)
+{
+    const struct dy_int_op_data *d = data;
+
+    bool left_is_value = false;
+    struct dy_core_expr left;
+    bool left_is_new = dy_eval_expr(ctx, d->left, &left_is_value, &left);
+    if (!left_is_new) {
+        left = dy_core_expr_retain(ctx, d->left);
+    }
+
+    bool right_is_value = false;
+    struct dy_core_expr right;
+    bool right_is_new = dy_eval_expr(ctx, d->right, &right_is_value, &right);
+    if (!right_is_new) {
+        right = dy_core_expr_retain(ctx, d->right);
+    }
+
+    intptr_t left_value, right_value, value;
+    if (dy_int_get(left, &left_value) && dy_int_get(right, &right_value) && dy_int_op_compute(d->op, left_value, right_value, &value)) {
+        dy_core_expr_release(ctx, left);
+        dy_core_expr_release(ctx, right);
+
+        *is_value = true;
+        *result = (struct dy_core_expr){
+            .tag = DY_CORE_EXPR_CUSTOM,
+            .custom = dy_int_create(value)
+        };
+
+        return true;
+    }
+
+    *is_value = false;
+
+    if (!left_is_new && !right_is_new) {
+        dy_core_expr_release(ctx, left);
+        dy_core_expr_release(ctx, right);
+        return false;
+    }
+
+    struct dy_int_op_data new_data = {
+        .op = d->op,
+        .left = left,
+        .right = right
+    };
+
+    *result = (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_int_op_create(new_data)
+    };
+
+    return true;
+}
+
+bool dy_int_op_substitute(struct dy_core_ctx *ctx, void *data, size_t id, struct dy_core_expr sub, struct dy_core_expr *result)
+{
+    const struct dy_int_op_data *d = data;
+
+    struct dy_core_expr left;
+    bool left_is_new = dy_substitute(ctx, d->left, id, sub, &left);
+
+    struct dy_core_expr right;
+    bool right_is_new = dy_substitute(ctx, d->right, id, sub, &right);
+
+    if (!left_is_new && !right_is_new) {
+        return false;
+    }
+
+    if (!left_is_new) {
+        left = dy_core_expr_retain(ctx, d->left);
+    }
+
+    if (!right_is_new) {
+        right = dy_core_expr_retain(ctx, d->right);
+    }
+
+    struct dy_int_op_data new_data = {
+        .op = d->op,
+        .left = left,
+        .right = right
+    };
+
+    *result = (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_int_op_create(new_data)
+    };
+
+    return true;
+}
+
+dy_ternary_t dy_int_op_is_subtype(struct dy_core_ctx *ctx, void *subtype, void *supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr)
+{
+    return DY_MAYBE;
+}
+
+bool dy_int_op_contains_this_variable(struct dy_core_ctx *ctx, void *data, size_t id)
+{
+    const struct dy_int_op_data *d = data;
+    return dy_core_expr_contains_this_variable(ctx, id, d->left) || dy_core_expr_contains_this_variable(ctx, id, d->right);
+}
+
+void dy_int_op_variable_appears_in_polarity(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, bool *positive, bool *negative)
+{
+}
+
+void *dy_int_op_retain(struct dy_core_ctx *ctx, void *data)
+{
+    return dy_rc_retain(data, dy_int_op_data_align);
+}
+
+void dy_int_op_release(struct dy_core_ctx *ctx, void *data)
+{
+    struct dy_int_op_data d = *(struct dy_int_op_data *)data;
+
+    if (dy_rc_release(data, dy_int_op_data_align) == 0) {
+        dy_core_expr_release(ctx, d.left);
+        dy_core_expr_release(ctx, d.right);
+    }
+}
+
+void dy_int_op_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer)
+{
+    const struct dy_int_op_data *d = data;
+
+    dy_write(writer, DY_STR_LIT("<"));
+    dy_write(writer, dy_int_op_name(d->op));
+    dy_write(writer, DY_STR_LIT(": "));
+    dy_core_expr_to_string(ctx, d->left, writer);
+    dy_write(writer, DY_STR_LIT(", "));
+    dy_core_expr_to_string(ctx, d->right, writer);
+    dy_write(writer, DY_STR_LIT(">"));
+}
+
+void dy_int_op_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s)
+{
+    const struct dy_int_op_data *d = data;
+
+    dy_serialize_size_t(s, d->op);
+    dy_serialize_expr(ctx, s, d->left);
+    dy_serialize_expr(ctx, s, d->right);
+}
+
+bool dy_int_op_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result)
+{
+    size_t op;
+    struct dy_int_op_data data;
+    if (!dy_deserialize_bounded(d, DY_INT_OP_COMPARE + 1, &op) || !dy_deserialize_expr(ctx, d, &data.left)) {
+        return false;
+    }
+
+    if (!dy_deserialize_expr(ctx, d, &data.right)) {
+        dy_core_expr_release(ctx, data.left);
+        return false;
+    }
+
+    data.op = (enum dy_int_op)op;
+
+    *result = dy_int_op_create(data);
+    return true;
+}
+
+bool dy_int_op_compute(enum dy_int_op op, intptr_t left, intptr_t right, intptr_t *result)
+{
+    intmax_t value = 0;
+    bool overflow = false;
+
+    switch (op) {
+    case DY_INT_OP_ADD:
+        overflow = dy_intmax_t_add_overflow(left, right, &value);
+        break;
+    case DY_INT_OP_SUB:
+        overflow = dy_intmax_t_sub_overflow(left, right, &value);
+        break;
+    case DY_INT_OP_MUL:
+        overflow = dy_intmax_t_mul_overflow(left, right, &value);
+        break;
+    case DY_INT_OP_COMPARE:
+        value = (left > right) - (left < right);
+        break;
+    }
+
+    // intmax_t may be wider than a pointer.
+    if (overflow || value < INTPTR_MIN || value > INTPTR_MAX) {
+        return false;
+    }
+
+    *result = (intptr_t)value;
+    return true;
+}
+
+dy_string_t dy_int_op_name(enum dy_int_op op)
+{
+    switch (op) {
+    case DY_INT_OP_ADD:
+        return DY_STR_LIT("add");
+    case DY_INT_OP_SUB:
+        return DY_STR_LIT("sub");
+    case DY_INT_OP_MUL:
+        return DY_STR_LIT("mul");
+    case DY_INT_OP_COMPARE:
+        return DY_STR_LIT("compare");
+    }
+
+    dy_bail("impossible");
+}
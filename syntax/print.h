@@ -8,6 +8,7 @@
 
 #include "../core/core.h"
 #include "../core/check.h"
+#include "../core/serialize.h"
 
 #include "string.h"
 
@@ -39,7 +40,11 @@ static void *dy_print_retain(struct dy_core_ctx *ctx, void *data);
 
 static void dy_print_release(struct dy_core_ctx *ctx, void *data);
 
-static void dy_print_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string);
+static void dy_print_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer);
+
+static void dy_print_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s);
+
+static bool dy_print_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result);
 
 static inline struct dy_core_custom dy_print_create(struct dy_print_data data);
 
@@ -59,7 +64,9 @@ static inline void dy_print_register(dy_array_t *reg)
         .variable_appears_in_polarity = dy_print_variable_appears_in_polarity,
         .retain = dy_print_retain,
         .release = dy_print_release,
-        .to_string = dy_print_to_string
+        .to_string = dy_print_to_string,
+        .serialize = dy_print_serialize,
+        .deserialize = dy_print_deserialize
     };
 
     dy_print_id = dy_array_add(reg, &s);
@@ -72,10 +79,15 @@ struct dy_core_custom dy_print_create(struct dy_print_data data)
 
 struct dy_core_custom dy_print_create_no_alloc(struct dy_print_data *data)
 {
-    return (struct dy_core_custom){
+    struct dy_core_custom custom = {
         .id = dy_print_id,
-        .data = data
+        .data = data,
+        .has_id_range = true
     };
+
+    dy_core_expr_id_range(data->expr, &custom.min_id, &custom.max_id);
+
+    return custom;
 }
 
 struct dy_core_expr dy_print_type_of(struct dy_core_ctx *ctx, void *data)
@@ -104,16 +116,18 @@ bool dy_print_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct d
 {
     const struct dy_print_data *d = data;
 
-    if (d->expr.tag != DY_CORE_EXPR_CUSTOM || d->expr.custom.id != dy_string_id) {
+    struct dy_string_data *string_data;
+    if (!dy_string_get(d->expr, &string_data)) {
+        *is_value = false;
         return false;
     }
 
-    const struct dy_string_data *string_data = d->expr.custom.data;
-
-    for (size_t i = 0; i < string_data->value.num_elems; ++i) {
-        printf("%c", *(char *)dy_array_pos(&string_data->value, i));
+    struct dy_string_chunks chunks = dy_string_chunks(string_data);
+    dy_string_t chunk;
+    while (dy_string_next_chunk(&chunks, &chunk)) {
+        fwrite(chunk.ptr, 1, chunk.size, stdout);
     }
-    printf("\n");
+    putchar('\n');
 
     *is_value = true;
     *result = (struct dy_core_expr){
@@ -163,13 +177,30 @@ void dy_print_release(struct dy_core_ctx *ctx, void *data)
     dy_rc_release(data, DY_ALIGNOF(struct dy_print_data));
 }
 
-void dy_print_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string)
+void dy_print_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer)
 {
     struct dy_print_data *d = data;
 
-    add_string(string, DY_STR_LIT("<print: "));
+    dy_write(writer, DY_STR_LIT("<print: "));
+
+    dy_core_expr_to_string(ctx, d->expr, writer);
+
+    dy_write(writer, DY_STR_LIT(">"));
+}
+
+void dy_print_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s)
+{
+    const struct dy_print_data *d = data;
+    dy_serialize_expr(ctx, s, d->expr);
+}
 
-    dy_core_expr_to_string(ctx, d->expr, string);
+bool dy_print_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result)
+{
+    struct dy_print_data data;
+    if (!dy_deserialize_expr(ctx, d, &data.expr)) {
+        return false;
+    }
 
-    add_string(string, DY_STR_LIT(">"));
+    *result = dy_print_create(data);
+    return true;
 }
@@ -8,16 +8,68 @@
 
 #include "../core/check.h"
 #include "../core/eval.h"
+#include "../core/serialize.h"
 #include "string_type.h"
 
+#include <stdio.h>
+#include <string.h>
+
 /**
- * Support for strings. Just for testing puposes, for now.
+ * Support for strings.
+ *
+ * String values are immutable ropes: a node is either a slice of a
+ * reference-counted byte buffer or the concatenation of two other nodes.
+ * Nodes are reference-counted themselves, so concatenating and taking
+ * substrings never copies any text except for small results, and those
+ * of ropes that would get deeper than DY_STRING_MAX_DEPTH, which are
+ * flattened into a single slice.
+ *
+ * The bytes of a rope are visited one contiguous chunk at a time (see dy_string_next_chunk).
  */
 
+/** Bounds the depth of every rope, so its chunks can be walked with a fixed-size stack. */
+#define DY_STRING_MAX_DEPTH 48
+
 static size_t dy_string_id;
 
+enum dy_string_data_tag {
+    DY_STRING_DATA_SLICE,
+    DY_STRING_DATA_CONCAT
+};
+
 struct dy_string_data {
-    dy_array_t value;
+    union {
+        struct {
+            char *buffer; // Reference-counted. NULL for empty slices.
+            size_t start;
+        } slice;
+
+        struct {
+            struct dy_string_data *left;
+            struct dy_string_data *right;
+        } concat;
+    };
+
+    size_t size;
+    size_t depth;
+
+    // Polynomial hash of the bytes, computed on demand (see dy_string_data_hash).
+    size_t hash;
+    bool has_hash;
+
+    enum dy_string_data_tag tag;
+};
+
+static const size_t dy_string_data_align = DY_ALIGNOF(struct dy_string_data);
+
+/** Concatenations up to this size are copied into a fresh slice instead of creating a node. */
+static const size_t dy_string_flat_size = 64;
+
+static const size_t dy_string_hash_base = 0x100000001b3u;
+
+struct dy_string_chunks {
+    const struct dy_string_data *pending[DY_STRING_MAX_DEPTH + 1];
+    size_t num_pending;
 };
 
 static struct dy_core_expr dy_string_type_of(struct dy_core_ctx *ctx, void *data);
@@ -42,12 +94,49 @@ static void *dy_string_retain(struct dy_core_ctx *ctx, void *data);
 
 static void dy_string_release(struct dy_core_ctx *ctx, void *data);
 
-static void dy_string_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string);
+static void dy_string_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer);
+
+static void dy_string_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s);
+
+static bool dy_string_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result);
 
 static inline struct dy_core_custom dy_string_create(struct dy_string_data data);
 
 static inline struct dy_core_custom dy_string_create_no_alloc(struct dy_string_data *data);
 
+/** Copies the bytes of 's' into a new string value. */
+static inline struct dy_core_custom dy_string_create_from_view(dy_string_t s);
+
+/** Whether 'expr' is a string value, and if so, which. Doesn't retain. */
+static inline bool dy_string_get(struct dy_core_expr expr, struct dy_string_data **data);
+
+/** Returns a new slice of a copy of 's'. */
+static inline struct dy_string_data *dy_string_data_from_view(dy_string_t s);
+
+/** Returns the concatenation of 'left' and 'right', which stay owned by the caller. */
+static inline struct dy_string_data *dy_string_data_concat(struct dy_string_data *left, struct dy_string_data *right);
+
+/** Returns the 'size' bytes of 's' starting at 'start', which have to lie within 's'. */
+static inline struct dy_string_data *dy_string_data_substring(struct dy_string_data *s, size_t start, size_t size);
+
+static inline size_t dy_string_data_hash(struct dy_string_data *s);
+
+static inline bool dy_string_data_are_equal(struct dy_string_data *s1, struct dy_string_data *s2);
+
+static inline struct dy_string_data *dy_string_data_retain(struct dy_string_data *s);
+
+static inline void dy_string_data_release(struct dy_string_data *s);
+
+/** Copies the bytes of 'left' followed by those of 'right' into a fresh slice. */
+static inline struct dy_string_data *dy_string_data_copy_concat(const struct dy_string_data *left, const struct dy_string_data *right);
+
+static inline struct dy_string_data *dy_string_data_new_slice(char *buffer, size_t start, size_t size);
+
+static inline struct dy_string_chunks dy_string_chunks(const struct dy_string_data *s);
+
+/** Stores the next non-empty chunk of bytes in 'chunk', if any is left. */
+static inline bool dy_string_next_chunk(struct dy_string_chunks *chunks, dy_string_t *chunk);
+
 static inline void dy_string_register(dy_array_t *reg)
 {
     struct dy_core_custom_shared s = {
@@ -62,7 +151,9 @@ static inline void dy_string_register(dy_array_t *reg)
         .variable_appears_in_polarity = dy_string_variable_appears_in_polarity,
         .retain = dy_string_retain,
         .release = dy_string_release,
-        .to_string = dy_string_to_string
+        .to_string = dy_string_to_string,
+        .serialize = dy_string_serialize,
+        .deserialize = dy_string_deserialize
     };
 
     dy_string_id = dy_array_add(reg, &s);
@@ -70,17 +161,36 @@ static inline void dy_string_register(dy_array_t *reg)
 
 struct dy_core_custom dy_string_create(struct dy_string_data data)
 {
-    return dy_string_create_no_alloc(dy_rc_new(&data, sizeof data, DY_ALIGNOF(data)));
+    return dy_string_create_no_alloc(dy_rc_new(&data, sizeof data, dy_string_data_align));
 }
 
 struct dy_core_custom dy_string_create_no_alloc(struct dy_string_data *data)
 {
+    // Holds just text, no variables.
     return (struct dy_core_custom){
         .id = dy_string_id,
-        .data = data
+        .data = data,
+        .min_id = SIZE_MAX,
+        .max_id = 0,
+        .has_id_range = true
     };
 }
 
+struct dy_core_custom dy_string_create_from_view(dy_string_t s)
+{
+    return dy_string_create_no_alloc(dy_string_data_from_view(s));
+}
+
+bool dy_string_get(struct dy_core_expr expr, struct dy_string_data **data)
+{
+    if (expr.tag != DY_CORE_EXPR_CUSTOM || expr.custom.id != dy_string_id) {
+        return false;
+    }
+
+    *data = expr.custom.data;
+    return true;
+}
+
 struct dy_core_expr dy_string_type_of(struct dy_core_ctx *ctx, void *data)
 {
     return (struct dy_core_expr){
@@ -91,20 +201,7 @@ struct dy_core_expr dy_string_type_of(struct dy_core_ctx *ctx, void *data)
 
 dy_ternary_t dy_string_is_equal(struct dy_core_ctx *ctx, void *data1, void *data2)
 {
-    const struct dy_string_data *s1 = data1;
-    const struct dy_string_data *s2 = data2;
-
-    dy_string_t view1 = {
-        .ptr = s1->value.buffer,
-        .size = s1->value.num_elems
-    };
-
-    dy_string_t view2 = {
-        .ptr = s2->value.buffer,
-        .size = s2->value.num_elems
-    };
-
-    if (dy_string_are_equal(view1, view2)) {
+    if (dy_string_data_are_equal(data1, data2)) {
         return DY_YES;
     } else {
         return DY_NO;
@@ -148,23 +245,323 @@ void dy_string_variable_appears_in_polarity(struct dy_core_ctx *ctx, void *data,
 
 void *dy_string_retain(struct dy_core_ctx *ctx, void *data)
 {
-    return dy_rc_retain(data, DY_ALIGNOF(struct dy_string_data));
+    return dy_string_data_retain(data);
 }
 
 void dy_string_release(struct dy_core_ctx *ctx, void *data)
 {
-    dy_rc_release(data, DY_ALIGNOF(struct dy_string_data));
+    dy_string_data_release(data);
+}
+
+void dy_string_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer)
+{
+    dy_write_char(writer, '\'');
+
+    struct dy_string_chunks chunks = dy_string_chunks(data);
+    dy_string_t chunk;
+    while (dy_string_next_chunk(&chunks, &chunk)) {
+        dy_write(writer, chunk);
+    }
+
+    dy_write_char(writer, '\'');
+}
+
+void dy_string_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s)
+{
+    const struct dy_string_data *string = data;
+
+    // Laid out like dy_serialize_bytes(), without flattening the rope first.
+    dy_serialize_size_t(s, string->size);
+
+    struct dy_string_chunks chunks = dy_string_chunks(string);
+    dy_string_t chunk;
+    while (dy_string_next_chunk(&chunks, &chunk)) {
+        dy_write(s->writer, chunk);
+    }
+}
+
+bool dy_string_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result)
+{
+    dy_string_t bytes;
+    if (!dy_deserialize_bytes(d, &bytes)) {
+        return false;
+    }
+
+    *result = dy_string_create_from_view(bytes);
+    return true;
 }
 
-void dy_string_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string)
+struct dy_string_data *dy_string_data_from_view(dy_string_t s)
 {
-    struct dy_string_data *s = data;
+    if (s.size == 0) {
+        return dy_string_data_new_slice(NULL, 0, 0);
+    }
+
+    char *buffer = dy_rc_alloc(s.size, DY_ALIGNOF(char));
+    memcpy(buffer, s.ptr, s.size);
+
+    struct dy_string_data *data = dy_string_data_new_slice(buffer, 0, s.size);
 
-    dy_array_add(string, &(char){ '\'' });
+    dy_rc_release(buffer, DY_ALIGNOF(char));
+
+    return data;
+}
+
+struct dy_string_data *dy_string_data_concat(struct dy_string_data *left, struct dy_string_data *right)
+{
+    if (right->size == 0) {
+        return dy_string_data_retain(left);
+    }
 
-    for (size_t i = 0; i < s->value.num_elems; ++i) {
-        dy_array_add(string, (char *)s->value.buffer + i);
+    if (left->size == 0) {
+        return dy_string_data_retain(right);
     }
 
-    dy_array_add(string, &(char){ '\'' });
+    size_t size = left->size + right->size;
+    size_t depth = (left->depth > right->depth ? left->depth : right->depth) + 1;
+
+    if (size <= dy_string_flat_size || depth > DY_STRING_MAX_DEPTH) {
+        return dy_string_data_copy_concat(left, right);
+    }
+
+    struct dy_string_data data = {
+        .concat = {
+            .left = dy_string_data_retain(left),
+            .right = dy_string_data_retain(right) },
+        .size = size,
+        .depth = depth,
+        .tag = DY_STRING_DATA_CONCAT
+    };
+
+    return dy_rc_new(&data, sizeof data, dy_string_data_align);
+}
+
+struct dy_string_data *dy_string_data_substring(struct dy_string_data *s, size_t start, size_t size)
+{
+    assert(start <= s->size && size <= s->size - start);
+
+    if (size == s->size) {
+        return dy_string_data_retain(s);
+    }
+
+    if (size == 0) {
+        return dy_string_data_new_slice(NULL, 0, 0);
+    }
+
+    switch (s->tag) {
+    case DY_STRING_DATA_SLICE:
+        return dy_string_data_new_slice(s->slice.buffer, s->slice.start + start, size);
+    case DY_STRING_DATA_CONCAT: {
+        struct dy_string_data *left = s->concat.left;
+        struct dy_string_data *right = s->concat.right;
+
+        if (start + size <= left->size) {
+            return dy_string_data_substring(left, start, size);
+        }
+
+        if (start >= left->size) {
+            return dy_string_data_substring(right, start - left->size, size);
+        }
+
+        // Straddles both halves: a suffix of the left one and a prefix of the right one.
+        struct dy_string_data *suffix = dy_string_data_substring(left, start, left->size - start);
+        struct dy_string_data *prefix = dy_string_data_substring(right, 0, start + size - left->size);
+
+        struct dy_string_data *result = dy_string_data_concat(suffix, prefix);
+
+        dy_string_data_release(suffix);
+        dy_string_data_release(prefix);
+
+        return result;
+    }
+    }
+
+    dy_bail("impossible");
+}
+
+size_t dy_string_data_hash(struct dy_string_data *s)
+{
+    if (s->has_hash) {
+        return s->hash;
+    }
+
+    size_t hash = 0;
+
+    switch (s->tag) {
+    case DY_STRING_DATA_SLICE:
+        for (size_t i = 0; i < s->size; ++i) {
+            hash = hash * dy_string_hash_base + (unsigned char)s->slice.buffer[s->slice.start + i];
+        }
+        break;
+    case DY_STRING_DATA_CONCAT: {
+        // hash(left ++ right) = hash(left) * base^|right| + hash(right)
+        size_t power = 1, base = dy_string_hash_base;
+        for (size_t n = s->concat.right->size; n != 0; n >>= 1) {
+            if (n & 1) {
+                power *= base;
+            }
+
+            base *= base;
+        }
+
+        hash = dy_string_data_hash(s->concat.left) * power + dy_string_data_hash(s->concat.right);
+        break;
+    }
+    }
+
+    // Only ever caches what the bytes determine anyway, so sharing 's' is unaffected.
+    s->hash = hash;
+    s->has_hash = true;
+
+    return hash;
+}
+
+bool dy_string_data_are_equal(struct dy_string_data *s1, struct dy_string_data *s2)
+{
+    if (s1 == s2) {
+        return true;
+    }
+
+    if (s1->size != s2->size || dy_string_data_hash(s1) != dy_string_data_hash(s2)) {
+        return false;
+    }
+
+    // Equal hashes almost certainly mean equal bytes, but that still needs confirming.
+    struct dy_string_chunks chunks1 = dy_string_chunks(s1);
+    struct dy_string_chunks chunks2 = dy_string_chunks(s2);
+
+    dy_string_t chunk1 = { 0 }, chunk2 = { 0 };
+
+    for (;;) {
+        if (chunk1.size == 0 && !dy_string_next_chunk(&chunks1, &chunk1)) {
+            // Both have the same size, so both are exhausted.
+            return true;
+        }
+
+        if (chunk2.size == 0) {
+            dy_string_next_chunk(&chunks2, &chunk2);
+        }
+
+        size_t n = chunk1.size < chunk2.size ? chunk1.size : chunk2.size;
+
+        if (memcmp(chunk1.ptr, chunk2.ptr, n) != 0) {
+            return false;
+        }
+
+        chunk1.ptr += n;
+        chunk1.size -= n;
+        chunk2.ptr += n;
+        chunk2.size -= n;
+    }
+}
+
+struct dy_string_data *dy_string_data_retain(struct dy_string_data *s)
+{
+    return dy_rc_retain(s, dy_string_data_align);
+}
+
+void dy_string_data_release(struct dy_string_data *s)
+{
+    struct dy_string_data d = *s;
+
+    if (dy_rc_release(s, dy_string_data_align) != 0) {
+        return;
+    }
+
+    switch (d.tag) {
+    case DY_STRING_DATA_SLICE:
+        if (d.slice.buffer != NULL) {
+            dy_rc_release(d.slice.buffer, DY_ALIGNOF(char));
+        }
+        return;
+    case DY_STRING_DATA_CONCAT:
+        dy_string_data_release(d.concat.left);
+        dy_string_data_release(d.concat.right);
+        return;
+    }
+
+    dy_bail("impossible");
+}
+
+struct dy_string_data *dy_string_data_copy_concat(const struct dy_string_data *left, const struct dy_string_data *right)
+{
+    size_t size = left->size + right->size;
+
+    char *buffer = dy_rc_alloc(size, DY_ALIGNOF(char));
+
+    size_t offset = 0;
+
+    struct dy_string_chunks chunks = dy_string_chunks(left);
+    dy_string_t chunk;
+    while (dy_string_next_chunk(&chunks, &chunk)) {
+        memcpy(buffer + offset, chunk.ptr, chunk.size);
+        offset += chunk.size;
+    }
+
+    chunks = dy_string_chunks(right);
+    while (dy_string_next_chunk(&chunks, &chunk)) {
+        memcpy(buffer + offset, chunk.ptr, chunk.size);
+        offset += chunk.size;
+    }
+
+    struct dy_string_data *data = dy_string_data_new_slice(buffer, 0, size);
+
+    dy_rc_release(buffer, DY_ALIGNOF(char));
+
+    return data;
+}
+
+struct dy_string_data *dy_string_data_new_slice(char *buffer, size_t start, size_t size)
+{
+    if (buffer != NULL) {
+        dy_rc_retain(buffer, DY_ALIGNOF(char));
+    }
+
+    struct dy_string_data data = {
+        .slice = {
+            .buffer = buffer,
+            .start = start },
+        .size = size,
+        .depth = 0,
+        .tag = DY_STRING_DATA_SLICE
+    };
+
+    return dy_rc_new(&data, sizeof data, dy_string_data_align);
+}
+
+struct dy_string_chunks dy_string_chunks(const struct dy_string_data *s)
+{
+    return (struct dy_string_chunks){
+        .pending = { s },
+        .num_pending = 1
+    };
+}
+
+bool dy_string_next_chunk(struct dy_string_chunks *chunks, dy_string_t *chunk)
+{
+    while (chunks->num_pending != 0) {
+        const struct dy_string_data *s = chunks->pending[--chunks->num_pending];
+
+        switch (s->tag) {
+        case DY_STRING_DATA_SLICE:
+            if (s->size == 0) {
+                continue;
+            }
+
+            *chunk = (dy_string_t){
+                .ptr = s->slice.buffer + s->slice.start,
+                .size = s->size
+            };
+            return true;
+        case DY_STRING_DATA_CONCAT:
+            // Depth-first, left to right: at most one pending node per level, plus the current one.
+            chunks->pending[chunks->num_pending++] = s->concat.right;
+            chunks->pending[chunks->num_pending++] = s->concat.left;
+            continue;
+        }
+
+        dy_bail("impossible");
+    }
+
+    return false;
 }
@@ -0,0 +1,440 @@
+/*
+ * Copyright 2021 Thorben Hasenpusch <t.hasenpusch@icloud.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "../core/check.h"
+#include "../core/eval.h"
+#include "../core/serialize.h"
+
+#include "string.h"
+#include "int.h"
+
+/**
+ * Primitive operations on string values (see string.h).
+ *
+ * Once all operands have evaluated, the result is computed on the ropes directly,
+ * so neither operation copies the text of its operands.
+ *
+ * 'substring' takes a string, a start index and a length, in bytes. If they don't
+ * describe a part of the string, the operation doesn't evaluate any further.
+ */
+
+static size_t dy_string_op_id;
+
+enum dy_string_op {
+    DY_STRING_OP_CONCAT,
+    DY_STRING_OP_SUBSTRING
+};
+
+#define DY_STRING_OP_MAX_ARITY 3
+
+struct dy_string_op_data {
+    enum dy_string_op op;
+    struct dy_core_expr args[DY_STRING_OP_MAX_ARITY];
+};
+
+static const size_t dy_string_op_data_align = DY_ALIGNOF(struct dy_string_op_data);
+
+static struct dy_core_expr dy_string_op_type_of(struct dy_core_ctx *ctx, void *data);
+
+static dy_ternary_t dy_string_op_is_equal(struct dy_core_ctx *ctx, void *data1, void *data2);
+
+static bool dy_string_op_check(struct dy_core_ctx *ctx, void *data, struct dy_core_expr *result);
+
+static bool dy_string_op_remove_mentions_in_type(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, struct dy_core_expr *result);
+
+static bool dy_string_op_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_core_expr *result);
+
+static bool dy_string_op_substitute(struct dy_core_ctx *ctx, void *data, size_t id, struct dy_core_expr sub, struct dy_core_expr *result);
+
+static dy_ternary_t dy_string_op_is_subtype(struct dy_core_ctx *ctx, void *subtype, void *supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr);
+
+static bool dy_string_op_contains_this_variable(struct dy_core_ctx *ctx, void *data, size_t id);
+
+static void dy_string_op_variable_appears_in_polarity(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, bool *positive, bool *negative);
+
+static void *dy_string_op_retain(struct dy_core_ctx *ctx, void *data);
+
+static void dy_string_op_release(struct dy_core_ctx *ctx, void *data);
+
+static void dy_string_op_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer);
+
+static void dy_string_op_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s);
+
+static bool dy_string_op_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result);
+
+static inline struct dy_core_custom dy_string_op_create(struct dy_string_op_data data);
+
+static inline struct dy_core_custom dy_string_op_create_no_alloc(struct dy_string_op_data *data);
+
+/** The number of operands of 'op'. Unused entries of 'args' are ignored. */
+static inline size_t dy_string_op_arity(enum dy_string_op op);
+
+/** Returns false if the operands don't evaluate to anything, yet. */
+static inline bool dy_string_op_compute(enum dy_string_op op, const struct dy_core_expr *args, struct dy_string_data **result);
+
+static inline dy_string_t dy_string_op_name(enum dy_string_op op);
+
+static inline void dy_string_op_register(dy_array_t *reg)
+{
+    struct dy_core_custom_shared s = {
+        .type_of = dy_string_op_type_of,
+        .is_equal = dy_string_op_is_equal,
+        .check = dy_string_op_check,
+        .remove_mentions_in_type = dy_string_op_remove_mentions_in_type,
+        .eval = dy_string_op_eval,
+        .substitute = dy_string_op_substitute,
+        .is_subtype = dy_string_op_is_subtype,
+        .contains_this_variable = dy_string_op_contains_this_variable,
+        .variable_appears_in_polarity = dy_string_op_variable_appears_in_polarity,
+        .retain = dy_string_op_retain,
+        .release = dy_string_op_release,
+        .to_string = dy_string_op_to_string,
+        .serialize = dy_string_op_serialize,
+        .deserialize = dy_string_op_deserialize
+    };
+
+    dy_string_op_id = dy_array_add(reg, &s);
+}
+
+struct dy_core_custom dy_string_op_create(struct dy_string_op_data data)
+{
+    return dy_string_op_create_no_alloc(dy_rc_new(&data, sizeof data, dy_string_op_data_align));
+}
+
+struct dy_core_custom dy_string_op_create_no_alloc(struct dy_string_op_data *data)
+{
+    struct dy_core_custom custom = {
+        .id = dy_string_op_id,
+        .data = data,
+        .has_id_range = true
+    };
+
+    dy_core_expr_id_range(data->args[0], &custom.min_id, &custom.max_id);
+    for (size_t i = 1, arity = dy_string_op_arity(data->op); i < arity; ++i) {
+        dy_core_id_range_add(data->args[i], &custom.min_id, &custom.max_id);
+    }
+
+    return custom;
+}
+
+struct dy_core_expr dy_string_op_type_of(struct dy_core_ctx *ctx, void *data)
+{
+    return (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_string_type_create()
+    };
+}
+
+dy_ternary_t dy_string_op_is_equal(struct dy_core_ctx *ctx, void *data1, void *data2)
+{
+    const struct dy_string_op_data *d1 = data1;
+    const struct dy_string_op_data *d2 = data2;
+
+    if (d1->op != d2->op) {
+        return DY_MAYBE;
+    }
+
+    for (size_t i = 0, arity = dy_string_op_arity(d1->op); i < arity; ++i) {
+        if (dy_are_equal(ctx, d1->args[i], d2->args[i]) != DY_YES) {
+            return DY_MAYBE;
+        }
+    }
+
+    return DY_YES;
+}
+
+bool dy_string_op_check(struct dy_core_ctx *ctx, void *data, struct dy_core_expr *result)
+{
+    const struct dy_string_op_data *d = data;
+
+    size_t arity = dy_string_op_arity(d->op);
+
+    struct dy_string_op_data new_data = { .op = d->op };
+    bool is_new = false;
+
+    size_t constraint_start = ctx->constraints.num_elems;
+
+    for (size_t i = 0; i < arity; ++i) {
+        size_t next_constraint_start = ctx->constraints.num_elems;
+
+        if (dy_check_expr(ctx, d->args[i], &new_data.args[i])) {
+            is_new = true;
+        } else {
+            new_data.args[i] = dy_core_expr_retain(ctx, d->args[i]);
+        }
+
+        if (i != 0) {
+            dy_join_constraints(ctx, constraint_start, next_constraint_start);
+        }
+    }
+
+    if (!is_new) {
+        for (size_t i = 0; i < arity; ++i) {
+            dy_core_expr_release(ctx, new_data.args[i]);
+        }
+
+        return false;
+    }
+
+    *result = (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_string_op_create(new_data)
+    };
+
+    return true;
+}
+
+bool dy_string_op_remove_mentions_in_type(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, struct dy_core_expr *result)
+{
+    if (dy_string_op_contains_this_variable(ctx, data, id)) {
+        *result = (struct dy_core_expr){
+            .tag = DY_CORE_EXPR_ANY
+        };
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool dy_string_op_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_core_expr *result)
+{
+    const struct dy_string_op_data *d = data;
+
+    size_t arity = dy_string_op_arity(d->op);
+
+    struct dy_string_op_data new_data = { .op = d->op };
+    bool is_new = false;
+
+    for (size_t i = 0; i < arity; ++i) {
+        bool arg_is_value = false;
+        if (dy_eval_expr(ctx, d->args[i], &arg_is_value, &new_data.args[i])) {
+            is_new = true;
+        } else {
+            new_data.args[i] = dy_core_expr_retain(ctx, d->args[i]);
+        }
+    }
+
+    struct dy_string_data *value;
+    if (dy_string_op_compute(d->op, new_data.args, &value)) {
+        for (size_t i = 0; i < arity; ++i) {
+            dy_core_expr_release(ctx, new_data.args[i]);
+        }
+
+        *is_value = true;
+        *result = (struct dy_core_expr){
+            .tag = DY_CORE_EXPR_CUSTOM,
+            .custom = dy_string_create_no_alloc(value)
+        };
+
+        return true;
+    }
+
+    *is_value = false;
+
+    if (!is_new) {
+        for (size_t i = 0; i < arity; ++i) {
+            dy_core_expr_release(ctx, new_data.args[i]);
+        }
+
+        return false;
+    }
+
+    *result = (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_string_op_create(new_data)
+    };
+
+    return true;
+}
+
+bool dy_string_op_substitute(struct dy_core_ctx *ctx, void *data, size_t id, struct dy_core_expr sub, struct dy_core_expr *result)
+{
+    const struct dy_string_op_data *d = data;
+
+    size_t arity = dy_string_op_arity(d->op);
+
+    struct dy_string_op_data new_data = { .op = d->op };
+    bool is_new = false;
+
+    for (size_t i = 0; i < arity; ++i) {
+        if (dy_substitute(ctx, d->args[i], id, sub, &new_data.args[i])) {
+            is_new = true;
+        } else {
+            new_data.args[i] = dy_core_expr_retain(ctx, d->args[i]);
+        }
+    }
+
+    if (!is_new) {
+        for (size_t i = 0; i < arity; ++i) {
+            dy_core_expr_release(ctx, new_data.args[i]);
+        }
+
+        return false;
+    }
+
+    *result = (struct dy_core_expr){
+        .tag = DY_CORE_EXPR_CUSTOM,
+        .custom = dy_string_op_create(new_data)
+    };
+
+    return true;
+}
+
+dy_ternary_t dy_string_op_is_subtype(struct dy_core_ctx *ctx, void *subtype, void *supertype, struct dy_core_expr subtype_expr, struct dy_core_expr *new_subtype_expr, bool *did_transform_subtype_expr)
+{
+    return DY_MAYBE;
+}
+
+bool dy_string_op_contains_this_variable(struct dy_core_ctx *ctx, void *data, size_t id)
+{
+    const struct dy_string_op_data *d = data;
+
+    for (size_t i = 0, arity = dy_string_op_arity(d->op); i < arity; ++i) {
+        if (dy_core_expr_contains_this_variable(ctx, id, d->args[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void dy_string_op_variable_appears_in_polarity(struct dy_core_ctx *ctx, void *data, size_t id, enum dy_polarity current_polarity, bool *positive, bool *negative)
+{
+}
+
+void *dy_string_op_retain(struct dy_core_ctx *ctx, void *data)
+{
+    return dy_rc_retain(data, dy_string_op_data_align);
+}
+
+void dy_string_op_release(struct dy_core_ctx *ctx, void *data)
+{
+    struct dy_string_op_data d = *(struct dy_string_op_data *)data;
+
+    if (dy_rc_release(data, dy_string_op_data_align) == 0) {
+        for (size_t i = 0, arity = dy_string_op_arity(d.op); i < arity; ++i) {
+            dy_core_expr_release(ctx, d.args[i]);
+        }
+    }
+}
+
+void dy_string_op_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer)
+{
+    const struct dy_string_op_data *d = data;
+
+    dy_write(writer, DY_STR_LIT("<"));
+    dy_write(writer, dy_string_op_name(d->op));
+    dy_write(writer, DY_STR_LIT(": "));
+
+    for (size_t i = 0, arity = dy_string_op_arity(d->op); i < arity; ++i) {
+        if (i != 0) {
+            dy_write(writer, DY_STR_LIT(", "));
+        }
+
+        dy_core_expr_to_string(ctx, d->args[i], writer);
+    }
+
+    dy_write(writer, DY_STR_LIT(">"));
+}
+
+void dy_string_op_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s)
+{
+    const struct dy_string_op_data *d = data;
+
+    dy_serialize_size_t(s, d->op);
+
+    for (size_t i = 0, arity = dy_string_op_arity(d->op); i < arity; ++i) {
+        dy_serialize_expr(ctx, s, d->args[i]);
+    }
+}
+
+bool dy_string_op_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result)
+{
+    size_t op;
+    if (!dy_deserialize_bounded(d, DY_STRING_OP_SUBSTRING + 1, &op)) {
+        return false;
+    }
+
+    struct dy_string_op_data data = {
+        .op = (enum dy_string_op)op
+    };
+
+    size_t arity = dy_string_op_arity(data.op);
+
+    for (size_t i = 0; i < arity; ++i) {
+        if (!dy_deserialize_expr(ctx, d, &data.args[i])) {
+            while (i-- > 0) {
+                dy_core_expr_release(ctx, data.args[i]);
+            }
+
+            return false;
+        }
+    }
+
+    *result = dy_string_op_create(data);
+    return true;
+}
+
+size_t dy_string_op_arity(enum dy_string_op op)
+{
+    switch (op) {
+    case DY_STRING_OP_CONCAT:
+        return 2;
+    case DY_STRING_OP_SUBSTRING:
+        return 3;
+    }
+
+    dy_bail("impossible");
+}
+
+bool dy_string_op_compute(enum dy_string_op op, const struct dy_core_expr *args, struct dy_string_data **result)
+{
+    struct dy_string_data *s;
+    if (!dy_string_get(args[0], &s)) {
+        return false;
+    }
+
+    switch (op) {
+    case DY_STRING_OP_CONCAT: {
+        struct dy_string_data *right;
+        if (!dy_string_get(args[1], &right)) {
+            return false;
+        }
+
+        *result = dy_string_data_concat(s, right);
+        return true;
+    }
+    case DY_STRING_OP_SUBSTRING: {
+        intptr_t start, size;
+        if (!dy_int_get(args[1], &start) || !dy_int_get(args[2], &size)) {
+            return false;
+        }
+
+        if (start < 0 || size < 0 || (size_t)start > s->size || (size_t)size > s->size - (size_t)start) {
+            return false;
+        }
+
+        *result = dy_string_data_substring(s, (size_t)start, (size_t)size);
+        return true;
+    }
+    }
+
+    dy_bail("impossible");
+}
+
+dy_string_t dy_string_op_name(enum dy_string_op op)
+{
+    switch (op) {
+    case DY_STRING_OP_CONCAT:
+        return DY_STR_LIT("concat");
+    case DY_STRING_OP_SUBSTRING:
+        return DY_STR_LIT("substring");
+    }
+
+    dy_bail("impossible");
+}
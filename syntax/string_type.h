@@ -7,6 +7,7 @@
 #pragma once
 
 #include "../core/core.h"
+#include "../core/serialize.h"
 
 static size_t dy_string_type_id;
 
@@ -32,7 +33,11 @@ static void *dy_string_type_retain(struct dy_core_ctx *ctx, void *data);
 
 static void dy_string_type_release(struct dy_core_ctx *ctx, void *data);
 
-static void dy_string_type_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string);
+static void dy_string_type_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer);
+
+static void dy_string_type_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s);
+
+static bool dy_string_type_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result);
 
 static inline struct dy_core_custom dy_string_type_create(void);
 
@@ -50,7 +55,9 @@ static inline void dy_string_type_register(dy_array_t *reg)
         .variable_appears_in_polarity = dy_string_type_variable_appears_in_polarity,
         .retain = dy_string_type_retain,
         .release = dy_string_type_release,
-        .to_string = dy_string_type_to_string
+        .to_string = dy_string_type_to_string,
+        .serialize = dy_string_type_serialize,
+        .deserialize = dy_string_type_deserialize
     };
 
     dy_string_type_id = dy_array_add(reg, &s);
@@ -60,7 +67,10 @@ struct dy_core_custom dy_string_type_create(void)
 {
     return (struct dy_core_custom){
         .id = dy_string_type_id,
-        .data = NULL
+        .data = NULL,
+        .min_id = SIZE_MAX,
+        .max_id = 0,
+        .has_id_range = true
     };
 }
 
@@ -121,7 +131,17 @@ void dy_string_type_release(struct dy_core_ctx *ctx, void *data)
 
 }
 
-void dy_string_type_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string)
+void dy_string_type_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer)
+{
+    dy_write(writer, DY_STR_LIT("String"));
+}
+
+void dy_string_type_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s)
+{
+}
+
+bool dy_string_type_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result)
 {
-    add_string(string, DY_STR_LIT("String"));
+    *result = dy_string_type_create();
+    return true;
 }
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "../core/core.h"
+#include "../core/serialize.h"
 
 static size_t dy_uv_id;
 
@@ -36,7 +37,11 @@ static void *dy_uv_retain(struct dy_core_ctx *ctx, void *data);
 
 static void dy_uv_release(struct dy_core_ctx *ctx, void *data);
 
-static void dy_uv_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string);
+static void dy_uv_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer);
+
+static void dy_uv_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s);
+
+static bool dy_uv_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result);
 
 static inline struct dy_core_custom dy_uv_create(struct dy_uv_data data);
 
@@ -56,7 +61,9 @@ static inline void dy_uv_register(dy_array_t *reg)
         .variable_appears_in_polarity = dy_uv_variable_appears_in_polarity,
         .retain = dy_uv_retain,
         .release = dy_uv_release,
-        .to_string = dy_uv_to_string
+        .to_string = dy_uv_to_string,
+        .serialize = dy_uv_serialize,
+        .deserialize = dy_uv_deserialize
     };
 
     dy_uv_id = dy_array_add(reg, &s);
@@ -69,9 +76,13 @@ struct dy_core_custom dy_uv_create(struct dy_uv_data data)
 
 struct dy_core_custom dy_uv_create_no_alloc(struct dy_uv_data *data)
 {
+    // Holds just text, no variables.
     return (struct dy_core_custom){
         .id = dy_uv_id,
-        .data = data
+        .data = data,
+        .min_id = SIZE_MAX,
+        .max_id = 0,
+        .has_id_range = true
     };
 }
 
@@ -99,6 +110,7 @@ bool dy_uv_remove_mentions_in_type(struct dy_core_ctx *ctx, void *data, size_t i
 
 bool dy_uv_eval(struct dy_core_ctx *ctx, void *data, bool *is_value, struct dy_core_expr *result)
 {
+    *is_value = false;
     return false;
 }
 
@@ -131,11 +143,29 @@ void dy_uv_release(struct dy_core_ctx *ctx, void *data)
     dy_rc_release(data, DY_ALIGNOF(struct dy_uv_data));
 }
 
-void dy_uv_to_string(struct dy_core_ctx *ctx, void *data, dy_array_t *string)
+void dy_uv_to_string(struct dy_core_ctx *ctx, void *data, struct dy_writer *writer)
 {
     struct dy_uv_data *d = data;
 
-    for (size_t i = 0; i < d->var.num_elems; ++i) {
-        dy_array_add(string, (char *)d->var.buffer + i);
+    dy_write(writer, (dy_string_t){ .ptr = d->var.buffer, .size = d->var.num_elems });
+}
+
+void dy_uv_serialize(struct dy_core_ctx *ctx, void *data, struct dy_core_serializer *s)
+{
+    const struct dy_uv_data *uv = data;
+    dy_serialize_bytes(s, dy_array_view(&uv->var));
+}
+
+bool dy_uv_deserialize(struct dy_core_ctx *ctx, struct dy_core_deserializer *d, struct dy_core_custom *result)
+{
+    dy_string_t var;
+    if (!dy_deserialize_bytes(d, &var)) {
+        return false;
     }
+
+    *result = dy_uv_create((struct dy_uv_data){
+        .var = dy_array_from_view(var)
+    });
+
+    return true;
 }
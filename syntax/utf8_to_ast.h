@@ -10,9 +10,64 @@
 
 #include "../support/stream.h"
 #include "../support/bail.h"
+#include "../support/scan.h"
+#include "../support/intern.h"
+
+/**
+ * Rules whose results are memoized, see dy_utf8_to_ast_ctx.memo.
+ * These are the ones that depend on nothing but the position they start at.
+ */
+enum dy_utf8_rule {
+    DY_UTF8_RULE_EXPR,
+    DY_UTF8_RULE_ARGUMENT
+};
+
+struct dy_utf8_memo_entry {
+    union {
+        struct dy_ast_expr expr;
+        struct dy_ast_argument argument;
+    };
+
+    size_t start_index;
+    size_t end_index;
+    enum dy_utf8_rule rule;
+    bool success;
+    bool is_occupied;
+};
 
 struct dy_utf8_to_ast_ctx {
     struct dy_stream stream;
+
+    /**
+     * Packrat memo table of struct dy_utf8_memo_entry, keyed on (rule, start index).
+     *
+     * The parser backtracks, and without this, alternatives that fail late
+     * make it parse the same expressions over and over.
+     * With it, every rule is parsed at most once per position.
+     *
+     * Open-addressed with a power-of-two capacity; a capacity of 0 (e.g. a zero-initialized array)
+     * disables memoization. Emptied at the end of dy_utf8_to_ast_file().
+     */
+    dy_array_t memo;
+
+    /** Number of rule applications answered by the memo, i.e. re-parses avoided. */
+    size_t num_memo_hits;
+
+    /** Number of rule applications that had to be parsed while memoizing. */
+    size_t num_memo_misses;
+
+    /**
+     * Gives every name in the AST its symbol. The interned strings are views into the parsed text.
+     * Can be zero-initialized; release it with dy_interner_release() once parsing is done.
+     */
+    struct dy_interner symbols;
+
+    /**
+     * Set if an integer literal doesn't fit intptr_t, which makes dy_utf8_to_ast_file() fail.
+     * 'out_of_range_int_index' is where the first such literal starts.
+     */
+    bool has_out_of_range_int;
+    size_t out_of_range_int_index;
 };
 
 enum dy_infix_op {
@@ -30,10 +85,45 @@ static inline bool dy_utf8_to_size_t(struct dy_utf8_to_ast_ctx *ctx, size_t *nat
 
 static inline bool dy_utf8_to_ast_expr(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_expr *expr);
 
-static inline bool dy_utf8_to_ast_variable(struct dy_utf8_to_ast_ctx *ctx, dy_array_t *var);
+static inline bool dy_utf8_to_ast_expr_unmemoized(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_expr *expr);
+
+/** Looks up the result of 'rule' at the current position. On a hit, moves past what it consumed. */
+static inline bool dy_utf8_memo_lookup(struct dy_utf8_to_ast_ctx *ctx, enum dy_utf8_rule rule, struct dy_utf8_memo_entry *entry);
+
+/** Records the result of 'rule' started at 'start_index'; the end is the current position. 'entry' is retained. */
+static inline void dy_utf8_memo_insert(struct dy_utf8_to_ast_ctx *ctx, size_t start_index, struct dy_utf8_memo_entry entry);
+
+static inline void dy_utf8_memo_clear(struct dy_utf8_to_ast_ctx *ctx);
+
+static inline void dy_utf8_memo_rehash(dy_array_t *memo, size_t capacity);
+
+static inline void dy_utf8_memo_put(dy_array_t *memo, struct dy_utf8_memo_entry entry);
+
+static inline size_t dy_utf8_memo_hash(enum dy_utf8_rule rule, size_t start_index);
+
+/** The result is a view into the text, see dy_utf8_to_ast_file(). */
+static inline bool dy_utf8_to_ast_variable(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_name *var);
+
+/** Returns a view of the text in [start, end). */
+static inline dy_string_t dy_utf8_span(struct dy_utf8_to_ast_ctx *ctx, size_t start, size_t end);
+
+/**
+ * The unconsumed rest of the text, for the scanning functions of support/scan.h.
+ * That's all in the buffer since dy_utf8_to_ast_file() reads everything up front.
+ */
+static inline const char *dy_utf8_rest(struct dy_utf8_to_ast_ctx *ctx);
+
+static inline const char *dy_utf8_end(struct dy_utf8_to_ast_ctx *ctx);
+
+/** Continues after the text consumed by a scanning function. */
+static inline void dy_utf8_move_to(struct dy_utf8_to_ast_ctx *ctx, const char *pos);
 
 static inline bool dy_utf8_to_ast_do_block(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_do_block *do_block);
 
+/**
+ * Reads the whole stream up front (see dy_stream_read_all()), since names and string literals
+ * in the resulting AST are views into the stream's buffer. The buffer has to outlive the AST.
+ */
 static inline bool dy_utf8_to_ast_file(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_do_block *file);
 
 static inline bool dy_utf8_to_ast_list(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_list *list);
@@ -44,6 +134,8 @@ static inline bool dy_utf8_to_non_left_recursive_ast_expr(struct dy_utf8_to_ast_
 
 static inline bool dy_utf8_to_argument(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_argument *arg);
 
+static inline bool dy_utf8_to_argument_unmemoized(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_argument *arg);
+
 static inline enum dy_infix_op dy_utf8_to_ast_infix_op(struct dy_utf8_to_ast_ctx *ctx);
 
 static inline bool dy_utf8_to_ast_expr_further(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_argument left, enum dy_infix_op left_op, struct dy_ast_expr *expr);
@@ -96,11 +188,20 @@ static inline bool dy_utf8_to_ast_do_block_stmnt_def(struct dy_utf8_to_ast_ctx *
 
 static inline bool dy_skip_semicolon_or_newline(struct dy_utf8_to_ast_ctx *ctx);
 
-static inline bool dy_utf8_to_ast_string(struct dy_utf8_to_ast_ctx *ctx, dy_array_t *string);
+static inline bool dy_utf8_to_ast_string(struct dy_utf8_to_ast_ctx *ctx, dy_string_t *string);
+
+/**
+ * Integer literals always start with a sign, e.g. +1 or -12,
+ * which keeps them apart from the list indices in 'x 1'.
+ *
+ * Nothing else starts with a sign, so a literal that doesn't fit intptr_t is still
+ * consumed (as 0) and noted in ctx->has_out_of_range_int, instead of being backtracked over.
+ */
+static inline bool dy_utf8_to_ast_int(struct dy_utf8_to_ast_ctx *ctx, intptr_t *value);
 
-static inline bool dy_utf8_to_ast_binding_with_type(struct dy_utf8_to_ast_ctx *ctx, dy_array_t name, bool have_name, struct dy_ast_binding *binding);
+static inline bool dy_utf8_to_ast_binding_with_type(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_name name, bool have_name, struct dy_ast_binding *binding);
 
-static inline bool dy_utf8_to_ast_binding_with_pattern(struct dy_utf8_to_ast_ctx *ctx, dy_array_t name, bool have_name, struct dy_ast_binding *binding);
+static inline bool dy_utf8_to_ast_binding_with_pattern(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_name name, bool have_name, struct dy_ast_binding *binding);
 
 static inline bool dy_utf8_to_ast_index(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_argument_index *index);
 
@@ -128,7 +229,7 @@ bool dy_utf8_literal(struct dy_utf8_to_ast_ctx *ctx, dy_string_t s)
     return true;
 }
 
-bool dy_utf8_to_ast_variable(struct dy_utf8_to_ast_ctx *ctx, dy_array_t *var)
+bool dy_utf8_to_ast_variable(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_name *var)
 {
     size_t start_index = ctx->stream.current_index;
 
@@ -138,41 +239,190 @@ bool dy_utf8_to_ast_variable(struct dy_utf8_to_ast_ctx *ctx, dy_array_t *var)
         return false;
     }
 
-    dy_array_add(var, &c);
+    dy_utf8_move_to(ctx, dy_scan_identifier_tail(dy_utf8_rest(ctx), dy_utf8_end(ctx)));
 
-    for (;;) {
-        if (!dy_utf8_one_of(ctx, DY_STR_LIT("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-?"), &c)) {
-            dy_string_t final_var = {
-                .ptr = var->buffer,
-                .size = var->num_elems
-            };
+    dy_string_t final_var = dy_utf8_span(ctx, start_index, ctx->stream.current_index);
 
-            if (dy_string_are_equal(final_var, DY_STR_LIT("list"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("let"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("either"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("Void"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("Any"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("String"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("Unwrap"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("Unfold"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("max"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("inf"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("fin"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("fun"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("def"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("inv"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("some"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("map"))
-                || dy_string_are_equal(final_var, DY_STR_LIT("do"))) {
-                ctx->stream.current_index = start_index;
-                return false;
+    if (dy_string_are_equal(final_var, DY_STR_LIT("list"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("let"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("either"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("Void"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("Any"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("String"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("Int"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("Unwrap"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("Unfold"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("max"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("inf"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("fin"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("fun"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("def"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("inv"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("some"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("map"))
+        || dy_string_are_equal(final_var, DY_STR_LIT("do"))) {
+        ctx->stream.current_index = start_index;
+        return false;
+    }
+
+    if (ctx->symbols.num_symbols == 0) {
+        for (size_t i = 0; i < DY_AST_NUM_BUILTINS; ++i) {
+            dy_intern(&ctx->symbols, dy_ast_builtin_names[i]);
+        }
+    }
+
+    *var = (struct dy_ast_name){
+        .text = final_var,
+        .symbol = dy_intern(&ctx->symbols, final_var)
+    };
+
+    return true;
+}
+
+bool dy_utf8_memo_lookup(struct dy_utf8_to_ast_ctx *ctx, enum dy_utf8_rule rule, struct dy_utf8_memo_entry *entry)
+{
+    if (ctx->memo.capacity == 0) {
+        return false;
+    }
+
+    size_t start_index = ctx->stream.current_index;
+    size_t mask = ctx->memo.capacity - 1;
+
+    for (size_t i = dy_utf8_memo_hash(rule, start_index) & mask;; i = (i + 1) & mask) {
+        const struct dy_utf8_memo_entry *e = dy_array_pos_uninit(&ctx->memo, i);
+        if (!e->is_occupied) {
+            ++ctx->num_memo_misses;
+            return false;
+        }
+
+        if (e->rule == rule && e->start_index == start_index) {
+            ++ctx->num_memo_hits;
+
+            if (e->success) {
+                ctx->stream.current_index = e->end_index;
             }
 
+            *entry = *e;
             return true;
         }
+    }
+}
+
+void dy_utf8_memo_insert(struct dy_utf8_to_ast_ctx *ctx, size_t start_index, struct dy_utf8_memo_entry entry)
+{
+    dy_array_t *memo = &ctx->memo;
+
+    if (memo->capacity == 0) {
+        return;
+    }
+
+    if (4 * (memo->num_elems + 1) > 3 * memo->capacity) {
+        dy_utf8_memo_rehash(memo, memo->capacity * 2);
+    }
+
+    entry.start_index = start_index;
+    entry.end_index = ctx->stream.current_index;
+    entry.is_occupied = true;
+
+    if (entry.success) {
+        switch (entry.rule) {
+        case DY_UTF8_RULE_EXPR:
+            entry.expr = dy_ast_expr_retain(entry.expr);
+            break;
+        case DY_UTF8_RULE_ARGUMENT:
+            entry.argument = dy_ast_argument_retain(entry.argument);
+            break;
+        }
+    }
+
+    dy_utf8_memo_put(memo, entry);
+}
+
+void dy_utf8_memo_clear(struct dy_utf8_to_ast_ctx *ctx)
+{
+    for (size_t i = 0, size = ctx->memo.capacity; i < size; ++i) {
+        struct dy_utf8_memo_entry *entry = dy_array_pos_uninit(&ctx->memo, i);
+        if (!entry->is_occupied) {
+            continue;
+        }
 
-        dy_array_add(var, &c);
+        if (entry->success) {
+            switch (entry->rule) {
+            case DY_UTF8_RULE_EXPR:
+                dy_ast_expr_release(entry->expr);
+                break;
+            case DY_UTF8_RULE_ARGUMENT:
+                dy_ast_argument_release(entry->argument);
+                break;
+            }
+        }
+
+        *entry = (struct dy_utf8_memo_entry){ 0 };
     }
+
+    ctx->memo.num_elems = 0;
+}
+
+void dy_utf8_memo_rehash(dy_array_t *memo, size_t capacity)
+{
+    dy_array_t old = *memo;
+
+    *memo = dy_array_create(old.elem_size, old.elem_alignment, capacity);
+    memset(memo->buffer, 0, memo->elem_size * memo->capacity);
+
+    for (size_t i = 0; i < old.capacity; ++i) {
+        const struct dy_utf8_memo_entry *entry = dy_array_pos_uninit(&old, i);
+        if (entry->is_occupied) {
+            dy_utf8_memo_put(memo, *entry);
+        }
+    }
+
+    dy_array_release(&old);
+}
+
+void dy_utf8_memo_put(dy_array_t *memo, struct dy_utf8_memo_entry entry)
+{
+    size_t mask = memo->capacity - 1;
+
+    for (size_t i = dy_utf8_memo_hash(entry.rule, entry.start_index) & mask;; i = (i + 1) & mask) {
+        struct dy_utf8_memo_entry *slot = dy_array_pos_uninit(memo, i);
+        if (!slot->is_occupied) {
+            *slot = entry;
+            ++memo->num_elems;
+            return;
+        }
+    }
+}
+
+size_t dy_utf8_memo_hash(enum dy_utf8_rule rule, size_t start_index)
+{
+    // Fibonacci hashing spreads neighbouring positions over the table.
+    return (start_index * 2 + (size_t)rule) * (size_t)0x9E3779B97F4A7C15ull;
+}
+
+dy_string_t dy_utf8_span(struct dy_utf8_to_ast_ctx *ctx, size_t start, size_t end)
+{
+    return (dy_string_t){
+        .ptr = (const char *)ctx->stream.buffer.buffer + start,
+        .size = end - start
+    };
+}
+
+const char *dy_utf8_rest(struct dy_utf8_to_ast_ctx *ctx)
+{
+    assert(ctx->stream.get_chars == dy_stream_no_more_chars);
+
+    return (const char *)ctx->stream.buffer.buffer + ctx->stream.current_index;
+}
+
+const char *dy_utf8_end(struct dy_utf8_to_ast_ctx *ctx)
+{
+    return (const char *)ctx->stream.buffer.buffer + ctx->stream.buffer.num_elems;
+}
+
+void dy_utf8_move_to(struct dy_utf8_to_ast_ctx *ctx, const char *pos)
+{
+    ctx->stream.current_index = (size_t)(pos - (const char *)ctx->stream.buffer.buffer);
 }
 
 bool dy_utf8_to_size_t(struct dy_utf8_to_ast_ctx *ctx, size_t *nat)
@@ -234,16 +484,12 @@ bool dy_skip_line_comment(struct dy_utf8_to_ast_ctx *ctx)
         return false;
     }
 
-    for (;;) {
-        char c;
-        if (!dy_get_char(ctx, &c)) {
-            return true;
-        }
+    const char *end = dy_utf8_end(ctx);
+    const char *newline = dy_scan_byte(dy_utf8_rest(ctx), end, '\n');
 
-        if (c == '\n') {
-            return true;
-        }
-    }
+    dy_utf8_move_to(ctx, newline == end ? end : newline + 1);
+
+    return true;
 }
 
 bool dy_skip_block_comment(struct dy_utf8_to_ast_ctx *ctx)
@@ -256,6 +502,16 @@ bool dy_skip_block_comment(struct dy_utf8_to_ast_ctx *ctx)
     }
 
     for (;;) {
+        // Both "/#" and "#/" contain a '#', so nothing before the next one (or the '/' preceding it) can match.
+        const char *rest = dy_utf8_rest(ctx);
+        const char *end = dy_utf8_end(ctx);
+        const char *hash = dy_scan_byte(rest, end, '#');
+        if (hash != end && hash != rest && hash[-1] == '/') {
+            --hash;
+        }
+
+        dy_utf8_move_to(ctx, hash);
+
         if (dy_skip_block_comment(ctx)) {
             continue;
         }
@@ -276,6 +532,33 @@ bool dy_skip_block_comment(struct dy_utf8_to_ast_ctx *ctx)
 }
 
 bool dy_utf8_to_ast_expr(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_expr *expr)
+{
+    struct dy_utf8_memo_entry entry;
+    if (dy_utf8_memo_lookup(ctx, DY_UTF8_RULE_EXPR, &entry)) {
+        if (entry.success) {
+            *expr = dy_ast_expr_retain(entry.expr);
+        }
+
+        return entry.success;
+    }
+
+    size_t start_index = ctx->stream.current_index;
+
+    entry = (struct dy_utf8_memo_entry){
+        .rule = DY_UTF8_RULE_EXPR,
+        .success = dy_utf8_to_ast_expr_unmemoized(ctx, expr)
+    };
+
+    if (entry.success) {
+        entry.expr = *expr;
+    }
+
+    dy_utf8_memo_insert(ctx, start_index, entry);
+
+    return entry.success;
+}
+
+bool dy_utf8_to_ast_expr_unmemoized(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_expr *expr)
 {
     size_t start_index = ctx->stream.current_index;
 
@@ -424,6 +707,33 @@ bool dy_utf8_to_ast_expr_further(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_a
 }
 
 bool dy_utf8_to_argument(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_argument *arg)
+{
+    struct dy_utf8_memo_entry entry;
+    if (dy_utf8_memo_lookup(ctx, DY_UTF8_RULE_ARGUMENT, &entry)) {
+        if (entry.success) {
+            *arg = dy_ast_argument_retain(entry.argument);
+        }
+
+        return entry.success;
+    }
+
+    size_t start_index = ctx->stream.current_index;
+
+    entry = (struct dy_utf8_memo_entry){
+        .rule = DY_UTF8_RULE_ARGUMENT,
+        .success = dy_utf8_to_argument_unmemoized(ctx, arg)
+    };
+
+    if (entry.success) {
+        entry.argument = *arg;
+    }
+
+    dy_utf8_memo_insert(ctx, start_index, entry);
+
+    return entry.success;
+}
+
+bool dy_utf8_to_argument_unmemoized(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_argument *arg)
 {
     struct dy_ast_expr expr;
     if (dy_utf8_to_non_left_recursive_ast_expr(ctx, &expr)) {
@@ -506,7 +816,7 @@ bool dy_utf8_to_non_left_recursive_ast_expr(struct dy_utf8_to_ast_ctx *ctx, stru
         return true;
     }
 
-    dy_array_t string = dy_array_create(sizeof(char), DY_ALIGNOF(char), 8);
+    dy_string_t string;
     if (dy_utf8_to_ast_string(ctx, &string)) {
         *expr = (struct dy_ast_expr){
             .tag = DY_AST_EXPR_STRING,
@@ -516,6 +826,16 @@ bool dy_utf8_to_non_left_recursive_ast_expr(struct dy_utf8_to_ast_ctx *ctx, stru
         return true;
     }
 
+    intptr_t int_value;
+    if (dy_utf8_to_ast_int(ctx, &int_value)) {
+        *expr = (struct dy_ast_expr){
+            .tag = DY_AST_EXPR_INT,
+            .int_value = int_value
+        };
+
+        return true;
+    }
+
     if (dy_utf8_to_parenthesized_ast_expr(ctx, expr)) {
         return true;
     }
@@ -544,7 +864,15 @@ bool dy_utf8_to_non_left_recursive_ast_expr(struct dy_utf8_to_ast_ctx *ctx, stru
         return true;
     }
 
-    dy_array_t var = dy_array_create(sizeof(char), DY_ALIGNOF(char), 8);
+    if (dy_utf8_literal(ctx, DY_STR_LIT("Int"))) {
+        *expr = (struct dy_ast_expr){
+            .tag = DY_AST_EXPR_INT_TYPE
+        };
+
+        return true;
+    }
+
+    struct dy_ast_name var;
     if (dy_utf8_to_ast_variable(ctx, &var)) {
         *expr = (struct dy_ast_expr){
             .tag = DY_AST_EXPR_VARIABLE,
@@ -609,9 +937,8 @@ bool dy_utf8_to_map_some(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_map_some
 
     dy_skip_whitespace(ctx);
 
-    dy_array_t name = dy_array_create(sizeof(char), DY_ALIGNOF(char), 8);
+    struct dy_ast_name name;
     if (!dy_utf8_to_ast_variable(ctx, &name)) {
-        dy_array_release(&name);
         ctx->stream.current_index = start_index;
         return false;
     }
@@ -626,7 +953,6 @@ bool dy_utf8_to_map_some(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_map_some
         dy_skip_whitespace(ctx);
 
         if (!dy_utf8_to_ast_expr(ctx, &type)) {
-            dy_array_release(&name);
             ctx->stream.current_index = start_index;
             return false;
         }
@@ -637,7 +963,6 @@ bool dy_utf8_to_map_some(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_map_some
     dy_skip_whitespace(ctx);
 
     if (!dy_utf8_literal(ctx, DY_STR_LIT("=>"))) {
-        dy_array_release(&name);
 
         if (have_type) {
             dy_ast_expr_release(type);
@@ -652,7 +977,6 @@ bool dy_utf8_to_map_some(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_map_some
     struct dy_ast_binding binding;
     struct dy_ast_expr expr;
     if (!dy_utf8_to_binding_and_expr(ctx, &binding, &expr)) {
-        dy_array_release(&name);
         if (have_type) {
             dy_ast_expr_release(type);
         }
@@ -815,9 +1139,8 @@ bool dy_utf8_to_map_fin(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_map_fin *m
 
     dy_skip_whitespace(ctx);
 
-    dy_array_t name = dy_array_create(sizeof(char), DY_ALIGNOF(char), 8);
+    struct dy_ast_name name;
     if (!dy_utf8_to_ast_variable(ctx, &name)) {
-        dy_array_release(&name);
         ctx->stream.current_index = start_index;
         return false;
     }
@@ -827,7 +1150,6 @@ bool dy_utf8_to_map_fin(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_map_fin *m
     struct dy_ast_binding binding;
     struct dy_ast_expr expr;
     if (!dy_utf8_to_binding_and_expr(ctx, &binding, &expr)) {
-        dy_array_release(&name);
         ctx->stream.current_index = start_index;
         return false;
     }
@@ -875,7 +1197,7 @@ bool dy_utf8_to_binding_and_expr(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_b
     return true;
 }
 
-bool dy_utf8_to_ast_string(struct dy_utf8_to_ast_ctx *ctx, dy_array_t *string)
+bool dy_utf8_to_ast_string(struct dy_utf8_to_ast_ctx *ctx, dy_string_t *string)
 {
     size_t start_index = ctx->stream.current_index;
 
@@ -884,20 +1206,75 @@ bool dy_utf8_to_ast_string(struct dy_utf8_to_ast_ctx *ctx, dy_array_t *string)
         return false;
     }
 
+    size_t content_start = ctx->stream.current_index;
+
+    const char *end = dy_utf8_end(ctx);
+    const char *quote = dy_scan_byte(dy_utf8_rest(ctx), end, '\'');
+    if (quote == end) {
+        ctx->stream.current_index = start_index;
+        return false;
+    }
+
+    dy_utf8_move_to(ctx, quote + 1);
+
+    *string = dy_utf8_span(ctx, content_start, ctx->stream.current_index - 1);
+
+    return true;
+}
+
+bool dy_utf8_to_ast_int(struct dy_utf8_to_ast_ctx *ctx, intptr_t *value)
+{
+    size_t start_index = ctx->stream.current_index;
+
+    char sign;
+    if (!dy_utf8_one_of(ctx, DY_STR_LIT("+-"), &sign)) {
+        return false;
+    }
+
+    // Negative literals are accumulated downwards, so the most negative value can be written too.
+    intmax_t n = 0;
+    size_t num_digits = 0;
+    bool is_out_of_range = false;
     for (;;) {
         char c;
-        if (!dy_get_char(ctx, &c)) {
-            ctx->stream.current_index = start_index;
-            return false;
+        if (!dy_utf8_one_of(ctx, DY_STR_LIT("0123456789"), &c)) {
+            break;
         }
 
-        if (c == '\'') {
-            break;
+        ++num_digits;
+
+        if (is_out_of_range) {
+            continue;
         }
 
-        dy_array_add(string, &c);
+        bool overflow;
+        if (sign == '+') {
+            overflow = dy_intmax_t_mul_overflow(n, 10, &n) || dy_intmax_t_add_overflow(n, c - '0', &n);
+        } else {
+            overflow = dy_intmax_t_mul_overflow(n, 10, &n) || dy_intmax_t_sub_overflow(n, c - '0', &n);
+        }
+
+        if (overflow || n < INTPTR_MIN || n > INTPTR_MAX) {
+            is_out_of_range = true;
+        }
+    }
+
+    if (num_digits == 0) {
+        ctx->stream.current_index = start_index;
+        return false;
     }
 
+    if (is_out_of_range) {
+        if (!ctx->has_out_of_range_int) {
+            ctx->has_out_of_range_int = true;
+            ctx->out_of_range_int_index = start_index;
+        }
+
+        n = 0;
+    }
+
+    *value = (intptr_t)n;
+
     return true;
 }
 
@@ -1078,12 +1455,23 @@ bool dy_utf8_to_ast_do_block(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_do_bl
 
 bool dy_utf8_to_ast_file(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_do_block *do_block)
 {
+    dy_stream_read_all(&ctx->stream);
+
     size_t start_index = ctx->stream.current_index;
 
     dy_skip_whitespace(ctx);
 
     struct dy_ast_do_block body;
-    if (!dy_utf8_to_ast_do_block_body(ctx, &body)) {
+    bool success = dy_utf8_to_ast_do_block_body(ctx, &body);
+
+    dy_utf8_memo_clear(ctx);
+
+    if (success && ctx->has_out_of_range_int) {
+        dy_ast_do_block_release(body);
+        success = false;
+    }
+
+    if (!success) {
         ctx->stream.current_index = start_index;
         return false;
     }
@@ -1185,9 +1573,8 @@ bool dy_utf8_to_ast_do_block_stmnt_def(struct dy_utf8_to_ast_ctx *ctx, struct dy
 
     dy_skip_whitespace(ctx);
 
-    dy_array_t name = dy_array_create(sizeof(char), DY_ALIGNOF(char), 8);
+    struct dy_ast_name name;
     if (!dy_utf8_to_ast_variable(ctx, &name)) {
-        dy_array_release(&name);
         ctx->stream.current_index = start_index;
         return false;
     }
@@ -1195,7 +1582,6 @@ bool dy_utf8_to_ast_do_block_stmnt_def(struct dy_utf8_to_ast_ctx *ctx, struct dy
     dy_skip_whitespace(ctx);
 
     if (!dy_utf8_literal(ctx, DY_STR_LIT("="))) {
-        dy_array_release(&name);
         ctx->stream.current_index = start_index;
         return false;
     }
@@ -1204,7 +1590,6 @@ bool dy_utf8_to_ast_do_block_stmnt_def(struct dy_utf8_to_ast_ctx *ctx, struct dy
 
     struct dy_ast_expr expr;
     if (!dy_utf8_to_ast_expr(ctx, &expr)) {
-        dy_array_release(&name);
         ctx->stream.current_index = start_index;
         return false;
     }
@@ -1349,9 +1734,8 @@ bool dy_utf8_to_ast_recursion(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_recu
 
     dy_skip_whitespace(ctx);
 
-    dy_array_t name = dy_array_create(1, 1, 8);
+    struct dy_ast_name name;
     if (!dy_utf8_to_ast_variable(ctx, &name)) {
-        dy_array_release(&name);
         ctx->stream.current_index = start_index;
         return false;
     }
@@ -1359,7 +1743,6 @@ bool dy_utf8_to_ast_recursion(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_recu
     dy_skip_whitespace(ctx);
 
     if (!dy_utf8_literal(ctx, DY_STR_LIT("="))) {
-        dy_array_release(&name);
         ctx->stream.current_index = start_index;
         return false;
     }
@@ -1448,7 +1831,7 @@ bool dy_utf8_to_ast_binding(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_bindin
         return true;
     }
 
-    dy_array_t name = dy_array_create(sizeof(char), DY_ALIGNOF(char), 4);
+    struct dy_ast_name name = { 0 };
     bool have_name;
 
     if (dy_utf8_to_ast_variable(ctx, &name)) {
@@ -1476,7 +1859,7 @@ bool dy_utf8_to_ast_binding(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_bindin
     }
 }
 
-bool dy_utf8_to_ast_binding_with_type(struct dy_utf8_to_ast_ctx *ctx, dy_array_t name, bool have_name, struct dy_ast_binding *binding)
+bool dy_utf8_to_ast_binding_with_type(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_name name, bool have_name, struct dy_ast_binding *binding)
 {
     size_t start_index = ctx->stream.current_index;
 
@@ -1502,7 +1885,7 @@ bool dy_utf8_to_ast_binding_with_type(struct dy_utf8_to_ast_ctx *ctx, dy_array_t
     return true;
 }
 
-bool dy_utf8_to_ast_binding_with_pattern(struct dy_utf8_to_ast_ctx *ctx, dy_array_t name, bool have_name, struct dy_ast_binding *binding)
+bool dy_utf8_to_ast_binding_with_pattern(struct dy_utf8_to_ast_ctx *ctx, struct dy_ast_name name, bool have_name, struct dy_ast_binding *binding)
 {
     size_t start_index = ctx->stream.current_index;
 
@@ -1751,10 +2134,7 @@ bool dy_left_op_is_first(enum dy_infix_op left, enum dy_infix_op right)
 void dy_skip_whitespace(struct dy_utf8_to_ast_ctx *ctx)
 {
     for (;;) {
-        char c;
-        if (dy_utf8_one_of(ctx, DY_STR_LIT(" \r\n\t"), &c)) {
-            continue;
-        }
+        dy_utf8_move_to(ctx, dy_scan_blanks(dy_utf8_rest(ctx), dy_utf8_end(ctx), true));
 
         if (dy_skip_block_comment(ctx)) {
             continue;
@@ -1771,10 +2151,7 @@ void dy_skip_whitespace(struct dy_utf8_to_ast_ctx *ctx)
 void dy_skip_whitespace_except_newline(struct dy_utf8_to_ast_ctx *ctx)
 {
     for (;;) {
-        char c;
-        if (dy_utf8_one_of(ctx, DY_STR_LIT(" \t"), &c)) {
-            continue;
-        }
+        dy_utf8_move_to(ctx, dy_scan_blanks(dy_utf8_rest(ctx), dy_utf8_end(ctx), false));
 
         if (dy_skip_block_comment(ctx)) {
             continue;